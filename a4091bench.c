@@ -0,0 +1,376 @@
+/*
+ * a4091bench
+ * ----------
+ * Unattended disk benchmark for a4091.device, writing its results as
+ * JSON. It is run by the FS-UAE harness in uae/uaebench.sh, but works
+ * the same on real hardware.
+ *
+ * For each unit it times the OpenDevice(), sequential 64K reads,
+ * single-block random reads and, with -w, sequential 64K writes. The
+ * driver's boot timing and statistics (CMD_GETSTATS) are included as
+ * well. The output is written to a temporary file which is renamed when
+ * complete, so a host watching for the file never sees a partial one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <exec/types.h>
+#include <exec/io.h>
+#include <exec/memory.h>
+#include <devices/trackdisk.h>
+#include <devices/timer.h>
+#include <clib/alib_protos.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <proto/timer.h>
+#include <inttypes.h>
+
+#include "cmdhandler.h"
+#include "stats.h"
+
+#define DEVICE_NAME   "a4091.device"
+#define MAX_UNITS     16
+#define SEQ_SIZE      (64 << 10)  // Sequential transfer size
+#define DEFAULT_SECS  2           // Duration of each test
+
+extern BOOL __check_abort_enabled;  // 0 = Disable gcc clib2 ^C break handling
+
+struct Device *TimerBase;
+static struct timerequest *timer_io;
+static uint32_t            eclock_freq;
+static UWORD               drv_version;   // Of the driver which answered
+static UWORD               drv_revision;
+
+typedef struct {
+    int      unit;
+    int      rc;             // Open or test failure, 0 = all passed
+    uint32_t open_usecs;
+    uint32_t blocks;
+    uint32_t blksize;
+    uint32_t seq_read_kbs;
+    uint32_t rand_read_iops;
+    uint32_t seq_write_kbs;  // 0 = not run
+} unit_result_t;
+
+static void
+usage(void)
+{
+    printf("Usage: a4091bench [-o <file>] [-s <secs>] [-w] <unit> [...]\n"
+           "   -o <file>  write the JSON results to file (default stdout)\n"
+           "   -s <secs>  duration of each test (%d)\n"
+           "   -w         also time writes (destroys data on the unit)\n",
+           DEFAULT_SECS);
+}
+
+static int
+timer_open(void)
+{
+    struct EClockVal ev;
+    struct MsgPort  *mp = CreatePort(NULL, 0);
+
+    if (mp == NULL)
+        return (1);
+    timer_io = (struct timerequest *) CreateExtIO(mp, sizeof (*timer_io));
+    if (timer_io == NULL) {
+        DeletePort(mp);
+        return (1);
+    }
+    if (OpenDevice(TIMERNAME, UNIT_MICROHZ, &timer_io->tr_node, 0)) {
+        DeleteExtIO(&timer_io->tr_node);
+        DeletePort(mp);
+        timer_io = NULL;
+        return (1);
+    }
+    TimerBase = timer_io->tr_node.io_Device;
+    eclock_freq = ReadEClock(&ev);
+    return (0);
+}
+
+static void
+timer_close(void)
+{
+    if (timer_io == NULL)
+        return;
+    CloseDevice(&timer_io->tr_node);
+    DeletePort(timer_io->tr_node.io_Message.mn_ReplyPort);
+    DeleteExtIO(&timer_io->tr_node);
+    timer_io = NULL;
+}
+
+static uint64_t
+eclock_read(void)
+{
+    struct EClockVal ev;
+
+    ReadEClock(&ev);
+    return (((uint64_t) ev.ev_hi << 32) | ev.ev_lo);
+}
+
+static uint32_t
+eclock_usecs(uint64_t ticks)
+{
+    return ((uint32_t) (ticks * 1000000 / eclock_freq));
+}
+
+/*
+ * run_io
+ * ------
+ * Issue requests of len bytes for usecs, either sequentially from the
+ * start of the unit or at pseudo-random block offsets. Returns the number
+ * of requests done, or 0 if one failed. The time taken is returned in
+ * elapsed.
+ */
+static uint32_t
+run_io(struct IOExtTD *tio, UWORD cmd, APTR buf, uint32_t len,
+       unit_result_t *ur, BOOL random, uint32_t usecs, uint32_t *elapsed)
+{
+    uint32_t lenblks = len / ur->blksize;
+    uint32_t blk = 0;
+    uint32_t seed = 0x4091;
+    uint32_t count = 0;
+    uint64_t start = eclock_read();
+
+    *elapsed = 0;
+    while (*elapsed < usecs) {
+        if (random) {
+            seed = seed * 1103515245 + 12345;
+            blk = (seed >> 8) % (ur->blocks - lenblks);
+        } else if (blk + lenblks > ur->blocks) {
+            blk = 0;
+        }
+        tio->iotd_Req.io_Command = cmd;
+        tio->iotd_Req.io_Offset  = blk * ur->blksize;
+        tio->iotd_Req.io_Data    = buf;
+        tio->iotd_Req.io_Length  = len;
+        if (DoIO((struct IORequest *) tio) != 0) {
+            fprintf(stderr, "Unit %d: %s of block %"PRIu32" failed: %d\n",
+                    ur->unit, (cmd == CMD_READ) ? "read" : "write", blk,
+                    tio->iotd_Req.io_Error);
+            return (0);
+        }
+        count++;
+        blk += lenblks;
+        *elapsed = eclock_usecs(eclock_read() - start);
+    }
+    return (count);
+}
+
+static uint32_t
+kb_per_sec(uint32_t count, uint32_t len, uint32_t usecs)
+{
+    return ((uint32_t) ((uint64_t) count * len * 1000000 / 1024 / usecs));
+}
+
+static void
+bench_unit(struct IOExtTD *tio, APTR buf, unit_result_t *ur, uint32_t usecs,
+           BOOL do_write)
+{
+    struct DriveGeometry dg;
+    uint32_t             count;
+    uint32_t             elapsed;
+
+    memset(&dg, 0, sizeof (dg));
+    tio->iotd_Req.io_Command = TD_GETGEOMETRY;
+    tio->iotd_Req.io_Data    = &dg;
+    tio->iotd_Req.io_Length  = sizeof (dg);
+    if ((DoIO((struct IORequest *) tio) != 0) || (dg.dg_SectorSize == 0) ||
+        (dg.dg_TotalSectors <= SEQ_SIZE / dg.dg_SectorSize)) {
+        fprintf(stderr, "Unit %d: no usable geometry\n", ur->unit);
+        ur->rc = tio->iotd_Req.io_Error ? tio->iotd_Req.io_Error : 1;
+        return;
+    }
+    ur->blocks  = dg.dg_TotalSectors;
+    ur->blksize = dg.dg_SectorSize;
+    if (ur->blocks > 0xffffffff / ur->blksize)
+        ur->blocks = 0xffffffff / ur->blksize;  // CMD_READ reaches 4GB
+
+    count = run_io(tio, CMD_READ, buf, SEQ_SIZE, ur, FALSE, usecs, &elapsed);
+    if (count == 0)
+        goto fail;
+    ur->seq_read_kbs = kb_per_sec(count, SEQ_SIZE, elapsed);
+
+    count = run_io(tio, CMD_READ, buf, ur->blksize, ur, TRUE, usecs,
+                   &elapsed);
+    if (count == 0)
+        goto fail;
+    ur->rand_read_iops = (uint32_t) ((uint64_t) count * 1000000 / elapsed);
+
+    if (do_write) {
+        count = run_io(tio, CMD_WRITE, buf, SEQ_SIZE, ur, FALSE, usecs,
+                       &elapsed);
+        if (count == 0)
+            goto fail;
+        ur->seq_write_kbs = kb_per_sec(count, SEQ_SIZE, elapsed);
+    }
+    return;
+
+fail:
+    ur->rc = tio->iotd_Req.io_Error;
+}
+
+static void
+print_json(FILE *fp, const a4091_stats_t *st, const unit_result_t *ur,
+           int units)
+{
+    int i;
+
+    fprintf(fp, "{\n  \"driver\": \"%u.%u\",\n", drv_version, drv_revision);
+    if (st->st_version >= 3) {
+        fprintf(fp, "  \"boot\": { \"ready_ms\": %"PRIu32", "
+                "\"first_open_ms\": %"PRIu32,
+                st->st_boot.bt_ready_usecs / 1000,
+                st->st_boot.bt_open_usecs / 1000);
+        if (st->st_version >= 4)
+            fprintf(fp, ", \"cdrom_ms\": %"PRIu32,
+                    st->st_boot.bt_cdrom_usecs / 1000);
+        fprintf(fp, " },\n");
+    }
+    fprintf(fp, "  \"mempool\": { \"allocs\": %"PRIu32", \"failed\": %"PRIu32
+            ", \"peak\": %"PRIu32" },\n", st->st_mem.ms_allocs,
+            st->st_mem.ms_failed, st->st_mem.ms_peak);
+    if (st->st_version >= 2) {
+        fprintf(fp, "  \"bcache\": { \"lookups\": %"PRIu32", \"hits\": %"
+                PRIu32" },\n", st->st_bcache.bs_lookups,
+                st->st_bcache.bs_hits);
+    }
+    if (st->st_version >= 5) {
+        fprintf(fp, "  \"dma\": { \"maxseg\": %"PRIu32", \"default_split\": "
+                "%u, \"regions\": [", st->st_dma.ds_maxseg,
+                st->st_dma.ds_default);
+        for (i = 0; i < st->st_dma.ds_regions; i++) {
+            const a4091_dma_region_t *dr = &st->st_dma.ds_region[i];
+            fprintf(fp, "%s\n    { \"lower\": %"PRIu32", \"upper\": %"PRIu32
+                    ", \"split\": %"PRId32", \"gain_permille\": %d }",
+                    (i == 0) ? "" : ",", dr->dr_lower, dr->dr_upper,
+                    (dr->dr_split == A4091_DMA_NEVER) ?
+                    -1 : (int32_t) dr->dr_split, dr->dr_gain);
+        }
+        fprintf(fp, "%s] },\n", (i == 0) ? "" : "\n  ");
+    }
+    fprintf(fp, "  \"units\": [");
+    for (i = 0; i < units; i++, ur++) {
+        fprintf(fp, "%s\n    { \"unit\": %d, \"rc\": %d, \"open_ms\": %"
+                PRIu32".%03"PRIu32", \"blocks\": %"PRIu32", \"blksize\": %"
+                PRIu32",\n      \"seq_read_kbs\": %"PRIu32", "
+                "\"rand_read_iops\": %"PRIu32", \"seq_write_kbs\": %"
+                PRIu32" }", (i == 0) ? "" : ",", ur->unit, ur->rc,
+                ur->open_usecs / 1000, ur->open_usecs % 1000, ur->blocks,
+                ur->blksize, ur->seq_read_kbs, ur->rand_read_iops,
+                ur->seq_write_kbs);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    unit_result_t   results[MAX_UNITS];
+    a4091_stats_t   st;
+    struct MsgPort *mp;
+    struct IOExtTD *tio;
+    const char     *outname = NULL;
+    char            tmpname[256];
+    FILE           *fp = stdout;
+    APTR            buf;
+    uint32_t        usecs = DEFAULT_SECS * 1000000;
+    uint64_t        start;
+    BOOL            do_write = FALSE;
+    int             units = 0;
+    int             rc = 0;
+    int             arg;
+    int             i;
+
+    for (arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "-o") == 0 && (arg + 1 < argc)) {
+            outname = argv[++arg];
+        } else if (strcmp(argv[arg], "-s") == 0 && (arg + 1 < argc)) {
+            usecs = atoi(argv[++arg]) * 1000000;
+        } else if (strcmp(argv[arg], "-w") == 0) {
+            do_write = TRUE;
+        } else if ((argv[arg][0] >= '0') && (argv[arg][0] <= '9') &&
+                   (units < MAX_UNITS)) {
+            memset(&results[units], 0, sizeof (results[units]));
+            results[units++].unit = atoi(argv[arg]);
+        } else {
+            usage();
+            exit(1);
+        }
+    }
+    if ((units == 0) || (usecs == 0)) {
+        usage();
+        exit(1);
+    }
+
+    __check_abort_enabled = 0;  // Disable gcc clib2 ^C break handling
+
+    if (timer_open()) {
+        fprintf(stderr, "Failed to open " TIMERNAME "\n");
+        exit(1);
+    }
+    buf = AllocMem(SEQ_SIZE, MEMF_PUBLIC);
+    mp = CreatePort(NULL, 0);
+    tio = (mp == NULL) ? NULL :
+          (struct IOExtTD *) CreateExtIO(mp, sizeof (struct IOExtTD));
+    if ((buf == NULL) || (tio == NULL)) {
+        fprintf(stderr, "Out of memory\n");
+        rc = 1;
+        goto done;
+    }
+
+    memset(&st, 0, sizeof (st));
+    for (i = 0; i < units; i++) {
+        unit_result_t *ur = &results[i];
+
+        start = eclock_read();
+        if (OpenDevice(DEVICE_NAME, ur->unit, (struct IORequest *) tio, 0)) {
+            fprintf(stderr, "Unit %d: open failed: %d\n", ur->unit,
+                    tio->iotd_Req.io_Error);
+            ur->rc = tio->iotd_Req.io_Error;
+            rc = 1;
+            continue;
+        }
+        ur->open_usecs = eclock_usecs(eclock_read() - start);
+        drv_version  = tio->iotd_Req.io_Device->dd_Library.lib_Version;
+        drv_revision = tio->iotd_Req.io_Device->dd_Library.lib_Revision;
+        bench_unit(tio, buf, ur, usecs, do_write);
+        if (ur->rc != 0)
+            rc = 1;
+
+        /* Statistics cover all units, so the last open unit reports them */
+        tio->iotd_Req.io_Command = CMD_GETSTATS;
+        tio->iotd_Req.io_Data    = &st;
+        tio->iotd_Req.io_Length  = sizeof (st);
+        (void) DoIO((struct IORequest *) tio);
+        CloseDevice((struct IORequest *) tio);
+    }
+
+    if (outname != NULL) {
+        snprintf(tmpname, sizeof (tmpname), "%s.tmp", outname);
+        fp = fopen(tmpname, "w");
+        if (fp == NULL) {
+            fprintf(stderr, "Failed to create %s\n", tmpname);
+            rc = 1;
+            goto done;
+        }
+    }
+    print_json(fp, &st, results, units);
+    if (outname != NULL) {
+        fclose(fp);
+        DeleteFile((STRPTR) outname);
+        if (!Rename((STRPTR) tmpname, (STRPTR) outname)) {
+            fprintf(stderr, "Failed to rename %s\n", tmpname);
+            rc = 1;
+        }
+    }
+
+done:
+    if (tio != NULL)
+        DeleteExtIO((struct IORequest *) tio);
+    if (mp != NULL)
+        DeletePort(mp);
+    if (buf != NULL)
+        FreeMem(buf, SEQ_SIZE);
+    timer_close();
+    exit(rc);
+}
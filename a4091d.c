@@ -17,6 +17,7 @@
 #include <exec/lists.h>
 #include <dos/dostags.h>
 #include <devices/scsidisk.h>
+#include <devices/hardblocks.h>
 #include <proto/exec.h>
 
 #include "cmdhandler.h"
@@ -36,6 +37,9 @@ typedef struct device *device_t;
 #include "scsi_all.h"
 #include "scsipiconf.h"
 #include "sd.h"
+#include "diskprofile.h"
+#include "siop_target.h"
+#include "stats.h"
 #include "sys_queue.h"
 #include "siopreg.h"
 #include "siopvar.h"
@@ -85,7 +89,121 @@ usage(void)
            "Usage:  a4091d [<unit>]\n"
            "        a4091d -c   -- show 68040 special registers\n"
            "        a4091d -p <periph address>\n"
-           "        a4091d -x <xs address>\n");
+           "        a4091d -x <xs address>\n"
+           "        a4091d -m <profile> <unit>  -- set drive caching profile\n"
+           "        a4091d -M <profile> <unit>  -- set and save profile\n"
+           "               profile: show, sequential, random, balanced\n"
+           "        a4091d -r <settings> <unit> -- store and apply disk profile\n"
+           "               settings: show or a comma separated list of\n"
+           "               depth=<1-7> (1 untagged), sync=<ns>|async|default,\n"
+           "               disc=never|nodata|always|default,\n"
+           "               wce=on|off|default, prefetch=<blocks>,\n"
+           "               cache=sequential|random|balanced|default\n"
+           "        a4091d -s <unit>  -- show driver statistics\n"
+           "        a4091d -t <kbytes> <unit>   -- answer as a RAM disk target\n"
+           "               kbytes: 0 = disable, -1 = show state\n");
+}
+
+static const char * const cache_profile_names[] = {
+    "show", "sequential", "random", "balanced", "custom"
+};
+
+static int
+parse_cache_profile(const char *name)
+{
+    uint i;
+    for (i = 0; i < ARRAY_SIZE(cache_profile_names); i++)
+        if (strcmp(name, cache_profile_names[i]) == 0)
+            return (i);
+    return (-1);
+}
+
+static const char * const disc_names[] = {
+    "default", "never", "nodata", "always"
+};
+
+static const char * const wce_names[] = {
+    "default", "off", "on"
+};
+
+static int
+parse_name(const char *name, const char * const *names, uint count)
+{
+    uint i;
+    for (i = 0; i < count; i++)
+        if (strcmp(name, names[i]) == 0)
+            return (i);
+    return (-1);
+}
+
+/*
+ * parse_disk_profile
+ * ------------------
+ * Apply a comma separated list of name=value settings to a disk profile.
+ * Returns 0 on success, or 1 after reporting the setting in error.
+ */
+static int
+parse_disk_profile(char *str, a4091_disk_profile_t *dp)
+{
+    char *opt;
+    char *val;
+    int   num;
+    int   pos;
+
+    for (opt = strtok(str, ","); opt != NULL; opt = strtok(NULL, ",")) {
+        val = strchr(opt, '=');
+        if (val == NULL) {
+            printf("Missing value in '%s'\n", opt);
+            return (1);
+        }
+        *val++ = '\0';
+        if ((sscanf(val, "%d%n", &num, &pos) != 1) || (val[pos] != '\0'))
+            num = -1;
+
+        if (strcmp(opt, "depth") == 0) {
+            if ((num < 1) || (num > 7))
+                goto invalid;
+            dp->dp_queue_depth = num;
+        } else if (strcmp(opt, "sync") == 0) {
+            if (strcmp(val, "default") == 0)
+                dp->dp_sync_period = DP_SYNC_DEFAULT;
+            else if (strcmp(val, "async") == 0)
+                dp->dp_sync_period = DP_SYNC_ASYNC;
+            else if ((num >= 100) && (num <= 1000))
+                dp->dp_sync_period = (num + 3) / 4;  // 4ns units
+            else
+                goto invalid;
+        } else if (strcmp(opt, "disc") == 0) {
+            if ((num = parse_name(val, disc_names,
+                                  ARRAY_SIZE(disc_names))) < 0)
+                goto invalid;
+            dp->dp_disconnect = num;
+        } else if (strcmp(opt, "wce") == 0) {
+            if ((num = parse_name(val, wce_names,
+                                  ARRAY_SIZE(wce_names))) < 0)
+                goto invalid;
+            dp->dp_write_cache = num;
+        } else if (strcmp(opt, "cache") == 0) {
+            if (strcmp(val, "default") == 0)
+                num = CACHE_PROFILE_GET;
+            else if (((num = parse_cache_profile(val)) <= 0) ||
+                     (num > CACHE_PROFILE_BALANCED))
+                goto invalid;
+            dp->dp_cache_profile = num;
+        } else if (strcmp(opt, "prefetch") == 0) {
+            if ((num < 0) || (num > 0xffff))
+                goto invalid;
+            dp->dp_max_prefetch = num;
+        } else {
+            printf("Unknown setting '%s'\n", opt);
+            return (1);
+        }
+    }
+    return (0);
+
+invalid:
+    printf("Invalid %s '%s'\n", opt, val);
+    return (1);
 }
 
 typedef const char * const bitdesc_t;
@@ -245,6 +363,16 @@ iocmd_name(uint cmd)
         case CMD_TERM:          return ("CMD_TERM");            // 0x2ef0
         case CMD_ATTACH:        return ("CMD_ATTACH");          // 0x2ff1
         case CMD_DETACH:        return ("CMD_DETACH");          // 0x2ef2
+        case CMD_GETSTATS:      return ("CMD_GETSTATS");        // 0x2ef3
+        case CMD_CACHEPROFILE:  return ("CMD_CACHEPROFILE");    // 0x2ef4
+        case CMD_TAPE_WRITEFM:  return ("CMD_TAPE_WRITEFM");    // 0x2ef5
+        case CMD_TAPE_REWIND:   return ("CMD_TAPE_REWIND");     // 0x2ef6
+        case CMD_TAPE_SPACE:    return ("CMD_TAPE_SPACE");      // 0x2ef7
+        case CMD_TAPE_BLKSIZE:  return ("CMD_TAPE_BLKSIZE");    // 0x2ef8
+        case CMD_TARGET:        return ("CMD_TARGET");          // 0x2ef9
+        case CMD_DISKPROFILE:   return ("CMD_DISKPROFILE");     // 0x2efa
+        case CMD_SCATTER_READ:  return ("CMD_SCATTER_READ");    // 0x2efb
+        case CMD_SCATTER_WRITE: return ("CMD_SCATTER_WRITE");   // 0x2efc
         case NSCMD_DEVICEQUERY: return ("NSCMD_DEVICEQUERY");   // 0x4000
         case NSCMD_TD_READ64:   return ("NSCMD_TD_READ64");     // 0xc000
         case NSCMD_TD_WRITE64:  return ("NSCMD_TD_WRITE64");    // 0xc001
@@ -302,10 +430,13 @@ struct ioerr {
     { 47, "ERROR_TIMEOUT" },
     { 48, "ERROR_BUS_RESET" },
     { 49, "ERROR_TRY_AGAIN" },
-    { 56, "HFERR_NoBoard" },
+    { 50, "HFERR_NoBoard" },
     { 51, "ERROR_BAD_BOARD" },
     { 52, "ERROR_SENSE_CODE" },
     { 53, "ERROR_NOT_READY" },
+    { 54, "ERROR_FILEMARK" },
+    { 55, "ERROR_END_OF_DATA" },
+    { 56, "ERROR_END_OF_MEDIA" },
 };
 
 static void
@@ -1673,6 +1804,313 @@ show_periph(struct scsipi_periph *periph)
     Permit();
 }
 
+static int
+do_stats(struct IOExtTD *tio)
+{
+    a4091_stats_t st;
+    a4091_bcache_stats_t *bs = &st.st_bcache;
+    uint i;
+
+    memset(&st, 0, sizeof (st));
+    tio->iotd_Req.io_Command = CMD_GETSTATS;
+    tio->iotd_Req.io_Data    = &st;
+    tio->iotd_Req.io_Length  = sizeof (st);
+    if (DoIO((struct IORequest *) tio)) {
+        printf("CMD_GETSTATS failed: %d", tio->iotd_Req.io_Error);
+        decode_io_error(tio->iotd_Req.io_Error);
+        printf("\n");
+        return (1);
+    }
+    printf("Memory pool:  allocs=%u  frees=%u  failed=%u  large=%u\n",
+           (uint) st.st_mem.ms_allocs, (uint) st.st_mem.ms_frees,
+           (uint) st.st_mem.ms_failed, (uint) st.st_mem.ms_large);
+    printf("  in use=%u  peak=%u  puddles=%u  reserved=%u\n",
+           (uint) st.st_mem.ms_inuse, (uint) st.st_mem.ms_peak,
+           (uint) st.st_mem.ms_puddles, (uint) st.st_mem.ms_reserved);
+    if (st.st_version < 2)
+        return (0);
+    if (bs->bs_blocks == 0) {
+        printf("Block cache:  disabled\n");
+    } else {
+        printf("Block cache:  %u of %u blocks used\n",
+               (uint) bs->bs_used, (uint) bs->bs_blocks);
+        printf("  lookups=%u  hits=%u (%u%%)  fills=%u  updates=%u\n",
+               (uint) bs->bs_lookups, (uint) bs->bs_hits,
+               bs->bs_lookups ?
+               (uint) (bs->bs_hits * 100ULL / bs->bs_lookups) : 0,
+               (uint) bs->bs_fills, (uint) bs->bs_updates);
+        printf("  evictions=%u  invalidates=%u\n",
+               (uint) bs->bs_evictions, (uint) bs->bs_invalidates);
+    }
+    if (st.st_version < 3)
+        return (0);
+    printf("Boot:         channel ready %u ms  first open %u ms\n",
+           (uint) st.st_boot.bt_ready_usecs / 1000,
+           (uint) st.st_boot.bt_open_usecs / 1000);
+    if ((st.st_version >= 4) && (st.st_boot.bt_cdrom_usecs != 0))
+        printf("              CD-ROM scanned %u ms\n",
+               (uint) st.st_boot.bt_cdrom_usecs / 1000);
+    if (st.st_version < 5)
+        return (0);
+    printf("DMA:          max segment %u  default split > %u\n",
+           (uint) st.st_dma.ds_maxseg, (uint) st.st_dma.ds_default);
+    for (i = 0; i < st.st_dma.ds_regions; i++) {
+        const a4091_dma_region_t *dr = &st.st_dma.ds_region[i];
+        uint gain = (dr->dr_gain < 0) ? -dr->dr_gain : dr->dr_gain;
+
+        printf("  %08x-%08x  ", (uint) dr->dr_lower, (uint) dr->dr_upper - 1);
+        if (dr->dr_split == A4091_DMA_NEVER)
+            printf("never split");
+        else
+            printf("split > %u", (uint) dr->dr_split);
+        printf("  gain %s%u.%u%%\n", (dr->dr_gain < 0) ? "-" : "",
+               gain / 10, gain % 10);
+    }
+    return (0);
+}
+
+static int
+do_target(struct IOExtTD *tio, int kbytes)
+{
+    a4091_target_t tg;
+
+    memset(&tg, 0, sizeof (tg));
+    if (kbytes < 0) {
+        tg.tg_op = TARGET_GET;
+    } else if (kbytes == 0) {
+        tg.tg_op = TARGET_DISABLE;
+    } else {
+        tg.tg_op      = TARGET_ENABLE;
+        tg.tg_blksize = 512;
+        tg.tg_blocks  = kbytes * 2;
+    }
+
+    tio->iotd_Req.io_Command = CMD_TARGET;
+    tio->iotd_Req.io_Data    = &tg;
+    tio->iotd_Req.io_Length  = sizeof (tg);
+    if (DoIO((struct IORequest *) tio)) {
+        printf("CMD_TARGET failed: %d", tio->iotd_Req.io_Error);
+        decode_io_error(tio->iotd_Req.io_Error);
+        printf("\n");
+        return (1);
+    }
+    printf("Target mode:  %s  id=%u",
+           tg.tg_enabled ? "enabled" : "disabled", tg.tg_id);
+    if (tg.tg_blocks != 0)
+        printf("  %u blocks of %u bytes%s",
+               (uint) tg.tg_blocks, (uint) tg.tg_blksize,
+               (tg.tg_flags & TGF_READONLY) ? " (read-only)" : "");
+    printf("\n  commands=%u  errors=%u  written=%llu  read=%llu\n",
+           (uint) tg.tg_cmds, (uint) tg.tg_errors,
+           (unsigned long long) tg.tg_bytes_in,
+           (unsigned long long) tg.tg_bytes_out);
+    return (0);
+}
+
+static int
+do_cache_profile(struct IOExtTD *tio, int profile, int save)
+{
+    a4091_cache_profile_t cp;
+
+    memset(&cp, 0, sizeof (cp));
+    cp.cp_profile = profile;
+    cp.cp_flags   = save ? CPF_SAVE : 0;
+
+    tio->iotd_Req.io_Command = CMD_CACHEPROFILE;
+    tio->iotd_Req.io_Data    = &cp;
+    tio->iotd_Req.io_Length  = sizeof (cp);
+    if (DoIO((struct IORequest *) tio)) {
+        printf("CMD_CACHEPROFILE failed: %d", tio->iotd_Req.io_Error);
+        decode_io_error(tio->iotd_Req.io_Error);
+        printf("\n");
+        return (1);
+    }
+    printf("Caching page:  flags=%02x%s%s%s  flags2=%02x%s\n",
+           cp.cp_cache_flags,
+           (cp.cp_cache_flags & CACHING_WCE) ? " WCE" : "",
+           (cp.cp_cache_flags & CACHING_RCD) ? " RCD" : "",
+           (cp.cp_cache_flags & CACHING_DISC) ? " DISC" : "",
+           cp.cp_cache_flags2,
+           (cp.cp_cache_flags2 & CACHING2_DRA) ? " DRA" : "");
+    printf("  prefetch disable len=%u  min=%u  max=%u  ceiling=%u\n",
+           cp.cp_dis_prefetch_len, cp.cp_min_prefetch, cp.cp_max_prefetch,
+           cp.cp_max_prefetch_ceiling);
+    printf("  cache segments=%u\n", cp.cp_segments);
+    return (0);
+}
+
+static void
+print_disk_profile(const char *what, const a4091_disk_profile_t *dp)
+{
+    printf("%s profile:  depth=", what);
+    if (dp->dp_queue_depth == 0)
+        printf("default");
+    else
+        printf("%u", dp->dp_queue_depth);
+    if (dp->dp_sync_period == DP_SYNC_DEFAULT)
+        printf("  sync=default");
+    else if (dp->dp_sync_period == DP_SYNC_ASYNC)
+        printf("  sync=async");
+    else
+        printf("  sync=%uns", dp->dp_sync_period * 4);
+    printf("  disc=%s  wce=%s\n",
+           (dp->dp_disconnect < ARRAY_SIZE(disc_names)) ?
+           disc_names[dp->dp_disconnect] : "?",
+           (dp->dp_write_cache < ARRAY_SIZE(wce_names)) ?
+           wce_names[dp->dp_write_cache] : "?");
+    printf("  cache=%s  prefetch=",
+           (dp->dp_cache_profile == CACHE_PROFILE_GET) ? "default" :
+           (dp->dp_cache_profile <= CACHE_PROFILE_BALANCED) ?
+           cache_profile_names[dp->dp_cache_profile] : "?");
+    if (dp->dp_max_prefetch == 0)
+        printf("default\n");
+    else
+        printf("%u\n", dp->dp_max_prefetch);
+}
+
+static int
+disk_io(struct IOExtTD *tio, UWORD cmd, ULONG block, void *buf)
+{
+    tio->iotd_Req.io_Command = cmd;
+    tio->iotd_Req.io_Offset  = block << 9;
+    tio->iotd_Req.io_Data    = buf;
+    tio->iotd_Req.io_Length  = 512;
+    if (DoIO((struct IORequest *) tio)) {
+        printf("%s of block %u failed: %d",
+               (cmd == CMD_READ) ? "Read" : "Write", (uint) block,
+               tio->iotd_Req.io_Error);
+        decode_io_error(tio->iotd_Req.io_Error);
+        printf("\n");
+        return (1);
+    }
+    return (0);
+}
+
+/* Checksum rules of the Rigid Disk Block area: longwords sum to zero */
+static int
+rdb_block_valid(const ULONG *blk, ULONG id)
+{
+    ULONG sum = 0;
+    uint  i;
+
+    if ((blk[0] != id) || (blk[1] == 0) || (blk[1] > 128))
+        return (0);
+    for (i = 0; i < blk[1]; i++)
+        sum += blk[i];
+    return (sum == 0);
+}
+
+static void
+rdb_block_checksum(ULONG *blk)
+{
+    ULONG sum = 0;
+    uint  i;
+
+    blk[2] = 0;
+    for (i = 0; i < blk[1]; i++)
+        sum += blk[i];
+    blk[2] = -sum;
+}
+
+/*
+ * do_disk_profile
+ * ---------------
+ * Show the disk profile stored in the RDB and the settings in effect, or
+ * merge new settings into the stored profile, write it back and apply it.
+ * A new profile block is placed after the highest block the RDB uses.
+ */
+static int
+do_disk_profile(struct IOExtTD *tio, char *settings)
+{
+    ULONG                  rdbbuf[128];
+    ULONG                  pfbuf[128];
+    struct RigidDiskBlock *rdb = (struct RigidDiskBlock *) rdbbuf;
+    a4091_profile_block_t *pfb = (a4091_profile_block_t *) pfbuf;
+    a4091_disk_profile_t   dp;
+    ULONG                  rdbblock;
+    ULONG                  pblock;
+    int                    stored = 0;
+
+    for (rdbblock = 0; rdbblock < RDB_LOCATION_LIMIT; rdbblock++) {
+        if (disk_io(tio, CMD_READ, rdbblock, rdbbuf))
+            return (1);
+        if (rdb_block_valid(rdbbuf, IDNAME_RIGIDDISK))
+            break;
+    }
+    if (rdbblock == RDB_LOCATION_LIMIT) {
+        printf("No Rigid Disk Block found\n");
+        return (1);
+    }
+    if (rdb->rdb_BlockBytes != 512) {
+        printf("Block size %u is not supported\n", (uint) rdb->rdb_BlockBytes);
+        return (1);
+    }
+
+    memset(pfbuf, 0, sizeof (pfbuf));
+    pblock = RDB_DISKPROFILE(rdb);
+    if ((pblock != 0) && (pblock != 0xffffffff)) {
+        if (disk_io(tio, CMD_READ, pblock, pfbuf))
+            return (1);
+        if (rdb_block_valid(pfbuf, IDNAME_DISKPROFILE)) {
+            stored = 1;
+            if (pfb->dpb_Size < sizeof (dp))
+                memset((UBYTE *) &pfb->dpb_Profile + pfb->dpb_Size, 0,
+                       sizeof (dp) - pfb->dpb_Size);
+        } else {
+            memset(pfbuf, 0, sizeof (pfbuf));
+        }
+    }
+
+    if (settings == NULL) {
+        if (stored)
+            print_disk_profile("Stored", &pfb->dpb_Profile);
+        else
+            printf("No disk profile stored\n");
+        memset(&dp, 0, sizeof (dp));
+    } else {
+        if (parse_disk_profile(settings, &pfb->dpb_Profile))
+            return (1);
+        if (!stored) {
+            pblock = rdb->rdb_HighRDSKBlock + 1;
+            if (pblock > rdb->rdb_RDBBlocksHi) {
+                printf("No free block in the RDB area\n");
+                return (1);
+            }
+        }
+        pfb->dpb_ID          = IDNAME_DISKPROFILE;
+        pfb->dpb_SummedLongs = sizeof (*pfb) / sizeof (ULONG);
+        pfb->dpb_HostID      = rdb->rdb_HostID;
+        pfb->dpb_Version     = DISKPROFILE_VERSION;
+        pfb->dpb_Size        = sizeof (pfb->dpb_Profile);
+        rdb_block_checksum(pfbuf);
+        if (disk_io(tio, CMD_WRITE, pblock, pfbuf))
+            return (1);
+
+        if (!stored) {
+            RDB_DISKPROFILE(rdb) = pblock;
+            if (rdb->rdb_HighRDSKBlock < pblock)
+                rdb->rdb_HighRDSKBlock = pblock;
+            rdb_block_checksum(rdbbuf);
+            if (disk_io(tio, CMD_WRITE, rdbblock, rdbbuf))
+                return (1);
+        }
+        print_disk_profile("Stored", &pfb->dpb_Profile);
+        dp = pfb->dpb_Profile;
+    }
+
+    tio->iotd_Req.io_Command = CMD_DISKPROFILE;
+    tio->iotd_Req.io_Data    = &dp;
+    tio->iotd_Req.io_Length  = sizeof (dp);
+    if (DoIO((struct IORequest *) tio)) {
+        printf("CMD_DISKPROFILE failed: %d", tio->iotd_Req.io_Error);
+        decode_io_error(tio->iotd_Req.io_Error);
+        printf("\n");
+        return (1);
+    }
+    print_disk_profile("Active", &dp);
+    return (0);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -1681,6 +2119,11 @@ main(int argc, char *argv[])
     int pos = 0;
     int rc = 0;
     int open_and_wait = 0;
+    int cache_profile = -1;
+    int cache_save = 0;
+    int target_kbytes = -2;
+    int show_stats = 0;
+    char *disk_profile = NULL;
     struct IOExtTD     *tio;
     struct MsgPort     *mp;
     struct IOStdReq    *ior;
@@ -1721,9 +2164,51 @@ main(int argc, char *argv[])
                         }
                         print_xs(xs, 1);
                         exit(0);
+                    case 'r':
+                        if (++arg >= argc) {
+                            printf("-%c requires an argument\n", *ptr);
+                            exit(1);
+                        }
+                        disk_profile = argv[arg];
+                        ptr += strlen(ptr) - 1;  // Done with this argument
+                        break;
+                    case 's':
+                        show_stats++;
+                        break;
                     case 'w':
                         open_and_wait++;
                         break;
+                    case 'M':
+                        cache_save = 1;
+                        /* FALLTHROUGH */
+                    case 'm':
+                        if (++arg >= argc) {
+                            printf("-%c requires an argument\n", *ptr);
+                            exit(1);
+                        }
+                        cache_profile = parse_cache_profile(argv[arg]);
+                        if ((cache_profile < 0) ||
+                            (cache_profile == CACHE_PROFILE_CUSTOM)) {
+                            printf("Invalid profile '%s'\n", argv[arg]);
+                            usage();
+                            exit(1);
+                        }
+                        ptr += strlen(ptr) - 1;  // Done with this argument
+                        break;
+                    case 't':
+                        if (++arg >= argc) {
+                            printf("-%c requires an argument\n", *ptr);
+                            exit(1);
+                        }
+                        if ((sscanf(argv[arg], "%d%n",
+                                    &target_kbytes, &pos) != 1) ||
+                            (argv[arg][pos] != '\0') || (target_kbytes < -1)) {
+                            printf("Invalid size '%s'\n", argv[arg]);
+                            usage();
+                            exit(1);
+                        }
+                        ptr += strlen(ptr) - 1;  // Done with this argument
+                        break;
                     default:
                         printf("Invalid argument -%s\n", ptr);
                         usage();
@@ -1773,6 +2258,27 @@ main(int argc, char *argv[])
     global_mp     = mp;
     global_tio    = tio;
 
+    if (cache_profile >= 0) {
+        rc = do_cache_profile(tio, cache_profile, cache_save);
+        goto done;
+    }
+
+    if (disk_profile != NULL) {
+        rc = do_disk_profile(tio, (strcmp(disk_profile, "show") == 0) ?
+                                  NULL : disk_profile);
+        goto done;
+    }
+
+    if (target_kbytes >= -1) {
+        rc = do_target(tio, target_kbytes);
+        goto done;
+    }
+
+    if (show_stats) {
+        rc = do_stats(tio);
+        goto done;
+    }
+
     if (open_and_wait) {
         int i;
         printf("Device open; press enter to proceed.\n");
@@ -2011,6 +2517,7 @@ main(int argc, char *argv[])
         }
     }
 
+done:
     CloseDevice((struct IORequest *) tio);
 
 open_fail:
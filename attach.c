@@ -27,12 +27,17 @@
 
 #include "scsi_all.h"
 #include "scsipiconf.h"
+#include "scsipi_all.h"
+#include "scsipi_base.h"
 #include "sd.h"
+#include "st.h"
 #include "sys_queue.h"
 #include "siopreg.h"
 #include "siopvar.h"
 #include "attach.h"
 #include "battmem.h"
+#include "mempool.h"
+#include "bcache.h"
 #include "ndkcompat.h"
 
 #include "a4091.h"
@@ -334,15 +339,18 @@ a4091_validate(uint32_t dev_base)
     return (fail ? ERROR_BAD_BOARD : 0);
 }
 
+/*
+ * init_chan
+ * ---------
+ * Locate the board and load the BattMem settings. This is all that is done
+ * before the device is added to the system, so that a missing board still
+ * fails OpenLibrary of the device while it takes almost no time at boot.
+ * The rest of the channel is brought up by start_chan().
+ */
 int
 init_chan(device_t self, UBYTE *boardnum)
 {
-    struct siop_softc     *sc = device_private(self);
-    struct scsipi_adapter *adapt = &sc->sc_adapter;
-    struct scsipi_channel *chan = &sc->sc_channel;
     uint32_t dev_base;
-    uint8_t dip_switches;
-    int rc;
 
     dev_base = a4091_find(boardnum);
     if (dev_base == 0) {
@@ -351,16 +359,39 @@ init_chan(device_t self, UBYTE *boardnum)
     }
 
     printf("A4091: board #%u found at 0x%x\n", *boardnum, dev_base);
-    if ((rc = a4091_validate(dev_base)))
-        return (rc);
+    Load_BattMem();
+    return (0);
+}
+
+/*
+ * start_chan
+ * ----------
+ * Check the board, set up the channel and reset the SCSI bus. This is run
+ * by the command handler after init_device() has returned, so the board
+ * self-test and the bus reset settle time overlap with the rest of the
+ * system's boot. Requests which arrive meanwhile wait in the handler's
+ * message port until the channel is ready. On failure the board is
+ * released again.
+ */
+int
+start_chan(device_t self)
+{
+    struct siop_softc     *sc = device_private(self);
+    struct scsipi_adapter *adapt = &sc->sc_adapter;
+    struct scsipi_channel *chan = &sc->sc_channel;
+    uint32_t dev_base = asave->as_addr;
+    uint8_t dip_switches;
+    int rc;
 
+    if ((rc = a4091_validate(dev_base))) {
+        a4091_release(dev_base);
+        return (rc);
+    }
 
     memset(sc, 0, sizeof (*sc));
     dip_switches = *(uint8_t *)(dev_base + A4091_OFFSET_SWITCHES);
     printf("DIP switches = %02x\n", dip_switches);
 
-    Load_BattMem();
-
     sc->sc_dev = self;
     sc->sc_siopp = (siop_regmap_p)((char *)dev_base + A4091_OFFSET_REGISTERS);
     sc->sc_clock_freq = 50;     /* Clock = 50 MHz */
@@ -417,10 +448,13 @@ init_chan(device_t self, UBYTE *boardnum)
     scsipi_channel_init(chan);
 
     rc = a4091_add_local_irq_handler();
-    if (rc != 0)
+    if (rc != 0) {
+        a4091_release(dev_base);
         return (rc);
+    }
 
     Signal(asave->as_svc_task, BIT(asave->as_irq_signal));
+    bcache_init(asave->bcache_size);
     siopinitialize(sc);
     return (0);
 }
@@ -432,6 +466,7 @@ deinit_chan(device_t self)
     struct scsipi_channel *chan = &sc->sc_channel;
 
     siopshutdown(chan);
+    bcache_deinit();
     a4091_remove_local_irq_handler();
     a4091_release((uint32_t) sc->sc_siopp - 0x00800000);
 }
@@ -442,7 +477,7 @@ scsipi_alloc_periph(int flags)
     struct scsipi_periph *periph;
     uint i;
 
-    periph = AllocMem(sizeof (*periph), MEMF_PUBLIC | MEMF_CLEAR);
+    periph = mempool_alloc(sizeof (*periph), MEMF_PUBLIC | MEMF_CLEAR);
     if (periph == NULL)
         return (NULL);
 
@@ -467,33 +502,202 @@ scsipi_alloc_periph(int flags)
 void
 scsipi_free_periph(struct scsipi_periph *periph)
 {
-    FreeMem(periph, sizeof (*periph));
+    mempool_free(periph, sizeof (*periph));
 }
 
-int scsi_probe_device(struct scsipi_channel *chan, int target, int lun, struct scsipi_periph *periph, int *failed);
+int scsi_probe_device(struct scsipi_channel *chan, int target, int lun,
+                      struct scsipi_periph *periph,
+                      const struct scsipi_inquiry_data *inq, int *failed);
 
-int
-attach(device_t self, uint scsi_target, struct scsipi_periph **periph_p,
-       uint flags)
+/*
+ * Attach of a SCSI unit in progress. All CMD_ATTACH requests for the unit
+ * which arrive before the probe finishes wait in at_iors, and are replied
+ * together with the result.
+ */
+typedef struct attach_state attach_state_t;
+struct attach_state {
+    attach_state_t             *at_next;
+    struct scsipi_periph       *at_periph;
+    struct scsipi_inquiry_data *at_inq;     // INQUIRY data buffer
+    struct scsipi_xfer         *at_xs;      // INQUIRY in progress
+    struct MinList              at_iors;    // CMD_ATTACH requests waiting
+    uint                        at_flags;   // Open flags of first request
+    int                         at_rc;      // INQUIRY result
+};
+
+static attach_state_t *attach_probing;  // INQUIRY in progress
+static attach_state_t *attach_probed;   // INQUIRY done, for attach_poll()
+
+static void attach_inquiry_done(struct scsipi_xfer *xs);
+
+static attach_state_t *
+attach_find(attach_state_t *list, int target, int lun)
 {
-    struct siop_softc     *sc = device_private(self);
+    for (; list != NULL; list = list->at_next)
+        if ((list->at_periph->periph_target == target) &&
+            (list->at_periph->periph_lun == lun))
+            break;
+    return (list);
+}
+
+/*
+ * attach_reply
+ * ------------
+ * Reply all CMD_ATTACH requests waiting for an attach with its result,
+ * and free the attach state. The periph is freed if the attach failed.
+ * A NULL periph or buffer is left alone.
+ */
+static void
+attach_reply(attach_state_t *at, int rc)
+{
+    struct IORequest *ior;
+
+    while ((ior = (struct IORequest *) RemHead((struct List *)
+                                               &at->at_iors)) != NULL) {
+        ior->io_Error = rc;
+        ior->io_Unit = (rc == 0) ? (struct Unit *) at->at_periph : NULL;
+        ReplyMsg(&ior->io_Message);
+    }
+    if ((rc != 0) && (at->at_periph != NULL))
+        scsipi_free_periph(at->at_periph);
+    if (at->at_inq != NULL)
+        mempool_free(at->at_inq, sizeof (*at->at_inq));
+    mempool_free(at, sizeof (*at));
+}
+
+/*
+ * attach_inquiry
+ * --------------
+ * Queue an INQUIRY of the specified length for the unit being attached.
+ * The timeouts are those of scsipi_inquire().
+ */
+static int
+attach_inquiry(attach_state_t *at, int len, int timeout)
+{
+    struct scsipi_xfer   *xs;
+    struct scsipi_inquiry cmd;
+    int flags = XS_CTL_ASYNC | XS_CTL_DISCOVERY | XS_CTL_SILENT |
+                XS_CTL_DATA_IN;
+
+    memset(&cmd, 0, sizeof (cmd));
+    cmd.opcode = INQUIRY;
+    cmd.length = len;
+
+    xs = scsipi_make_xs_locked(at->at_periph,
+                               (struct scsipi_generic *) &cmd, sizeof (cmd),
+                               (uint8_t *) at->at_inq, len,
+                               0, timeout, NULL, flags);
+    if (__predict_false(xs == NULL))
+        return (ERROR_NO_MEMORY);
+    xs->xs_callback_arg = at;
+    xs->xs_done_callback = attach_inquiry_done;
+    at->at_xs = xs;
+
+    return (scsipi_execute_xs(xs));
+}
+
+/*
+ * attach_inquiry_done
+ * -------------------
+ * INQUIRY completion. As in scsipi_inquire(), the full SCSI-3 data is
+ * requested if the device has more than the SCSI-2 length to report.
+ * This may run from interrupt processing, so the rest of the attach,
+ * which issues synchronous commands, is left to attach_poll().
+ */
+static void
+attach_inquiry_done(struct scsipi_xfer *xs)
+{
+    attach_state_t  *at = xs->xs_callback_arg;
+    attach_state_t **prev;
+
+    if (xs->error != XS_NOERROR) {
+        at->at_rc = ERROR_INQUIRY_FAILED;
+    } else if ((xs->datalen == SCSIPI_INQUIRY_LENGTH_SCSI2) &&
+               (at->at_inq->additional_length >
+                SCSIPI_INQUIRY_LENGTH_SCSI2 - 4)) {
+        if (attach_inquiry(at, SCSIPI_INQUIRY_LENGTH_SCSI3, 1000) == 0)
+            return;
+        at->at_rc = ERROR_INQUIRY_FAILED;
+    }
+
+    for (prev = &attach_probing; *prev != at; prev = &(*prev)->at_next)
+        ;
+    *prev = at->at_next;
+    at->at_next = attach_probed;
+    attach_probed = at;
+}
+
+/*
+ * attach_start
+ * ------------
+ * Start attaching the SCSI unit of a CMD_ATTACH request. The INQUIRY of
+ * the unit is queued like any other command, so the handler goes on
+ * with other requests while the device responds, or the selection of an
+ * absent target times out. The request is replied by attach_poll().
+ * A request for a unit which is already attached, or being attached, is
+ * given the same periph.
+ */
+void
+attach_start(struct IORequest *ior)
+{
+    struct IOStdReq       *io = (struct IOStdReq *) ior;
+    struct siop_softc     *sc = device_private(NULL);
     struct scsipi_channel *chan = &sc->sc_channel;
     struct scsipi_periph  *periph;
-    int target = scsi_target % 10;
-    int lun    = (scsi_target / 10) % 10;
-    int rc;
-    int failed = 0;
+    attach_state_t        *at;
+    uint scsi_target = io->io_Offset;
+    int  target = scsi_target % 10;
+    int  lun    = (scsi_target / 10) % 10;
+    int  rc;
 
+    ior->io_Unit = NULL;
     if (scsi_target >= 100)
-        return (ERROR_OPEN_FAIL);
+        rc = ERROR_OPEN_FAIL;
+    else if (target == chan->chan_id)
+        rc = ERROR_SELF_UNIT;
+    else
+        rc = 0;
+    if (rc != 0) {
+        ior->io_Error = rc;
+        ReplyMsg(&ior->io_Message);
+        return;
+    }
+
+    periph = scsipi_lookup_periph(chan, target, lun);
+    if (periph != NULL) {
+        ior->io_Error = 0;
+        ior->io_Unit = (struct Unit *) periph;
+        ReplyMsg(&ior->io_Message);
+        return;
+    }
 
-    if (target == chan->chan_id)
-        return (ERROR_SELF_UNIT);
+    at = attach_find(attach_probing, target, lun);
+    if (at == NULL)
+        at = attach_find(attach_probed, target, lun);
+    if (at != NULL) {
+        AddTail((struct List *) &at->at_iors, (struct Node *) ior);
+        return;
+    }
 
+    at = mempool_alloc(sizeof (*at), MEMF_PUBLIC | MEMF_CLEAR);
+    if (at == NULL) {
+        ior->io_Error = ERROR_NO_MEMORY;
+        ReplyMsg(&ior->io_Message);
+        return;
+    }
+    /* Not on the stack or in at, as the buffer is a DMA target */
+    at->at_inq = mempool_alloc(sizeof (*at->at_inq), MEMF_PUBLIC | MEMF_CLEAR);
     periph = scsipi_alloc_periph(0);
-    *periph_p = periph;
-    if (periph == NULL)
-        return (ERROR_NO_MEMORY);
+    if ((at->at_inq == NULL) || (periph == NULL)) {
+        if (periph != NULL)
+            scsipi_free_periph(periph);
+        if (at->at_inq != NULL)
+            mempool_free(at->at_inq, sizeof (*at->at_inq));
+        mempool_free(at, sizeof (*at));
+        ior->io_Error = ERROR_NO_MEMORY;
+        ReplyMsg(&ior->io_Message);
+        return;
+    }
     printf("attach(%p, %d)\n", periph, scsi_target);
     periph->periph_openings  = 4;  // Max # of outstanding commands
     periph->periph_target    = target;              // SCSI target ID
@@ -508,25 +712,104 @@ attach(device_t self, uint scsi_target, struct scsipi_periph **periph_p,
     periph->periph_changeint = NULL;
     NewMinList(&periph->periph_changeintlist);
 
-    rc = scsi_probe_device(chan, target, lun, periph, &failed);
-    printf("scsi_probe_device(%d.%d) cont=%d failed=%d\n",
-           target, lun, rc, failed);
-#ifndef USE_SERIAL_OUTPUT
-    (void) rc;
-#endif
+    at->at_periph = periph;
+    at->at_flags = io->io_Length;
+    NewMinList(&at->at_iors);
+    AddTail((struct List *) &at->at_iors, (struct Node *) ior);
 
-    if (failed) {
-        scsipi_free_periph(periph);
-        return (failed);
+    rc = attach_inquiry(at, SCSIPI_INQUIRY_LENGTH_SCSI2, 3000);
+    if (rc != 0) {
+        attach_reply(at, ERROR_INQUIRY_FAILED);
+        return;
     }
+    at->at_next = attach_probing;
+    attach_probing = at;
+}
 
-    scsipi_insert_periph(chan, periph);
+/*
+ * attach_poll
+ * -----------
+ * Finish the attaches whose INQUIRY has completed: interpret the data,
+ * add the periph to the channel and read the block size and caching
+ * setup of disks, or the block limits of tapes. These take a few short
+ * commands of a device which is known to respond, so they are issued
+ * synchronously. Called by the command handler, outside of interrupt
+ * processing.
+ */
+void
+attach_poll(void)
+{
+    attach_state_t       *at;
+    struct scsipi_periph *periph;
+    int rc;
+    int failed;
+
+    while ((at = attach_probed) != NULL) {
+        attach_probed = at->at_next;
+        periph = at->at_periph;
+
+        rc = at->at_rc;
+        if (rc == 0) {
+            failed = 0;
+            rc = scsi_probe_device(periph->periph_channel,
+                                   periph->periph_target, periph->periph_lun,
+                                   periph, at->at_inq, &failed);
+            printf("scsi_probe_device(%d.%d) cont=%d failed=%d\n",
+                   periph->periph_target, periph->periph_lun, rc, failed);
+            rc = failed;
+        }
+        if (rc == 0) {
+            scsipi_insert_periph(periph->periph_channel, periph);
 #if 0
-    /* Might be needed for A3000 / A2091 / A590 */
-    scsipi_set_xfer_mode(chan, target, 1);
+            /* Might be needed for A3000 / A2091 / A590 */
+            scsipi_set_xfer_mode(periph->periph_channel,
+                                 periph->periph_target, 1);
 #endif
+            if (at->at_flags & TDF_DEBUG_OPEN) {
+                /* No I/O to the unit */
+            } else if (periph->periph_type == T_SEQUENTIAL) {
+                (void) st_attach(periph);
+            } else {
+                (void) sd_blocksize(periph);
+                sd_cache_probe(periph);
+            }
+        }
+        attach_reply(at, rc);
+    }
+}
 
-    return (0);
+/*
+ * attach_abort
+ * ------------
+ * Fail all attaches in progress, when the handler is shutting down. The
+ * outstanding INQUIRY commands are given time to complete or time out
+ * first, so that their buffers and periphs can be freed. An attach whose
+ * INQUIRY is still outstanding after that is cut off from it, and its
+ * periph and buffer are left to mempool_deinit().
+ */
+void
+attach_abort(void)
+{
+    attach_state_t *at;
+    uint64_t        start = eclock_read();
+
+    while ((attach_probing != NULL) &&
+           (eclock_usecs(eclock_read() - start) < 5000000))
+        (void) irq_and_timer_handler();
+
+    while ((at = attach_probing) != NULL) {
+        printf("attach(%p) abort: INQUIRY still outstanding\n",
+               at->at_periph);
+        attach_probing = at->at_next;
+        at->at_xs->xs_done_callback = NULL;
+        at->at_periph = NULL;
+        at->at_inq = NULL;
+        attach_reply(at, IOERR_ABORTED);
+    }
+    while ((at = attach_probed) != NULL) {
+        attach_probed = at->at_next;
+        attach_reply(at, IOERR_ABORTED);
+    }
 }
 
 void
@@ -546,6 +829,8 @@ detach(struct scsipi_periph *periph)
                 return;
             }
         }
+        st_detach(periph);
+        bcache_invalidate(periph);
         scsipi_remove_periph(chan, periph);
         scsipi_free_periph(periph);
     }
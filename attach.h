@@ -11,6 +11,7 @@ struct MsgPort;
 struct timerequest;
 struct callout;
 struct ConfigDev;
+struct IORequest;
 
 typedef struct {
     uint32_t              as_addr;
@@ -28,18 +29,25 @@ typedef struct {
     struct timerequest   *as_timerio;
     struct callout      **as_callout_head;
     struct ConfigDev     *as_cd;
+    uint64_t              as_start_eclock; // Handler start, for boot timing
+    uint32_t              as_ready_usecs;  // Start to channel ready
+    uint32_t              as_open_usecs;   // Start to first unit open
+    uint32_t              as_cdrom_usecs;  // Start to first CD-ROM scanned
     /* battmem */
     uint8_t              cdrom_boot;
     uint8_t              ignore_last;
+    uint8_t              bcache_size;    // Block cache setting (bcache.h)
 } a4091_save_t;
 
 extern a4091_save_t *asave;
 
-int attach(device_t self, uint scsi_target, struct scsipi_periph **periph,
-           uint flags);
+void attach_start(struct IORequest *ior);
+void attach_poll(void);
+void attach_abort(void);
 void detach(struct scsipi_periph *periph);
 int periph_still_attached(void);
 int init_chan(device_t self, UBYTE *boardnum);
+int start_chan(device_t self);
 void deinit_chan(device_t self);
 
 #endif /* _ATTACH_H */
@@ -19,7 +19,8 @@ struct Library *BattMemBase;
 int Load_BattMem(void)
 {
     UBYTE cdrom_boot = 0,
-          ignore_last = 0;
+          ignore_last = 0,
+          bcache_size = 0;
 
     BattMemBase = OpenResource(BATTMEMNAME);
     if (!BattMemBase)
@@ -30,15 +31,20 @@ int Load_BattMem(void)
     ReadBattMem(&cdrom_boot,
                 BATTMEM_A4091_CDROM_BOOT_ADDR,
                 BATTMEM_A4091_CDROM_BOOT_LEN);
-    ReadBattMem(&cdrom_boot,
+    ReadBattMem(&ignore_last,
                 BATTMEM_A4091_IGNORE_LAST_ADDR,
                 BATTMEM_A4091_IGNORE_LAST_LEN);
+    ReadBattMem(&bcache_size,
+                BATTMEM_A4091_BCACHE_ADDR,
+                BATTMEM_A4091_BCACHE_LEN);
 
     // CDROM_BOOT defaults to on, hence invert it
     asave->cdrom_boot = !cdrom_boot;
     asave->ignore_last = ignore_last;
+    asave->bcache_size = bcache_size;
     printf("  cdrom_boot: %d\n", asave->cdrom_boot);
     printf("  ignore_last: %d\n", asave->ignore_last);
+    printf("  bcache_size: %d\n", asave->bcache_size);
     ReleaseBattSemaphore();
 
     return 1;
@@ -47,7 +53,8 @@ int Load_BattMem(void)
 int Save_BattMem(void)
 {
     UBYTE cdrom_boot = !asave->cdrom_boot,
-          ignore_last = asave->ignore_last;
+          ignore_last = asave->ignore_last,
+          bcache_size = asave->bcache_size;
 
     if (!BattMemBase)
         return 0;
@@ -56,12 +63,16 @@ int Save_BattMem(void)
     printf("Storing settings to BattMem\n");
     printf("  cdrom_boot: %d (%d)\n", asave->cdrom_boot, cdrom_boot);
     printf("  ignore_last: %d (%d)\n", asave->ignore_last, ignore_last);
+    printf("  bcache_size: %d\n", bcache_size);
     WriteBattMem(&cdrom_boot,
                  BATTMEM_A4091_CDROM_BOOT_ADDR,
                  BATTMEM_A4091_CDROM_BOOT_LEN);
     WriteBattMem(&ignore_last,
                  BATTMEM_A4091_IGNORE_LAST_ADDR,
                  BATTMEM_A4091_IGNORE_LAST_LEN);
+    WriteBattMem(&bcache_size,
+                 BATTMEM_A4091_BCACHE_ADDR,
+                 BATTMEM_A4091_BCACHE_LEN);
 
     ReleaseBattSemaphore();
 
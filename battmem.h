@@ -8,5 +8,7 @@ int Save_BattMem(void);
 #define BATTMEM_A4091_CDROM_BOOT_LEN   1
 #define BATTMEM_A4091_IGNORE_LAST_ADDR 73
 #define BATTMEM_A4091_IGNORE_LAST_LEN   1
+#define BATTMEM_A4091_BCACHE_ADDR      74
+#define BATTMEM_A4091_BCACHE_LEN        3
 
 #endif
@@ -0,0 +1,322 @@
+#ifdef DEBUG_BCACHE
+#define USE_SERIAL_OUTPUT
+#endif
+
+#include "port.h"
+#include "port_bsd.h"
+#include <stdint.h>
+#include <string.h>
+#include <sys/param.h>
+#include <exec/memory.h>
+#include "scsipiconf.h"
+#include "sys_queue.h"
+#include "bcache.h"
+
+#ifdef DEBUG_BCACHE
+#define PRINTF_BCACHE(args...) printf(args)
+#else
+#define PRINTF_BCACHE(args...)
+#endif
+
+/*
+ * Metadata block cache
+ *
+ * Filesystems keep re-reading a small set of blocks: the root block,
+ * bitmap blocks, directory headers and, on every remount, the RDB. With
+ * few buffers given to AddBuffers, each of those is a SCSI command. This
+ * cache keeps the most recently read single blocks in driver memory, so
+ * such a read is answered by a copy instead.
+ *
+ * A cacheable read which misses reserves an entry before the READ is
+ * issued, and the entry is filled from the caller's buffer when the READ
+ * completes. Writes are passed through to the drive and also update any
+ * cached copy. A write to a block whose READ is still in flight marks the
+ * reservation stale, so the fill is dropped. Entries remember the unit's
+ * change count, so blocks from a previous medium are never returned.
+ *
+ * Everything here runs in the command handler task, so no locking is
+ * needed.
+ */
+
+#define BE_FREE    0  // Holds nothing
+#define BE_VALID   1  // Holds the block's current data
+#define BE_PENDING 2  // READ in progress, fill when done
+#define BE_STALE   3  // READ in progress, but block was written since
+
+typedef struct bcache_entry bcache_entry_t;
+struct bcache_entry {
+    TAILQ_ENTRY(bcache_entry) be_lru;   // LRU list, most recent first
+    LIST_ENTRY(bcache_entry)  be_hash;  // Hash chain
+    struct scsipi_periph     *be_periph;
+    uint64_t                  be_blkno;
+    uint                      be_changenum;
+    uint8_t                  *be_data;
+    uint8_t                   be_state;  // BE_*
+};
+
+TAILQ_HEAD(bcache_lru, bcache_entry);
+LIST_HEAD(bcache_chain, bcache_entry);
+
+static bcache_entry_t       *bcache_entries;
+static struct bcache_chain  *bcache_hash;
+static uint8_t              *bcache_data;
+static uint                  bcache_hash_mask;
+static struct bcache_lru     bcache_lru;
+static a4091_bcache_stats_t  bcache_stats;
+
+static uint
+bcache_hashval(struct scsipi_periph *periph, uint64_t blkno)
+{
+    return (((uint32_t) blkno ^ ((uint32_t) (uintptr_t) periph >> 4)) & bcache_hash_mask);
+}
+
+static bcache_entry_t *
+bcache_find(struct scsipi_periph *periph, uint64_t blkno)
+{
+    bcache_entry_t *be;
+
+    LIST_FOREACH(be, &bcache_hash[bcache_hashval(periph, blkno)], be_hash)
+        if ((be->be_blkno == blkno) && (be->be_periph == periph))
+            return (be);
+    return (NULL);
+}
+
+/* Drop the entry's contents and make it the first candidate for reuse */
+static void
+bcache_drop(bcache_entry_t *be)
+{
+    if (be->be_state == BE_VALID)
+        bcache_stats.bs_used--;
+    if (be->be_state != BE_FREE)
+        LIST_REMOVE(be, be_hash);
+    if (be->be_state != BE_PENDING && be->be_state != BE_STALE)
+        TAILQ_REMOVE(&bcache_lru, be, be_lru);
+    be->be_state  = BE_FREE;
+    be->be_periph = NULL;
+    TAILQ_INSERT_TAIL(&bcache_lru, be, be_lru);
+}
+
+static int
+bcache_cacheable(struct scsipi_periph *periph, uint len)
+{
+    return ((bcache_entries != NULL) && (len == BCACHE_BLKSIZE) &&
+            ((1U << periph->periph_blkshift) == BCACHE_BLKSIZE));
+}
+
+/*
+ * bcache_read
+ * -----------
+ * Copy the block to buf and return 1 if it is cached. Otherwise return 0,
+ * and if the read can be cached, reserve an entry and return it in *fillp
+ * for bcache_fill(). *fillp is set to NULL if there is nothing to fill.
+ */
+int
+bcache_read(struct scsipi_periph *periph, uint64_t blkno, void *buf,
+            uint len, void **fillp)
+{
+    bcache_entry_t *be;
+
+    *fillp = NULL;
+    if (!bcache_cacheable(periph, len))
+        return (0);
+
+    bcache_stats.bs_lookups++;
+    be = bcache_find(periph, blkno);
+    if (be != NULL) {
+        if (be->be_state != BE_VALID)
+            return (0);  // Already being read
+        if (be->be_changenum == periph->periph_changenum) {
+            CopyMem(be->be_data, buf, len);
+            TAILQ_REMOVE(&bcache_lru, be, be_lru);
+            TAILQ_INSERT_HEAD(&bcache_lru, be, be_lru);
+            bcache_stats.bs_hits++;
+            return (1);
+        }
+        /* Left over from a previous medium */
+        bcache_stats.bs_invalidates++;
+        bcache_drop(be);
+    }
+
+    /* Reserve the least recently used entry; in-flight ones are not listed */
+    be = TAILQ_LAST(&bcache_lru, bcache_lru);
+    if (be == NULL)
+        return (0);
+    if (be->be_state == BE_VALID) {
+        bcache_stats.bs_evictions++;
+        bcache_drop(be);
+    }
+    TAILQ_REMOVE(&bcache_lru, be, be_lru);
+    be->be_periph    = periph;
+    be->be_blkno     = blkno;
+    be->be_changenum = periph->periph_changenum;
+    be->be_state     = BE_PENDING;
+    LIST_INSERT_HEAD(&bcache_hash[bcache_hashval(periph, blkno)], be, be_hash);
+    *fillp = be;
+    return (0);
+}
+
+/*
+ * bcache_fill
+ * -----------
+ * Complete a reservation made by bcache_read(). buf holds the data which
+ * was read, unless ok is 0.
+ */
+void
+bcache_fill(void *fill, const void *buf, int ok)
+{
+    bcache_entry_t *be = fill;
+
+    if ((be->be_state != BE_PENDING) || !ok) {
+        bcache_drop(be);
+        return;
+    }
+    CopyMem((void *) buf, be->be_data, BCACHE_BLKSIZE);
+    be->be_state = BE_VALID;
+    TAILQ_INSERT_HEAD(&bcache_lru, be, be_lru);
+    bcache_stats.bs_used++;
+    bcache_stats.bs_fills++;
+}
+
+/* Write through: update cached copies of blocks being written */
+static void
+bcache_write_entry(bcache_entry_t *be, uint64_t blkno, const uint8_t *buf)
+{
+    if (be->be_state == BE_VALID) {
+        CopyMem((void *) (buf + ((be->be_blkno - blkno) * BCACHE_BLKSIZE)),
+                be->be_data, BCACHE_BLKSIZE);
+        bcache_stats.bs_updates++;
+    } else if (be->be_state == BE_PENDING) {
+        be->be_state = BE_STALE;
+    }
+}
+
+/*
+ * bcache_write
+ * ------------
+ * Called when a WRITE is issued. If the WRITE then fails, the caller must
+ * use bcache_invalidate() as the cache may now hold data the drive does
+ * not.
+ */
+void
+bcache_write(struct scsipi_periph *periph, uint64_t blkno, const void *buf,
+             uint len)
+{
+    bcache_entry_t *be;
+    uint64_t        nblks;
+    uint            i;
+
+    if ((bcache_entries == NULL) ||
+        ((1U << periph->periph_blkshift) != BCACHE_BLKSIZE))
+        return;
+
+    nblks = len / BCACHE_BLKSIZE;
+    if (nblks > bcache_stats.bs_blocks) {
+        /* Large write: visit every entry instead of every block */
+        for (i = 0; i < bcache_stats.bs_blocks; i++) {
+            be = &bcache_entries[i];
+            if ((be->be_periph == periph) && (be->be_blkno >= blkno) &&
+                (be->be_blkno < blkno + nblks))
+                bcache_write_entry(be, blkno, buf);
+        }
+    } else {
+        for (i = 0; i < nblks; i++) {
+            be = bcache_find(periph, blkno + i);
+            if (be != NULL)
+                bcache_write_entry(be, blkno, buf);
+        }
+    }
+}
+
+/*
+ * bcache_invalidate
+ * -----------------
+ * Drop all blocks of the specified unit, or of all units if periph is
+ * NULL. Reads in flight are not filled.
+ */
+void
+bcache_invalidate(struct scsipi_periph *periph)
+{
+    bcache_entry_t *be;
+    uint            i;
+
+    for (i = 0; i < bcache_stats.bs_blocks; i++) {
+        be = &bcache_entries[i];
+        if ((be->be_state == BE_FREE) ||
+            ((periph != NULL) && (be->be_periph != periph)))
+            continue;
+        if (be->be_state == BE_PENDING) {
+            be->be_state = BE_STALE;
+        } else if (be->be_state == BE_VALID) {
+            bcache_stats.bs_invalidates++;
+            bcache_drop(be);
+        }
+    }
+}
+
+void
+bcache_get_stats(a4091_bcache_stats_t *stats)
+{
+    CopyMem(&bcache_stats, stats, sizeof (*stats));
+}
+
+/*
+ * bcache_init
+ * -----------
+ * Allocate the cache for the BattMem setting (0 = no cache). The cache is
+ * left disabled if there is not enough memory.
+ */
+void
+bcache_init(uint setting)
+{
+    uint nblocks;
+    uint nhash;
+    uint i;
+
+    memset(&bcache_stats, 0, sizeof (bcache_stats));
+    TAILQ_INIT(&bcache_lru);
+    if (setting > BCACHE_SETTING_MAX)
+        setting = BCACHE_SETTING_MAX;
+    nblocks = BCACHE_SETTING_BLOCKS(setting);
+    if (nblocks == 0)
+        return;
+    nhash = nblocks / 4;
+
+    bcache_data = AllocMem(nblocks * BCACHE_BLKSIZE, MEMF_PUBLIC);
+    bcache_entries = AllocMem(nblocks * sizeof (*bcache_entries) +
+                              nhash * sizeof (*bcache_hash),
+                              MEMF_PUBLIC | MEMF_CLEAR);
+    if ((bcache_data == NULL) || (bcache_entries == NULL)) {
+        printf("bcache: no memory for %u blocks\n", nblocks);
+        bcache_stats.bs_blocks = nblocks;
+        bcache_deinit();
+        return;
+    }
+    bcache_hash = (struct bcache_chain *) &bcache_entries[nblocks];
+    bcache_hash_mask = nhash - 1;
+    for (i = 0; i < nhash; i++)
+        LIST_INIT(&bcache_hash[i]);
+    for (i = 0; i < nblocks; i++) {
+        bcache_entries[i].be_data = bcache_data + i * BCACHE_BLKSIZE;
+        TAILQ_INSERT_TAIL(&bcache_lru, &bcache_entries[i], be_lru);
+    }
+    bcache_stats.bs_blocks = nblocks;
+    PRINTF_BCACHE("bcache: %u blocks\n", nblocks);
+}
+
+void
+bcache_deinit(void)
+{
+    uint nblocks = bcache_stats.bs_blocks;
+
+    if (bcache_data != NULL)
+        FreeMem(bcache_data, nblocks * BCACHE_BLKSIZE);
+    if (bcache_entries != NULL)
+        FreeMem(bcache_entries, nblocks * sizeof (*bcache_entries) +
+                                (nblocks / 4) * sizeof (*bcache_hash));
+    bcache_data    = NULL;
+    bcache_entries = NULL;
+    bcache_hash    = NULL;
+    bcache_stats.bs_blocks = 0;
+    bcache_stats.bs_used   = 0;
+    TAILQ_INIT(&bcache_lru);
+}
@@ -0,0 +1,31 @@
+#ifndef _BCACHE_H
+#define _BCACHE_H
+
+#include "stats.h"
+
+/*
+ * Metadata block cache, see bcache.c
+ *
+ * Single-block reads of BCACHE_BLKSIZE bytes from disks with that block
+ * size are kept in a small LRU cache. The size is a BattMem setting
+ * (BATTMEM_A4091_BCACHE_ADDR); 0 disables the cache.
+ */
+#define BCACHE_BLKSIZE     512
+#define BCACHE_SETTING_MAX 7    // Largest BattMem setting (512 KB)
+
+/* Number of cache blocks for a BattMem setting */
+#define BCACHE_SETTING_BLOCKS(s) ((s) ? (8 << (s)) : 0)
+
+struct scsipi_periph;
+
+void bcache_init(uint setting);
+void bcache_deinit(void);
+int  bcache_read(struct scsipi_periph *periph, uint64_t blkno, void *buf,
+                 uint len, void **fillp);
+void bcache_fill(void *fill, const void *buf, int ok);
+void bcache_write(struct scsipi_periph *periph, uint64_t blkno,
+                  const void *buf, uint len);
+void bcache_invalidate(struct scsipi_periph *periph);
+void bcache_get_stats(a4091_bcache_stats_t *stats);
+
+#endif /* _BCACHE_H */
@@ -22,6 +22,7 @@
 #include <exec/execbase.h>
 #include <exec/types.h>
 #include <exec/libraries.h>
+#include <exec/memory.h>
 
 #include <proto/exec.h>
 #include <intuition/intuition.h>
@@ -47,6 +48,7 @@
 #include "attach.h"
 #include "scsimsg.h"
 #include "battmem.h"
+#include "bcache.h"
 #include "amigahw.h"
 #include "ndkcompat.h"
 #include "version.h"
@@ -76,6 +78,10 @@ static struct NewGadget *NewGadget;
 #define DEBUG_CDROM_BOOT_ID  10
 #define DEBUG_IGNORE_LAST_ID 11
 #define DEBUG_BOGUS_ID       12
+#define DEBUG_BCACHE_ID      13
+#define DISKS_UNIT_ID        14
+#define DISKS_BENCH_ID       15
+#define BENCH_BACK_ID        16
 
 #define ARRAY_LENGTH(array) (sizeof((array))/sizeof((array)[0]))
 #define WIDTH  640
@@ -382,6 +388,19 @@ devtype_str(uint dtype)
     return ("Unknown");
 }
 
+/* Units found by scan_disks() which can be benchmarked */
+#define BENCH_MAX_UNITS 14
+static struct {
+    ULONG unit;
+    ULONG blocks;
+    ULONG blksize;
+    char  name[28];
+} bench_units[BENCH_MAX_UNITS];
+static char   bench_labels[BENCH_MAX_UNITS][4];
+static STRPTR bench_label_ptrs[BENCH_MAX_UNITS + 1];
+static int    bench_count;
+static int    bench_selected;
+
 static char _itoabuf[12]; // MAXINT
 int scan_disks(void)
 {
@@ -393,6 +412,7 @@ int scan_disks(void)
 
     int x,y;
     printf("Looking for disks!\n");
+    bench_count = 0;
 
     port = W_CreateMsgPort(SysBase);
     if(!port) {
@@ -488,6 +508,24 @@ next_lun:
                 const char caps[]="KMGTPEZY";
                 Text(rp,&caps[cap_c],1);
                 Text(rp,"B",1);
+
+                if ((bench_count < BENCH_MAX_UNITS) && (ssize != 0) &&
+                    (geom.dg_TotalSectors > 256)) {
+                    bench_units[bench_count].unit    = unitNum;
+                    bench_units[bench_count].blocks  = geom.dg_TotalSectors;
+                    bench_units[bench_count].blksize = ssize;
+                    if (err == 0)
+                        sprintf(bench_units[bench_count].name, "%.8s %.16s",
+                                inq_res.vendor, inq_res.product);
+                    else
+                        bench_units[bench_count].name[0] = '\0';
+                    bench_labels[bench_count][0] = '0' + (unitNum % 10);
+                    bench_labels[bench_count][1] = '.';
+                    bench_labels[bench_count][2] = '0' + (unitNum / 10);
+                    bench_labels[bench_count][3] = '\0';
+                    bench_label_ptrs[bench_count] = bench_labels[bench_count];
+                    bench_count++;
+                }
             }
             CloseDevice((struct IORequest*)request);
             cnt++;
@@ -536,13 +574,6 @@ static void disks_page(void)
     Print("Unit  Vendor      Device                Rev.  Type     Blk   Size",52,38,FALSE);
     SetAPen(&screen->RastPort,1);
 
-    ng.ng_LeftEdge   = 400;
-    ng.ng_TopEdge    = 185;
-    ng.ng_Width      = 120;
-    ng.ng_GadgetText = "Back";
-    ng.ng_GadgetID   = DISKS_BACK_ID;
-    LastAdded = create_gadget(BUTTON_KIND);
-
     tag=GTBB_Recessed;
     for (i = 0; i < 15; i++)
     {
@@ -555,11 +586,211 @@ static void disks_page(void)
         tag = TAG_IGNORE;
     }
 
+    scan_disks();
+
+    ng.ng_LeftEdge   = 400;
+    ng.ng_TopEdge    = 185;
+    ng.ng_Width      = 120;
+    ng.ng_GadgetText = "Back";
+    ng.ng_GadgetID   = DISKS_BACK_ID;
+    LastAdded = create_gadget(BUTTON_KIND);
+
+    if (bench_selected >= bench_count)
+        bench_selected = 0;
+    if (bench_count > 0) {
+        bench_label_ptrs[bench_count] = NULL;
+        ng.ng_LeftEdge   = 90;
+        ng.ng_Width      = 72;
+        ng.ng_GadgetText = "Unit";
+        ng.ng_GadgetID   = DISKS_UNIT_ID;
+        LastAdded = create_gadget_custom(CYCLE_KIND,
+                                         GTCY_Labels, (ULONG) bench_label_ptrs,
+                                         GTCY_Active, bench_selected,
+                                         TAG_DONE);
+    }
+
+    ng.ng_LeftEdge   = 172;
+    ng.ng_Width      = 120;
+    ng.ng_GadgetText = "Benchmark";
+    ng.ng_GadgetID   = DISKS_BENCH_ID;
+    LastAdded = create_gadget_custom(BUTTON_KIND,
+                                     GA_Disabled, (bench_count == 0),
+                                     TAG_DONE);
+
     page_footer();
+}
 
-    scan_disks();
+#define BENCH_USECS     2000000     // Duration of each test
+#define BENCH_SEQ_SIZE  (64 << 10)  // Sequential read size
+
+/*
+ * bench_read
+ * ----------
+ * Issue reads of len bytes for BENCH_USECS, either sequentially from the
+ * start of the disk or at pseudo-random block offsets. Returns the number
+ * of reads done and the time taken, or 0 if a read failed.
+ */
+static ULONG bench_read(struct IOExtTD *request, APTR buf, ULONG len,
+                        ULONG blksize, ULONG blocks, BOOL random,
+                        ULONG *usecs)
+{
+    ULONG    lenblks = len / blksize;
+    ULONG    blk = 0;
+    ULONG    seed = 0x4091;
+    ULONG    count = 0;
+    ULONG    elapsed = 0;
+    uint64_t start = eclock_read();
+
+    while (elapsed < BENCH_USECS) {
+        if (random) {
+            seed = seed * 1103515245 + 12345;
+            blk = (seed >> 8) % (blocks - lenblks);
+        } else if (blk + lenblks > blocks) {
+            blk = 0;
+        }
+        request->iotd_Req.io_Command = CMD_READ;
+        request->iotd_Req.io_Offset  = blk * blksize;
+        request->iotd_Req.io_Data    = buf;
+        request->iotd_Req.io_Length  = len;
+        if (DoIO((struct IORequest *) request) != 0) {
+            printf("Benchmark read of block %"PRIu32" failed: %d\n",
+                   blk, request->iotd_Req.io_Error);
+            return (0);
+        }
+        count++;
+        blk += lenblks;
+        elapsed = eclock_usecs(eclock_read() - start);
+    }
+    *usecs = elapsed;
+    return (count);
+}
+
+/* Describe the transfer mode negotiated with a target */
+static void bench_sync_str(char *str, uint target)
+{
+    struct siop_softc *sc = asave->as_device_private;
+    UBYTE sxfer = sc->sc_sync[target].sxfer;
+    ULONG period;
+
+    if ((sxfer & 0x0f) == 0) {
+        sprintf(str, "Asynchronous");
+        return;
+    }
+    period = sc->sc_tcp[sc->sc_sync[target].sbcl & 3] * ((sxfer >> 4) + 4);
+    sprintf(str, "Sync %"PRIu32".%02"PRIu32" MB/s (%"PRIu32" ns, offset %u)",
+            100000 / period / 100, 100000 / period % 100, period,
+            sxfer & 0x0f);
 }
 
+static void bench_page(int idx)
+{
+    struct NewGadget ng;
+    struct RastPort *rp = &screen->RastPort;
+    struct MsgPort *port;
+    struct IOExtTD *request;
+    struct scsipi_periph *periph;
+    APTR  buf;
+    ULONG blocks = bench_units[idx].blocks;
+    ULONG blksize = bench_units[idx].blksize;
+    ULONG count;
+    ULONG usecs;
+    ULONG retries;
+    char  line[80];
+    char  mode[48];
+
+    page_header(&ng, "A4091 Diagnostics - Benchmark", FALSE);
+    SetRGB4(&screen->ViewPort,3,6,8,11);
+
+    ng.ng_LeftEdge   = 400;
+    ng.ng_TopEdge    = 185;
+    ng.ng_Width      = 120;
+    ng.ng_GadgetText = "Back";
+    ng.ng_GadgetID   = BENCH_BACK_ID;
+    LastAdded = create_gadget(BUTTON_KIND);
+
+    DrawBevelBox(rp,100,40,440,110,
+                 GT_VisualInfo,  visualInfo,
+                 GTBB_Recessed,  TRUE,
+                 GTBB_FrameType, BBFT_RIDGE,
+                 TAG_DONE);
+    page_footer();
+
+    SetAPen(rp,2);
+    sprintf(line, "Unit %s  %s", bench_labels[idx], bench_units[idx].name);
+    Print(line,120,56,FALSE);
+    SetAPen(rp,1);
+
+    if (eclock_freq == 0) {
+        Print("No E-clock timer available",120,76,FALSE);
+        return;
+    }
+    /* TD requests address at most 4 GB */
+    if (blocks > 0xffffffff / blksize)
+        blocks = 0xffffffff / blksize;
+
+    port = W_CreateMsgPort(SysBase);
+    if (port == NULL)
+        return;
+    request = (struct IOExtTD*)W_CreateIORequest(port, sizeof(struct IOExtTD), SysBase);
+    if (request == NULL)
+        goto fail_request;
+    if (OpenDevice(real_device_name, bench_units[idx].unit,
+                   (struct IORequest*)request, 0) != 0) {
+        Print("Unit open failed",120,76,FALSE);
+        goto fail_open;
+    }
+    buf = AllocMem(BENCH_SEQ_SIZE, MEMF_PUBLIC);
+    if (buf == NULL) {
+        Print("Out of memory",120,76,FALSE);
+        goto fail_alloc;
+    }
+    periph = (struct scsipi_periph *) request->iotd_Req.io_Unit;
+    retries = periph->periph_retries;
+
+    Print("Sequential read:  running...",120,76,FALSE);
+    count = bench_read(request, buf, BENCH_SEQ_SIZE, blksize, blocks,
+                       FALSE, &usecs);
+    if (count == 0) {
+        sprintf(line, "Sequential read:  failed      ");
+    } else {
+        uint64_t rate = (uint64_t) count * BENCH_SEQ_SIZE * 100 / usecs;
+        sprintf(line, "Sequential read:  %"PRIu32".%02"PRIu32" MB/s     ",
+                (ULONG) rate / 100, (ULONG) rate % 100);
+    }
+    Print(line,120,76,FALSE);
+
+    Print("Random read:      running...",120,88,FALSE);
+    count = bench_read(request, buf, blksize, blksize, blocks,
+                       TRUE, &usecs);
+    if (count == 0) {
+        sprintf(line, "Random read:      failed      ");
+    } else {
+        sprintf(line, "Random read:      %"PRIu32" IOPS          ",
+                (ULONG) ((uint64_t) count * 1000000 / usecs));
+    }
+    Print(line,120,88,FALSE);
+
+    bench_sync_str(mode, bench_units[idx].unit % 10);
+    sprintf(line, "Transfer mode:    %s", mode);
+    Print(line,120,100,FALSE);
+    sprintf(line, "Retries:          %"PRIu32,
+            (ULONG) (periph->periph_retries - retries));
+    Print(line,120,112,FALSE);
+
+    FreeMem(buf, BENCH_SEQ_SIZE);
+fail_alloc:
+    CloseDevice((struct IORequest*)request);
+fail_open:
+    W_DeleteIORequest(request, SysBase);
+fail_request:
+    W_DeleteMsgPort(port, SysBase);
+}
+
+/* Block cache sizes, indexed by BattMem setting (bcache.h) */
+static STRPTR bcache_labels[] = {
+    "Off", "8K", "16K", "32K", "64K", "128K", "256K", "512K", NULL
+};
+
 static void debug_page(void)
 {
     struct NewGadget ng;
@@ -590,6 +821,15 @@ static void debug_page(void)
                                      GA_Disabled, TRUE,
                                      TAG_DONE);
 
+    ng.ng_TopEdge    = 108;
+    ng.ng_Width      = 90;
+    ng.ng_GadgetText = "Block cache (next boot)";
+    ng.ng_GadgetID   = DEBUG_BCACHE_ID;
+    LastAdded = create_gadget_custom(CYCLE_KIND,
+                                     GTCY_Labels, (ULONG) bcache_labels,
+                                     GTCY_Active, asave->bcache_size,
+                                     TAG_DONE);
+
     ng.ng_LeftEdge   = 400;
     ng.ng_TopEdge    = 145;
     ng.ng_Width      = 120;
@@ -772,6 +1012,15 @@ static void event_loop(void)
                 case MAIN_DEBUG_ID:
                     debug_page();
                     break;
+                case DISKS_UNIT_ID:
+                    bench_selected = icode;
+                    break;
+                case DISKS_BENCH_ID:
+                    bench_page(bench_selected);
+                    break;
+                case BENCH_BACK_ID:
+                    disks_page();
+                    break;
                 case DISKS_BACK_ID:
                 case DIPSWITCH_BACK_ID:
                 case ABOUT_BACK_ID:
@@ -789,6 +1038,10 @@ static void event_loop(void)
                     asave->ignore_last=gad->Flags&GFLG_SELECTED?TRUE:FALSE;
                     Save_BattMem();
                     break;
+                case DEBUG_BCACHE_ID:
+                    asave->bcache_size = (icode <= BCACHE_SETTING_MAX) ? icode : 0;
+                    Save_BattMem();
+                    break;
                 }
             }
         }
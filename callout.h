@@ -8,6 +8,7 @@ struct callout {
     void *arg;             /* callout function argument */
     callout_t *co_next;    /* next callout in list */
     callout_t *co_prev;    /* previous callout in list */
+    int co_new;            /* armed during the current timer interval */
 };
 extern callout_t *callout_head;
 void callout_init(callout_t *c, u_int flags);
@@ -16,6 +17,8 @@ void callout_reset(callout_t *c, int ticks, void (*func)(void *), void *arg);
 int callout_stop(callout_t *c);
 void callout_call(callout_t *c);
 void callout_list(void);
-void callout_run_timeouts(void);
+void callout_run_timeouts(int elapsed);
+void callout_start_interval(void);
+int callout_next_timeout(void);
 
 #endif /* _CALLOUT_H */
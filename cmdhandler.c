@@ -25,13 +25,20 @@
 #include "device.h"
 #include "scsi_all.h"
 #include "scsipiconf.h"
+#include "scsipi_all.h"
 #include "sd.h"
+#include "st.h"
+#include "siop_target.h"
+#include "diskprofile.h"
 #include "sys_queue.h"
 #include "siopreg.h"
 #include "siopvar.h"
 #include "attach.h"
 #include "cmdhandler.h"
 #include "nsd.h"
+#include "mempool.h"
+#include "bcache.h"
+#include "stats.h"
 #include "ndkcompat.h"
 
 #ifndef DEBUG_CMDHANDLER
@@ -87,12 +94,18 @@ irq_poll(uint got_int, struct siop_softc *sc)
     }
 }
 
+static int      timer_ticks;   // Length of the running timer interval
+static uint64_t timer_eclock;  // E-clock when the running interval began
+
 static void
-restart_timer(void)
+restart_timer(int ticks)
 {
     if (asave->as_timerio != NULL) {
-        asave->as_timerio->tr_time.tv_secs  = 1;
-        asave->as_timerio->tr_time.tv_micro = 0;
+        timer_ticks = ticks;
+        timer_eclock = eclock_read();
+        asave->as_timerio->tr_time.tv_secs  = ticks / TICKS_PER_SECOND;
+        asave->as_timerio->tr_time.tv_micro = (ticks % TICKS_PER_SECOND) *
+                                              (1000000 / TICKS_PER_SECOND);
         asave->as_timerio->tr_node.io_Command = TR_ADDREQUEST;
         SendIO(&asave->as_timerio->tr_node);
         asave->as_timer_running = 1;
@@ -100,13 +113,21 @@ restart_timer(void)
 }
 
 static void
-close_timer(void)
+stop_timer(void)
 {
-    printf("Shutting down timer.\n");
     if (asave->as_timer_running) {
+        AbortIO(&asave->as_timerio->tr_node);
         WaitIO(&asave->as_timerio->tr_node);
+        SetSignal(0, BIT(asave->as_timerport->mp_SigBit));
         asave->as_timer_running = 0;
     }
+}
+
+static void
+close_timer(void)
+{
+    printf("Shutting down timer.\n");
+    stop_timer();
 
     if (asave->as_timerio != NULL) {
         CloseDevice(&asave->as_timerio->tr_node);
@@ -120,6 +141,82 @@ close_timer(void)
     }
 }
 
+/*
+ * run_timer
+ * ---------
+ * Runs the callouts and media change polls which are due after elapsed
+ * ticks, then arms the timer for whichever is due next. The timer is
+ * left idle when no callout is pending and no media needs polling, so
+ * the handler task sleeps until the next request arrives.
+ *
+ * Callouts armed while the timer runs are only charged from the next
+ * interval, so the interval is kept to at most a second while any are
+ * pending. This bounds how late a new command timeout may fire.
+ */
+static void
+run_timer(struct scsipi_channel *chan, int elapsed)
+{
+    int ticks;
+    int tur;
+
+    if (elapsed != 0)
+        callout_run_timeouts(elapsed);
+    tur = sd_testunitready_walk(chan, elapsed);
+
+    callout_start_interval();
+    ticks = callout_next_timeout();
+    if (ticks > TICKS_PER_SECOND)
+        ticks = TICKS_PER_SECOND;
+    if ((tur != 0) && ((ticks == 0) || (tur < ticks)))
+        ticks = tur;
+    if (ticks != 0)
+        restart_timer(ticks);
+}
+
+/*
+ * timer_event
+ * -----------
+ * Handles the timer signal, running the interval which has just ended.
+ */
+static void
+timer_event(struct scsipi_channel *chan)
+{
+    if (!asave->as_timer_running ||
+        (CheckIO(&asave->as_timerio->tr_node) == NULL))
+        return;  // Stale signal
+
+    WaitIO(&asave->as_timerio->tr_node);
+    asave->as_timer_running = 0;
+    run_timer(chan, timer_ticks);
+}
+
+/*
+ * timer_update
+ * ------------
+ * Arms the timer when new work needs it: a command timeout or a client
+ * waiting for media changes. A long interval armed only for media change
+ * polling is cut short when a command timeout is armed. The part of it
+ * which has already passed is charged, so that commands arriving every
+ * few seconds do not keep putting off the next media change poll.
+ */
+static void
+timer_update(struct scsipi_channel *chan)
+{
+    int elapsed = 0;
+
+    if (asave->as_timer_running) {
+        if ((timer_ticks <= TICKS_PER_SECOND) || (callout_next_timeout() == 0))
+            return;
+        elapsed = (uint64_t) eclock_usecs(eclock_read() - timer_eclock) *
+                  TICKS_PER_SECOND / 1000000;
+        if (elapsed > timer_ticks)
+            elapsed = timer_ticks;
+    }
+
+    stop_timer();
+    run_timer(chan, elapsed);
+}
+
 static int
 open_timer(void)
 {
@@ -247,6 +344,33 @@ static const UWORD nsd_supported_cmds[] = {
     TAG_END
 };
 
+/*
+ * cmd_get_stats
+ * -------------
+ * Fill in as much of the caller's a4091_stats_t as fits in io_Length.
+ */
+static void
+cmd_get_stats(struct IOExtTD *iotd)
+{
+    a4091_stats_t stats;
+    uint32_t      len = iotd->iotd_Req.io_Length;
+
+    memset(&stats, 0, sizeof (stats));
+    stats.st_version = A4091_STATS_VERSION;
+    stats.st_size    = sizeof (stats);
+    mempool_get_stats(&stats.st_mem);
+    bcache_get_stats(&stats.st_bcache);
+    stats.st_boot.bt_ready_usecs = asave->as_ready_usecs;
+    stats.st_boot.bt_open_usecs  = asave->as_open_usecs;
+    stats.st_boot.bt_cdrom_usecs = asave->as_cdrom_usecs;
+    siop_get_dma_stats(asave->as_device_private, &stats.st_dma);
+
+    if (len > sizeof (stats))
+        len = sizeof (stats);
+    CopyMem(&stats, iotd->iotd_Req.io_Data, len);
+    iotd->iotd_Req.io_Actual = len;
+}
+
 static int
 cmd_do_iorequest(struct IORequest * ior)
 {
@@ -285,6 +409,20 @@ validate_etd:
             PRINTF_CMD("E");
             break;
         }
+        case CMD_READ:
+        case CMD_WRITE:
+        case CMD_UPDATE:
+        case HD_SCSICMD:
+        case CMD_TAPE_WRITEFM:
+        case CMD_TAPE_REWIND:
+        case CMD_TAPE_SPACE:
+        case CMD_TAPE_BLKSIZE:
+            if (((struct scsipi_periph *) ior->io_Unit)->drv_state != NULL) {
+                /* Sequential-access unit: st.c orders and buffers I/O */
+                st_iorequest(ior);
+                return (0);
+            }
+            break;
     }
 
     switch (cmd) {
@@ -298,11 +436,12 @@ validate_etd:
             blkshift = ((struct scsipi_periph *) ior->io_Unit)->periph_blkshift;
             blkno = iotd->iotd_Req.io_Offset >> blkshift;
 CMD_READ_continue:
+            /* Set first, as a block cache hit replies at once */
+            iotd->iotd_Req.io_Actual = iotd->iotd_Req.io_Length;
             rc = sd_readwrite(iotd->iotd_Req.io_Unit, blkno, B_READ,
                               iotd->iotd_Req.io_Data,
                               iotd->iotd_Req.io_Length, ior);
             if (rc == 0) {
-                iotd->iotd_Req.io_Actual = iotd->iotd_Req.io_Length;
                 /* cmd_complete() does ReplyMsg() */
             } else {
                 iotd->iotd_Req.io_Error = rc;
@@ -323,7 +462,9 @@ io_done:
             blkshift = ((struct scsipi_periph *) ior->io_Unit)->periph_blkshift;
             blkno = iotd->iotd_Req.io_Offset >> blkshift;
 CMD_WRITE_continue:
-            rc = sd_readwrite(iotd->iotd_Req.io_Unit, blkno, B_WRITE,
+            rc = sd_readwrite(iotd->iotd_Req.io_Unit, blkno,
+                              (ior->io_Flags & IOF_A4091_BARRIER) ?
+                              B_WRITE | B_ORDERED : B_WRITE,
                               iotd->iotd_Req.io_Data,
                               iotd->iotd_Req.io_Length, ior);
             if (rc == 0) {
@@ -336,6 +477,40 @@ CMD_WRITE_continue:
             }
             break;
 
+        case CMD_SCATTER_READ:   // Read consecutive blocks into several buffers
+        case CMD_SCATTER_WRITE:  // Write consecutive blocks from several buffers
+            PRINTF_CMD("CMD_SCATTER_%s %d %"PRIx32":%"PRIx32" %"PRIu32"\n",
+                    (cmd == CMD_SCATTER_READ) ? "READ" : "WRITE",
+                    ((struct scsipi_periph *) ior->io_Unit)->periph_lun * 10 +
+                    ((struct scsipi_periph *) ior->io_Unit)->periph_target,
+                    iotd->iotd_Req.io_Actual, iotd->iotd_Req.io_Offset,
+                    iotd->iotd_Req.io_Length);
+            blkshift = ((struct scsipi_periph *) ior->io_Unit)->periph_blkshift;
+            blkno = ((uint64_t) iotd->iotd_Req.io_Actual << (32 - blkshift)) |
+                    (iotd->iotd_Req.io_Offset >> blkshift);
+            if (((struct scsipi_periph *) ior->io_Unit)->drv_state != NULL)
+                rc = ERROR_UNKNOWN_COMMAND;  // Not for sequential access
+            else
+                rc = sd_scatter(iotd->iotd_Req.io_Unit, blkno,
+                                (cmd == CMD_SCATTER_READ) ? B_READ :
+                                (ior->io_Flags & IOF_A4091_BARRIER) ?
+                                B_WRITE | B_ORDERED : B_WRITE,
+                                iotd->iotd_Req.io_Data,
+                                iotd->iotd_Req.io_Length, ior);
+            if (rc == 0) {
+                const a4091_iovec_t *iov = iotd->iotd_Req.io_Data;
+                uint i;
+                iotd->iotd_Req.io_Actual = 0;
+                for (i = 0; i < iotd->iotd_Req.io_Length; i++)
+                    iotd->iotd_Req.io_Actual += iov[i].iov_len;
+                /* cmd_complete() does ReplyMsg() */
+            } else {
+                iotd->iotd_Req.io_Error = rc;
+                iotd->iotd_Req.io_Actual = 0;
+                ReplyMsg(&ior->io_Message);
+            }
+            break;
+
         case HD_SCSICMD:      // Send any SCSI command to drive (SCSI Direct)
 #ifdef DEBUG_CMD
             {
@@ -530,16 +705,13 @@ CMD_SEEK_continue:
         case CMD_ATTACH:  // Attach (open) a new SCSI device
             PRINTF_CMD("CMD_ATTACH %"PRIu32"\n", iotd->iotd_Req.io_Offset);
 
-            rc = attach(NULL, iotd->iotd_Req.io_Offset,
-                        (struct scsipi_periph **) &ior->io_Unit,
-                        iotd->iotd_Req.io_Length);
-            if (rc != 0) {
-                ior->io_Error = rc;
-            } else if ((iotd->iotd_Req.io_Length & TDF_DEBUG_OPEN) == 0) {
-                (void) sd_blocksize((struct scsipi_periph *) ior->io_Unit);
+            if (asave->as_open_usecs == 0) {
+                asave->as_open_usecs = eclock_usecs(eclock_read() -
+                                                    asave->as_start_eclock);
+                printf("A4091: first open %"PRIu32" ms after start\n",
+                       asave->as_open_usecs / 1000);
             }
-
-            ReplyMsg(&ior->io_Message);
+            attach_start(ior);  // Replied once the unit has been probed
             break;
 
         case CMD_DETACH:  // Detach (close) a SCSI device
@@ -551,9 +723,61 @@ CMD_SEEK_continue:
             ReplyMsg(&ior->io_Message);
             break;
 
+        case CMD_GETSTATS:  // Copy driver statistics to caller
+            PRINTF_CMD("CMD_GETSTATS\n");
+            cmd_get_stats(iotd);
+            ReplyMsg(&ior->io_Message);
+            break;
+
+        case CMD_CACHEPROFILE:  // Get/set drive caching (MODE page 8)
+            PRINTF_CMD("CMD_CACHEPROFILE %d\n",
+                    ((struct scsipi_periph *) ior->io_Unit)->periph_lun * 10 +
+                    ((struct scsipi_periph *) ior->io_Unit)->periph_target);
+            if (iotd->iotd_Req.io_Length < sizeof (a4091_cache_profile_t)) {
+                ior->io_Error = IOERR_BADLENGTH;
+            } else {
+                ior->io_Error = sd_cache_profile(iotd->iotd_Req.io_Unit,
+                                                 iotd->iotd_Req.io_Data);
+                if (ior->io_Error == 0)
+                    iotd->iotd_Req.io_Actual = sizeof (a4091_cache_profile_t);
+            }
+            ReplyMsg(&ior->io_Message);
+            break;
+
+        case CMD_DISKPROFILE:  // Get/set per-disk performance profile
+            PRINTF_CMD("CMD_DISKPROFILE %d\n",
+                    ((struct scsipi_periph *) ior->io_Unit)->periph_lun * 10 +
+                    ((struct scsipi_periph *) ior->io_Unit)->periph_target);
+            if (iotd->iotd_Req.io_Length < sizeof (a4091_disk_profile_t)) {
+                ior->io_Error = IOERR_BADLENGTH;
+            } else {
+                ior->io_Error = sd_disk_profile(iotd->iotd_Req.io_Unit,
+                                                iotd->iotd_Req.io_Data);
+                if (ior->io_Error == 0)
+                    iotd->iotd_Req.io_Actual = sizeof (a4091_disk_profile_t);
+            }
+            ReplyMsg(&ior->io_Message);
+            break;
+
+        case CMD_TARGET:  // Get/set SCSI target mode
+            PRINTF_CMD("CMD_TARGET\n");
+            if (iotd->iotd_Req.io_Length < sizeof (a4091_target_t)) {
+                ior->io_Error = IOERR_BADLENGTH;
+            } else {
+                ior->io_Error = siop_target_control(asave->as_device_private,
+                                                    iotd->iotd_Req.io_Data);
+                if (ior->io_Error == 0)
+                    iotd->iotd_Req.io_Actual = sizeof (a4091_target_t);
+            }
+            ReplyMsg(&ior->io_Message);
+            break;
+
         case CMD_TERM:
             PRINTF_CMD("CMD_TERM\n");
+            attach_abort();
             deinit_chan(NULL);
+            mempool_deinit();
+            timing_deinit();
             close_timer();
             asave->as_isr = NULL;
             FreeMem(asave->as_device_private, sizeof (*asave->as_device_private));
@@ -631,18 +855,50 @@ irq_and_timer_handler(void)
     /* Handle incoming interrupts */
     irq_poll(mask & int_mask, sc);
 
-    if (mask & timer_mask) {
-        WaitIO(&asave->as_timerio->tr_node);
-        callout_run_timeouts();
-        sd_testunitready_walk(chan);
-        restart_timer();
-    }
+    if (mask & timer_mask)
+        timer_event(chan);
 
     /* Process the failure completion queue, if anything is present */
     scsipi_completion_poll(chan);
+    timer_update(chan);
     return ((mask & int_mask) ? 1 : 0);
 }
 
+/*
+ * cmd_handler_failed
+ * ------------------
+ * The board could not be brought up after the device was added. Fail every
+ * request with the start error until the device is expunged.
+ */
+static void
+cmd_handler_failed(struct MsgPort *msgport, int rc)
+{
+    struct IORequest *ior;
+
+    while (1) {
+        WaitPort(msgport);
+        while ((ior = (struct IORequest *) GetMsg(msgport)) != NULL) {
+            if (ior->io_Command == CMD_TERM) {
+                attach_abort();
+                mempool_deinit();
+                timing_deinit();
+                close_timer();
+                FreeMem(asave->as_device_private,
+                        sizeof (*asave->as_device_private));
+                FreeMem(asave, sizeof (*asave));
+                asave = NULL;
+                Forbid();
+                DeletePort(myPort);
+                myPort = NULL;
+                ReplyMsg(&ior->io_Message);
+                return;
+            }
+            ior->io_Error = rc;
+            ReplyMsg(&ior->io_Message);
+        }
+    }
+}
+
 static void __saveds
 cmd_handler(void)
 {
@@ -658,9 +914,11 @@ cmd_handler(void)
     ULONG                  wait_mask;
     ULONG                  timer_mask;
     uint32_t               mask;
+    int                    rc;
 
     task = (struct Task *) FindTask((char *)NULL);
 
+    mempool_init();
     msgport = CreatePort(NULL, 0);
     while ((msg = (start_msg_t *)(task->tc_UserData)) == NULL) {
         printf(".");
@@ -688,8 +946,17 @@ cmd_handler(void)
     if (msg->io_Error != 0)
         goto fail_timer;
 
+    msg->io_Error = timing_init();
+    if (msg->io_Error != 0) {
+        close_timer();
+        goto fail_timer;
+    }
+
+    asave->as_start_eclock = eclock_read();
     msg->io_Error = init_chan(NULL, &msg->boardnum);
     if (msg->io_Error != 0) {
+        mempool_deinit();
+        timing_deinit();
         close_timer();
 fail_timer:
         FreeMem(asave->as_device_private, sizeof (*asave->as_device_private));
@@ -704,8 +971,21 @@ fail_msgport:
         return;
     }
 
+    /*
+     * The device may now be added. Bring up the channel while the system
+     * carries on booting; requests queue in msgport until this is done.
+     */
     ReleaseSemaphore(&msg->started);
-    restart_timer();
+    rc = start_chan(NULL);
+    asave->as_ready_usecs = eclock_usecs(eclock_read() -
+                                         asave->as_start_eclock);
+    if (rc != 0) {
+        printf("A4091: channel start failed: %d\n", rc);
+        cmd_handler_failed(msgport, rc);
+        return;
+    }
+    printf("A4091: channel ready after %"PRIu32" ms\n",
+           asave->as_ready_usecs / 1000);
 
     sc         = asave->as_device_private;
     active     = &sc->sc_channel.chan_active;
@@ -717,6 +997,7 @@ fail_msgport:
 
     asave->as_int_mask   = int_mask;
     asave->as_timer_mask = timer_mask;
+    timer_update(chan);
 
     while (1) {
         mask = Wait(wait_mask);
@@ -730,12 +1011,8 @@ fail_msgport:
         } while ((SetSignal(0, 0) & int_mask) && ((mask |= Wait(wait_mask))));
 
         /* Process timer events */
-        if (mask & timer_mask) {
-            WaitIO(&asave->as_timerio->tr_node);
-            callout_run_timeouts();
-            sd_testunitready_walk(chan);
-            restart_timer();
-        }
+        if (mask & timer_mask)
+            timer_event(chan);
 
         if (*active > 20) {
             wait_mask = int_mask | timer_mask;
@@ -757,6 +1034,8 @@ fail_msgport:
         /* Process the failure completion queue, if anything is present */
 run_completion_queue:
         scsipi_completion_poll(chan);
+        attach_poll();
+        timer_update(chan);
     }
 }
 
@@ -813,49 +1092,98 @@ struct unit_list {
 };
 unit_list_t *unit_list = NULL;
 
+/*
+ * send_handler_cmd
+ * ----------------
+ * Send an internal command to the handler task and wait for it to complete.
+ * The reply port lives on the stack, so no port or signal has to be
+ * allocated for each OpenDevice() and CloseDevice().
+ */
+static void
+send_handler_cmd(struct IOStdReq *ior)
+{
+    struct MsgPort port;
+
+    single_port_init(&port);
+    ior->io_Message.mn_ReplyPort = &port;
+    PutMsg(myPort, &ior->io_Message);
+    while (GetMsg(&port) == NULL)
+        Wait(SIGF_SINGLE);
+}
+
+/*
+ * open_unit
+ * ---------
+ * Open a SCSI unit, having the handler attach it on the first open.
+ * No semaphore is held while the handler probes the unit, so other tasks
+ * may open units meanwhile. The unit's entry is added before the attach,
+ * without a periph, so that opens of the same unit which arrive during
+ * the attach are counted in it, and a close can't detach the unit while
+ * any of them still waits for the handler.
+ */
 int
 open_unit(uint scsi_target, void **io_Unit, uint flags)
 {
-    unit_list_t *cur;
-    for (cur = unit_list; cur != NULL; cur = cur->next) {
-        if (cur->scsi_target == scsi_target) {
-            cur->count++;
-            *io_Unit = cur->periph;
-            return (0);
-        }
+    unit_list_t    *parent;
+    unit_list_t    *cur;
+    struct IOStdReq ior;
+
+    for (cur = unit_list; cur != NULL; cur = cur->next)
+        if (cur->scsi_target == scsi_target)
+            break;
+
+    if ((cur != NULL) && (cur->periph != NULL)) {
+        cur->count++;
+        *io_Unit = cur->periph;
+        return (0);
     }
     if (flags & TDF_DEBUG_OPEN)
         return (ERROR_BAD_UNIT);  // This flag only grabs already open device
 
-    cur = AllocMem(sizeof (*cur), MEMF_PUBLIC);
-    if (cur == NULL)
-        return (ERROR_NO_MEMORY);
+    if (cur == NULL) {
+        cur = mempool_alloc(sizeof (*cur), MEMF_PUBLIC);
+        if (cur == NULL)
+            return (ERROR_NO_MEMORY);
+
+        /* Add new device to periph list; the periph is set once attached */
+        cur->count = 0;
+        cur->periph = NULL;
+        cur->scsi_target = scsi_target;
+        cur->next = unit_list;
+        unit_list = cur;
+    }
+    cur->count++;
 
-    struct IOStdReq ior;
-    ior.io_Message.mn_ReplyPort = CreateMsgPort();
+    /* The handler replies all opens of the unit with the same periph */
     ior.io_Command = CMD_ATTACH;
     ior.io_Unit = NULL;
     ior.io_Offset = scsi_target;
     ior.io_Length = flags;
 
-    PutMsg(myPort, &ior.io_Message);
-    WaitPort(ior.io_Message.mn_ReplyPort);
-    DeleteMsgPort(ior.io_Message.mn_ReplyPort);
+    send_handler_cmd(&ior);
 
-    if (ior.io_Error != 0)
-        return (ior.io_Error);
+    if ((ior.io_Error == 0) && (ior.io_Unit == NULL))
+        ior.io_Error = ERROR_BAD_UNIT;  // Attach failed
 
-    *io_Unit = ior.io_Unit;
-    if (ior.io_Unit == NULL)
-        return (ERROR_BAD_UNIT);  // Attach failed
+    if (ior.io_Error == 0) {
+        cur->periph = (struct scsipi_periph *) ior.io_Unit;
+        *io_Unit = ior.io_Unit;
+        return (0);
+    }
 
-    /* Add new device to periph list */
-    cur->count = 1;
-    cur->periph = (struct scsipi_periph *) ior.io_Unit;
-    cur->scsi_target = scsi_target;
-    cur->next = unit_list;
-    unit_list = cur;
-    return (0);
+    if (--cur->count == 0) {
+        /* Remove device from list */
+        if (unit_list == cur) {
+            unit_list = cur->next;
+        } else {
+            for (parent = unit_list; parent->next != cur;
+                 parent = parent->next)
+                ;
+            parent->next = cur->next;
+        }
+        mempool_free(cur, sizeof (*cur));
+    }
+    return (ior.io_Error);
 }
 
 void
@@ -874,17 +1202,14 @@ close_unit(void *io_Unit)
                 unit_list = cur->next;
             else
                 parent->next = cur->next;
-            FreeMem(cur, sizeof (*cur));
+            mempool_free(cur, sizeof (*cur));
 
             /* Detach (close) peripheral */
             struct IOStdReq ior;
-            ior.io_Message.mn_ReplyPort = CreateMsgPort();
             ior.io_Command = CMD_DETACH;
             ior.io_Unit = (struct Unit *) periph;
 
-            PutMsg(myPort, &ior.io_Message);
-            WaitPort(ior.io_Message.mn_ReplyPort);
-            DeleteMsgPort(ior.io_Message.mn_ReplyPort);
+            send_handler_cmd(&ior);
             return;
         }
     }
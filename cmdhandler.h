@@ -34,5 +34,32 @@ void td_remove(struct IORequest *ior);
 #define CMD_ATTACH   0x2ff1  // Attach (open) SCSI peripheral
 #define CMD_DETACH   0x2ef2  // Detach (close) SCSI peripheral
 
+/* Driver-specific commands */
+#define CMD_GETSTATS 0x2ef3  // Get driver statistics (a4091_stats_t, stats.h)
+#define CMD_CACHEPROFILE 0x2ef4  // Get/set caching profile (sd.h)
+#define CMD_TAPE_WRITEFM 0x2ef5  // Write io_Length filemarks (st.h)
+#define CMD_TAPE_REWIND  0x2ef6  // Rewind tape
+#define CMD_TAPE_SPACE   0x2ef7  // Space blocks or filemarks (st.h)
+#define CMD_TAPE_BLKSIZE 0x2ef8  // Set tape block size, 0 = variable
+#define CMD_TARGET       0x2ef9  // Get/set SCSI target mode (siop_target.h)
+#define CMD_DISKPROFILE  0x2efa  // Get/set disk profile (diskprofile.h)
+#define CMD_SCATTER_READ  0x2efb  // Read blocks into several buffers (sd.h)
+#define CMD_SCATTER_WRITE 0x2efc  // Write blocks from several buffers
+
+/*
+ * Driver-specific io_Flags
+ *
+ * IOF_A4091_BARRIER on a write (CMD_WRITE, TD_WRITE64, TD_FORMAT,
+ * CMD_SCATTER_WRITE and their 64-bit/ETD forms) makes it a barrier: it
+ * is not started before every command sent to the unit ahead of it has
+ * completed, and no command sent after it starts before it completes.
+ * If the drive's write cache is on, the cache is flushed to the medium
+ * before the barrier is written. A filesystem may then queue its
+ * metadata write right behind the data writes, instead of waiting for
+ * their replies first.
+ */
+#define IOB_A4091_BARRIER 7
+#define IOF_A4091_BARRIER (1 << IOB_A4091_BARRIER)
+
 #endif /* _CMD_HANDLER_H */
 
@@ -219,9 +219,10 @@ drv_expunge(struct Library *dev asm("a6"))
  *
  * ------------------------------------------------------------
  *
- * CAUTION: This function runs in Forbid() state. It is guaranteed
- *          to be single-threaded; only one task will execute Open()
- *          at a time.
+ * CAUTION: This function runs in Forbid() state, but waiting for the
+ *          handler to attach a unit breaks the Forbid(). The attach is
+ *          done without holding entry_sem, so several tasks may be in
+ *          Open() at the same time, each waiting for its own unit.
  */
 void __used __saveds
 drv_open(struct Library *dev asm("a6"), struct IORequest *ioreq asm("a1"),
@@ -235,14 +236,17 @@ drv_open(struct Library *dev asm("a6"), struct IORequest *ioreq asm("a1"),
         return; /* can only run under 2.0 or greater */
     }
 
+    /* The open count keeps the device from being expunged meanwhile */
     ObtainSemaphore(&entry_sem);
     dev->lib_OpenCnt++;
+    ReleaseSemaphore(&entry_sem);
 
     if ((rc = open_unit(scsi_unit, (void **) &ioreq->io_Unit, flags)) != 0) {
         printf("Open fail %d.%d\n", scsi_unit % 10, scsi_unit / 10);
+        ObtainSemaphore(&entry_sem);
         dev->lib_OpenCnt--;
-        ioreq->io_Error = rc;
         ReleaseSemaphore(&entry_sem);
+        ioreq->io_Error = rc;
         return;
     }
 #if 0
@@ -250,8 +254,6 @@ drv_open(struct Library *dev asm("a6"), struct IORequest *ioreq asm("a1"),
 #endif
 
     ioreq->io_Error = 0; // Success
-
-    ReleaseSemaphore(&entry_sem);
 }
 
 /*
@@ -19,6 +19,9 @@
 #define ERROR_BAD_BOARD       51  // (HFERR_NoBoard + 1)
 #define ERROR_SENSE_CODE      52  // (HFERR_NoBoard + 2)
 #define ERROR_NOT_READY       53  // (HFERR_NoBoard + 3)
+#define ERROR_FILEMARK        54  // (HFERR_NoBoard + 4) Tape read hit filemark
+#define ERROR_END_OF_DATA     55  // (HFERR_NoBoard + 5) Tape blank check
+#define ERROR_END_OF_MEDIA    56  // (HFERR_NoBoard + 6) Tape end of medium
 
 #define TDF_DEBUG_OPEN    (1<<7)  // Open unit in debug mode (no I/O)
 
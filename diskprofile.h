@@ -0,0 +1,60 @@
+#ifndef _DISKPROFILE_H
+#define _DISKPROFILE_H
+
+/*
+ * Per-disk performance profile, used with CMD_DISKPROFILE.
+ *
+ * The profile is stored on the disk in a block of its own within the
+ * Rigid Disk Block area, so that it moves with the disk. The block is
+ * linked from the first of the RigidDiskBlock's reserved longwords, which
+ * are 0xffffffff (or 0) when no profile exists. The mounter passes the
+ * profile to the driver before it mounts the disk's partitions; a4091d -r
+ * writes it and applies it immediately.
+ *
+ * A field value of 0 keeps the driver's or drive's default. On return
+ * from CMD_DISKPROFILE, the structure holds the settings now in effect.
+ * Fields are only ever appended; dpb_Size tells how much of the profile
+ * was written, and missing fields read as 0.
+ */
+#define IDNAME_DISKPROFILE  0x41345046  // 'A4PF'
+#define DISKPROFILE_VERSION 1
+
+/* RDB longword which holds the profile block number */
+#define RDB_DISKPROFILE(rdb) ((rdb)->rdb_Reserved1[0])
+
+#define DP_SYNC_DEFAULT   0     // Fastest period the board supports
+#define DP_SYNC_ASYNC     0xff  // No synchronous transfers
+
+#define DP_DISC_DEFAULT   0     // Disconnect unless disabled by jumper
+#define DP_DISC_NEVER     1     // Target may not disconnect
+#define DP_DISC_NODATA    2     // Only commands without data may disconnect
+#define DP_DISC_ALWAYS    3     // All commands may disconnect
+
+#define DP_WCACHE_DEFAULT 0     // Leave the drive's write cache setting
+#define DP_WCACHE_OFF     1     // Write cache disabled (WCE clear)
+#define DP_WCACHE_ON      2     // Write cache enabled (WCE set)
+
+typedef struct {
+    uint8_t  dp_queue_depth;    // Commands in flight to the drive, 1-7;
+                                // 1 without tagged queuing
+    uint8_t  dp_sync_period;    // Minimum sync period in 4ns units, DP_SYNC_*
+    uint8_t  dp_disconnect;     // DP_DISC_*
+    uint8_t  dp_write_cache;    // DP_WCACHE_*
+    uint8_t  dp_cache_profile;  // Read-ahead, CACHE_PROFILE_* in sd.h
+    uint8_t  dp_pad;
+    uint16_t dp_max_prefetch;   // Read-ahead limit in blocks
+} a4091_disk_profile_t;
+
+/* On-disk block; the same checksum rules as other RDB blocks apply */
+typedef struct {
+    uint32_t dpb_ID;            // IDNAME_DISKPROFILE
+    uint32_t dpb_SummedLongs;   // Size of this structure in longwords
+    int32_t  dpb_ChkSum;        // Longwords sum to zero
+    uint32_t dpb_HostID;        // SCSI ID of the host adapter
+    uint16_t dpb_Version;       // DISKPROFILE_VERSION when written
+    uint16_t dpb_Size;          // sizeof (a4091_disk_profile_t) when written
+    a4091_disk_profile_t dpb_Profile;
+    uint32_t dpb_Reserved[8];
+} a4091_profile_block_t;
+
+#endif /* _DISKPROFILE_H */
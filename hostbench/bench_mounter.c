@@ -0,0 +1,251 @@
+/*
+ * Benchmarks for the RDB parser in mounter.c
+ *
+ * mounter.c is included rather than linked, as the parser functions are
+ * static. The disk is a synthetic Rigid Disk Block with a chain of
+ * partitions, served from memory through the shim's DoIO(). Mounted
+ * partitions are discarded by the shim, so every pass sees the same
+ * empty mount list.
+ *
+ * The blocks are built as they would be on disk: the fields which
+ * mounter.c reads byte by byte (ID, length and checksum) are stored big
+ * endian, while the fields it reads through the structures are stored in
+ * host order. They are laid out the way HDToolBox writes them: RDSK in
+ * block 0, followed by the PART blocks and then the FSHD block, all
+ * within the RDB search region.
+ *
+ * The CD-ROM case serves an ISO 9660 volume descriptor set instead: a
+ * PVD with the "AMIGA BOOT" system ID, a supplementary descriptor and
+ * the set terminator, starting at sector 16.
+ */
+#include "../mounter.c"
+#include "hostbench.h"
+
+#define BENCH_PARTS   4
+#define BENCH_FSHD    (BENCH_PARTS + 1)
+#define BENCH_BLOCKS  RDB_LOCATION_LIMIT
+#define BENCH_BLKSIZE 512
+#define BENCH_DOSTYPE 0x444f5303  // DOS\3
+
+#define BENCH_CD_SECTORS (ISO_VDS_START + 3)
+
+static uint8_t               bench_disk[BENCH_BLOCKS][BENCH_BLKSIZE];
+static uint8_t               bench_cd[BENCH_CD_SECTORS][ISO_SECTOR];
+static uint8_t              *bench_media;
+static uint32_t              bench_media_size;
+static struct MountData      bench_md;
+static struct ExpansionBase  bench_expbase;
+static struct IOExtTD        bench_request;
+
+static struct {
+    struct FileSysResource fsr;
+    struct FileSysEntry    fse;
+} bench_fsres;
+
+static void
+bench_put_be32(uint8_t *ptr, uint32_t value)
+{
+    ptr[0] = value >> 24;
+    ptr[1] = value >> 16;
+    ptr[2] = value >> 8;
+    ptr[3] = value;
+}
+
+static void
+bench_block_seal(uint8_t *blk, uint32_t id)
+{
+    uint32_t sum = 0;
+    uint     i;
+
+    bench_put_be32(blk + 0, id);
+    bench_put_be32(blk + 4, BENCH_BLKSIZE / 4);
+    bench_put_be32(blk + 8, 0);
+    for (i = 0; i < BENCH_BLKSIZE; i += 4)
+        sum += ((uint32_t) blk[i] << 24) | (blk[i + 1] << 16) |
+               (blk[i + 2] << 8) | blk[i + 3];
+    bench_put_be32(blk + 8, -sum);
+}
+
+static BYTE
+bench_doio(struct IORequest *ior)
+{
+    struct IOStdReq *io = (struct IOStdReq *) ior;
+
+    if (io->io_Command == TD_CHANGESTATE) {
+        io->io_Actual = 0;  // Disc present
+        return (0);
+    }
+    if ((io->io_Command != CMD_READ) ||
+        (io->io_Offset + io->io_Length > bench_media_size))
+        return (TDERR_BadSecPreamble);
+    CopyMem(bench_media + io->io_Offset, io->io_Data, io->io_Length);
+    io->io_Actual = io->io_Length;
+    return (0);
+}
+
+static void
+bench_mounter_setup(void)
+{
+    struct RigidDiskBlock     *rdb = (struct RigidDiskBlock *) bench_disk[0];
+    struct FileSysHeaderBlock *fhb;
+    struct PartitionBlock     *pb;
+    uint                       i;
+
+    shim_init();
+    shim_doio_hook = bench_doio;
+    bench_media = (uint8_t *) bench_disk;
+    bench_media_size = sizeof (bench_disk);
+    if (bench_md.SysBase != NULL)
+        return;
+
+    memset(bench_disk, 0, sizeof (bench_disk));
+    rdb->rdb_PartitionList = 1;
+    rdb->rdb_FileSysHeaderList = BENCH_FSHD;
+    rdb->rdb_HighRDSKBlock = BENCH_FSHD;
+    bench_block_seal(bench_disk[0], IDNAME_RIGIDDISK);
+
+    fhb = (struct FileSysHeaderBlock *) bench_disk[BENCH_FSHD];
+    fhb->fhb_Next = 0xffffffff;
+    fhb->fhb_DosType = BENCH_DOSTYPE;
+    fhb->fhb_Version = 0x002f0000;
+    fhb->fhb_SegListBlocks = 0xffffffff;
+    bench_block_seal(bench_disk[BENCH_FSHD], IDNAME_FILESYSHEADER);
+
+    for (i = 1; i <= BENCH_PARTS; i++) {
+        pb = (struct PartitionBlock *) bench_disk[i];
+        pb->pb_Next = (i < BENCH_PARTS) ? i + 1 : 0xffffffff;
+        pb->pb_Flags = (i == 1) ? PBFF_BOOTABLE : 0;
+        pb->pb_DriveName[0] = 3;
+        CopyMem("DH", pb->pb_DriveName + 1, 2);
+        pb->pb_DriveName[3] = '0' + i - 1;
+        pb->pb_Environment[0]  = 16;    // de_TableSize
+        pb->pb_Environment[1]  = 128;   // de_SizeBlock
+        pb->pb_Environment[3]  = 16;    // de_Surfaces
+        pb->pb_Environment[4]  = 1;     // de_SectorPerBlock
+        pb->pb_Environment[5]  = 63;    // de_BlocksPerTrack
+        pb->pb_Environment[9]  = 2 + (i - 1) * 1000;  // de_LowCyl
+        pb->pb_Environment[10] = 1 + i * 1000;        // de_HighCyl
+        pb->pb_Environment[11] = 30;    // de_NumBuffers
+        pb->pb_Environment[13] = 0x1fe00;     // de_MaxTransfer
+        pb->pb_Environment[14] = 0x7ffffffe;  // de_Mask
+        pb->pb_Environment[16] = BENCH_DOSTYPE;
+        bench_block_seal(bench_disk[i], IDNAME_PARTITION);
+    }
+
+    /* The filesystem is already resident, as after LoadFileSystems() */
+    NewList(&bench_fsres.fsr.fsr_FileSysEntries);
+    bench_fsres.fsr.fsr_Node.ln_Name = FSRNAME;
+    bench_fsres.fse.fse_DosType = BENCH_DOSTYPE;
+    bench_fsres.fse.fse_Version = 0x002f0000;
+    bench_fsres.fse.fse_PatchFlags = 0x190;  // StackSize, SegList, GlobalVec
+    AddTail(&bench_fsres.fsr.fsr_FileSysEntries, &bench_fsres.fse.fse_Node);
+    AddTail(&SysBase->ResourceList, &bench_fsres.fsr.fsr_Node);
+
+    bench_expbase.LibNode.lib_Version = 40;
+    NewList(&bench_expbase.MountList);
+
+    bench_md.SysBase = SysBase;
+    bench_md.ExpansionBase = &bench_expbase;
+    bench_md.request = &bench_request;
+    bench_md.devicename = (const UBYTE *) real_device_name;
+    bench_md.blocksize = BENCH_BLKSIZE;
+}
+
+/* Verify the checksum of one partition block */
+static void
+bench_checksum(uint32_t iters)
+{
+    while (iters-- > 0)
+        bench_sink += checksum(bench_disk[1], &bench_md);
+}
+
+/* Read, verify and mount one partition */
+static void
+bench_parse_part(uint32_t iters)
+{
+    while (iters-- > 0) {
+        bench_sink += ParsePART(bench_md.buf, 1, &bench_md);
+        bench_md.ret = 0;
+    }
+}
+
+/* Walk the whole partition list of the RDB */
+static void
+bench_parse_rdsk(uint32_t iters)
+{
+    while (iters-- > 0) {
+        CopyMem(bench_disk[0], bench_md.buf, BENCH_BLKSIZE);
+        bench_sink += ParseRDSK(bench_md.buf, &bench_md);
+        bench_md.ret = 0;
+    }
+}
+
+/*
+ * Find the RDB, collect its filesystems and partition DosTypes and mount
+ * its partitions, as MountDrive() does for each unit. The io column shows
+ * the disk reads.
+ */
+static void
+bench_scan_unit(uint32_t iters)
+{
+    struct RigidDiskBlock *rdb = (struct RigidDiskBlock *) bench_md.buf;
+    LONG                   rdbblock;
+
+    while (iters-- > 0) {
+        bench_md.numfshd = 0;
+        bench_md.numdostypes = 0;
+        rdbblock = ScanRDSK(&bench_md);
+        CollectFSHD(bench_md.buf + BENCH_BLKSIZE, rdb->rdb_FileSysHeaderList,
+                    0, &bench_md);
+        CollectDosTypes(bench_md.buf + BENCH_BLKSIZE, rdb->rdb_PartitionList,
+                        &bench_md);
+        if (readblock(bench_md.buf, rdbblock, IDNAME_RIGIDDISK, &bench_md))
+            bench_sink += ParseRDSK(bench_md.buf, &bench_md);
+        FreeRegion(&bench_md);
+        bench_md.ret = 0;
+    }
+}
+
+static void
+bench_cdrom_setup(void)
+{
+    uint8_t *vd;
+    uint     i;
+
+    bench_mounter_setup();
+    bench_media = (uint8_t *) bench_cd;
+    bench_media_size = sizeof (bench_cd);
+
+    memset(bench_cd, 0, sizeof (bench_cd));
+    for (i = ISO_VDS_START; i < BENCH_CD_SECTORS; i++) {
+        vd = bench_cd[i];
+        CopyMem("CD001", vd + 1, 5);
+        vd[6] = 1;
+    }
+    bench_cd[ISO_VDS_START][0] = ISO_VD_PRIMARY;
+    CopyMem("AMIGA BOOT", bench_cd[ISO_VDS_START] + 8, 10);
+    bench_cd[ISO_VDS_START + 1][0] = 2;  // Supplementary (Joliet)
+    bench_cd[ISO_VDS_START + 2][0] = ISO_VD_TERM;
+}
+
+/* Check whether the disc in a CD-ROM unit is bootable, as ScanCDROM() */
+static void
+bench_check_pvd(uint32_t iters)
+{
+    while (iters-- > 0)
+        bench_sink += CheckPVD(&bench_md);
+}
+
+const bench_case_t bench_mounter_cases[] = {
+    { "mounter_checksum", "512 byte block checksum",
+      bench_mounter_setup, bench_checksum },
+    { "mounter_parse_part", "read + verify + mount one PART",
+      bench_mounter_setup, bench_parse_part },
+    { "mounter_parse_rdsk", "RDB with 4 partitions",
+      bench_mounter_setup, bench_parse_rdsk },
+    { "mounter_scan_unit", "RDB scan + FSHD + mount, one unit",
+      bench_mounter_setup, bench_scan_unit },
+    { "mounter_check_pvd", "CD-ROM volume descriptor scan",
+      bench_cdrom_setup, bench_check_pvd },
+    { NULL, NULL, NULL, NULL }
+};
@@ -0,0 +1,105 @@
+/*
+ * Benchmarks for the callout timer list in port.c
+ *
+ * Every outstanding SCSI command has a callout, which is armed when the
+ * command is started and stopped when it completes. callout_run_timeouts()
+ * and callout_next_timeout() walk the whole list once per timer interval.
+ */
+#include <stdint.h>
+#include "port.h"
+#include "hostbench.h"
+
+#define BENCH_CALLOUTS 16  // Commands outstanding on a busy channel
+#define BENCH_TICKS    (1 << 30)
+
+static callout_t bench_callouts[BENCH_CALLOUTS];
+
+static void
+bench_timeout(void *arg)
+{
+    bench_sink += (uint32_t) (uintptr_t) arg;
+}
+
+static void
+bench_callouts_clear(void)
+{
+    uint i;
+
+    for (i = 0; i < BENCH_CALLOUTS; i++)
+        if (callout_pending(&bench_callouts[i]))
+            callout_stop(&bench_callouts[i]);
+    callout_head = NULL;
+}
+
+/* Fill the list, leaving the first callout unarmed */
+static void
+bench_callouts_setup(void)
+{
+    uint i;
+
+    bench_callouts_clear();
+    for (i = 0; i < BENCH_CALLOUTS; i++)
+        callout_init(&bench_callouts[i], 0);
+    for (i = 1; i < BENCH_CALLOUTS; i++)
+        callout_reset(&bench_callouts[i], BENCH_TICKS, bench_timeout,
+                      (void *) (uintptr_t) i);
+}
+
+/* Arm and disarm a command timeout with other commands outstanding */
+static void
+bench_callout_reset_stop(uint32_t iters)
+{
+    callout_t *c = &bench_callouts[0];
+
+    while (iters-- > 0) {
+        callout_reset(c, BENCH_TICKS, bench_timeout, NULL);
+        callout_stop(c);
+    }
+}
+
+/* Rearm the middle of the list, as when a command is restarted */
+static void
+bench_callout_rearm(uint32_t iters)
+{
+    callout_t *c = &bench_callouts[BENCH_CALLOUTS / 2];
+
+    while (iters-- > 0)
+        callout_reset(c, BENCH_TICKS, bench_timeout, NULL);
+}
+
+/* One timer interval of a second with nothing expiring */
+static void
+bench_callout_run_timeouts(uint32_t iters)
+{
+    callout_t *cur;
+    uint32_t   i;
+
+    for (i = 0; i < iters; i++) {
+        if ((i & 0xffff) == 0) {
+            for (cur = callout_head; cur != NULL; cur = cur->co_next)
+                cur->ticks = BENCH_TICKS;
+            callout_start_interval();
+        }
+        callout_run_timeouts(TICKS_PER_SECOND);
+    }
+}
+
+/* Find the deadline for the next timer interval */
+static void
+bench_callout_next_timeout(uint32_t iters)
+{
+    while (iters-- > 0)
+        bench_sink += callout_next_timeout();
+}
+
+const bench_case_t bench_port_cases[] = {
+    { "callout_reset_stop", "arm + stop with 15 others pending",
+      bench_callouts_setup, bench_callout_reset_stop },
+    { "callout_rearm", "callout_reset() of a pending callout",
+      bench_callouts_setup, bench_callout_rearm },
+    { "callout_run_timeouts", "timer tick over 15 pending callouts",
+      bench_callouts_setup, bench_callout_run_timeouts },
+    { "callout_next_timeout", "next deadline over 15 pending callouts",
+      bench_callouts_setup, bench_callout_next_timeout },
+    { NULL, NULL, NULL, NULL }
+};
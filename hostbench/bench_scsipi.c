@@ -0,0 +1,205 @@
+/*
+ * Benchmarks for the scsipi command path
+ *
+ * scsipi_base.c is included rather than linked, as the xfer pool
+ * functions are static in the Amiga build.
+ *
+ * The disk I/O cases issue a transfer through sd_readwrite() the way
+ * the command handler does, to a channel whose adapter only records the
+ * transfer. The transfer is then completed through scsipi_done() as the
+ * siop interrupt code would, so each operation covers CDB construction,
+ * xfer allocation, queueing, completion and return of the xfer to the
+ * pool.
+ */
+#include "../scsipi_base.c"
+#include "sd.h"
+#include "hostbench.h"
+
+static struct scsipi_adapter bench_adapt;
+static struct scsipi_channel bench_chan;
+static struct scsipi_periph  bench_periph;
+static struct scsipi_xfer   *bench_running;
+static uint8_t               bench_buf[64 << 10];
+
+/* Adapter which leaves every transfer running until bench_finish() */
+static void
+bench_adapt_request(struct scsipi_channel *chan, scsipi_adapter_req_t req,
+                    void *arg)
+{
+    struct scsipi_xfer *xs = arg;
+
+    if (req != ADAPTER_REQ_RUN_XFER)
+        return;
+    bench_running = xs;
+}
+
+static void
+bench_finish(void)
+{
+    struct scsipi_xfer *xs = bench_running;
+
+    bench_running = NULL;
+    xs->error = XS_NOERROR;
+    xs->status = SCSI_OK;
+    xs->resid = 0;
+    scsipi_done(xs);
+}
+
+static void
+bench_scsipi_setup(void)
+{
+    uint i;
+
+    shim_init();
+    if (bench_chan.chan_adapter != NULL)
+        return;
+
+    bench_adapt.adapt_nchannels = 1;
+    bench_adapt.adapt_openings = 7;
+    bench_adapt.adapt_request = bench_adapt_request;
+
+    bench_chan.chan_adapter = &bench_adapt;
+    bench_chan.chan_nluns = 8;
+    bench_chan.chan_id = 7;
+    scsipi_channel_init(&bench_chan);
+
+    for (i = 0; i < PERIPH_NTAGWORDS; i++)
+        bench_periph.periph_freetags[i] = 0xffffffff;
+    bench_periph.periph_openings  = 4;
+    bench_periph.periph_target    = 0;
+    bench_periph.periph_lun       = 0;
+    bench_periph.periph_version   = 3;
+    bench_periph.periph_changenum = 1;
+    bench_periph.periph_channel   = &bench_chan;
+    bench_periph.periph_blkshift  = 9;
+    bench_periph.periph_changeintlist.mlh_Head =
+        (struct MinNode *) &bench_periph.periph_changeintlist.mlh_Tail;
+    bench_periph.periph_changeintlist.mlh_Tail = NULL;
+    bench_periph.periph_changeintlist.mlh_TailPred =
+        (struct MinNode *) &bench_periph.periph_changeintlist.mlh_Head;
+    scsipi_insert_periph(&bench_chan, &bench_periph);
+}
+
+/* Take an xfer from the channel's free list and return it */
+static void
+bench_xs_get_put(uint32_t iters)
+{
+    struct scsipi_xfer *xs;
+
+    while (iters-- > 0) {
+        xs = scsipi_get_xs(&bench_periph, XS_CTL_ASYNC);
+        scsipi_put_xs(xs);
+    }
+}
+
+/* Four xfers outstanding at once, as with a full tagged queue */
+static void
+bench_xs_get_put4(uint32_t iters)
+{
+    struct scsipi_xfer *xs[4];
+    uint i;
+
+    while (iters-- > 0) {
+        for (i = 0; i < 4; i++)
+            xs[i] = scsipi_get_xs(&bench_periph, XS_CTL_ASYNC);
+        for (i = 0; i < 4; i++)
+            scsipi_put_xs(xs[i]);
+    }
+}
+
+static void
+bench_readwrite(uint32_t iters, uint64_t blkno, uint b_flags, uint len)
+{
+    while (iters-- > 0) {
+        sd_readwrite(&bench_periph, blkno, b_flags, bench_buf, len, NULL);
+        bench_finish();
+    }
+}
+
+static void
+bench_read6(uint32_t iters)
+{
+    bench_readwrite(iters, 0x1234, B_READ, 8 << 9);
+}
+
+static void
+bench_write10(uint32_t iters)
+{
+    bench_readwrite(iters, 0x123456, 0, 128 << 9);
+}
+
+static void
+bench_read16(uint32_t iters)
+{
+    bench_readwrite(iters, 0x123456789ULL, B_READ, 1 << 9);
+}
+
+/* Four 4K buffers filled by one command, as with CMD_SCATTER_READ */
+static void
+bench_scatter_read(uint32_t iters)
+{
+    a4091_iovec_t iov[4];
+    uint          i;
+
+    for (i = 0; i < 4; i++) {
+        iov[i].iov_base = bench_buf + i * (8 << 10);
+        iov[i].iov_len = 4 << 10;
+    }
+    while (iters-- > 0) {
+        sd_scatter(&bench_periph, 0x1234, B_READ, iov, 4, NULL);
+        bench_finish();
+    }
+}
+
+/* Sense data seen on typical drives: recoverable, not ready, bad media */
+static const struct {
+    uint8_t key;
+    uint8_t asc;
+    uint8_t ascq;
+} bench_senses[] = {
+    { SKEY_RECOVERED_ERROR, 0x17, 0x01 },
+    { SKEY_NOT_READY,       0x04, 0x01 },
+    { SKEY_MEDIUM_ERROR,    0x11, 0x00 },
+    { SKEY_UNIT_ATTENTION,  0x29, 0x00 },
+};
+#define BENCH_NSENSES (sizeof (bench_senses) / sizeof (bench_senses[0]))
+
+static void
+bench_interpret_sense(uint32_t iters)
+{
+    struct scsipi_xfer      xs;
+    struct scsi_sense_data *sense = &xs.sense.scsi_sense;
+    uint32_t                i;
+    uint                    s;
+
+    memset(&xs, 0, sizeof (xs));
+    xs.xs_periph = &bench_periph;
+    xs.datalen = 512;
+    sense->response_code = SSD_RCODE_VALID | SSD_RCODE_CURRENT;
+    for (i = 0; i < iters; i++) {
+        s = i % BENCH_NSENSES;
+        sense->flags = bench_senses[s].key;
+        sense->asc = bench_senses[s].asc;
+        sense->ascq = bench_senses[s].ascq;
+        xs.resid = xs.datalen;
+        bench_sink += scsipi_interpret_sense(&xs);
+    }
+}
+
+const bench_case_t bench_scsipi_cases[] = {
+    { "scsipi_xs_get_put", "one xfer from the free list and back",
+      bench_scsipi_setup, bench_xs_get_put },
+    { "scsipi_xs_get_put4", "four xfers outstanding",
+      bench_scsipi_setup, bench_xs_get_put4 },
+    { "sd_read_6", "4K read, 6-byte CDB, issue + complete",
+      bench_scsipi_setup, bench_read6 },
+    { "sd_write_10", "64K write, 10-byte CDB, issue + complete",
+      bench_scsipi_setup, bench_write10 },
+    { "sd_read_16", "512 byte read, 16-byte CDB, issue + complete",
+      bench_scsipi_setup, bench_read16 },
+    { "sd_scatter_read", "4 x 4K read into separate buffers, one CDB",
+      bench_scsipi_setup, bench_scatter_read },
+    { "scsipi_interpret_sense", "extended sense, 4 keys in rotation",
+      bench_scsipi_setup, bench_interpret_sense },
+    { NULL, NULL, NULL, NULL }
+};
@@ -0,0 +1,395 @@
+/*
+ * A4091 host microbenchmarks
+ *
+ * Builds the portable parts of the driver (scsipi, sd, mounter, callouts,
+ * memory pool) for the build host against the Exec shim in shim.c, and
+ * times individual hot functions in isolation. The figures are host
+ * figures: they do not predict 68030 cycles, but they do show when a
+ * change makes one of these functions more expensive, long before that
+ * is measurable on real hardware.
+ *
+ * Each case is first calibrated to run for at least the minimum sample
+ * time, then timed for a number of samples. The median time per
+ * operation is reported along with the fastest sample and the median
+ * absolute deviation (MAD) as a measure of noise. AllocMem() and driver
+ * pool allocations per operation are counted as well, as are I/O
+ * requests, which for the mounter cases is the number of disk reads.
+ *
+ * A baseline written with -w can be compared against with -b. Hosts
+ * change speed from run to run (clock scaling, other load), so a fixed
+ * reference loop is timed before and after the cases, and the baseline
+ * is scaled by how much faster or slower the reference ran compared to
+ * when the baseline was written. A case regresses when both its median
+ * and its fastest sample exceed the scaled baseline by more than the
+ * tolerance, and the median does so by more than three times the MAD.
+ * The exit status is 1 if any case regressed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <getopt.h>
+#include "hostbench.h"
+
+#define HOSTBENCH_VERSION "v0.1"
+
+#define MAX_SAMPLES   101
+#define MAX_BASELINE  64
+#define REFERENCE     "host_reference"
+
+volatile uint32_t bench_sink;
+
+typedef struct {
+    char   name[40];
+    double median;
+    double fastest;
+} baseline_t;
+
+static baseline_t baseline[MAX_BASELINE];
+static int        baseline_count;
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return ((x > y) - (x < y));
+}
+
+static double
+median(double *values, int count)
+{
+    qsort(values, count, sizeof (*values), cmp_double);
+    if (count & 1)
+        return (values[count / 2]);
+    return ((values[count / 2 - 1] + values[count / 2]) / 2);
+}
+
+static int
+baseline_load(const char *filename)
+{
+    FILE *fp = fopen(filename, "r");
+    char  line[128];
+
+    if (fp == NULL) {
+        perror(filename);
+        return (1);
+    }
+    while ((fgets(line, sizeof (line), fp) != NULL) &&
+           (baseline_count < MAX_BASELINE)) {
+        baseline_t *b = &baseline[baseline_count];
+        if ((line[0] == '#') ||
+            (sscanf(line, "%39s %lf %lf", b->name, &b->median,
+                    &b->fastest) != 3))
+            continue;
+        baseline_count++;
+    }
+    fclose(fp);
+    return (0);
+}
+
+static const baseline_t *
+baseline_find(const char *name)
+{
+    int i;
+
+    for (i = 0; i < baseline_count; i++)
+        if (strcmp(baseline[i].name, name) == 0)
+            return (&baseline[i]);
+    return (NULL);
+}
+
+/* Reference loop: integer work with no memory traffic or branches */
+static void
+bench_reference(uint32_t iters)
+{
+    uint32_t x = bench_sink | 1;
+    uint     i;
+
+    while (iters-- > 0) {
+        for (i = 0; i < 16; i++) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+        }
+    }
+    bench_sink = x;
+}
+
+static void
+bench_reference_setup(void)
+{
+}
+
+static const bench_case_t reference_case = {
+    REFERENCE, "fixed integer loop for host speed scaling",
+    bench_reference_setup, bench_reference
+};
+
+/* Double the iteration count until one sample takes at least min_ns */
+static uint32_t
+calibrate(const bench_case_t *bc, uint64_t min_ns)
+{
+    uint32_t iters = 1;
+    uint64_t start;
+    uint64_t elapsed;
+
+    for (;;) {
+        start = now_ns();
+        bc->run(iters);
+        elapsed = now_ns() - start;
+        if ((elapsed >= min_ns) || (iters >= (1U << 30)))
+            return (iters);
+        if (elapsed < min_ns / 64)
+            iters *= 16;
+        else
+            iters *= 2;
+    }
+}
+
+/* Sample statistics of one case, in ns per operation */
+typedef struct {
+    double   median;
+    double   fastest;
+    double   mad;
+    uint64_t ops;
+    uint64_t allocs;  // AllocMem() calls during the samples
+    uint64_t frees;   // FreeMem() calls during the samples
+    uint64_t pool;    // Driver pool allocations during the samples
+    uint64_t io;      // DoIO() requests during the samples
+} result_t;
+
+static void
+measure(const bench_case_t *bc, int samples, uint64_t min_ns, result_t *res)
+{
+    double          ns[MAX_SAMPLES];
+    double          dev[MAX_SAMPLES];
+    shim_counters_t before;
+    shim_counters_t after;
+    uint32_t        iters;
+    uint64_t        start;
+    int             i;
+
+    bc->setup();
+    iters = calibrate(bc, min_ns);
+
+    res->ops = 0;
+    shim_get_counters(&before);
+    for (i = 0; i < samples; i++) {
+        start = now_ns();
+        bc->run(iters);
+        ns[i] = (double) (now_ns() - start) / iters;
+        res->ops += iters;
+    }
+    shim_get_counters(&after);
+    res->allocs = after.sc_allocmem - before.sc_allocmem;
+    res->frees = after.sc_freemem - before.sc_freemem;
+    res->pool = after.sc_pool - before.sc_pool;
+    res->io = after.sc_doio - before.sc_doio;
+    res->median = median(ns, samples);
+    res->fastest = ns[0];
+    for (i = 0; i < samples; i++)
+        dev[i] = (ns[i] > res->median) ? ns[i] - res->median :
+                                         res->median - ns[i];
+    res->mad = median(dev, samples);
+}
+
+/*
+ * run_case
+ * --------
+ * Time one case and print its line. The baseline is multiplied by scale
+ * before comparing. Returns 1 if the case regressed.
+ */
+static int
+run_case(const bench_case_t *bc, int samples, uint64_t min_ns, double tol,
+         double scale, FILE *out)
+{
+    result_t          res;
+    const baseline_t *base;
+    int               regressed = 0;
+
+    measure(bc, samples, min_ns, &res);
+    printf("%-24s %10.1f %10.1f %6.1f%% %8.2f %8.2f %6.2f",
+           bc->name, res.median, res.fastest, 100 * res.mad / res.median,
+           (double) res.allocs / res.ops, (double) res.pool / res.ops,
+           (double) res.io / res.ops);
+    if (res.allocs != res.frees)
+        printf("  LEAK");
+
+    base = baseline_find(bc->name);
+    if (base != NULL) {
+        double bmed = base->median * scale;
+        double delta = 100 * (res.median - bmed) / bmed;
+        if ((res.median > bmed * (1 + tol)) &&
+            (res.fastest > base->fastest * scale * (1 + tol)) &&
+            (res.median - bmed > 3 * res.mad)) {
+            printf("  %+6.1f%% REGRESSED", delta);
+            regressed = 1;
+        } else {
+            printf("  %+6.1f%%", delta);
+        }
+    }
+    printf("\n");
+
+    if (out != NULL)
+        fprintf(out, "%s %.2f %.2f\n", bc->name, res.median, res.fastest);
+    return (regressed);
+}
+
+static void
+print_usage(const char *name)
+{
+    printf("Usage: %s [options] [case ...]\n", name);
+    printf("\n"
+           "   -s | --samples <n>      samples per case (11)\n"
+           "   -m | --min-time <ms>    minimum time per sample (10)\n"
+           "   -b | --baseline <file>  compare against a baseline\n"
+           "   -w | --write <file>     write the results as a baseline\n"
+           "   -t | --tolerance <%%>    allowed slowdown against baseline (20)\n"
+           "   -l | --list             list the cases\n"
+           "   -v | --version          print the version\n"
+           "   -h | --help             print this help\n\n"
+           "Cases are selected by name prefix; all run by default.\n");
+}
+
+static const bench_case_t * const bench_tables[] = {
+    bench_scsipi_cases,
+    bench_mounter_cases,
+    bench_port_cases,
+};
+#define BENCH_TABLES (sizeof (bench_tables) / sizeof (bench_tables[0]))
+
+static int
+selected(const char *name, int argc, char *argv[])
+{
+    int i;
+
+    if (argc == 0)
+        return (1);
+    for (i = 0; i < argc; i++)
+        if (strncmp(name, argv[i], strlen(argv[i])) == 0)
+            return (1);
+    return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const bench_case_t *bc;
+    const baseline_t   *base;
+    const char         *write_file = NULL;
+    result_t            ref;
+    double              scale = 1.0;
+    FILE               *out = NULL;
+    uint64_t            min_ns = 10000000;
+    double              tol = 0.20;
+    int                 samples = 11;
+    int                 list = 0;
+    int                 regressed = 0;
+    uint                t;
+    int                 opt;
+    static const struct option long_options[] = {
+        {"samples", 1, NULL, 's'},
+        {"min-time", 1, NULL, 'm'},
+        {"baseline", 1, NULL, 'b'},
+        {"write", 1, NULL, 'w'},
+        {"tolerance", 1, NULL, 't'},
+        {"list", 0, NULL, 'l'},
+        {"version", 0, NULL, 'v'},
+        {"help", 0, NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "s:m:b:w:t:lvh?",
+                              long_options, NULL)) != EOF) {
+        switch (opt) {
+            case 's':
+                samples = atoi(optarg);
+                if ((samples < 3) || (samples > MAX_SAMPLES)) {
+                    printf("Samples must be 3 to %d\n", MAX_SAMPLES);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'm':
+                min_ns = strtoull(optarg, NULL, 0) * 1000000;
+                break;
+            case 'b':
+                if (baseline_load(optarg))
+                    exit(EXIT_FAILURE);
+                break;
+            case 'w':
+                write_file = optarg;
+                break;
+            case 't':
+                tol = strtod(optarg, NULL) / 100;
+                break;
+            case 'l':
+                list = 1;
+                break;
+            case 'v':
+                printf("hostbench %s\n", HOSTBENCH_VERSION);
+                exit(EXIT_SUCCESS);
+            case 'h':
+            case '?':
+            default:
+                print_usage(argv[0]);
+                exit(EXIT_SUCCESS);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (list) {
+        for (t = 0; t < BENCH_TABLES; t++)
+            for (bc = bench_tables[t]; bc->name != NULL; bc++)
+                printf("%-24s %s\n", bc->name, bc->desc);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (write_file != NULL) {
+        out = fopen(write_file, "w");
+        if (out == NULL) {
+            perror(write_file);
+            exit(EXIT_FAILURE);
+        }
+        fprintf(out, "# hostbench %s baseline: case median_ns fastest_ns\n",
+                HOSTBENCH_VERSION);
+    }
+
+    measure(&reference_case, samples, min_ns, &ref);
+    base = baseline_find(REFERENCE);
+    if (base != NULL) {
+        scale = ref.median / base->median;
+        printf("Host reference %.1f ns, baseline %.1f ns: scaling by %.3f\n\n",
+               ref.median, base->median, scale);
+    }
+    if (out != NULL)
+        fprintf(out, "%s %.2f %.2f\n", REFERENCE, ref.median, ref.fastest);
+
+    printf("%-24s %10s %10s %7s %8s %8s %6s\n",
+           "case", "ns/op", "min", "MAD", "allocs", "pool", "io");
+    for (t = 0; t < BENCH_TABLES; t++)
+        for (bc = bench_tables[t]; bc->name != NULL; bc++)
+            if (selected(bc->name, argc, argv))
+                regressed |= run_case(bc, samples, min_ns, tol, scale, out);
+
+    if (out != NULL)
+        fclose(out);
+    if (regressed) {
+        printf("\nRegression against baseline (tolerance %.0f%%)\n",
+               tol * 100);
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,44 @@
+#ifndef _HOSTBENCH_H
+#define _HOSTBENCH_H
+
+/*
+ * Host microbenchmarks, see hostbench.c
+ *
+ * Each benchmark case prepares its state in setup() and then performs
+ * the operation under test iters times in run(). Anything run() allocates
+ * per operation should also be freed per operation, so that the
+ * allocation counts reported are per operation.
+ */
+typedef struct {
+    const char *name;
+    const char *desc;
+    void      (*setup)(void);
+    void      (*run)(uint32_t iters);
+} bench_case_t;
+
+extern const bench_case_t bench_scsipi_cases[];
+extern const bench_case_t bench_mounter_cases[];
+extern const bench_case_t bench_port_cases[];
+
+/* Allocation counters kept by shim.c */
+typedef struct {
+    uint64_t sc_allocmem;   // AllocMem() / AllocVec() calls
+    uint64_t sc_freemem;    // FreeMem() / FreeVec() calls
+    uint64_t sc_pool;       // Driver mempool_alloc() calls
+    uint64_t sc_doio;       // DoIO() / SendIO() requests
+} shim_counters_t;
+
+void shim_init(void);
+void shim_get_counters(shim_counters_t *counters);
+
+/* Services DoIO() for the benchmarks; returns io_Error */
+struct IORequest;
+extern BYTE (*shim_doio_hook)(struct IORequest *ior);
+
+/* Completions reported by the driver through cmd_complete() */
+extern uint64_t shim_completions;
+
+/* Keep the compiler from discarding a result */
+extern volatile uint32_t bench_sink;
+
+#endif /* _HOSTBENCH_H */
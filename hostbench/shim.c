@@ -0,0 +1,532 @@
+/*
+ * Exec emulation for the host microbenchmarks, see shim.h
+ *
+ * Memory comes from the host heap and every allocation is counted. Lists
+ * behave as under Exec. Tasking, signals and interrupts are reduced to
+ * no-ops, as the benchmarked code runs single threaded. I/O is only
+ * supported through shim_doio_hook, which the mounter benchmarks use to
+ * serve disk blocks from memory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "port.h"
+#include "attach.h"
+#include "mempool.h"
+#include "cmdhandler.h"
+#include "hostbench.h"
+#include "shim.h"
+
+/* Host memory allocations are prefixed with their size for FreeVec() */
+#define SHIM_VEC_HDR 16
+
+static struct ExecBase  shim_execbase;
+static struct Task      shim_task;
+static uint64_t         shim_allocmem;
+static uint64_t         shim_freemem;
+static uint64_t         shim_doio;
+
+struct ExecBase      *SysBase = &shim_execbase;
+struct ExpansionBase *ExpansionBase = NULL;
+struct DosLibrary    *DOSBase = NULL;
+a4091_save_t         *asave = NULL;
+char                  real_device_name[17] = "a4091.device";
+uint64_t              shim_completions;
+BYTE                (*shim_doio_hook)(struct IORequest *ior) = NULL;
+
+void
+shim_get_counters(shim_counters_t *counters)
+{
+    a4091_mem_stats_t ms;
+
+    mempool_get_stats(&ms);
+    counters->sc_allocmem = shim_allocmem;
+    counters->sc_freemem  = shim_freemem;
+    counters->sc_pool     = ms.ms_allocs;
+    counters->sc_doio     = shim_doio;
+}
+
+void
+shim_init(void)
+{
+    static int done;
+
+    if (done)
+        return;
+    done = 1;
+    shim_execbase.LibNode.lib_Version = 40;
+    shim_execbase.AttnFlags = AFF_68010 | AFF_68020 | AFF_68030 | AFF_68040;
+    shim_execbase.ThisTask = &shim_task;
+    NewList(&shim_execbase.ResourceList);
+    NewList(&shim_execbase.DeviceList);
+    NewList(&shim_execbase.LibList);
+    mempool_init();
+}
+
+APTR
+(AllocMem)(ULONG size, ULONG flags)
+{
+    void *ptr = (flags & MEMF_CLEAR) ? calloc(1, size) : malloc(size);
+
+    if (ptr != NULL)
+        shim_allocmem++;
+    return (ptr);
+}
+
+void
+(FreeMem)(APTR ptr, ULONG size)
+{
+    (void) size;
+    if (ptr != NULL)
+        shim_freemem++;
+    free(ptr);
+}
+
+APTR
+(AllocVec)(ULONG size, ULONG flags)
+{
+    uint8_t *ptr = AllocMem(size + SHIM_VEC_HDR, flags);
+
+    if (ptr == NULL)
+        return (NULL);
+    *(ULONG *) ptr = size + SHIM_VEC_HDR;
+    return (ptr + SHIM_VEC_HDR);
+}
+
+void
+(FreeVec)(APTR ptr)
+{
+    uint8_t *base;
+
+    if (ptr == NULL)
+        return;
+    base = (uint8_t *) ptr - SHIM_VEC_HDR;
+    FreeMem(base, *(ULONG *) base);
+}
+
+APTR
+(CreatePool)(ULONG flags, ULONG puddle, ULONG thresh)
+{
+    static int pool;
+
+    (void) flags;
+    (void) puddle;
+    (void) thresh;
+    return (&pool);
+}
+
+void
+(DeletePool)(APTR pool)
+{
+    (void) pool;
+}
+
+APTR
+(AllocPooled)(APTR pool, ULONG size)
+{
+    (void) pool;
+    return (AllocMem(size, MEMF_CLEAR));
+}
+
+void
+(FreePooled)(APTR pool, APTR ptr, ULONG size)
+{
+    (void) pool;
+    FreeMem(ptr, size);
+}
+
+void
+(CopyMem)(const void *src, void *dst, ULONG size)
+{
+    memmove(dst, src, size);
+}
+
+void
+(CopyMemQuick)(const void *src, void *dst, ULONG size)
+{
+    memmove(dst, src, size);
+}
+
+void (Forbid)(void) { }
+void (Permit)(void) { }
+void (Disable)(void) { }
+void (Enable)(void) { }
+void (Cause)(struct Interrupt *irq) { (void) irq; }
+void (CacheClearU)(void) { }
+void (Alert)(ULONG num) { (void) num; abort(); }
+void (SumKickData)(void) { }
+void (AddIntServer)(LONG num, struct Interrupt *irq) { (void) num; (void) irq; }
+void (RemIntServer)(LONG num, struct Interrupt *irq) { (void) num; (void) irq; }
+void KPutChar(LONG ch) { (void) ch; }
+
+void
+(CacheClearE)(APTR addr, ULONG len, ULONG flags)
+{
+    (void) addr;
+    (void) len;
+    (void) flags;
+}
+
+APTR
+(CachePreDMA)(APTR addr, ULONG *len, ULONG flags)
+{
+    (void) len;
+    (void) flags;
+    return (addr);
+}
+
+void
+(CachePostDMA)(APTR addr, ULONG *len, ULONG flags)
+{
+    (void) addr;
+    (void) len;
+    (void) flags;
+}
+
+struct Task *
+(FindTask)(CONST_STRPTR name)
+{
+    (void) name;
+    return (&shim_task);
+}
+
+void
+(Signal)(struct Task *task, ULONG mask)
+{
+    task->tc_SigRecvd |= mask;
+}
+
+ULONG
+(SetSignal)(ULONG newsig, ULONG mask)
+{
+    ULONG old = shim_task.tc_SigRecvd;
+
+    shim_task.tc_SigRecvd = (old & ~mask) | (newsig & mask);
+    return (old);
+}
+
+ULONG
+(Wait)(ULONG mask)
+{
+    ULONG got = shim_task.tc_SigRecvd & mask;
+
+    shim_task.tc_SigRecvd &= ~mask;
+    return (got);
+}
+
+BYTE
+(AllocSignal)(LONG num)
+{
+    return ((num < 0) ? 16 : num);
+}
+
+void
+(FreeSignal)(LONG num)
+{
+    (void) num;
+}
+
+void
+(NewList)(struct List *list)
+{
+    list->lh_Head     = (struct Node *) &list->lh_Tail;
+    list->lh_Tail     = NULL;
+    list->lh_TailPred = (struct Node *) &list->lh_Head;
+}
+
+void
+(AddHead)(struct List *list, struct Node *node)
+{
+    node->ln_Succ = list->lh_Head;
+    node->ln_Pred = (struct Node *) &list->lh_Head;
+    list->lh_Head->ln_Pred = node;
+    list->lh_Head = node;
+}
+
+void
+(AddTail)(struct List *list, struct Node *node)
+{
+    node->ln_Succ = (struct Node *) &list->lh_Tail;
+    node->ln_Pred = list->lh_TailPred;
+    list->lh_TailPred->ln_Succ = node;
+    list->lh_TailPred = node;
+}
+
+void
+(Remove)(struct Node *node)
+{
+    node->ln_Pred->ln_Succ = node->ln_Succ;
+    node->ln_Succ->ln_Pred = node->ln_Pred;
+}
+
+void
+(Enqueue)(struct List *list, struct Node *node)
+{
+    struct Node *next;
+
+    for (next = list->lh_Head; next->ln_Succ != NULL; next = next->ln_Succ)
+        if (next->ln_Pri < node->ln_Pri)
+            break;
+    node->ln_Succ = next;
+    node->ln_Pred = next->ln_Pred;
+    next->ln_Pred->ln_Succ = node;
+    next->ln_Pred = node;
+}
+
+struct Node *
+(FindName)(struct List *list, CONST_STRPTR name)
+{
+    struct Node *node;
+
+    for (node = list->lh_Head; node->ln_Succ != NULL; node = node->ln_Succ)
+        if ((node->ln_Name != NULL) && (strcmp(node->ln_Name, name) == 0))
+            return (node);
+    return (NULL);
+}
+
+void
+(PutMsg)(struct MsgPort *port, struct Message *msg)
+{
+    AddTail(&port->mp_MsgList, &msg->mn_Node);
+}
+
+struct Message *
+(GetMsg)(struct MsgPort *port)
+{
+    struct Node *node = port->mp_MsgList.lh_Head;
+
+    if (node->ln_Succ == NULL)
+        return (NULL);
+    Remove(node);
+    return ((struct Message *) node);
+}
+
+struct Message *
+(WaitPort)(struct MsgPort *port)
+{
+    return ((struct Message *) port->mp_MsgList.lh_Head);
+}
+
+void
+(ReplyMsg)(struct Message *msg)
+{
+    msg->mn_Node.ln_Type = NT_REPLYMSG;
+    if (msg->mn_ReplyPort != NULL)
+        PutMsg(msg->mn_ReplyPort, msg);
+}
+
+struct MsgPort *
+CreatePort(CONST_STRPTR name, LONG pri)
+{
+    struct MsgPort *port = AllocMem(sizeof (*port), MEMF_CLEAR);
+
+    if (port != NULL) {
+        port->mp_Node.ln_Name = (char *) name;
+        port->mp_Node.ln_Pri  = pri;
+        port->mp_SigTask = &shim_task;
+        NewList(&port->mp_MsgList);
+    }
+    return (port);
+}
+
+void
+DeletePort(struct MsgPort *port)
+{
+    FreeMem(port, sizeof (*port));
+}
+
+struct IORequest *
+CreateExtIO(struct MsgPort *port, LONG size)
+{
+    struct IORequest *ior = AllocMem(size, MEMF_CLEAR);
+
+    if (ior != NULL)
+        ior->io_Message.mn_ReplyPort = port;
+    return (ior);
+}
+
+void
+DeleteExtIO(struct IORequest *ior)
+{
+    FreeMem(ior, sizeof (*ior));
+}
+
+struct Task *
+CreateTask(CONST_STRPTR name, LONG pri, APTR code, ULONG stack)
+{
+    (void) name;
+    (void) pri;
+    (void) code;
+    (void) stack;
+    return (NULL);
+}
+
+BYTE
+(OpenDevice)(CONST_STRPTR name, ULONG unit, struct IORequest *ior, ULONG flags)
+{
+    (void) name;
+    (void) unit;
+    (void) flags;
+    ior->io_Error = IOERR_OPENFAIL;
+    return (IOERR_OPENFAIL);
+}
+
+void
+(CloseDevice)(struct IORequest *ior)
+{
+    (void) ior;
+}
+
+BYTE
+(DoIO)(struct IORequest *ior)
+{
+    shim_doio++;
+    ior->io_Error = (shim_doio_hook != NULL) ? shim_doio_hook(ior) :
+                                                IOERR_NOCMD;
+    return (ior->io_Error);
+}
+
+void
+(SendIO)(struct IORequest *ior)
+{
+    (void) DoIO(ior);
+}
+
+BYTE
+(WaitIO)(struct IORequest *ior)
+{
+    return (ior->io_Error);
+}
+
+LONG
+(CheckIO)(struct IORequest *ior)
+{
+    (void) ior;
+    return (1);
+}
+
+void
+(AbortIO)(struct IORequest *ior)
+{
+    (void) ior;
+}
+
+struct Library *
+(OpenLibrary)(CONST_STRPTR name, ULONG version)
+{
+    (void) name;
+    (void) version;
+    return (NULL);
+}
+
+void
+(CloseLibrary)(struct Library *lib)
+{
+    (void) lib;
+}
+
+APTR
+(OpenResource)(CONST_STRPTR name)
+{
+    return (FindName(&SysBase->ResourceList, name));
+}
+
+void
+(AddResource)(APTR resource)
+{
+    AddTail(&SysBase->ResourceList, resource);
+}
+
+void (InitSemaphore)(struct SignalSemaphore *sem) { (void) sem; }
+void (ObtainSemaphore)(struct SignalSemaphore *sem) { (void) sem; }
+void (ReleaseSemaphore)(struct SignalSemaphore *sem) { (void) sem; }
+
+ULONG
+ReadEClock(struct EClockVal *ev)
+{
+    ev->ev_hi = 0;
+    ev->ev_lo = 0;
+    return (0);
+}
+
+/*
+ * Mounted partitions are not kept: the DeviceNode is counted as an
+ * allocation by MakeDosNode() and freed again when it is added.
+ */
+struct DeviceNode *
+(MakeDosNode)(APTR parmpacket)
+{
+    (void) parmpacket;
+    return (AllocMem(sizeof (struct DeviceNode), MEMF_CLEAR));
+}
+
+BOOL
+(AddDosNode)(LONG bootpri, ULONG flags, struct DeviceNode *dn)
+{
+    (void) bootpri;
+    (void) flags;
+    FreeMem(dn, sizeof (*dn));
+    return (TRUE);
+}
+
+BOOL
+(AddBootNode)(LONG bootpri, ULONG flags, struct DeviceNode *dn,
+            struct ConfigDev *cd)
+{
+    (void) cd;
+    return (AddDosNode(bootpri, flags, dn));
+}
+
+struct ConfigDev *
+(FindConfigDev)(struct ConfigDev *old, LONG manu, LONG prod)
+{
+    (void) old;
+    (void) manu;
+    (void) prod;
+    return (NULL);
+}
+
+struct ConfigDev *
+(AllocConfigDev)(void)
+{
+    return (AllocMem(sizeof (struct ConfigDev), MEMF_CLEAR));
+}
+
+void
+(AddConfigDev)(struct ConfigDev *cd)
+{
+    (void) cd;
+}
+
+APTR
+(DeviceProc)(CONST_STRPTR name)
+{
+    (void) name;
+    return (NULL);
+}
+
+LONG
+EasyRequestArgs(struct Window *w, struct EasyStruct *es, ULONG *idcmp,
+                APTR args)
+{
+    (void) w;
+    (void) es;
+    (void) idcmp;
+    (void) args;
+    return (0);
+}
+
+/* Driver functions outside the benchmarked sources */
+void
+cmd_complete(void *ior, int8_t rc)
+{
+    (void) ior;
+    (void) rc;
+    shim_completions++;
+}
+
+int
+irq_and_timer_handler(void)
+{
+    return (1);
+}
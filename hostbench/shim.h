@@ -0,0 +1,794 @@
+/*
+ * Host shim for building driver sources on Linux, see hostbench.c
+ *
+ * Every AmigaOS include used by the benchmarked sources (exec/types.h,
+ * devices/scsidisk.h, proto/exec.h, ...) is generated by the Makefile as a
+ * one-line file which includes this header. Only the types, constants and
+ * functions the benchmarked code uses are provided. Integer types have the
+ * same sizes as on the Amiga so on-disk structures such as the RDB keep
+ * their layout; pointers are host sized.
+ *
+ * The Exec functions are emulated in shim.c, which also counts memory
+ * allocations for the benchmark.
+ */
+#ifndef _HOSTBENCH_SHIM_H
+#define _HOSTBENCH_SHIM_H
+
+/*
+ * Pull in the host headers first, so that struct timeval below can be
+ * renamed without clashing with the host's own definition.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#undef ERESTART  /* scsipi_base.c has its own */
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/param.h>
+
+#define INCLUDE_VERSION  47
+#define TICKS_PER_SECOND 50
+#define NBPG             4096
+#define __packed         __attribute__((packed))
+#define timeval          shim_timeval
+#define __predict_false(x) __builtin_expect((x) != 0, 0)
+#define __predict_true(x)  __builtin_expect((x) != 0, 1)
+
+/* exec/types.h */
+typedef void           *APTR;
+typedef int32_t         LONG;
+typedef uint32_t        ULONG;
+typedef int16_t         WORD;
+typedef uint16_t        UWORD;
+typedef int8_t          BYTE;
+typedef uint8_t         UBYTE;
+typedef int16_t         BOOL;
+typedef uint16_t        USHORT;
+typedef int16_t         SHORT;
+typedef char           *STRPTR;
+typedef const char     *CONST_STRPTR;
+typedef LONG            BPTR;
+typedef LONG            BSTR;
+typedef ULONG           IPTR;
+#ifndef TRUE
+#define TRUE  1
+#define FALSE 0
+#endif
+#ifndef NULL
+#define NULL ((void *) 0)
+#endif
+#define __saveds
+#define __stdargs
+#define __asm(x)
+
+/* exec/nodes.h, exec/lists.h */
+struct Node {
+    struct Node *ln_Succ;
+    struct Node *ln_Pred;
+    UBYTE        ln_Type;
+    BYTE         ln_Pri;
+    char        *ln_Name;
+};
+struct MinNode {
+    struct MinNode *mln_Succ;
+    struct MinNode *mln_Pred;
+};
+struct List {
+    struct Node *lh_Head;
+    struct Node *lh_Tail;
+    struct Node *lh_TailPred;
+    UBYTE        lh_Type;
+    UBYTE        l_pad;
+};
+struct MinList {
+    struct MinNode *mlh_Head;
+    struct MinNode *mlh_Tail;
+    struct MinNode *mlh_TailPred;
+};
+#define NT_UNKNOWN   0
+#define NT_TASK      1
+#define NT_DEVICE    3
+#define NT_MSGPORT   4
+#define NT_MESSAGE   5
+#define NT_REPLYMSG  7
+#define NT_RESOURCE  8
+#define NT_BOOTNODE  16
+#define IsListEmpty(x) (((x)->lh_TailPred) == (struct Node *) (x))
+
+/* exec/libraries.h, exec/tasks.h, exec/ports.h, exec/semaphores.h */
+struct Library {
+    struct Node lib_Node;
+    UBYTE       lib_Flags;
+    UBYTE       lib_pad;
+    UWORD       lib_NegSize;
+    UWORD       lib_PosSize;
+    UWORD       lib_Version;
+    UWORD       lib_Revision;
+    APTR        lib_IdString;
+    ULONG       lib_Sum;
+    UWORD       lib_OpenCnt;
+};
+struct Device {
+    struct Library dd_Library;
+};
+struct Unit {
+    struct Node  unit_MsgPort;
+};
+struct Task {
+    struct Node tc_Node;
+    ULONG       tc_SigAlloc;
+    ULONG       tc_SigWait;
+    ULONG       tc_SigRecvd;
+    APTR        tc_UserData;
+};
+struct MsgPort {
+    struct Node  mp_Node;
+    UBYTE        mp_Flags;
+    UBYTE        mp_SigBit;
+    void        *mp_SigTask;
+    struct List  mp_MsgList;
+};
+#define PA_SIGNAL  0
+#define PA_SOFTINT 1
+#define PA_IGNORE  2
+struct Message {
+    struct Node     mn_Node;
+    struct MsgPort *mn_ReplyPort;
+    UWORD           mn_Length;
+};
+struct Interrupt {
+    struct Node is_Node;
+    APTR        is_Data;
+    void      (*is_Code)(void);
+};
+struct SignalSemaphore {
+    struct Node ss_Link;
+    WORD        ss_NestCount;
+};
+#define SIGB_SINGLE 4
+#define SIGF_SINGLE (1 << SIGB_SINGLE)
+struct ExecBase {
+    struct Library LibNode;
+    UWORD          AttnFlags;
+    UBYTE          VBlankFrequency;
+    UBYTE          PowerSupplyFrequency;
+    struct List    ResourceList;
+    struct List    DeviceList;
+    struct List    LibList;
+    struct Task   *ThisTask;
+    ULONG          ex_EClockFrequency;
+};
+#define AFF_68010 (1 << 0)
+#define AFF_68020 (1 << 1)
+#define AFF_68030 (1 << 2)
+#define AFF_68040 (1 << 3)
+#define AFF_68060 (1 << 7)
+
+/* exec/memory.h */
+#define MEMF_ANY     0
+#define MEMF_PUBLIC  (1 << 0)
+#define MEMF_CHIP    (1 << 1)
+#define MEMF_FAST    (1 << 2)
+#define MEMF_24BITDMA (1 << 9)
+#define MEMF_KICK    (1 << 10)
+#define MEMF_CLEAR   (1 << 16)
+#define MEMF_REVERSE (1 << 18)
+
+/* exec/io.h, exec/errors.h */
+struct IORequest {
+    struct Message  io_Message;
+    struct Device  *io_Device;
+    struct Unit    *io_Unit;
+    UWORD           io_Command;
+    UBYTE           io_Flags;
+    BYTE            io_Error;
+};
+struct IOStdReq {
+    struct Message  io_Message;
+    struct Device  *io_Device;
+    struct Unit    *io_Unit;
+    UWORD           io_Command;
+    UBYTE           io_Flags;
+    BYTE            io_Error;
+    ULONG           io_Actual;
+    ULONG           io_Length;
+    APTR            io_Data;
+    ULONG           io_Offset;
+};
+#define IOF_QUICK          (1 << 0)
+#define CMD_INVALID        0
+#define CMD_RESET          1
+#define CMD_READ           2
+#define CMD_WRITE          3
+#define CMD_UPDATE         4
+#define CMD_CLEAR          5
+#define CMD_STOP           6
+#define CMD_START          7
+#define CMD_FLUSH          8
+#define CMD_NONSTD         9
+#define IOERR_OPENFAIL     (-1)
+#define IOERR_ABORTED      (-2)
+#define IOERR_NOCMD        (-3)
+#define IOERR_BADLENGTH    (-4)
+#define IOERR_BADADDRESS   (-5)
+#define IOERR_UNITBUSY     (-6)
+#define IOERR_SELFTEST     (-7)
+
+/* exec/alerts.h */
+#define AT_DeadEnd         0x80000000
+#define AG_NoMemory        0x00010000
+#define AO_Unknown         0x00008035
+
+/* exec/execbase.h cache flags */
+#define CACRF_ClearI       (1 << 3)
+#define CACRF_ClearD       (1 << 11)
+#define DMA_Continue       (1 << 1)
+#define DMA_NoModify       (1 << 2)
+#define DMA_ReadFromRAM    (1 << 3)
+
+/* exec/resident.h */
+struct Resident {
+    UWORD rt_MatchWord;
+    struct Resident *rt_MatchTag;
+    APTR  rt_EndSkip;
+    UBYTE rt_Flags;
+    UBYTE rt_Version;
+    UBYTE rt_Type;
+    BYTE  rt_Pri;
+    char *rt_Name;
+    char *rt_IdString;
+    APTR  rt_Init;
+};
+
+/* devices/trackdisk.h */
+struct IOExtTD {
+    struct IOStdReq iotd_Req;
+    ULONG           iotd_Count;
+    ULONG           iotd_SecLabel;
+};
+#define TD_SECTOR 512
+#define TD_SECSHIFT 9
+struct DriveGeometry {
+    ULONG dg_SectorSize;
+    ULONG dg_TotalSectors;
+    ULONG dg_Cylinders;
+    ULONG dg_CylSectors;
+    ULONG dg_Heads;
+    ULONG dg_TrackSectors;
+    ULONG dg_BufMemType;
+    UBYTE dg_DeviceType;
+    UBYTE dg_Flags;
+    UWORD dg_Reserved;
+};
+#define TD_MOTOR         (CMD_NONSTD + 0)
+#define TD_SEEK          (CMD_NONSTD + 1)
+#define TD_FORMAT        (CMD_NONSTD + 2)
+#define TD_REMOVE        (CMD_NONSTD + 3)
+#define TD_CHANGENUM     (CMD_NONSTD + 4)
+#define TD_CHANGESTATE   (CMD_NONSTD + 5)
+#define TD_PROTSTATUS    (CMD_NONSTD + 6)
+#define TD_RAWREAD       (CMD_NONSTD + 7)
+#define TD_RAWWRITE      (CMD_NONSTD + 8)
+#define TD_GETDRIVETYPE  (CMD_NONSTD + 9)
+#define TD_GETNUMTRACKS  (CMD_NONSTD + 10)
+#define TD_ADDCHANGEINT  (CMD_NONSTD + 11)
+#define TD_REMCHANGEINT  (CMD_NONSTD + 12)
+#define TD_GETGEOMETRY   (CMD_NONSTD + 13)
+#define TD_EJECT         (CMD_NONSTD + 14)
+#define TD_LASTCOMM      (CMD_NONSTD + 15)
+#define TD_READ64        24
+#define TD_WRITE64       25
+#define TD_SEEK64        26
+#define TD_FORMAT64      27
+#define TDF_EXTCOM       (1 << 15)
+#define ETD_WRITE        (CMD_WRITE | TDF_EXTCOM)
+#define ETD_READ         (CMD_READ | TDF_EXTCOM)
+#define ETD_MOTOR        (TD_MOTOR | TDF_EXTCOM)
+#define ETD_SEEK         (TD_SEEK | TDF_EXTCOM)
+#define ETD_FORMAT       (TD_FORMAT | TDF_EXTCOM)
+#define ETD_UPDATE       (CMD_UPDATE | TDF_EXTCOM)
+#define ETD_CLEAR        (CMD_CLEAR | TDF_EXTCOM)
+#define ETD_RAWREAD      (TD_RAWREAD | TDF_EXTCOM)
+#define ETD_RAWWRITE     (TD_RAWWRITE | TDF_EXTCOM)
+#define DG_DIRECT_ACCESS     0
+#define DG_SEQUENTIAL_ACCESS 1
+#define DG_PRINTER           2
+#define DG_PROCESSOR         3
+#define DG_WORM              4
+#define DG_CDROM             5
+#define DG_SCANNER           6
+#define DG_OPTICAL_DISK      7
+#define DG_MEDIUM_CHANGER    8
+#define DG_COMMUNICATION     9
+#define DG_UNKNOWN           31
+#define DGF_REMOVABLE        1
+#define TDERR_NotSpecified   20
+#define TDERR_NoSecHdr       21
+#define TDERR_BadSecPreamble 22
+#define TDERR_BadSecID       23
+#define TDERR_BadHdrSum      24
+#define TDERR_BadSecSum      25
+#define TDERR_TooFewSecs     26
+#define TDERR_BadSecHdr      27
+#define TDERR_WriteProt      28
+#define TDERR_DiskChanged    29
+#define TDERR_SeekError      30
+#define TDERR_NoMem          31
+#define TDERR_BadUnitNum     32
+#define TDERR_BadDriveType   33
+#define TDERR_DriveInUse     34
+#define TDERR_PostReset      35
+
+/* devices/scsidisk.h */
+#define HD_SCSICMD 28
+struct SCSICmd {
+    UWORD *scsi_Data;
+    ULONG  scsi_Length;
+    ULONG  scsi_Actual;
+    UBYTE *scsi_Command;
+    UWORD  scsi_CmdLength;
+    UWORD  scsi_CmdActual;
+    UBYTE  scsi_Flags;
+    UBYTE  scsi_Status;
+    UBYTE *scsi_SenseData;
+    UWORD  scsi_SenseLength;
+    UWORD  scsi_SenseActual;
+};
+#define SCSIF_WRITE          0
+#define SCSIF_READ           1
+#define SCSIF_NOSENSE        0
+#define SCSIF_AUTOSENSE      2
+#define SCSIF_OLDAUTOSENSE   6
+#define HFERR_SelfUnit       40
+#define HFERR_DMA            41
+#define HFERR_Phase          42
+#define HFERR_Parity         43
+#define HFERR_SelTimeout     44
+#define HFERR_BadStatus      45
+#define HFERR_NoBoard        50
+
+/* devices/timer.h */
+#define TIMERNAME "timer.device"
+struct timeval {
+    ULONG tv_secs;
+    ULONG tv_micro;
+};
+struct timerequest {
+    struct IORequest tr_node;
+    struct timeval   tr_time;
+};
+struct EClockVal {
+    ULONG ev_hi;
+    ULONG ev_lo;
+};
+#define UNIT_MICROHZ    0
+#define UNIT_VBLANK     1
+#define UNIT_ECLOCK     2
+#define TR_ADDREQUEST   (CMD_NONSTD + 0)
+#define TR_GETSYSTIME   (CMD_NONSTD + 1)
+#define TR_SETSYSTIME   (CMD_NONSTD + 2)
+
+/* devices/hardblocks.h */
+struct RigidDiskBlock {
+    ULONG rdb_ID;
+    ULONG rdb_SummedLongs;
+    LONG  rdb_ChkSum;
+    ULONG rdb_HostID;
+    ULONG rdb_BlockBytes;
+    ULONG rdb_Flags;
+    ULONG rdb_BadBlockList;
+    ULONG rdb_PartitionList;
+    ULONG rdb_FileSysHeaderList;
+    ULONG rdb_DriveInit;
+    ULONG rdb_Reserved1[6];
+    ULONG rdb_Cylinders;
+    ULONG rdb_Sectors;
+    ULONG rdb_Heads;
+    ULONG rdb_Interleave;
+    ULONG rdb_Park;
+    ULONG rdb_Reserved2[3];
+    ULONG rdb_WritePreComp;
+    ULONG rdb_ReducedWrite;
+    ULONG rdb_StepRate;
+    ULONG rdb_Reserved3[5];
+    ULONG rdb_RDBBlocksLo;
+    ULONG rdb_RDBBlocksHi;
+    ULONG rdb_LoCylinder;
+    ULONG rdb_HiCylinder;
+    ULONG rdb_CylBlocks;
+    ULONG rdb_AutoParkSeconds;
+    ULONG rdb_HighRDSKBlock;
+    ULONG rdb_Reserved4;
+    char  rdb_DiskVendor[8];
+    char  rdb_DiskProduct[16];
+    char  rdb_DiskRevision[4];
+    char  rdb_ControllerVendor[8];
+    char  rdb_ControllerProduct[16];
+    char  rdb_ControllerRevision[4];
+    ULONG rdb_DriveInitName[10];
+};
+#define IDNAME_RIGIDDISK     0x5244534B  /* 'RDSK' */
+#define IDNAME_BADBLOCK      0x42414442  /* 'BADB' */
+#define IDNAME_PARTITION     0x50415254  /* 'PART' */
+#define IDNAME_FILESYSHEADER 0x46534844  /* 'FSHD' */
+#define IDNAME_LOADSEG       0x4C534547  /* 'LSEG' */
+#define RDB_LOCATION_LIMIT   16
+#define RDBFF_LAST           0x01
+#define RDBFF_LASTLUN        0x02
+#define RDBFF_LASTTID        0x04
+#define RDBFF_NORESELECT     0x08
+#define RDBFF_DISKID         0x10
+#define RDBFF_CTRLRID        0x20
+#define RDBFF_SYNCH          0x40
+struct PartitionBlock {
+    ULONG pb_ID;
+    ULONG pb_SummedLongs;
+    LONG  pb_ChkSum;
+    ULONG pb_HostID;
+    ULONG pb_Next;
+    ULONG pb_Flags;
+    ULONG pb_Reserved1[2];
+    ULONG pb_DevFlags;
+    UBYTE pb_DriveName[32];
+    ULONG pb_Reserved2[15];
+    ULONG pb_Environment[20];
+    ULONG pb_EReserved[12];
+};
+#define PBFF_BOOTABLE        0x01
+#define PBFF_NOMOUNT         0x02
+struct FileSysHeaderBlock {
+    ULONG fhb_ID;
+    ULONG fhb_SummedLongs;
+    LONG  fhb_ChkSum;
+    ULONG fhb_HostID;
+    ULONG fhb_Next;
+    ULONG fhb_Flags;
+    ULONG fhb_Reserved1[2];
+    ULONG fhb_DosType;
+    ULONG fhb_Version;
+    ULONG fhb_PatchFlags;
+    ULONG fhb_Type;
+    ULONG fhb_Task;
+    ULONG fhb_Lock;
+    ULONG fhb_Handler;
+    ULONG fhb_StackSize;
+    LONG  fhb_Priority;
+    LONG  fhb_Startup;
+    LONG  fhb_SegListBlocks;
+    LONG  fhb_GlobalVec;
+    ULONG fhb_Reserved2[23];
+    ULONG fhb_Reserved3[21];
+};
+struct LoadSegBlock {
+    ULONG lsb_ID;
+    ULONG lsb_SummedLongs;
+    LONG  lsb_ChkSum;
+    ULONG lsb_HostID;
+    ULONG lsb_Next;
+    ULONG lsb_LoadData[123];
+};
+
+/* dos/dos.h, dos/dosextens.h, dos/filehandler.h, dos/doshunks.h */
+#define ERROR_NO_FREE_STORE  103
+#define ERROR_OBJECT_NOT_FOUND 205
+#define ID_DOS_DISK          0x444F5300
+#define MKBADDR(x) ((BPTR) ((uintptr_t) (x) >> 2))
+#define BADDR(x)   ((APTR) ((uintptr_t) (x) << 2))
+struct DosLibrary {
+    struct Library dl_lib;
+};
+struct DosEnvec {
+    ULONG de_TableSize;
+    ULONG de_SizeBlock;
+    ULONG de_SecOrg;
+    ULONG de_Surfaces;
+    ULONG de_SectorPerBlock;
+    ULONG de_BlocksPerTrack;
+    ULONG de_Reserved;
+    ULONG de_PreAlloc;
+    ULONG de_Interleave;
+    ULONG de_LowCyl;
+    ULONG de_HighCyl;
+    ULONG de_NumBuffers;
+    ULONG de_BufMemType;
+    ULONG de_MaxTransfer;
+    ULONG de_Mask;
+    LONG  de_BootPri;
+    ULONG de_DosType;
+    ULONG de_Baud;
+    ULONG de_Control;
+    ULONG de_BootBlocks;
+};
+/*
+ * The task field is a longword here, so that the patch flags of a
+ * FileSysEntry index a DeviceNode longword by longword as on the Amiga.
+ */
+struct DeviceNode {
+    BPTR  dn_Next;
+    ULONG dn_Type;
+    ULONG dn_Task;
+    BPTR  dn_Lock;
+    BSTR  dn_Handler;
+    ULONG dn_StackSize;
+    LONG  dn_Priority;
+    BPTR  dn_Startup;
+    BPTR  dn_SegList;
+    BPTR  dn_GlobalVec;
+    BSTR  dn_Name;
+};
+#define HUNK_UNIT         999
+#define HUNK_NAME         1000
+#define HUNK_CODE         1001
+#define HUNK_DATA         1002
+#define HUNK_BSS          1003
+#define HUNK_RELOC32      1004
+#define HUNK_RELOC16      1005
+#define HUNK_RELOC8       1006
+#define HUNK_EXT          1007
+#define HUNK_SYMBOL       1008
+#define HUNK_DEBUG        1009
+#define HUNK_END          1010
+#define HUNK_HEADER       1011
+#define HUNK_OVERLAY      1013
+#define HUNK_BREAK        1014
+#define HUNK_DREL32       1015
+#define HUNK_DREL16       1016
+#define HUNK_DREL8        1017
+#define HUNK_LIB          1018
+#define HUNK_INDEX        1019
+#define HUNK_RELOC32SHORT 1020
+#define HUNKF_CHIP        (1 << 30)
+#define HUNKF_FAST        (1U << 31)
+
+/* resources/filesysres.h */
+#define FSRNAME "FileSystem.resource"
+struct FileSysResource {
+    struct Node     fsr_Node;
+    char           *fsr_Creator;
+    struct List     fsr_FileSysEntries;
+};
+/* Longword fields, so that fse_Type onwards may be patched as on the Amiga */
+struct FileSysEntry {
+    struct Node fse_Node;
+    ULONG       fse_DosType;
+    ULONG       fse_Version;
+    ULONG       fse_PatchFlags;
+    ULONG       fse_Type;
+    ULONG       fse_Task;
+    BPTR        fse_Lock;
+    BSTR        fse_Handler;
+    ULONG       fse_StackSize;
+    LONG        fse_Priority;
+    BPTR        fse_Startup;
+    BPTR        fse_SegList;
+    BPTR        fse_GlobalVec;
+};
+
+/* libraries/configvars.h, libraries/expansion*.h */
+struct ExpansionRom {
+    UBYTE er_Type;
+    UBYTE er_Product;
+    UBYTE er_Flags;
+    UBYTE er_Reserved03;
+    UWORD er_Manufacturer;
+    ULONG er_SerialNumber;
+    UWORD er_InitDiagVec;
+    UBYTE er_Reserved0c;
+    UBYTE er_Reserved0d;
+    UBYTE er_Reserved0e;
+    UBYTE er_Reserved0f;
+};
+struct ConfigDev {
+    struct Node         cd_Node;
+    UBYTE               cd_Flags;
+    UBYTE               cd_Pad;
+    struct ExpansionRom cd_Rom;
+    APTR                cd_BoardAddr;
+    ULONG               cd_BoardSize;
+    UWORD               cd_SlotAddr;
+    UWORD               cd_SlotSize;
+    APTR                cd_Driver;
+    struct ConfigDev   *cd_NextCD;
+    ULONG               cd_Unused[4];
+};
+#define CDB_SHUTUP   0
+#define CDB_CONFIGME 1
+#define CDF_SHUTUP   0x01
+#define CDF_CONFIGME 0x02
+struct DiagArea {
+    UBYTE da_Config;
+    UBYTE da_Flags;
+    UWORD da_Size;
+    UWORD da_DiagPoint;
+    UWORD da_BootPoint;
+    UWORD da_Name;
+    UWORD da_Reserved01;
+    UWORD da_Reserved02;
+};
+#define DAC_WORDWIDE  0x10
+#define DAC_CONFIGTIME 0x10
+struct BootNode {
+    struct Node bn_Node;
+    UWORD       bn_Flags;
+    APTR        bn_DeviceNode;
+};
+struct ExpansionBase {
+    struct Library LibNode;
+    UBYTE          Flags;
+    UBYTE          eb_Private01;
+    ULONG          eb_Private02;
+    ULONG          eb_Private03;
+    struct List    MountList;
+};
+#define ADNF_STARTPROC 1
+
+/* intuition/intuition.h */
+struct Window;
+struct EasyStruct {
+    ULONG        es_StructSize;
+    ULONG        es_Flags;
+    CONST_STRPTR es_Title;
+    CONST_STRPTR es_TextFormat;
+    CONST_STRPTR es_GadgetFormat;
+};
+
+/* Globals provided by shim.c */
+extern struct ExecBase      *SysBase;
+extern struct Device        *TimerBase;
+extern struct ExpansionBase *ExpansionBase;
+extern struct DosLibrary    *DOSBase;
+
+/* Exec, emulated by shim.c */
+APTR  AllocMem(ULONG size, ULONG flags);
+void  FreeMem(APTR ptr, ULONG size);
+APTR  AllocVec(ULONG size, ULONG flags);
+void  FreeVec(APTR ptr);
+APTR  CreatePool(ULONG flags, ULONG puddle, ULONG thresh);
+void  DeletePool(APTR pool);
+APTR  AllocPooled(APTR pool, ULONG size);
+void  FreePooled(APTR pool, APTR ptr, ULONG size);
+void  CopyMem(const void *src, void *dst, ULONG size);
+void  CopyMemQuick(const void *src, void *dst, ULONG size);
+void  Forbid(void);
+void  Permit(void);
+void  Disable(void);
+void  Enable(void);
+void  Cause(struct Interrupt *irq);
+struct Task *FindTask(CONST_STRPTR name);
+void  Signal(struct Task *task, ULONG mask);
+ULONG SetSignal(ULONG newsig, ULONG mask);
+ULONG Wait(ULONG mask);
+BYTE  AllocSignal(LONG num);
+void  FreeSignal(LONG num);
+void  ReplyMsg(struct Message *msg);
+void  PutMsg(struct MsgPort *port, struct Message *msg);
+struct Message *GetMsg(struct MsgPort *port);
+struct Message *WaitPort(struct MsgPort *port);
+void  NewList(struct List *list);
+void  AddHead(struct List *list, struct Node *node);
+void  AddTail(struct List *list, struct Node *node);
+void  Remove(struct Node *node);
+void  Enqueue(struct List *list, struct Node *node);
+struct Node *FindName(struct List *list, CONST_STRPTR name);
+BYTE  OpenDevice(CONST_STRPTR name, ULONG unit, struct IORequest *ior,
+                 ULONG flags);
+void  CloseDevice(struct IORequest *ior);
+BYTE  DoIO(struct IORequest *ior);
+void  SendIO(struct IORequest *ior);
+BYTE  WaitIO(struct IORequest *ior);
+LONG  CheckIO(struct IORequest *ior);
+void  AbortIO(struct IORequest *ior);
+struct Library *OpenLibrary(CONST_STRPTR name, ULONG version);
+void  CloseLibrary(struct Library *lib);
+APTR  OpenResource(CONST_STRPTR name);
+void  AddResource(APTR resource);
+void  CacheClearU(void);
+void  CacheClearE(APTR addr, ULONG len, ULONG flags);
+APTR  CachePreDMA(APTR addr, ULONG *len, ULONG flags);
+void  CachePostDMA(APTR addr, ULONG *len, ULONG flags);
+void  InitSemaphore(struct SignalSemaphore *sem);
+void  ObtainSemaphore(struct SignalSemaphore *sem);
+void  ReleaseSemaphore(struct SignalSemaphore *sem);
+void  Alert(ULONG num);
+void  SumKickData(void);
+void  AddIntServer(LONG num, struct Interrupt *irq);
+void  RemIntServer(LONG num, struct Interrupt *irq);
+
+/* amiga.lib */
+struct MsgPort   *CreatePort(CONST_STRPTR name, LONG pri);
+void              DeletePort(struct MsgPort *port);
+struct IORequest *CreateExtIO(struct MsgPort *port, LONG size);
+void              DeleteExtIO(struct IORequest *ior);
+struct Task      *CreateTask(CONST_STRPTR name, LONG pri, APTR code,
+                             ULONG stack);
+
+/* timer.device */
+ULONG ReadEClock(struct EClockVal *ev);
+
+/* expansion.library, dos.library, intuition.library */
+struct DeviceNode *MakeDosNode(APTR parmpacket);
+BOOL  AddDosNode(LONG bootpri, ULONG flags, struct DeviceNode *dn);
+BOOL  AddBootNode(LONG bootpri, ULONG flags, struct DeviceNode *dn,
+                  struct ConfigDev *cd);
+struct ConfigDev *FindConfigDev(struct ConfigDev *old, LONG manu, LONG prod);
+struct ConfigDev *AllocConfigDev(void);
+void  AddConfigDev(struct ConfigDev *cd);
+APTR  DeviceProc(CONST_STRPTR name);
+LONG  EasyRequestArgs(struct Window *w, struct EasyStruct *es, ULONG *idcmp,
+                      APTR args);
+
+/* debug.lib */
+void  KPutChar(LONG ch);
+
+/*
+ * As with the real inline headers, library calls go through their base
+ * pointer, so a local SysBase or DOSBase copy counts as used. shim.c
+ * defines the functions with their names in parentheses.
+ */
+#define SHIM_LIBCALL(base, fn) ((void) (base), (fn))
+
+#define AllocMem(...)        SHIM_LIBCALL(SysBase, AllocMem)(__VA_ARGS__)
+#define FreeMem(...)         SHIM_LIBCALL(SysBase, FreeMem)(__VA_ARGS__)
+#define AllocVec(...)        SHIM_LIBCALL(SysBase, AllocVec)(__VA_ARGS__)
+#define FreeVec(...)         SHIM_LIBCALL(SysBase, FreeVec)(__VA_ARGS__)
+#define CreatePool(...)      SHIM_LIBCALL(SysBase, CreatePool)(__VA_ARGS__)
+#define DeletePool(...)      SHIM_LIBCALL(SysBase, DeletePool)(__VA_ARGS__)
+#define AllocPooled(...)     SHIM_LIBCALL(SysBase, AllocPooled)(__VA_ARGS__)
+#define FreePooled(...)      SHIM_LIBCALL(SysBase, FreePooled)(__VA_ARGS__)
+#define CopyMem(...)         SHIM_LIBCALL(SysBase, CopyMem)(__VA_ARGS__)
+#define CopyMemQuick(...)    SHIM_LIBCALL(SysBase, CopyMemQuick)(__VA_ARGS__)
+#define Forbid(...)          SHIM_LIBCALL(SysBase, Forbid)(__VA_ARGS__)
+#define Permit(...)          SHIM_LIBCALL(SysBase, Permit)(__VA_ARGS__)
+#define Disable(...)         SHIM_LIBCALL(SysBase, Disable)(__VA_ARGS__)
+#define Enable(...)          SHIM_LIBCALL(SysBase, Enable)(__VA_ARGS__)
+#define Cause(...)           SHIM_LIBCALL(SysBase, Cause)(__VA_ARGS__)
+#define FindTask(...)        SHIM_LIBCALL(SysBase, FindTask)(__VA_ARGS__)
+#define Signal(...)          SHIM_LIBCALL(SysBase, Signal)(__VA_ARGS__)
+#define SetSignal(...)       SHIM_LIBCALL(SysBase, SetSignal)(__VA_ARGS__)
+#define Wait(...)            SHIM_LIBCALL(SysBase, Wait)(__VA_ARGS__)
+#define AllocSignal(...)     SHIM_LIBCALL(SysBase, AllocSignal)(__VA_ARGS__)
+#define FreeSignal(...)      SHIM_LIBCALL(SysBase, FreeSignal)(__VA_ARGS__)
+#define ReplyMsg(...)        SHIM_LIBCALL(SysBase, ReplyMsg)(__VA_ARGS__)
+#define PutMsg(...)          SHIM_LIBCALL(SysBase, PutMsg)(__VA_ARGS__)
+#define GetMsg(...)          SHIM_LIBCALL(SysBase, GetMsg)(__VA_ARGS__)
+#define WaitPort(...)        SHIM_LIBCALL(SysBase, WaitPort)(__VA_ARGS__)
+#define NewList(...)         SHIM_LIBCALL(SysBase, NewList)(__VA_ARGS__)
+#define AddHead(...)         SHIM_LIBCALL(SysBase, AddHead)(__VA_ARGS__)
+#define AddTail(...)         SHIM_LIBCALL(SysBase, AddTail)(__VA_ARGS__)
+#define Remove(...)          SHIM_LIBCALL(SysBase, Remove)(__VA_ARGS__)
+#define Enqueue(...)         SHIM_LIBCALL(SysBase, Enqueue)(__VA_ARGS__)
+#define FindName(...)        SHIM_LIBCALL(SysBase, FindName)(__VA_ARGS__)
+#define OpenDevice(...)      SHIM_LIBCALL(SysBase, OpenDevice)(__VA_ARGS__)
+#define CloseDevice(...)     SHIM_LIBCALL(SysBase, CloseDevice)(__VA_ARGS__)
+#define DoIO(...)            SHIM_LIBCALL(SysBase, DoIO)(__VA_ARGS__)
+#define SendIO(...)          SHIM_LIBCALL(SysBase, SendIO)(__VA_ARGS__)
+#define WaitIO(...)          SHIM_LIBCALL(SysBase, WaitIO)(__VA_ARGS__)
+#define CheckIO(...)         SHIM_LIBCALL(SysBase, CheckIO)(__VA_ARGS__)
+#define AbortIO(...)         SHIM_LIBCALL(SysBase, AbortIO)(__VA_ARGS__)
+#define OpenLibrary(...)     SHIM_LIBCALL(SysBase, OpenLibrary)(__VA_ARGS__)
+#define CloseLibrary(...)    SHIM_LIBCALL(SysBase, CloseLibrary)(__VA_ARGS__)
+#define OpenResource(...)    SHIM_LIBCALL(SysBase, OpenResource)(__VA_ARGS__)
+#define AddResource(...)     SHIM_LIBCALL(SysBase, AddResource)(__VA_ARGS__)
+#define CacheClearU(...)     SHIM_LIBCALL(SysBase, CacheClearU)(__VA_ARGS__)
+#define CacheClearE(...)     SHIM_LIBCALL(SysBase, CacheClearE)(__VA_ARGS__)
+#define CachePreDMA(...)     SHIM_LIBCALL(SysBase, CachePreDMA)(__VA_ARGS__)
+#define CachePostDMA(...)    SHIM_LIBCALL(SysBase, CachePostDMA)(__VA_ARGS__)
+#define InitSemaphore(...)   SHIM_LIBCALL(SysBase, InitSemaphore)(__VA_ARGS__)
+#define ObtainSemaphore(...) SHIM_LIBCALL(SysBase, ObtainSemaphore)(__VA_ARGS__)
+#define ReleaseSemaphore(...) SHIM_LIBCALL(SysBase, ReleaseSemaphore)(__VA_ARGS__)
+#define Alert(...)           SHIM_LIBCALL(SysBase, Alert)(__VA_ARGS__)
+#define SumKickData(...)     SHIM_LIBCALL(SysBase, SumKickData)(__VA_ARGS__)
+#define AddIntServer(...)    SHIM_LIBCALL(SysBase, AddIntServer)(__VA_ARGS__)
+#define RemIntServer(...)    SHIM_LIBCALL(SysBase, RemIntServer)(__VA_ARGS__)
+
+#define MakeDosNode(...)     SHIM_LIBCALL(ExpansionBase, MakeDosNode)(__VA_ARGS__)
+#define AddDosNode(...)      SHIM_LIBCALL(ExpansionBase, AddDosNode)(__VA_ARGS__)
+#define AddBootNode(...)     SHIM_LIBCALL(ExpansionBase, AddBootNode)(__VA_ARGS__)
+#define FindConfigDev(...)   SHIM_LIBCALL(ExpansionBase, FindConfigDev)(__VA_ARGS__)
+#define AllocConfigDev(...)  SHIM_LIBCALL(ExpansionBase, AllocConfigDev)(__VA_ARGS__)
+#define AddConfigDev(...)    SHIM_LIBCALL(ExpansionBase, AddConfigDev)(__VA_ARGS__)
+
+#define DeviceProc(...)      SHIM_LIBCALL(DOSBase, DeviceProc)(__VA_ARGS__)
+
+#endif /* _HOSTBENCH_SHIM_H */
@@ -0,0 +1,232 @@
+#ifdef DEBUG_MEMPOOL
+#define USE_SERIAL_OUTPUT
+#endif
+
+#include "port.h"
+#include "printf.h"
+#include <string.h>
+#include <exec/memory.h>
+#include "mempool.h"
+
+/*
+ * Driver memory pool
+ *
+ * Small driver-internal allocations (peripherals, unit nodes, INQUIRY and
+ * MODE SENSE buffers, ...) are served from per-size-class free lists which
+ * are carved out of larger puddles taken from Exec. Freed chunks go back
+ * on their free list and are reused, so allocation cost stays flat and
+ * Fast RAM is not fragmented by long uptimes or frequent OpenDevice() /
+ * CloseDevice() cycles. Puddles are only returned to Exec when the
+ * command handler terminates.
+ *
+ * This does not use exec.library CreatePool(), as that needs V39 and the
+ * driver also has to run on Kickstart 2.x.
+ *
+ * Size classes are powers of two from 16 to 2048 bytes. Larger requests
+ * are passed through to AllocMem(). As with FreeMem(), the caller must
+ * pass the size of the allocation to mempool_free(). All pool memory is
+ * MEMF_PUBLIC; anything which needs a specific memory type must still
+ * come from AllocMem().
+ *
+ * Chunks are aligned to a cache line and never share one with another
+ * chunk, so they may be used as DMA buffers.
+ */
+
+#define MEMPOOL_MIN_SHIFT   4     // Smallest class is 16 bytes
+#define MEMPOOL_CLASSES     8     // 16, 32, 64, ... 2048 bytes
+#define MEMPOOL_MAX_SIZE    (1 << (MEMPOOL_MIN_SHIFT + MEMPOOL_CLASSES - 1))
+#define MEMPOOL_PUDDLE_SIZE 4096
+#define MEMPOOL_ALIGN       16    // 68040/68060 cache line size
+
+typedef struct mempool_puddle mempool_puddle_t;
+struct mempool_puddle {
+    mempool_puddle_t *mp_next;
+    uint32_t          mp_size;
+};
+
+static void              *mempool_free_list[MEMPOOL_CLASSES];
+static mempool_puddle_t  *mempool_puddles;
+static a4091_mem_stats_t  mempool_stats;
+
+static uint
+mempool_class(uint32_t size)
+{
+    uint class = 0;
+
+    if (size != 0)
+        size = (size - 1) >> MEMPOOL_MIN_SHIFT;
+    while (size != 0) {
+        class++;
+        size >>= 1;
+    }
+    return (class);
+}
+
+/*
+ * mempool_refill
+ * --------------
+ * Take a new puddle from Exec and put all of its chunks on the free list
+ * of the specified size class. Must be called under Forbid().
+ */
+static int
+mempool_refill(uint class)
+{
+    mempool_puddle_t *puddle;
+    uint32_t          csize = 1 << (class + MEMPOOL_MIN_SHIFT);
+    uint32_t          psize = MEMPOOL_PUDDLE_SIZE;
+    uint8_t          *chunk;
+    uint8_t          *end;
+
+    if (psize < csize * 4)
+        psize = csize * 4;
+    psize += MEMPOOL_ALIGN;
+
+    puddle = AllocMem(psize, MEMF_PUBLIC);
+    if (puddle == NULL)
+        return (1);
+
+    puddle->mp_size = psize;
+    puddle->mp_next = mempool_puddles;
+    mempool_puddles = puddle;
+    mempool_stats.ms_puddles++;
+    mempool_stats.ms_reserved += psize;
+
+    chunk = (uint8_t *) (((uintptr_t) (puddle + 1) + MEMPOOL_ALIGN - 1) &
+                         ~(MEMPOOL_ALIGN - 1));
+    end = (uint8_t *) puddle + psize;
+    for (; chunk + csize <= end; chunk += csize) {
+        *(void **) chunk = mempool_free_list[class];
+        mempool_free_list[class] = chunk;
+    }
+    printf("mempool: puddle %p of %"PRIu32" bytes for class %"PRIu32"\n",
+           puddle, psize, csize);
+    return (0);
+}
+
+static void
+mempool_account(uint32_t size)
+{
+    mempool_stats.ms_allocs++;
+    mempool_stats.ms_inuse += size;
+    if (mempool_stats.ms_peak < mempool_stats.ms_inuse)
+        mempool_stats.ms_peak = mempool_stats.ms_inuse;
+}
+
+/*
+ * mempool_alloc
+ * -------------
+ * Allocate memory from the driver pool. Of the flags, only MEMF_CLEAR
+ * is honoured.
+ */
+void *
+mempool_alloc(uint32_t size, uint32_t flags)
+{
+    void     *ptr;
+    uint      class;
+    uint32_t  csize;
+
+    if (size > MEMPOOL_MAX_SIZE) {
+        ptr = AllocMem(size, MEMF_PUBLIC | (flags & MEMF_CLEAR));
+        Forbid();
+        if (ptr == NULL) {
+            mempool_stats.ms_failed++;
+        } else {
+            mempool_stats.ms_large++;
+            mempool_account(size);
+        }
+        Permit();
+        return (ptr);
+    }
+
+    class = mempool_class(size);
+    csize = 1 << (class + MEMPOOL_MIN_SHIFT);
+
+    Forbid();
+    if ((mempool_free_list[class] == NULL) && mempool_refill(class)) {
+        mempool_stats.ms_failed++;
+        Permit();
+        return (NULL);
+    }
+    ptr = mempool_free_list[class];
+    mempool_free_list[class] = *(void **) ptr;
+    mempool_account(csize);
+    Permit();
+
+    if (flags & MEMF_CLEAR)
+        memset(ptr, 0, csize);
+    return (ptr);
+}
+
+/*
+ * mempool_free
+ * ------------
+ * Return memory obtained from mempool_alloc(). The size must be the same
+ * as was passed to mempool_alloc().
+ */
+void
+mempool_free(void *ptr, uint32_t size)
+{
+    uint class;
+
+    if (ptr == NULL)
+        return;
+
+    if (size > MEMPOOL_MAX_SIZE) {
+        FreeMem(ptr, size);
+        Forbid();
+        mempool_stats.ms_frees++;
+        mempool_stats.ms_inuse -= size;
+        Permit();
+        return;
+    }
+
+    class = mempool_class(size);
+
+    Forbid();
+    *(void **) ptr = mempool_free_list[class];
+    mempool_free_list[class] = ptr;
+    mempool_stats.ms_frees++;
+    mempool_stats.ms_inuse -= 1 << (class + MEMPOOL_MIN_SHIFT);
+    Permit();
+}
+
+void
+mempool_get_stats(a4091_mem_stats_t *stats)
+{
+    Forbid();
+    CopyMem(&mempool_stats, stats, sizeof (*stats));
+    Permit();
+}
+
+void
+mempool_init(void)
+{
+    memset(mempool_free_list, 0, sizeof (mempool_free_list));
+    memset(&mempool_stats, 0, sizeof (mempool_stats));
+    mempool_puddles = NULL;
+}
+
+/*
+ * mempool_deinit
+ * --------------
+ * Return all puddles to Exec. Everything allocated from the pool must
+ * have been freed before this is called.
+ */
+void
+mempool_deinit(void)
+{
+    mempool_puddle_t *puddle;
+
+    if (mempool_stats.ms_allocs != mempool_stats.ms_frees) {
+        printf("mempool: %"PRIu32" allocations (%"PRIu32" bytes) "
+               "not freed\n",
+               mempool_stats.ms_allocs - mempool_stats.ms_frees,
+               mempool_stats.ms_inuse);
+    }
+
+    while ((puddle = mempool_puddles) != NULL) {
+        mempool_puddles = puddle->mp_next;
+        FreeMem(puddle, puddle->mp_size);
+    }
+    mempool_init();
+}
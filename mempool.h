@@ -0,0 +1,12 @@
+#ifndef _MEMPOOL_H
+#define _MEMPOOL_H
+
+#include "stats.h"
+
+void mempool_init(void);
+void mempool_deinit(void);
+void *mempool_alloc(uint32_t size, uint32_t flags);
+void mempool_free(void *ptr, uint32_t size);
+void mempool_get_stats(a4091_mem_stats_t *stats);
+
+#endif /* _MEMPOOL_H */
@@ -56,6 +56,9 @@
 #include "a4091.h"
 #include "attach.h"
 #include "legacy.h"
+#include "mempool.h"
+#include "cmdhandler.h"
+#include "diskprofile.h"
 
 #define TRACE 1
 #undef TRACE_LSEG
@@ -83,6 +86,29 @@ extern UBYTE bootblock, bootblock_end;
 
 struct FileSysResource *FileSysResBase = NULL;
 
+#define MAX_FSHD  8
+#define MAX_UNITS (8 * 9) // 8 targets, LUNs 0-8
+#define MAX_DOSTYPES 16   // Distinct DosTypes of partitions on all units
+
+// Best FileSystem Header Block found for a DosType on any unit
+struct FSHDCandidate
+{
+	UWORD unit;
+	struct FileSysHeaderBlock fshb;
+};
+
+// Unit kept open between the scan, filesystem load and mount passes
+struct MountUnit
+{
+	struct IOExtTD *request;
+	ULONG unitnum;
+	ULONG rdbblock;
+	UBYTE *region;
+	ULONG regionsize;
+	UWORD blocksize;
+	UBYTE devicetype;
+};
+
 struct MountData
 {
 	struct ExecBase *SysBase;
@@ -102,12 +128,21 @@ struct MountData
 
 	ULONG unitnum;
 	LONG ret;
+	UBYTE *region;     // Copy of the unit's RDB search region, or NULL
+	ULONG regionsize;
 	UBYTE buf[MAX_BLOCKSIZE * 3];
 	UBYTE zero[2];
 	BOOL wasLastDev;
 	BOOL wasLastLun;
 	BOOL slowSpinup;
 	int blocksize;
+
+	UWORD numfshd;
+	UWORD numunits;
+	UWORD numdostypes;  // MAX_DOSTYPES + 1 after an overflow: load all
+	struct FSHDCandidate fshd[MAX_FSHD];
+	ULONG dostypes[MAX_DOSTYPES];
+	struct MountUnit units[MAX_UNITS];
 };
 
 // KS 1.3 compatibility functions
@@ -207,8 +242,8 @@ static UWORD checksum(UBYTE *buf, struct MountData *md)
 
 #define MAX_RETRIES 3
 
-// Read single block with retries
-static BOOL readblock(UBYTE *buf, ULONG block, ULONG id, struct MountData *md)
+// Read from disk with retries while the drive spins up
+static BOOL readdisk(UBYTE *buf, ULONG offset, ULONG length, struct MountData *md)
 {
 	struct ExecBase *SysBase = md->SysBase;
 	struct IOExtTD *request = md->request;
@@ -217,25 +252,33 @@ static BOOL readblock(UBYTE *buf, ULONG block, ULONG id, struct MountData *md)
 		max_retries = 15;
 
 	request->iotd_Req.io_Command = CMD_READ;
-	request->iotd_Req.io_Offset = block << 9;
+	request->iotd_Req.io_Offset = offset;
 	request->iotd_Req.io_Data = buf;
-	request->iotd_Req.io_Length = md->blocksize;
+	request->iotd_Req.io_Length = length;
 	for (i = 0; i < max_retries; i++) {
 		LONG err = DoIO((struct IORequest*)request);
 		if (!err) {
-			break;
+			return TRUE;
 		}
 		if (err != ERROR_NOT_READY) {
-			dbg("Read block %"PRIu32" error %"PRId32"\n", block, err);
+			dbg("Read offset %"PRIu32" error %"PRId32"\n", offset, err);
 			/* Error retry handled in a4091.device, fail quickly here. */
-			i = max_retries;
-			break;
+			return FALSE;
 		}
 		/* Give the drive more time to spin up */
 		dbg("Drive not ready.\n");
 		delay(1000000);
 	}
-	if (i == max_retries) {
+	return FALSE;
+}
+
+// Read single block, from the RDB region copy when it holds the block
+static BOOL readblock(UBYTE *buf, ULONG block, ULONG id, struct MountData *md)
+{
+	if (md->region && block < (md->regionsize >> 9) &&
+	    (block << 9) + md->blocksize <= md->regionsize) {
+		copymem(buf, md->region + (block << 9), md->blocksize);
+	} else if (!readdisk(buf, block << 9, md->blocksize, md)) {
 		return FALSE;
 	}
 	ULONG v = (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | (buf[3] << 0);
@@ -475,13 +518,13 @@ static APTR fsrelocate(struct MountData *md)
 						if (relocOffset & 1) {
 							// Odd address, 68000/010 support.
 							ULONG v = (hData[0] << 24) | (hData[1] << 16) | (hData[2] << 8) | (hData[3] << 0);
-							v += (ULONG)rhr->hunkData;
+							v += (ULONG)(uintptr_t)rhr->hunkData;
 							hData[0] = v >> 24;
 							hData[1] = v >> 16;
 							hData[2] = v >>  8;
 							hData[3] = v >>  0;
 						} else {
-							*((ULONG*)hData) += (ULONG)rhr->hunkData;
+							*((ULONG*)hData) += (ULONG)(uintptr_t)rhr->hunkData;
 						}
 						relocCnt--;
 					}
@@ -609,40 +652,118 @@ static void FSHDAdd(struct FileSysEntry *fse, struct MountData *md)
 	}
 }
 
-// Parse FileSystem Header Blocks, load and relocate filesystem if needed.
-static struct FileSysEntry *ParseFSHD(UBYTE *buf, ULONG block, ULONG dostype, struct MountData *md)
+// Walk a unit's FileSystem Header Block chain and remember the newest
+// version of each DosType seen on any unit so far.
+static void CollectFSHD(UBYTE *buf, ULONG block, UWORD unit, struct MountData *md)
 {
 	struct FileSysHeaderBlock *fshb = (struct FileSysHeaderBlock*)buf;
-	struct FileSysEntry *fse = NULL;
 
-	for (;;) {
-		if (block == 0xffffffff) {
-			break;
-		}
+	while (block != 0xffffffff) {
+		UWORD i;
 		if (!readblock(buf, block, IDNAME_FILESYSHEADER, md)) {
 			break;
 		}
-		dbg("FSHD found, block %"PRIu32", dostype %08"PRIx32", looking for dostype %08"PRIx32"\n", block, fshb->fhb_DosType, dostype);
-		if (fshb->fhb_DosType == dostype) {
-			dbg("FSHD dostype match found\n");
-			fse = FSHDProcess(fshb, dostype, fshb->fhb_Version, TRUE, md);
-			if (fse) {
-				md->lsegblock = fshb->fhb_SegListBlocks;
-				md->lsegbuf = (struct LoadSegBlock*)(buf + md->blocksize);
-				md->lseglongs = 0;
-				APTR seg = fsrelocate(md);
-				fse->fse_SegList = MKBADDR(seg);
-				// Add to FileSystem.resource if succeeded, delete entry if failure.
-				FSHDAdd(fse, md);
+		dbg("FSHD found, block %"PRIu32", dostype %08"PRIx32", version %08"PRIx32"\n", block, fshb->fhb_DosType, fshb->fhb_Version);
+		for (i = 0; i < md->numfshd; i++) {
+			if (md->fshd[i].fshb.fhb_DosType == fshb->fhb_DosType) {
+				break;
 			}
-			break;
 		}
+		if (i == md->numfshd) {
+			if (md->numfshd == MAX_FSHD) {
+				dbg("Too many filesystems, ignoring %08"PRIx32"\n", fshb->fhb_DosType);
+				block = fshb->fhb_Next;
+				continue;
+			}
+			md->numfshd++;
+		} else if (md->fshd[i].fshb.fhb_Version >= fshb->fhb_Version) {
+			block = fshb->fhb_Next;
+			continue;
+		}
+		md->fshd[i].unit = unit;
+		copymem(&md->fshd[i].fshb, fshb, sizeof(struct FileSysHeaderBlock));
 		block = fshb->fhb_Next;
 	}
-	if (!fse) {
-		fse = FSHDProcess(NULL, dostype, 0, FALSE, md);
+}
+
+// Walk a unit's PART chain and remember the DosType of each partition
+// which will be mounted, so that only filesystems in use are loaded.
+static void CollectDosTypes(UBYTE *buf, ULONG block, struct MountData *md)
+{
+	struct PartitionBlock *part = (struct PartitionBlock*)buf;
+	struct DosEnvec *de = (struct DosEnvec*)part->pb_Environment;
+
+	while (block != 0xffffffff && md->numdostypes <= MAX_DOSTYPES) {
+		UWORD i;
+		if (!readblock(buf, block, IDNAME_PARTITION, md)) {
+			break;
+		}
+		block = part->pb_Next;
+		if (part->pb_Flags & PBFF_NOMOUNT) {
+			continue;
+		}
+		for (i = 0; i < md->numdostypes; i++) {
+			if (md->dostypes[i] == de->de_DosType) {
+				break;
+			}
+		}
+		if (i < md->numdostypes) {
+			continue;
+		}
+		if (md->numdostypes >= MAX_DOSTYPES) {
+			dbg("Too many DosTypes, loading all filesystems\n");
+			md->numdostypes = MAX_DOSTYPES + 1;
+			continue;
+		}
+		md->dostypes[md->numdostypes++] = de->de_DosType;
+	}
+}
+
+// Check whether a partition to be mounted uses a DosType
+static BOOL DosTypeUsed(ULONG dostype, struct MountData *md)
+{
+	if (md->numdostypes > MAX_DOSTYPES) {
+		return TRUE;
+	}
+	for (UWORD i = 0; i < md->numdostypes; i++) {
+		if (md->dostypes[i] == dostype) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+// Load and relocate the chosen filesystems which a partition uses, unless
+// FileSystem.resource already has the same or a newer version. Only one
+// LSEG chain is read per DosType, no matter how many units carry a copy.
+static void LoadFileSystems(struct MountData *md)
+{
+	for (UWORD i = 0; i < md->numfshd; i++) {
+		struct FSHDCandidate *c = &md->fshd[i];
+		struct MountUnit *mu = &md->units[c->unit];
+		struct FileSysEntry *fse;
+
+		if (!DosTypeUsed(c->fshb.fhb_DosType, md)) {
+			dbg("No partition uses dostype %08"PRIx32"\n", c->fshb.fhb_DosType);
+			continue;
+		}
+		fse = FSHDProcess(&c->fshb, c->fshb.fhb_DosType, c->fshb.fhb_Version, TRUE, md);
+		if (fse) {
+			dbg("Loading dostype %08"PRIx32" from unit %"PRIu32"\n", c->fshb.fhb_DosType, mu->unitnum);
+			md->request = mu->request;
+			md->unitnum = mu->unitnum;
+			md->blocksize = mu->blocksize;
+			md->region = mu->region;
+			md->regionsize = mu->regionsize;
+			md->lsegblock = c->fshb.fhb_SegListBlocks;
+			md->lsegbuf = (struct LoadSegBlock*)(md->buf + md->blocksize);
+			md->lseglongs = 0;
+			APTR seg = fsrelocate(md);
+			fse->fse_SegList = MKBADDR(seg);
+			// Add to FileSystem.resource if succeeded, delete entry if failure.
+			FSHDAdd(fse, md);
+		}
 	}
-	return fse;
 }
 
 #if NO_CONFIGDEV
@@ -807,7 +928,7 @@ static void ProcessPatchFlags(ULONG patchFlags, ULONG *dstPatch, ULONG *srcPatch
 }
 
 // Parse PART block, mount drive.
-static ULONG ParsePART(UBYTE *buf, ULONG block, ULONG filesysblock, struct MountData *md)
+static ULONG ParsePART(UBYTE *buf, ULONG block, struct MountData *md)
 {
 	struct ExecBase *SysBase = md->SysBase;
 	struct ExpansionBase *ExpansionBase = md->ExpansionBase;
@@ -823,7 +944,8 @@ static ULONG ParsePART(UBYTE *buf, ULONG block, ULONG filesysblock, struct Mount
 		struct ParameterPacket *pp = AllocMem(sizeof(struct ParameterPacket), MEMF_PUBLIC | MEMF_CLEAR);
 		if (pp) {
 			copymem(&pp->de, &part->pb_Environment, (part->pb_Environment[0] + 1) * sizeof(ULONG));
-			struct FileSysEntry *fse = ParseFSHD(buf + md->blocksize, filesysblock, pp->de.de_DosType, md);
+			// Filesystems were loaded by LoadFileSystems(), only look them up
+			struct FileSysEntry *fse = FSHDProcess(NULL, pp->de.de_DosType, 0, FALSE, md);
 			pp->execname = md->devicename;
 			pp->unitnum = md->unitnum;
 			pp->dosname = part->pb_DriveName + 1;
@@ -852,39 +974,98 @@ static ULONG ParsePART(UBYTE *buf, ULONG block, ULONG filesysblock, struct Mount
 	return nextpartblock;
 }
 
+// Pass the disk profile linked from the RDB to the driver
+static void ApplyDiskProfile(UBYTE *buf, ULONG block, struct MountData *md)
+{
+	struct ExecBase *SysBase = md->SysBase;
+	struct IOExtTD *request = md->request;
+	a4091_profile_block_t *pfb = (a4091_profile_block_t*)buf;
+	a4091_disk_profile_t dp;
+	UWORD len;
+
+	if (block == 0 || block == 0xffffffff)
+		return;
+	if (!readblock(buf, block, IDNAME_DISKPROFILE, md)) {
+		dbg("Disk profile block %"PRIu32" invalid\n", block);
+		return;
+	}
+	len = pfb->dpb_Size;
+	if (len > sizeof(dp))
+		len = sizeof(dp);
+	memset(&dp, 0, sizeof(dp));
+	copymem(&dp, &pfb->dpb_Profile, len);
+
+	request->iotd_Req.io_Command = CMD_DISKPROFILE;
+	request->iotd_Req.io_Data = &dp;
+	request->iotd_Req.io_Length = sizeof(dp);
+	if (DoIO((struct IORequest*)request)) {
+		dbg("Disk profile error %"PRId32"\n", (LONG)request->iotd_Req.io_Error);
+	} else {
+		dbg("Disk profile: depth=%d sync=%d disc=%d wce=%d cache=%d\n",
+		    dp.dp_queue_depth, dp.dp_sync_period, dp.dp_disconnect,
+		    dp.dp_write_cache, dp.dp_cache_profile);
+	}
+}
+
 // Scan PART blocks
 static LONG ParseRDSK(UBYTE *buf, struct MountData *md)
 {
 	struct RigidDiskBlock *rdb = (struct RigidDiskBlock*)buf;
 	ULONG partblock = rdb->rdb_PartitionList;
-	ULONG filesysblock = rdb->rdb_FileSysHeaderList;
-	ULONG flags = rdb->rdb_Flags;
+
+	// The profile must be in place before the filesystems start
+	ApplyDiskProfile(buf, RDB_DISKPROFILE(rdb), md);
 	for (;;) {
 		if (partblock == 0xffffffff) {
 			break;
 		}
-		partblock = ParsePART(buf, partblock, filesysblock, md);
+		partblock = ParsePART(buf, partblock, md);
 	}
-	md->wasLastDev = !asave->ignore_last && (flags & RDBFF_LAST) != 0;
-	md->wasLastLun = (flags & RDBFF_LASTLUN) != 0;
 	return md->ret;
 }
 
-// Search for RDB
+// Release the RDB region copy of the current unit
+static void FreeRegion(struct MountData *md)
+{
+	struct ExecBase *SysBase = md->SysBase;
+
+	if (md->region) {
+		FreeMem(md->region, md->regionsize);
+		md->region = NULL;
+		md->regionsize = 0;
+	}
+}
+
+// Read the whole RDB search region in one request. The RDB and, as
+// laid out by HDToolBox, the PART and FSHD blocks are then parsed from
+// memory. Falls back to block by block reads if the region can't be read.
+static void ReadRegion(struct MountData *md)
+{
+	struct ExecBase *SysBase = md->SysBase;
+	ULONG size = RDB_LOCATION_LIMIT * md->blocksize;
+
+	md->region = AllocMem(size, MEMF_PUBLIC);
+	if (!md->region)
+		return;
+	md->regionsize = size;
+	if (!readdisk(md->region, 0, size, md)) {
+		dbg("RDB region read failed, reading blocks\n");
+		FreeRegion(md);
+	}
+}
+
+// Search for RDB, returns its block number or -1.
 static LONG ScanRDSK(struct MountData *md)
 {
-	LONG ret = -1;
+	ReadRegion(md);
 	for (UWORD i = 0; i < RDB_LOCATION_LIMIT; i++) {
-		if (readblock(md->buf, i, 0xffffffff, md)) {
-			struct RigidDiskBlock *rdb = (struct RigidDiskBlock*)md->buf;
-			if (rdb->rdb_ID == IDNAME_RIGIDDISK) {
-				dbg("RDB found, block %"PRIu32"\n", i);
-				ret = ParseRDSK(md->buf, md);
-				break;
-			}
+		if (readblock(md->buf, i, IDNAME_RIGIDDISK, md)) {
+			dbg("RDB found, block %"PRIu32"\n", i);
+			return i;
 		}
 	}
-	return ret;
+	FreeRegion(md);
+	return -1;
 }
 
 static struct FileSysEntry *find_filesystem(ULONG id1, ULONG id2)
@@ -940,57 +1121,48 @@ static void list_filesystems(void)
 #endif
 }
 
+#define ISO_SECTOR     2048
+#define ISO_VDS_START  16   // First sector of the volume descriptor set
+#define ISO_VDS_MAX    32   // Sectors searched for the PVD
+#define ISO_VD_PRIMARY 1
+#define ISO_VD_TERM    255  // Volume descriptor set terminator
+
 // CheckPVD
-// Check for "CDTV" or "AMIGA BOOT" as the System ID in the PVD
-BOOL CheckPVD(struct IOStdReq *ior)
+// Check for "CDTV" or "AMIGA BOOT" as the System ID in the PVD.
+// The volume descriptor set is read into md->buf as many sectors at a
+// time as fit, and examined in place. The search ends at the PVD, at the
+// set terminator or at the first sector which is not a volume descriptor.
+static BOOL CheckPVD(struct MountData *md)
 {
-	const char sys_id_1[] = "CDTV";
-	const char sys_id_2[] = "AMIGA BOOT";
-	const char iso_id[]   = "CD001";
-
-	BYTE err = 0;
-	BOOL ret = FALSE;
-	char *buf = NULL;
-
-	if (!(buf = AllocMem(2048,MEMF_ANY|MEMF_CLEAR))) goto done;
-
-	ior->io_Command = TD_CHANGESTATE; // Check if there's a disc in the drive
-
-	if (err = DoIO((struct IORequest *)ior) || ior->io_Actual != 0) goto done;
-
-	char *id_string = buf + 1;
-	char *system_id = buf + 8;
-
-	ior->io_Command = CMD_READ;
-	ior->io_Data    = buf;
-	ior->io_Length  = 2048;
-
-	for (int i=0; i < 32; i++) {
+	struct ExecBase *SysBase = md->SysBase;
+	struct IOExtTD *request = md->request;
+	const ULONG count = sizeof(md->buf) / ISO_SECTOR;
+	ULONG sector;
+	UBYTE *vd;
 
-		ior->io_Offset = (i + 16) << 11;
+	request->iotd_Req.io_Command = TD_CHANGESTATE; // Check if there's a disc in the drive
 
-		for (int retry = 0; retry < 3; retry++) {
-			if ((err = DoIO((struct IORequest*)ior)) == 0) break;
-		}
+	if (DoIO((struct IORequest *)request) || request->iotd_Req.io_Actual != 0)
+		return FALSE;
 
-		if (ior->io_Actual < 2048) break;
+	for (sector = ISO_VDS_START; sector < ISO_VDS_START + ISO_VDS_MAX; sector += count) {
+		if (!readdisk(md->buf, sector * ISO_SECTOR, count * ISO_SECTOR, md))
+			return FALSE;
 
-		// Check ISO ID String & for PVD Version & Type code
-		if ((strncmp(iso_id,id_string,5) == 0) && buf[0] == 1 && buf[6] == 1) {
-			if (strncmp(sys_id_1,system_id,strlen(sys_id_1)) == 0 || strncmp(sys_id_2,system_id,strlen(sys_id_2) == 0)) {
-				ret = TRUE; // CDTV or AMIGA BOOT
-			} else {
-				ret = FALSE;
+		for (vd = md->buf; vd < md->buf + count * ISO_SECTOR; vd += ISO_SECTOR) {
+			// Check ISO ID String & Version
+			if (strncmp((char *)vd + 1, "CD001", 5) != 0 || vd[6] != 1)
+				return FALSE;
+			if (vd[0] == ISO_VD_TERM)
+				return FALSE;
+			if (vd[0] == ISO_VD_PRIMARY) {
+				char *system_id = (char *)vd + 8;
+				return (strncmp(system_id, "CDTV", 4) == 0 ||
+				        strncmp(system_id, "AMIGA BOOT", 10) == 0);
 			}
-			break;
-		} else {
-			continue;
 		}
-
 	}
-done:
-	if (buf)  FreeMem(buf,2048);
-	return ret;
+	return FALSE;
 }
 
 // Search for Bootable CDROM
@@ -1008,11 +1180,15 @@ static LONG ScanCDROM(struct MountData *md)
 	}
 
 	// "CDTV" or "AMIGA BOOT"?
-	if (CheckPVD((struct IOStdReq *)md->request)) {
+	if (CheckPVD(md)) {
 		bootPri = 2;  // Yes, give priority
 	} else {
 		bootPri = -1; // May not be a boot disk, lower priority than HDD
 	}
+	if (asave->as_cdrom_usecs == 0) {
+		asave->as_cdrom_usecs = eclock_usecs(eclock_read() - asave->as_start_eclock);
+		printf("CD-ROM scanned %"PRIu32" ms after start\n", asave->as_cdrom_usecs / 1000);
+	}
 
 	struct ParameterPacket pp;
 
@@ -1321,71 +1497,125 @@ LONG MountDrive(struct MountStruct *ms)
 			md->configDev = ms->configDev;
 			md->creator = ms->creatorName;
 			md->slowSpinup = ms->slowSpinup;
+			md->devicename = ms->deviceName;
 			port = W_CreateMsgPort(SysBase);
 			if(port) {
-				request = (struct IOExtTD*)W_CreateIORequest(port, sizeof(struct IOExtTD), SysBase);
-				if(request) {
-					ULONG target;
-					ULONG lun = 0;
-					for (target = 0; target < 8; target++, lun = 0) {
-						ULONG unitNum;
+				ULONG target;
+				ULONG lun = 0;
+				UWORD u;
+
+				// Pass 1: open all units, find their RDBs and collect
+				// the filesystems they carry. Units stay open until
+				// the end, closing the last opener detaches the unit.
+				for (target = 0; target < 8 && md->numunits < MAX_UNITS; target++, lun = 0) {
+					ULONG unitNum;
+					struct MountUnit *mu;
 next_lun:
-						unitNum = target + lun * 10;
-						dbg("OpenDevice('%s', %"PRId32", %p, 0)\n", ms->deviceName, unitNum, request);
-						UBYTE err = OpenDevice(ms->deviceName, unitNum, (struct IORequest*)request, 0);
+					unitNum = target + lun * 10;
+					mu = &md->units[md->numunits];
+					request = (struct IOExtTD*)W_CreateIORequest(port, sizeof(struct IOExtTD), SysBase);
+					if (!request) {
+						break;
+					}
+					dbg("OpenDevice('%s', %"PRId32", %p, 0)\n", ms->deviceName, unitNum, request);
+					UBYTE err = OpenDevice(ms->deviceName, unitNum, (struct IORequest*)request, 0);
+					if (err == 0) {
+						md->request = request;
+						md->unitnum = unitNum;
+						mu->request = request;
+						mu->unitnum = unitNum;
+						mu->rdbblock = 0xffffffff;
+						mu->region = NULL;
+						mu->devicetype = 0xff;
+						md->numunits++;
+
+						err = dev_scsi_get_drivegeometry(request, &geom);
 						if (err == 0) {
-							md->request = request;
-							md->devicename = ms->deviceName;
-							md->unitnum = unitNum;
-							ret = -1;
-
-							err = dev_scsi_get_drivegeometry(request, &geom);
-							if (err == 0) {
-								md->blocksize = geom.dg_SectorSize;
-								switch (geom.dg_DeviceType & SID_TYPE) {
-								case 5: // CDROM
-									if (!asave->cdrom_boot) {
-										printf("CDROM boot disabled.\n");
-										break;
-									}
-									ret = ScanRDSK(md);
-									if (ret==-1)
-										ret = ScanCDROM(md);
-									break;
-								case 0: // DISK
-									ret = ScanRDSK(md);
-#ifdef DISKLABELS
-									if (ret==-1)
-										ret = ScanMBR(md);
-#endif
-									break;
-								default:
-									printf("Don't know how to boot from device type %d.\n",
-										geom.dg_DeviceType & SID_TYPE);
+							md->blocksize = geom.dg_SectorSize;
+							mu->blocksize = geom.dg_SectorSize;
+							mu->devicetype = geom.dg_DeviceType & SID_TYPE;
+							switch (mu->devicetype) {
+							case 5: // CDROM
+								if (!asave->cdrom_boot) {
+									printf("CDROM boot disabled.\n");
+									mu->devicetype = 0xff;
 									break;
 								}
+								// fall through
+							case 0: // DISK
+								{
+									LONG rdbblock = ScanRDSK(md);
+									if (rdbblock != -1) {
+										struct RigidDiskBlock *rdb = (struct RigidDiskBlock*)md->buf;
+										ULONG flags = rdb->rdb_Flags;
+										mu->rdbblock = rdbblock;
+										CollectFSHD(md->buf + md->blocksize, rdb->rdb_FileSysHeaderList, md->numunits - 1, md);
+										CollectDosTypes(md->buf + md->blocksize, rdb->rdb_PartitionList, md);
+										md->wasLastDev = !asave->ignore_last && (flags & RDBFF_LAST) != 0;
+										md->wasLastLun = (flags & RDBFF_LASTLUN) != 0;
+										// Keep the region for the mount pass
+										mu->region = md->region;
+										mu->regionsize = md->regionsize;
+										md->region = NULL;
+									}
+								}
+								break;
+							default:
+								printf("Don't know how to boot from device type %d.\n",
+									mu->devicetype);
+								mu->devicetype = 0xff;
+								break;
 							}
+						}
 
-							// Disable motor after probing
-							md->request->iotd_Req.io_Command = TD_MOTOR;
-							md->request->iotd_Req.io_Length  = 0;
-							DoIO((struct IORequest*)md->request);
+						if (ms->luns && (lun++ < 8) &&
+						    (!md->wasLastLun) && md->numunits < MAX_UNITS) {
+							goto next_lun;
+						}
 
-							CloseDevice((struct IORequest*)request);
-							if (ms->luns && (lun++ < 8) &&
-							    (!md->wasLastLun)) {
-								goto next_lun;
-							}
+						if (md->wasLastDev) {
+							dbg("RDBFF_LAST exit\n");
+							break;
+						}
+					} else {
+						dbg("OpenDevice(%s,%"PRId32") failed: %"PRId32"\n", ms->deviceName, unitNum, (BYTE)err);
+						W_DeleteIORequest(request, SysBase);
+					}
+				}
 
-							if (md->wasLastDev) {
-								dbg("RDBFF_LAST exit\n");
-								break;
-							}
-						} else {
-							dbg("OpenDevice(%s,%"PRId32") failed: %"PRId32"\n", ms->deviceName, unitNum, (BYTE)err);
+				// Pass 2: load each filesystem once, newest version wins.
+				LoadFileSystems(md);
+
+				// Pass 3: mount partitions, then release the units.
+				for (u = 0; u < md->numunits; u++) {
+					struct MountUnit *mu = &md->units[u];
+					md->request = mu->request;
+					md->unitnum = mu->unitnum;
+					md->blocksize = mu->blocksize;
+					md->region = mu->region;
+					md->regionsize = mu->regionsize;
+					ret = -1;
+
+					if (mu->rdbblock != 0xffffffff) {
+						if (readblock(md->buf, mu->rdbblock, IDNAME_RIGIDDISK, md)) {
+							ret = ParseRDSK(md->buf, md);
 						}
+					} else if (mu->devicetype == 5) {
+						ret = ScanCDROM(md);
+#ifdef DISKLABELS
+					} else if (mu->devicetype == 0) {
+						ret = ScanMBR(md);
+#endif
 					}
-					W_DeleteIORequest(request, SysBase);
+
+					// Disable motor after probing
+					mu->request->iotd_Req.io_Command = TD_MOTOR;
+					mu->request->iotd_Req.io_Length  = 0;
+					DoIO((struct IORequest*)mu->request);
+
+					CloseDevice((struct IORequest*)mu->request);
+					W_DeleteIORequest(mu->request, SysBase);
+					FreeRegion(md);
 				}
 				W_DeleteMsgPort(port, SysBase);
 			}
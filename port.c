@@ -13,9 +13,11 @@
 #include <clib/exec_protos.h>
 #include <clib/intuition_protos.h>
 #include <devices/timer.h>
+#include <proto/timer.h>
 #include <intuition/intuition.h>
 #include <inline/intuition.h>
 #include <exec/io.h>
+#include <exec/memory.h>
 #include <exec/execbase.h>
 #include "device.h"
 #include "printf.h"
@@ -113,19 +115,228 @@ static struct timerequest *create_timer(ULONG unit)
     return tr;
 }
 
+/*
+ * Timing services
+ * ---------------
+ * timing_init() opens timer.device once for the whole driver. This gives
+ *   - eclock_read(), a monotonic E-clock timestamp which may be read from
+ *     any context, including interrupts and Disable()d sections,
+ *   - a small pool of timerequests shared by all callers of delay(), so a
+ *     sleep no longer has to create a port and open timer.device, and
+ *   - a busy-wait loop calibrated against the E-clock, which delay() uses
+ *     for very short delays and whenever interrupts are disabled.
+ * Before timing_init() (and on Kickstart 1.3, which lacks ReadEClock())
+ * delay() falls back to opening timer.device for each call.
+ */
+#define TIMER_POOL_SIZE   4
+#define SPIN_MAX_USECS    50     // Shorter delays spin instead of sleeping
+#define SPIN_CAL_LOOPS    10000  // Loop count for calibration
+
+struct Device *TimerBase = NULL;
+uint32_t eclock_freq = 0;        // E-clock ticks per second, 0 if unknown
+
+static struct timerequest *timer_pool[TIMER_POOL_SIZE];
+static uint8_t timer_pool_busy;
+static uint32_t spin_loops_per_ms = 0;
+
+static void __attribute__((noinline))
+spin_loops(uint32_t loops)
+{
+    while (loops-- > 0)
+        __asm volatile("nop");
+}
+
+static void
+spin_usecs(uint32_t usecs)
+{
+    uint32_t loops;
+
+    if (spin_loops_per_ms == 0) {
+        /* Not calibrated */
+        loops = usecs << 3;
+    } else {
+        loops = (usecs / 1000) * spin_loops_per_ms +
+                (usecs % 1000) * spin_loops_per_ms / 1000;
+    }
+    spin_loops(loops);
+}
+
+uint64_t
+eclock_read(void)
+{
+    struct EClockVal ev;
+
+    if (eclock_freq == 0)
+        return (0);
+
+    ReadEClock(&ev);
+    return (((uint64_t) ev.ev_hi << 32) | ev.ev_lo);
+}
+
+/* Convert a difference of two eclock_read() values to microseconds */
+uint32_t
+eclock_usecs(uint64_t ticks)
+{
+    if (eclock_freq == 0)
+        return (0);
+    return ((uint32_t) (ticks * 1000000 / eclock_freq));
+}
+
+/*
+ * single_port_init
+ * ----------------
+ * Set up a message port, usually on the stack, which signals the current
+ * task using SIGB_SINGLE. This avoids allocating a port and signal bit for
+ * a single synchronous request.
+ */
+void
+single_port_init(struct MsgPort *port)
+{
+    memset(port, 0, sizeof (*port));
+    port->mp_Node.ln_Type = NT_MSGPORT;
+    port->mp_Flags        = PA_SIGNAL;
+    port->mp_SigBit       = SIGB_SINGLE;
+    port->mp_SigTask      = FindTask(NULL);
+    NewList(&port->mp_MsgList);
+    SetSignal(0, SIGF_SINGLE);
+}
+
+static void
+spin_calibrate(void)
+{
+    uint32_t best = 0xffffffff;
+    uint     pass;
+
+    for (pass = 0; pass < 3; pass++) {
+        uint64_t start;
+        uint32_t elapsed;
+
+        Forbid();
+        start = eclock_read();
+        spin_loops(SPIN_CAL_LOOPS);
+        elapsed = (uint32_t) (eclock_read() - start);
+        Permit();
+
+        /* The fastest pass saw the fewest interrupts */
+        if ((elapsed != 0) && (best > elapsed))
+            best = elapsed;
+    }
+    if (best != 0xffffffff)
+        spin_loops_per_ms = SPIN_CAL_LOOPS * (eclock_freq / 1000) / best;
+    printf("spin: %"PRIu32" loops/ms, E-clock %"PRIu32" Hz\n",
+           spin_loops_per_ms, eclock_freq);
+}
+
+int
+timing_init(void)
+{
+    uint slot;
+
+    for (slot = 0; slot < TIMER_POOL_SIZE; slot++) {
+        struct timerequest *tr;
+        tr = AllocMem(sizeof (*tr), MEMF_PUBLIC | MEMF_CLEAR);
+        if (tr == NULL)
+            goto fail;
+        tr->tr_node.io_Message.mn_Node.ln_Type = NT_REPLYMSG;
+        tr->tr_node.io_Message.mn_Length = sizeof (*tr);
+        if (OpenDevice(TIMERNAME, UNIT_MICROHZ, (struct IORequest *)tr, 0)) {
+            FreeMem(tr, sizeof (*tr));
+            goto fail;
+        }
+        timer_pool[slot] = tr;
+    }
+    timer_pool_busy = 0;
+
+    TimerBase = timer_pool[0]->tr_node.io_Device;
+    if (TimerBase->dd_Library.lib_Version >= 36) {
+        struct EClockVal ev;
+        eclock_freq = ReadEClock(&ev);
+        spin_calibrate();
+    }
+    return (0);
+
+fail:
+    timing_deinit();
+    return (ERROR_OPEN_FAIL);
+}
+
+void
+timing_deinit(void)
+{
+    uint slot;
+
+    eclock_freq = 0;
+    TimerBase = NULL;
+    for (slot = 0; slot < TIMER_POOL_SIZE; slot++) {
+        struct timerequest *tr = timer_pool[slot];
+        if (tr != NULL) {
+            CloseDevice((struct IORequest *)tr);
+            FreeMem(tr, sizeof (*tr));
+            timer_pool[slot] = NULL;
+        }
+    }
+}
+
+static int
+timer_pool_get(void)
+{
+    int slot;
+
+    Forbid();
+    for (slot = 0; slot < TIMER_POOL_SIZE; slot++) {
+        if ((timer_pool[slot] != NULL) &&
+            ((timer_pool_busy & BIT(slot)) == 0)) {
+            timer_pool_busy |= BIT(slot);
+            break;
+        }
+    }
+    Permit();
+    return ((slot < TIMER_POOL_SIZE) ? slot : -1);
+}
+
+static void
+timer_pool_put(int slot)
+{
+    Forbid();
+    timer_pool_busy &= ~BIT(slot);
+    Permit();
+}
+
 void
 delay(int usecs)
 {
     struct timerequest *tr;
     struct timeval tv;
+    struct MsgPort port;
+    int slot;
+
+    if (bsd_ilevel > 0) {
+        if (spin_loops_per_ms == 0)
+            printf("delay(%d): Interrupts disabled, using delay loop.\n",
+                   usecs);
+        spin_usecs(usecs);
+        return;
+    }
 
-    if(bsd_ilevel > 0) {
-        printf("delay(%d): Interrupts disabled, using delay loop.\n", usecs);
-        for (unsigned long i = 0; i < ((unsigned long)usecs << 3); i++)
-            asm("nop");
-	return;
+    if ((usecs <= SPIN_MAX_USECS) && (spin_loops_per_ms != 0)) {
+        spin_usecs(usecs);
+        return;
     }
 
+    tv.tv_secs  = usecs / 1000000;
+    tv.tv_micro = usecs % 1000000;
+
+    slot = timer_pool_get();
+    if (slot >= 0) {
+        tr = timer_pool[slot];
+        single_port_init(&port);
+        tr->tr_node.io_Message.mn_ReplyPort = &port;
+        wait_for_timer(tr, &tv);
+        timer_pool_put(slot);
+        return;
+    }
+
+    /* Pool not set up yet or all entries in use */
     if (usecs < 20000)
         tr = create_timer(UNIT_MICROHZ);
     else
@@ -136,8 +347,6 @@ delay(int usecs)
         return;
     }
 
-    tv.tv_secs  = usecs / 1000000;
-    tv.tv_micro = usecs % 1000000;
     wait_for_timer(tr, &tv);
     delete_timer(tr);
 }
@@ -270,7 +479,10 @@ callout_stop(callout_t *c)
 void
 callout_reset(callout_t *c, int ticks, void (*func)(void *), void *arg)
 {
+    if (ticks < 1)
+        ticks = 1;
     c->ticks = ticks;
+    c->co_new = 1;
     c->func = func;
     c->arg = arg;
 
@@ -292,19 +504,61 @@ callout_call(callout_t *c)
     c->func(c->arg);
 }
 
+/*
+ * callout_run_timeouts
+ * --------------------
+ * Charges the ticks elapsed in the timer interval which just ended to each
+ * pending callout, and calls those which have run out. A callout armed
+ * during the interval is not charged until the next one, so that it never
+ * fires early.
+ */
 void
-callout_run_timeouts(void)
+callout_run_timeouts(int elapsed)
 {
     callout_t *cur;
 
     for (cur = callout_head; cur != NULL; cur = cur->co_next) {
-        if (cur->ticks == 1) {
+        if ((cur->ticks == 0) || cur->co_new)
+            continue;
+        if (cur->ticks <= elapsed) {
             cur->ticks = 0;
             callout_call(cur);
-        } else if (cur->ticks != 0) {
-            cur->ticks -= TICKS_PER_SECOND;
-            if (cur->ticks < 1)
-                cur->ticks = 1;
+        } else {
+            cur->ticks -= elapsed;
         }
     }
 }
+
+/*
+ * callout_start_interval
+ * ----------------------
+ * Starts a new timer interval: callouts armed so far are charged at its
+ * end.
+ */
+void
+callout_start_interval(void)
+{
+    callout_t *cur;
+
+    for (cur = callout_head; cur != NULL; cur = cur->co_next)
+        cur->co_new = 0;
+}
+
+/*
+ * callout_next_timeout
+ * --------------------
+ * Returns the ticks until the first pending callout runs out, or 0 if no
+ * callout is pending.
+ */
+int
+callout_next_timeout(void)
+{
+    callout_t *cur;
+    int        ticks = 0;
+
+    for (cur = callout_head; cur != NULL; cur = cur->co_next) {
+        if ((cur->ticks != 0) && ((ticks == 0) || (cur->ticks < ticks)))
+            ticks = cur->ticks;
+    }
+    return (ticks);
+}
@@ -41,11 +41,20 @@ void bsd_splx();
 
 void delay(int usecs);
 
+struct MsgPort;
+int timing_init(void);
+void timing_deinit(void);
+uint64_t eclock_read(void);
+uint32_t eclock_usecs(uint64_t ticks);
+void single_port_init(struct MsgPort *port);
+extern uint32_t eclock_freq;
+
 #define __UNVOLATILE(x) ((void *)(unsigned long)(volatile void *)(x))
 #define __UNCONST(a) ((void *)(intptr_t)(a))
 
 #define B_WRITE         0x00000000      /* Write buffer (pseudo flag). */
 #define B_READ          0x00100000      /* Read buffer. */
+#define B_ORDERED       0x00000008      /* Barrier: ordered with other I/O */
 
 #define memcpy USE_CopyMem
 
@@ -79,8 +88,12 @@ void delay(int usecs);
      !defined(DEBUG_SCSICONF)    && \
      !defined(DEBUG_SCSIMSG)     && \
      !defined(DEBUG_SD)          && \
+     !defined(DEBUG_ST)          && \
      !defined(DEBUG_SIOP)        && \
+     !defined(DEBUG_TARGET)      && \
      !defined(DEBUG_BOOTMENU)    && \
+     !defined(DEBUG_MEMPOOL)     && \
+     !defined(DEBUG_BCACHE)      && \
      !defined(DEBUG_MOUNTER)) || defined(NO_SERIAL_OUTPUT)
 #ifdef USE_SERIAL_OUTPUT
 #undef USE_SERIAL_OUTPUT
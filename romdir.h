@@ -0,0 +1,58 @@
+#ifndef __ROMDIR_H
+#define __ROMDIR_H 1
+
+/*
+ * A4091 ROM layout
+ *
+ * The last 40 bytes of a 32k or 64k ROM hold the legacy table of contents
+ * written by rom.ld: the driver and two filesystem slots, followed by the
+ * signature. rom.S only ever looks at the driver entry there.
+ *
+ * romtool additionally writes a versioned directory right in front of the
+ * legacy TOC, listing up to ROMDIR_MAX_ENTRIES payloads:
+ *
+ *   entry[0] .. entry[n-1]      ROMDIR_ENTRY_SIZE bytes each
+ *   checksum                    sum of all entry longwords
+ *   version, entries            two 16 bit values
+ *   magic                       ROMDIR_MAGIC
+ *   legacy TOC                  ROM_TOC_SIZE bytes
+ *
+ * The legacy TOC is still filled in for the driver and the first two
+ * filesystems, so older drivers and boot code keep working with new
+ * images, and images without a directory are read through the legacy TOC.
+ * All values are big endian.
+ */
+
+#define ROM_SIGNATURE1          0xffff5352
+#define ROM_SIGNATURE2          0x2f434448
+#define ROM_TOC_SIZE            40
+
+#define ROMDIR_MAGIC            0x52444952  /* RDIR */
+#define ROMDIR_VERSION          1
+#define ROMDIR_MAX_ENTRIES      8
+#define ROMDIR_HEADER_SIZE      12
+#define ROMDIR_ENTRY_SIZE       24
+
+/* Offsets of the header fields, relative to the end of the ROM */
+#define ROMDIR_MAGIC_OFS        (ROM_TOC_SIZE + 4)
+#define ROMDIR_COUNT_OFS        (ROM_TOC_SIZE + 8)
+#define ROMDIR_CHECKSUM_OFS     (ROM_TOC_SIZE + 12)
+/* Offset of entry 0 relative to the end of the ROM */
+#define ROMDIR_ENTRIES_OFS(n)   (ROM_TOC_SIZE + ROMDIR_HEADER_SIZE + \
+                                 (n) * ROMDIR_ENTRY_SIZE)
+
+/* Payload types */
+#define ROMDIR_TYPE_DEVICE      1
+#define ROMDIR_TYPE_FILESYSTEM  2
+
+/* Directory entry, as stored in the ROM */
+struct romdir_entry {
+    uint32_t type;
+    uint32_t dostype;   /* filesystems only */
+    uint32_t offset;    /* from the start of the ROM */
+    uint32_t len;       /* stored (possibly compressed) length */
+    uint32_t size;      /* uncompressed length */
+    uint32_t checksum;  /* sum of the stored payload longwords */
+};
+
+#endif
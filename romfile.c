@@ -9,13 +9,20 @@
 #include "attach.h"
 #include "reloc.h"
 #include <resources/filesysres.h>
+#include <exec/semaphores.h>
+#include <dos/dos.h>
+#include <dos/dosextens.h>
 #include "version.h"
 #include "romfile.h"
+#include "romdir.h"
 
 extern const char cdfs_id_string[];
 
+/* Slot 0 is the driver, all following slots are filesystems */
 typedef struct {
-	uint32_t romfile[3], romfile_len[3], romfile_dostype[3];
+	int slots;
+	uint32_t romfile[ROMDIR_MAX_ENTRIES], romfile_len[ROMDIR_MAX_ENTRIES];
+	uint32_t romfile_dostype[ROMDIR_MAX_ENTRIES];
 } romfiles_t;
 
 static uint32_t RomFetch32(uint32_t offset)
@@ -30,33 +37,105 @@ static uint32_t RomFetch32(uint32_t offset)
     return ret;
 }
 
+/*
+ * parse_romdir
+ * ------------
+ * Read the payload directory written by romtool in front of the legacy
+ * TOC. Returns 0 if the ROM does not have a valid directory: one with a
+ * bad checksum or an entry reaching past the start of the directory is
+ * ignored, and the legacy TOC is used instead.
+ */
+static int parse_romdir(romfiles_t *rom, uint32_t romend)
+{
+    uint32_t count, base, dirstart, sum = 0;
+    int i, j;
+
+    if (RomFetch32(romend - ROMDIR_MAGIC_OFS) != ROMDIR_MAGIC)
+        return 0;
+    count = RomFetch32(romend - ROMDIR_COUNT_OFS);
+    if ((count >> 16) != ROMDIR_VERSION ||
+        (count & 0xffff) > ROMDIR_MAX_ENTRIES)
+        return 0;
+    count &= 0xffff;
+
+    dirstart = romend - ROMDIR_ENTRIES_OFS(count);
+    for (i = 0, base = dirstart; i < count; i++, base += ROMDIR_ENTRY_SIZE) {
+        uint32_t offset = RomFetch32(base + 8);
+        uint32_t len = RomFetch32(base + 12);
+
+        if (offset > dirstart || len > dirstart - offset) {
+            printf("ROM directory entry %d out of range\n", i);
+            return 0;
+        }
+        for (j = 0; j < ROMDIR_ENTRY_SIZE; j += 4)
+            sum += RomFetch32(base + j);
+    }
+    if (sum != RomFetch32(romend - ROMDIR_CHECKSUM_OFS)) {
+        printf("ROM directory checksum error\n");
+        return 0;
+    }
+
+    rom->slots = 1;
+    for (i = 0, base = dirstart; i < count; i++, base += ROMDIR_ENTRY_SIZE) {
+        uint32_t type = RomFetch32(base);
+        int slot;
+
+        if (type == ROMDIR_TYPE_DEVICE) {
+            slot = 0;
+        } else if (type == ROMDIR_TYPE_FILESYSTEM &&
+                   rom->slots < ROMDIR_MAX_ENTRIES) {
+            slot = rom->slots++;
+        } else {
+            continue;
+        }
+        rom->romfile_dostype[slot] = RomFetch32(base + 4);
+        rom->romfile[slot]         = RomFetch32(base + 8);
+        /* Uncompressed size, the Resident scan needs it */
+        rom->romfile_len[slot]     = RomFetch32(base + 16);
+    }
+    return 1;
+}
+
 static void parse_romfiles(romfiles_t *rom)
 {
-    int i;
+    int i, j;
 
+    rom->slots = 1;
     rom->romfile_len[0] = 0;
 
     for (i=1; i<=2; i++) {
+        uint32_t romend = i*32*1024;
+
         /* Look for end-of-rom signature */
-        if (RomFetch32((i*32*1024)-8) == 0xffff5352 &&
-                RomFetch32((i*32*1024)-4) == 0x2f434448) {
+        if (RomFetch32(romend - 8) == ROM_SIGNATURE1 &&
+                RomFetch32(romend - 4) == ROM_SIGNATURE2) {
+
+            if (parse_romdir(rom, romend))
+                break;
 
-            rom->romfile_len[0]=RomFetch32((i*32*1024) - 12);
+            /* Legacy TOC: driver plus two filesystem slots */
+            rom->romfile_len[0]=RomFetch32(romend - 12);
             if (rom->romfile_len[0])
-                rom->romfile[0]=RomFetch32((i*32*1024) - 16);
+                rom->romfile[0]=RomFetch32(romend - 16);
 
-            rom->romfile_len[1]=RomFetch32((i*32*1024) - 20);
+            rom->romfile_len[1]=RomFetch32(romend - 20);
             if (rom->romfile_len[1]) {
-                rom->romfile[1]=RomFetch32((i*32*1024) - 24);
-                rom->romfile_dostype[1]=RomFetch32((i*32*1024) - 28);
+                rom->romfile[1]=RomFetch32(romend - 24);
+                rom->romfile_dostype[1]=RomFetch32(romend - 28);
             }
 
-            rom->romfile_len[2]=RomFetch32((i*32*1024) - 32);
+            rom->romfile_len[2]=RomFetch32(romend - 32);
             if (rom->romfile_len[2]) {
-                rom->romfile[2]=RomFetch32((i*32*1024) - 36);
-                rom->romfile_dostype[2]=RomFetch32((i*32*1024) - 40);
+                rom->romfile[2]=RomFetch32(romend - 36);
+                rom->romfile_dostype[2]=RomFetch32(romend - 40);
             }
+            rom->slots = 3;
 
+            for (j=1; j<3; j++) {
+                if (rom->romfile_len[j] &&
+                    RomFetch32(rom->romfile[j]) == 0x524e4301)
+                    rom->romfile_len[j] = RomFetch32(rom->romfile[j] + 4);
+            }
             break;
         }
     }
@@ -65,15 +144,10 @@ static void parse_romfiles(romfiles_t *rom)
     if(rom->romfile_len[0]) {
         printf("  Driver @ 0x%05x (%d bytes)\n", rom->romfile[0], rom->romfile_len[0]);
 
-        for (i=1; i<3; i++) {
+        for (i=1; i<rom->slots; i++) {
             if(rom->romfile_len[i]) {
                 printf("  FS %d   @ 0x%05x (%d bytes): %08x\n", i, rom->romfile[i],
                             rom->romfile_len[i], rom->romfile_dostype[i]);
-                if (RomFetch32(rom->romfile[i]) == 0x524e4301) {
-                    rom->romfile_len[i] = RomFetch32(rom->romfile[i] + 4);
-                    printf("            compressed (%d bytes)\n",
-                                    rom->romfile_len[i]);
-                }
             } else
                 printf("  FS %d not found.\n", i);
         }
@@ -99,18 +173,219 @@ static void add_fs_from_kickstart(void)
     }
 }
 
+static struct Resident *find_resident(uint32_t fs_seglist, uint32_t len)
+{
+    uint32_t i;
+
+    for (i=fs_seglist; i<fs_seglist + len; i+=2) {
+        if(*(uint16_t *)i == 0x4afc)
+            return (struct Resident *)i;
+    }
+    return NULL;
+}
+
+static struct FileSysEntry *add_fse(uint32_t dostype, uint32_t fs_seglist)
+{
+    struct FileSysResource *FileSysResBase;
+    struct FileSysEntry *fse = NULL;
+
+    Forbid();
+    FileSysResBase = (struct FileSysResource *)OpenResource(FSRNAME);
+    if (FileSysResBase) {
+
+        fse = AllocMem(sizeof(struct FileSysEntry), MEMF_PUBLIC | MEMF_CLEAR);
+        if (fse) {
+            fse->fse_Node.ln_Name = (UBYTE*)cdfs_id_string;
+            fse->fse_DosType = dostype;
+            fse->fse_Version = ((LONG)DEVICE_VERSION) << 16 | DEVICE_REVISION;
+            fse->fse_PatchFlags = 0x190; // SegList and GlobalVec
+            fse->fse_SegList = fs_seglist >> 2;
+            fse->fse_GlobalVec = -1;
+            //fse->fse_StackSize = 5120;
+            fse->fse_StackSize = 16384; // Is there a right answer here?
+            fse->fse_Priority = 10;
+
+            AddHead(&FileSysResBase->fsr_FileSysEntries,&fse->fse_Node);
+	}
+    }
+    Permit();
+    return fse;
+}
+
+/*
+ * Lazily loaded ROM filesystems
+ * -----------------------------
+ * Instead of decompressing and relocating a filesystem at boot, a stub
+ * seglist is registered in FileSystem.resource. The first time DOS starts
+ * a handler from it, the stub loads the filesystem from ROM, points the
+ * FileSysEntry at the real seglist and jumps to the real entry point
+ * with all registers as they were. Later handlers started from the stub
+ * (partitions mounted before the load) jump there directly.
+ *
+ * The stub code is:
+ *      subq.l  #4,sp                   ; room for the entry point
+ *      movem.l d0-d7/a0-a6,-(sp)
+ *      move.l  #stub,-(sp)
+ *      jsr     romfs_load
+ *      addq.l  #4,sp
+ *      move.l  d0,60(sp)
+ *      movem.l (sp)+,d0-d7/a0-a6
+ *      rts                             ; "return" into the filesystem
+ */
+typedef struct {
+    ULONG   seg_size;       /* seglist header: allocation size in bytes */
+    BPTR    seg_next;       /* the seglist BPTR points here */
+    UWORD   code[16];
+    uint32_t offset;
+    uint32_t len;
+    uint32_t dostype;
+    struct FileSysEntry *fse;
+    void    *entry;
+} romfs_stub_t;
+
+static struct SignalSemaphore romfs_sem;
+
+/*
+ * romfs_fail
+ * ----------
+ * Handler entry used when a filesystem could not be loaded from ROM.
+ * Fails the startup packet so DOS does not wait forever.
+ */
+static void
+romfs_fail(void)
+{
+    struct Process *pr = (struct Process *)FindTask(NULL);
+    struct DosPacket *pkt;
+    struct MsgPort *port;
+    struct Message *msg;
+
+    WaitPort(&pr->pr_MsgPort);
+    msg = GetMsg(&pr->pr_MsgPort);
+    pkt = (struct DosPacket *)msg->mn_Node.ln_Name;
+    pkt->dp_Res1 = DOSFALSE;
+    pkt->dp_Res2 = ERROR_OBJECT_NOT_FOUND;
+    port = pkt->dp_Port;
+    pkt->dp_Port = &pr->pr_MsgPort;
+    PutMsg(port, pkt->dp_Link);
+}
+
+static void *
+romfs_load(romfs_stub_t *stub)
+{
+    uint32_t fs_seglist;
+    struct Resident *r;
+    BPTR seglist;
+
+    ObtainSemaphore(&romfs_sem);
+    if (stub->entry != NULL)
+        goto done;
+
+    printf("Loading ROM FS %08x\n", stub->dostype);
+    fs_seglist = relocate(stub->offset, (uint32_t)asave->as_addr);
+    if (fs_seglist == 0) {
+        stub->entry = romfs_fail;
+        goto done;
+    }
+    seglist = fs_seglist >> 2;
+
+    r = find_resident(fs_seglist, stub->len);
+    if (r != NULL && r->rt_Init) {
+        /*
+         * The filesystem registers itself. Use the entry it added for
+         * our DosType rather than the raw seglist.
+         */
+        struct FileSysResource *FileSysResBase;
+        struct FileSysEntry *fse;
+
+        InitResident(r, fs_seglist);
+        Forbid();
+        FileSysResBase = (struct FileSysResource *)OpenResource(FSRNAME);
+        if (FileSysResBase) {
+            for (fse = (struct FileSysEntry *)FileSysResBase->fsr_FileSysEntries.lh_Head;
+                 fse->fse_Node.ln_Succ;
+                 fse = (struct FileSysEntry *)fse->fse_Node.ln_Succ) {
+                if (fse != stub->fse && fse->fse_DosType == stub->dostype &&
+                    fse->fse_SegList) {
+                    seglist = fse->fse_SegList;
+                    break;
+                }
+            }
+        }
+        Permit();
+    }
+
+    Forbid();
+    stub->fse->fse_SegList = seglist;
+    Permit();
+    stub->entry = (void *)((uint32_t)BADDR(seglist) + 4);
+
+done:
+    ReleaseSemaphore(&romfs_sem);
+    return stub->entry;
+}
+
+static int add_lazy_romfilesystem(romfiles_t *rom, int slot)
+{
+    romfs_stub_t *stub;
+    uint32_t ctx, fn = (uint32_t)romfs_load;
+
+    stub = AllocMem(sizeof(*stub), MEMF_PUBLIC | MEMF_CLEAR);
+    if (stub == NULL)
+        return 0;
+
+    ctx = (uint32_t)stub;
+    stub->seg_size = sizeof(*stub);  /* Bytes, as LoadSeg() writes it */
+    stub->seg_next = 0;
+    stub->code[0]  = 0x598f;    /* subq.l  #4,sp */
+    stub->code[1]  = 0x48e7;    /* movem.l d0-d7/a0-a6,-(sp) */
+    stub->code[2]  = 0xfffe;
+    stub->code[3]  = 0x2f3c;    /* move.l  #stub,-(sp) */
+    stub->code[4]  = ctx >> 16;
+    stub->code[5]  = ctx;
+    stub->code[6]  = 0x4eb9;    /* jsr     romfs_load */
+    stub->code[7]  = fn >> 16;
+    stub->code[8]  = fn;
+    stub->code[9]  = 0x588f;    /* addq.l  #4,sp */
+    stub->code[10] = 0x2f40;    /* move.l  d0,60(sp) */
+    stub->code[11] = 0x003c;
+    stub->code[12] = 0x4cdf;    /* movem.l (sp)+,d0-d7/a0-a6 */
+    stub->code[13] = 0x7fff;
+    stub->code[14] = 0x4e75;    /* rts */
+    stub->offset   = rom->romfile[slot];
+    stub->len      = rom->romfile_len[slot];
+    stub->dostype  = rom->romfile_dostype[slot];
+
+    if (SysBase->LibNode.lib_Version >= 37)
+        CacheClearU();
+
+    stub->fse = add_fse(stub->dostype, (uint32_t)&stub->seg_next);
+    if (stub->fse == NULL) {
+        FreeMem(stub, sizeof(*stub));
+        return 0;
+    }
+    printf("ROM FS slot %d (%08x) registered, loaded on first use.\n",
+           slot, stub->dostype);
+    return 1;
+}
+
 static int add_romfilesystem(romfiles_t *rom, int slot)
 {
     uint32_t fs_seglist = 0;
     struct Resident *r = NULL;
-    struct FileSysResource *FileSysResBase;
-    struct FileSysEntry *fse = NULL;
 
-    int i;
+    if (rom->romfile_len[slot] == 0)
+        return 0;
+
+    /* Filesystems with a known DosType are only loaded when used */
+    if (rom->romfile_dostype[slot] != 0 &&
+        rom->romfile_dostype[slot] != 0xffffffff)
+        return add_lazy_romfilesystem(rom, slot);
+
     printf("Looking for FS in A4091 ROM slot %d... ", slot);
 
-    if (rom->romfile_len[slot])
-        fs_seglist = relocate(rom->romfile[slot], (uint32_t)asave->as_addr);
+    ObtainSemaphore(&romfs_sem);
+    fs_seglist = relocate(rom->romfile[slot], (uint32_t)asave->as_addr);
+    ReleaseSemaphore(&romfs_sem);
 
     printf("%sfound.\n", fs_seglist?"":"not ");
     // baserel does not like rErrno
@@ -118,13 +393,7 @@ static int add_romfilesystem(romfiles_t *rom, int slot)
         return 0;
 
     printf("Resident struct... ");
-    for (i=fs_seglist; i<fs_seglist + rom->romfile_len[slot]; i+=2) {
-        if(*(uint16_t *)i == 0x4afc) {
-            r = (struct Resident *)i;
-            break;
-        }
-    }
-
+    r = find_resident(fs_seglist, rom->romfile_len[slot]);
     printf("%sfound.\n", r?"":"not ");
 
     if (r != NULL) {
@@ -137,35 +406,17 @@ static int add_romfilesystem(romfiles_t *rom, int slot)
             printf("No rt_Init.\n");
     }
 
-    Forbid();
-    FileSysResBase = (struct FileSysResource *)OpenResource(FSRNAME);
-    if (FileSysResBase) {
-
-        fse = AllocMem(sizeof(struct FileSysEntry), MEMF_PUBLIC | MEMF_CLEAR);
-        if (fse) {
-            fse->fse_Node.ln_Name = (UBYTE*)cdfs_id_string;
-            fse->fse_DosType = rom->romfile_dostype[1];
-            fse->fse_Version = ((LONG)DEVICE_VERSION) << 16 | DEVICE_REVISION;
-            fse->fse_PatchFlags = 0x190; // SegList and GlobalVec
-            fse->fse_SegList = fs_seglist >> 2;
-            fse->fse_GlobalVec = -1;
-            //fse->fse_StackSize = 5120;
-            fse->fse_StackSize = 16384; // Is there a right answer here?
-            fse->fse_Priority = 10;
-
-            AddHead(&FileSysResBase->fsr_FileSysEntries,&fse->fse_Node);
-	}
-    }
-    Permit();
-    return (fse!=NULL);
+    return (add_fse(rom->romfile_dostype[slot], fs_seglist) != NULL);
 }
 
 void init_romfiles(void)
 {
 	romfiles_t rom;
+	int slot;
 
+	InitSemaphore(&romfs_sem);
 	parse_romfiles(&rom);
 	add_fs_from_kickstart();
-	add_romfilesystem(&rom, 1);
-	add_romfilesystem(&rom, 2);
+	for (slot = 1; slot < rom.slots; slot++)
+		add_romfilesystem(&rom, slot);
 }
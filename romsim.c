@@ -0,0 +1,824 @@
+/* A4091 romsim
+ *
+ * Runs the boot path of an A4091 ROM image (DiagEntry, _relocate and the
+ * RNC unpacker) on an emulated 68k CPU and reports how many cycles and
+ * memory accesses each phase costs for each payload in the ROM.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "m68k.h"
+#include "romdir.h"
+
+#define ROMSIM_VERSION "v0.1"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/*
+ * Emulated memory map
+ *
+ * 0x000000 - 0x1fffff  Chip RAM: ExecBase, LVO stubs, DiagArea copy, stack
+ * 0x200000 - 0x9fffff  Fast RAM: AllocMem() heap
+ * board base           A4091 nibble-wide ROM (see RomFetch in reloc.S)
+ * 0xdff000 - 0xdfffff  Custom chips (only COLOR00 writes are noticed)
+ * 0xf00000             Hypercall register, written by the LVO stubs
+ */
+#define CHIP_BASE       0x00000000
+#define CHIP_SIZE       0x00200000
+#define FAST_BASE       0x00200000
+#define FAST_SIZE       0x00800000
+#define BOARD_BASE_Z3   0x40000000
+#define BOARD_BASE_24   0x00a00000
+#define COLOR00         0x00dff180
+#define HYPERCALL       0x00f00000
+
+#define LVO_TABLE       0x00000d00
+#define EXECBASE        0x00001000
+#define NUM_LVOS        ((EXECBASE - LVO_TABLE) / 6)
+#define STUB_BASE       0x00002000
+#define STUB_HALT       (STUB_BASE + NUM_LVOS * 16)
+#define CONFIGDEV       0x00003000
+#define EXPANSIONBASE   0x00003400
+#define DIAG_COPY       0x00040000
+#define STACK_TOP       0x00100000
+
+#define LVO_ALLOCMEM    198
+#define LVO_FREEMEM     210
+#define MEMF_CLEAR      (1L << 16)
+
+#define ROM_DIAGAREA    0x80
+#define RNC_MAGIC       0x524e4301
+#define MAX_ALLOCS      256
+
+enum {
+	PHASE_DIAG,
+	PHASE_FETCH,
+	PHASE_UNPACK,
+	PHASE_RELOCATE,
+	PHASES
+};
+
+static const char *phase_names[PHASES] = {
+	"diag", "fetch", "unpack", "relocate"
+};
+
+struct counters {
+	uint64_t cycles;
+	uint64_t insns;
+	uint64_t rom_reads;
+	uint64_t ram_reads;
+	uint64_t ram_writes;
+	uint64_t other;
+};
+
+struct allocation {
+	uint32_t addr;
+	uint32_t size;
+	int live;
+};
+
+struct run {
+	const char *name;
+	uint32_t offset;
+	int compressed;
+	int phase;
+	uint32_t unpack_sp;
+	int halted;
+	int failed;
+	uint32_t result;
+	struct counters phase_count[PHASES];
+	struct allocation allocs[MAX_ALLOCS];
+	int num_allocs, num_frees;
+	uint32_t heap_top, heap_live, heap_peak;
+};
+
+static uint8_t chipmem[CHIP_SIZE];
+static uint8_t fastmem[FAST_SIZE];
+static uint8_t *rom;
+static uint32_t rom_len;
+static uint32_t board_base = BOARD_BASE_Z3;
+static uint32_t board_size;
+static uint32_t unpack_addr, relocate_addr;
+static struct run *cur;
+
+static uint32_t be32(const uint8_t *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint16_t be16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static uint32_t rom_get32(uint32_t offset)
+{
+	return be32(rom + offset);
+}
+
+/*
+ * Memory access callbacks for Musashi. Every access is accounted to the
+ * phase the run is currently in.
+ */
+static uint8_t *ram_ptr(uint32_t address)
+{
+	if (address < CHIP_BASE + CHIP_SIZE)
+		return &chipmem[address - CHIP_BASE];
+	if (address >= FAST_BASE && address < FAST_BASE + FAST_SIZE)
+		return &fastmem[address - FAST_BASE];
+	return NULL;
+}
+
+static unsigned int board_read8(uint32_t address)
+{
+	/*
+	 * The A4091 ROM is 8 bits wide but only visible one nibble at a
+	 * time: ROM byte n shows up in the upper nibble of board offsets
+	 * n * 4 (high nibble) and n * 4 + 2 (low nibble).
+	 */
+	uint32_t offset = address - board_base;
+	uint32_t n = offset >> 2;
+
+	if (offset & 1)
+		return 0xff;
+	if (offset & 2)
+		return (rom[n] << 4) | 0x0f;
+	return rom[n] | 0x0f;
+}
+
+unsigned int m68k_read_memory_8(unsigned int address)
+{
+	uint8_t *p = ram_ptr(address);
+
+	if (p) {
+		cur->phase_count[cur->phase].ram_reads++;
+		return *p;
+	}
+	if (address >= board_base && address < board_base + board_size) {
+		cur->phase_count[cur->phase].rom_reads++;
+		return board_read8(address);
+	}
+	cur->phase_count[cur->phase].other++;
+	return 0;
+}
+
+unsigned int m68k_read_memory_16(unsigned int address)
+{
+	uint8_t *p = ram_ptr(address);
+
+	if (p) {
+		cur->phase_count[cur->phase].ram_reads++;
+		return be16(p);
+	}
+	if (address >= board_base && address < board_base + board_size) {
+		cur->phase_count[cur->phase].rom_reads++;
+		return (board_read8(address) << 8) | board_read8(address + 1);
+	}
+	cur->phase_count[cur->phase].other++;
+	return 0;
+}
+
+unsigned int m68k_read_memory_32(unsigned int address)
+{
+	uint8_t *p = ram_ptr(address);
+
+	if (p) {
+		cur->phase_count[cur->phase].ram_reads++;
+		return be32(p);
+	}
+	if (address >= board_base && address < board_base + board_size) {
+		cur->phase_count[cur->phase].rom_reads++;
+		return (board_read8(address) << 24) |
+		       (board_read8(address + 1) << 16) |
+		       (board_read8(address + 2) << 8) |
+		       board_read8(address + 3);
+	}
+	cur->phase_count[cur->phase].other++;
+	return 0;
+}
+
+unsigned int m68k_read_disassembler_16(unsigned int address)
+{
+	uint8_t *p = ram_ptr(address);
+	return p ? be16(p) : 0;
+}
+
+unsigned int m68k_read_disassembler_32(unsigned int address)
+{
+	uint8_t *p = ram_ptr(address);
+	return p ? be32(p) : 0;
+}
+
+static void hypercall(unsigned int value);
+
+static void other_write(unsigned int address, unsigned int value)
+{
+	cur->phase_count[cur->phase].other++;
+	if (address == HYPERCALL)
+		hypercall(value);
+	else if (address == COLOR00)
+		cur->failed = 1;  /* rom.S shows its purple failure screen */
+}
+
+void m68k_write_memory_8(unsigned int address, unsigned int value)
+{
+	uint8_t *p = ram_ptr(address);
+
+	if (p) {
+		cur->phase_count[cur->phase].ram_writes++;
+		*p = value;
+		return;
+	}
+	other_write(address, value);
+}
+
+void m68k_write_memory_16(unsigned int address, unsigned int value)
+{
+	uint8_t *p = ram_ptr(address);
+
+	if (p) {
+		cur->phase_count[cur->phase].ram_writes++;
+		put16(p, value);
+		return;
+	}
+	other_write(address, value);
+}
+
+void m68k_write_memory_32(unsigned int address, unsigned int value)
+{
+	uint8_t *p = ram_ptr(address);
+
+	if (p) {
+		cur->phase_count[cur->phase].ram_writes++;
+		put32(p, value);
+		return;
+	}
+	other_write(address, value);
+}
+
+/*
+ * Fake exec.library. Only AllocMem() and FreeMem() are needed by the
+ * ROM boot path. The time spent inside Exec is not part of the numbers,
+ * only the calls are counted.
+ */
+static uint32_t fake_allocmem(uint32_t size, uint32_t flags)
+{
+	struct allocation *a;
+	uint32_t addr = (cur->heap_top + 7) & ~7;
+
+	if (cur->num_allocs == MAX_ALLOCS || size == 0 ||
+	    addr + size > FAST_BASE + FAST_SIZE)
+		return 0;
+
+	a = &cur->allocs[cur->num_allocs++];
+	a->addr = addr;
+	a->size = size;
+	a->live = 1;
+	cur->heap_top = addr + size;
+	cur->heap_live += size;
+	if (cur->heap_live > cur->heap_peak)
+		cur->heap_peak = cur->heap_live;
+
+	if (flags & MEMF_CLEAR)
+		memset(ram_ptr(addr), 0, size);
+	else
+		memset(ram_ptr(addr), 0xa5, size);  /* catch missing clears */
+
+	/* The first allocation ends the diag phase */
+	if (cur->phase == PHASE_DIAG)
+		cur->phase = cur->compressed ? PHASE_FETCH : PHASE_RELOCATE;
+
+	return addr;
+}
+
+static void fake_freemem(uint32_t addr, uint32_t size)
+{
+	int i;
+
+	cur->num_frees++;
+	for (i = 0; i < cur->num_allocs; i++) {
+		struct allocation *a = &cur->allocs[i];
+		if (a->addr == addr && a->live) {
+			if (a->size != size)
+				fprintf(stderr, "FreeMem(0x%08x, %u): allocated with "
+						"size %u\n", addr, size, a->size);
+			a->live = 0;
+			cur->heap_live -= a->size;
+			return;
+		}
+	}
+	fprintf(stderr, "FreeMem(0x%08x, %u): not allocated\n", addr, size);
+	cur->failed = 1;
+}
+
+static void hypercall(unsigned int value)
+{
+	uint32_t lvo = value * 6;
+
+	if (value == NUM_LVOS) {
+		cur->halted = 1;
+		return;
+	}
+
+	switch (lvo) {
+	case LVO_ALLOCMEM:
+		m68k_set_reg(M68K_REG_D0,
+			fake_allocmem(m68k_get_reg(NULL, M68K_REG_D0),
+				m68k_get_reg(NULL, M68K_REG_D1)));
+		break;
+	case LVO_FREEMEM:
+		fake_freemem(m68k_get_reg(NULL, M68K_REG_A1),
+				m68k_get_reg(NULL, M68K_REG_D0));
+		break;
+	default:
+		fprintf(stderr, "Unimplemented exec call -%d\n", lvo);
+		cur->failed = 1;
+		cur->halted = 1;
+		break;
+	}
+}
+
+static void setup_exec(void)
+{
+	int i;
+
+	memset(chipmem, 0, sizeof(chipmem));
+	put32(&chipmem[4], EXECBASE);
+
+	/* LVO n: jmp stub_n, stub_n: move.w #n,HYPERCALL / rts */
+	for (i = 1; i <= NUM_LVOS; i++) {
+		uint8_t *lvo = &chipmem[EXECBASE - i * 6];
+		uint8_t *stub = &chipmem[STUB_BASE + i * 16];
+		put16(lvo, 0x4ef9);
+		put32(lvo + 2, STUB_BASE + i * 16);
+		put16(stub, 0x33fc);
+		put16(stub + 2, i);
+		put32(stub + 4, HYPERCALL);
+		put16(stub + 8, 0x4e75);
+	}
+	/* Halt stub: the return address of every run */
+	put16(&chipmem[STUB_HALT], 0x33fc);
+	put16(&chipmem[STUB_HALT + 2], NUM_LVOS);
+	put32(&chipmem[STUB_HALT + 4], HYPERCALL);
+	put16(&chipmem[STUB_HALT + 8], 0x4e75);
+
+	chipmem[EXECBASE + 20] = 0;   /* lib_Version: 40 */
+	chipmem[EXECBASE + 21] = 40;
+}
+
+/*
+ * Symbols are not available in a ROM image, so the relocator entry
+ * points are found by looking for their first instructions inside the
+ * DiagArea copy.
+ */
+static uint32_t find_pattern(uint32_t start, uint32_t end,
+		const uint16_t *pattern, int words)
+{
+	uint32_t i;
+	int j;
+
+	for (i = start; i + words * 2 <= end; i += 2) {
+		for (j = 0; j < words; j++)
+			if (be16(rom + i + j * 2) != pattern[j])
+				break;
+		if (j == words)
+			return i;
+	}
+	return 0;
+}
+
+static uint32_t bsr_target(uint32_t offset)
+{
+	uint16_t op = be16(rom + offset);
+	int32_t disp;
+
+	if ((op & 0xff00) != 0x6100)
+		return 0;
+	disp = (int8_t)(op & 0xff);
+	if (disp == 0)
+		disp = (int16_t)be16(rom + offset + 2);
+	else if (disp == -1)
+		disp = (int32_t)be32(rom + offset + 2);
+	return offset + 2 + disp;
+}
+
+static int find_symbols(uint32_t diag_len)
+{
+	static const uint16_t unpack[] = { 0x48e7, 0xfffe, 0x4fef, 0xfe80 };
+	static const uint16_t inithandle[] = { 0x48e7, 0x00c0, 0xe588, 0x43fa };
+	static const uint16_t rnccheck[] = { 0x0c80, 0x524e, 0x4301 };
+	uint32_t start = ROM_DIAGAREA, end = ROM_DIAGAREA + diag_len;
+	uint32_t u, ih, cmp, e;
+
+	u = find_pattern(start, end, unpack, 4);
+	ih = find_pattern(start, end, inithandle, 4);
+	cmp = find_pattern(start, end, rnccheck, 3);
+	if (!u || !ih || !cmp)
+		return -1;
+
+	/* _relocate: bsr InitHandle, bsr RomFetch32, cmp.l #RNC_MAGIC,d0 */
+	for (e = cmp - 8; e < cmp; e += 2)
+		if (bsr_target(e) == ih)
+			break;
+	if (e == cmp)
+		return -1;
+
+	unpack_addr = DIAG_COPY + u - ROM_DIAGAREA;
+	relocate_addr = DIAG_COPY + e - ROM_DIAGAREA;
+	return 0;
+}
+
+static void execute(struct run *r, uint32_t pc, uint64_t max_insns)
+{
+	uint32_t sp = STACK_TOP - 4;
+	uint64_t insns = 0;
+
+	put32(&chipmem[sp], STUB_HALT);
+	m68k_set_reg(M68K_REG_A7, sp);
+	m68k_set_reg(M68K_REG_A6, EXECBASE);
+	m68k_set_reg(M68K_REG_PC, pc);
+
+	while (!r->halted) {
+		uint32_t now = m68k_get_reg(NULL, M68K_REG_PC);
+		uint32_t a7 = m68k_get_reg(NULL, M68K_REG_A7);
+		int cycles;
+
+		if (now == unpack_addr && r->phase != PHASE_UNPACK) {
+			r->unpack_sp = a7;
+			r->phase = PHASE_UNPACK;
+		} else if (r->phase == PHASE_UNPACK && a7 > r->unpack_sp) {
+			r->phase = PHASE_RELOCATE;
+		}
+
+		cycles = m68k_execute(1);
+		r->phase_count[r->phase].cycles += cycles;
+		r->phase_count[r->phase].insns++;
+
+		if (++insns == max_insns) {
+			fprintf(stderr, "%s: no return after %llu instructions, "
+					"PC=0x%08x\n", r->name,
+					(unsigned long long)insns, now);
+			r->failed = 1;
+			break;
+		}
+	}
+	r->result = m68k_get_reg(NULL, M68K_REG_D0);
+}
+
+static void start_run(struct run *r, const char *name, uint32_t offset,
+		uint16_t diag_len)
+{
+	memset(r, 0, sizeof(*r));
+	r->name = name;
+	r->offset = offset;
+	r->compressed = (rom_get32(offset) == RNC_MAGIC);
+	r->heap_top = FAST_BASE;
+	cur = r;
+
+	setup_exec();
+	memcpy(&chipmem[DIAG_COPY], rom + ROM_DIAGAREA, diag_len);
+}
+
+/*
+ * Boot the ROM the way expansion.library does: copy the DiagArea to RAM
+ * and call da_DiagPoint with the board, the copy and ConfigDev in
+ * a0/a2/a3. This relocates a4091.device.
+ */
+static void run_diag(struct run *r, uint32_t device_offset, uint16_t diag_len,
+		uint64_t max_insns)
+{
+	uint16_t diag_point = be16(rom + ROM_DIAGAREA + 4);
+
+	start_run(r, "a4091.device", device_offset, diag_len);
+	m68k_set_reg(M68K_REG_A0, board_base);
+	m68k_set_reg(M68K_REG_A2, DIAG_COPY);
+	m68k_set_reg(M68K_REG_A3, CONFIGDEV);
+	m68k_set_reg(M68K_REG_A5, EXPANSIONBASE);
+	execute(r, DIAG_COPY + diag_point, max_insns);
+	if (r->result == 0)
+		r->failed = 1;
+}
+
+/*
+ * Load a filesystem the way romfile.c does, by calling relocate() with
+ * the offset of the payload in the ROM.
+ */
+static void run_relocate(struct run *r, const char *name, uint32_t offset,
+		uint16_t diag_len, uint64_t max_insns)
+{
+	start_run(r, name, offset, diag_len);
+	m68k_set_reg(M68K_REG_D0, offset);
+	m68k_set_reg(M68K_REG_A0, board_base);
+	execute(r, relocate_addr, max_insns);
+	if (r->result == 0)
+		r->failed = 1;
+}
+
+static double to_ms(uint64_t cycles, double mhz)
+{
+	return (double)cycles / (mhz * 1000.0);
+}
+
+static void report(struct run *r, int waitstates, double mhz, int quiet)
+{
+	struct counters total;
+	uint64_t est;
+	int i;
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < PHASES; i++) {
+		total.cycles += r->phase_count[i].cycles;
+		total.insns += r->phase_count[i].insns;
+		total.rom_reads += r->phase_count[i].rom_reads;
+		total.ram_reads += r->phase_count[i].ram_reads;
+		total.ram_writes += r->phase_count[i].ram_writes;
+		total.other += r->phase_count[i].other;
+	}
+	est = total.cycles + total.rom_reads * waitstates;
+
+	if (quiet) {
+		printf("%s %s %llu %llu %llu %.3f\n", r->name,
+				r->failed ? "FAIL" : "OK",
+				(unsigned long long)total.cycles,
+				(unsigned long long)total.insns,
+				(unsigned long long)total.rom_reads,
+				to_ms(est, mhz));
+		return;
+	}
+
+	printf("%s: offset = 0x%06x %s: %s (d0 = 0x%08x)\n", r->name, r->offset,
+			r->compressed ? "compressed" : "uncompressed",
+			r->failed ? "FAILED" : "OK", r->result);
+	printf(" phase          cycles      insns   rom rd   ram rd   ram wr"
+			"       ms\n");
+	for (i = 0; i < PHASES; i++) {
+		struct counters *c = &r->phase_count[i];
+		if (c->insns == 0)
+			continue;
+		printf(" %-8s %12llu %10llu %8llu %8llu %8llu %8.3f\n",
+				phase_names[i],
+				(unsigned long long)c->cycles,
+				(unsigned long long)c->insns,
+				(unsigned long long)c->rom_reads,
+				(unsigned long long)c->ram_reads,
+				(unsigned long long)c->ram_writes,
+				to_ms(c->cycles + c->rom_reads * waitstates, mhz));
+	}
+	printf(" %-8s %12llu %10llu %8llu %8llu %8llu %8.3f\n", "total",
+			(unsigned long long)total.cycles,
+			(unsigned long long)total.insns,
+			(unsigned long long)total.rom_reads,
+			(unsigned long long)total.ram_reads,
+			(unsigned long long)total.ram_writes,
+			to_ms(est, mhz));
+	printf(" AllocMem: %d calls, FreeMem: %d calls, peak %u bytes, "
+			"%u bytes resident\n\n", r->num_allocs, r->num_frees,
+			r->heap_peak, r->heap_live);
+}
+
+static uint8_t *load_rom(const char *filename, uint32_t *len)
+{
+	struct stat buf;
+	uint8_t *image;
+	int fd = open(filename, O_RDONLY | O_BINARY);
+
+	if (fd == -1) {
+		perror("Could not open file");
+		exit(EXIT_FAILURE);
+	}
+	if (fstat(fd, &buf) == -1) {
+		perror("Could not stat file");
+		exit(EXIT_FAILURE);
+	}
+	if (buf.st_size != 32 * 1024 && buf.st_size != 64 * 1024) {
+		printf("A4091 ROM file needs to be 32k or 64k in size\n");
+		exit(EXIT_FAILURE);
+	}
+	image = malloc(buf.st_size);
+	if (!image) {
+		printf("Out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (read(fd, image, buf.st_size) != buf.st_size) {
+		perror("Could not read file");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	*len = buf.st_size;
+	return image;
+}
+
+static const struct {
+	const char *name;
+	unsigned int type;
+	int addr24;
+} cpus[] = {
+	{ "68000", M68K_CPU_TYPE_68000, 1 },
+	{ "68010", M68K_CPU_TYPE_68010, 1 },
+	{ "68020", M68K_CPU_TYPE_68020, 0 },
+	{ "68030", M68K_CPU_TYPE_68030, 0 },
+	{ "68040", M68K_CPU_TYPE_68040, 0 },
+	{ NULL, 0, 0 }
+};
+
+static void print_version(void)
+{
+	printf("romsim %s\n\n", ROMSIM_VERSION);
+}
+
+static void print_usage(const char *name)
+{
+	printf("Usage: %s [-vh?] <filename>\n", name);
+	printf("\n"
+	       "   -c | --cpu <68000|68010|68020|68030|68040> CPU to emulate (68020)\n"
+	       "   -f | --clock <MHz>                    CPU clock for ms figures (25)\n"
+	       "   -w | --waitstates <n>                 extra cycles per ROM access (0)\n"
+	       "   -m | --max <n>                        instruction limit per payload\n"
+	       "   -q | --quiet                          one line per payload\n"
+	       "   -v | --version:                       print the version\n"
+	       "   -h | --help:                          print this help\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct run run;
+	int cpu = 2, waitstates = 0, quiet = 0, failed = 0, i;
+	double mhz = 25.0;
+	uint64_t max_insns = 100000000;
+	uint32_t end, device_offset, diag_len;
+
+	int opt, option_index = 0;
+	static const struct option long_options[] = {
+		{"cpu", 1, NULL, 'c'},
+		{"clock", 1, NULL, 'f'},
+		{"waitstates", 1, NULL, 'w'},
+		{"max", 1, NULL, 'm'},
+		{"quiet", 0, NULL, 'q'},
+		{"version", 0, NULL, 'v'},
+		{"help", 0, NULL, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	while ((opt = getopt_long(argc, argv, "c:f:w:m:qvh?",
+					long_options, &option_index)) != EOF) {
+		switch (opt) {
+		case 'c':
+			for (cpu = 0; cpus[cpu].name; cpu++)
+				if (!strcmp(cpus[cpu].name, optarg))
+					break;
+			if (!cpus[cpu].name) {
+				printf("Unsupported CPU %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'f':
+			mhz = strtod(optarg, NULL);
+			if (mhz <= 0) {
+				printf("Invalid clock %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'w':
+			waitstates = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			max_insns = strtoull(optarg, NULL, 0);
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		case 'v':
+			print_version();
+			exit(EXIT_SUCCESS);
+			break;
+		case 'h':
+		case '?':
+		default:
+			print_usage(argv[0]);
+			exit(EXIT_SUCCESS);
+			break;
+		}
+	}
+
+	if (optind + 1 != argc) {
+		fprintf(stderr, "You need to specify a file.\n\n");
+		fprintf(stderr, "run '%s -h' for usage\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	rom = load_rom(argv[optind], &rom_len);
+	end = rom_len;
+	if (rom_get32(end - 8) != ROM_SIGNATURE1 || rom_get32(end - 4) != ROM_SIGNATURE2) {
+		printf("%s: ROM signature not found\n", argv[optind]);
+		exit(EXIT_FAILURE);
+	}
+	device_offset = rom_get32(end - 16);
+	diag_len = be16(rom + ROM_DIAGAREA + 2);
+	if (rom_get32(end - 12) == 0) {
+		printf("%s: no a4091.device in ROM\n", argv[optind]);
+		exit(EXIT_FAILURE);
+	}
+	if (find_symbols(diag_len)) {
+		printf("%s: could not find relocator in DiagArea\n", argv[optind]);
+		exit(EXIT_FAILURE);
+	}
+	if (cpus[cpu].addr24)
+		board_base = BOARD_BASE_24;
+	board_size = rom_len * 4;
+
+	m68k_init();
+	m68k_set_cpu_type(cpus[cpu].type);
+
+	if (!quiet)
+		printf("%s: %dkB A4091 ROM image, %s @ %.2f MHz, "
+				"%d ROM wait states\n\n", argv[optind], rom_len / 1024,
+				cpus[cpu].name, mhz, waitstates);
+
+	start_run(&run, "reset", 0, diag_len);
+	m68k_pulse_reset();
+	run_diag(&run, device_offset, diag_len, max_insns);
+	report(&run, waitstates, mhz, quiet);
+	failed |= run.failed;
+
+	/* Filesystem slots, see parse_romfiles() in romfile.c */
+	if (rom_get32(end - ROMDIR_MAGIC_OFS) == ROMDIR_MAGIC &&
+	    (rom_get32(end - ROMDIR_COUNT_OFS) >> 16) == ROMDIR_VERSION) {
+		int entries = rom_get32(end - ROMDIR_COUNT_OFS) & 0xffff;
+		uint32_t base = end - ROMDIR_ENTRIES_OFS(entries);
+		int fs = 1;
+
+		for (i = 0; i < entries; i++, base += ROMDIR_ENTRY_SIZE) {
+			char name[24];
+
+			if (rom_get32(base) != ROMDIR_TYPE_FILESYSTEM)
+				continue;
+			snprintf(name, sizeof(name), "filesystem%d", fs++);
+			run_relocate(&run, name, rom_get32(base + 8), diag_len,
+					max_insns);
+			report(&run, waitstates, mhz, quiet);
+			failed |= run.failed;
+		}
+	} else {
+		for (i = 0; i < 2; i++) {
+			static const char *names[] = { "filesystem1", "filesystem2" };
+			uint32_t len = rom_get32(end - 20 - i * 12);
+			uint32_t offset = rom_get32(end - 24 - i * 12);
+
+			if (len == 0)
+				continue;
+			run_relocate(&run, names[i], offset, diag_len, max_insns);
+			report(&run, waitstates, mhz, quiet);
+			failed |= run.failed;
+		}
+	}
+
+	free(rom);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
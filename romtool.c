@@ -36,17 +36,15 @@
 #include <sys/stat.h>
 #include <arpa/inet.h>
 
-#define ROMTOOL_VERSION "v0.2 (2023-11-22)"
+#include "romdir.h"
+
+#define ROMTOOL_VERSION "v0.3 (2026-10-18)"
 
 #ifndef O_BINARY
 #define O_BINARY 0
 #endif
 
-enum {
-	DEVICE,
-	FILESYSTEM1,
-	FILESYSTEM2
-};
+#define MAX_FILESYSTEMS (ROMDIR_MAX_ENTRIES - 1)
 
 struct file {
 	char *addr;
@@ -60,6 +58,16 @@ struct rom_inventory {
 	uint32_t signature[2];
 };
 
+/* Everything stored in a ROM image behind the AutoConfig header */
+struct rom_contents {
+	uint32_t header_len;
+	int has_directory;
+	struct file device;
+	int filesystems;
+	struct file filesystem[MAX_FILESYSTEMS];
+	uint32_t dostype[MAX_FILESYSTEMS];
+};
+
 int is_compressed(char *image)
 {
 	uint32_t *file = (uint32_t *)image;
@@ -68,13 +76,98 @@ int is_compressed(char *image)
 	return (ntohl(file[0]) == 0x524e4301);
 }
 
-void inventory(char *filename, struct file *rom)
+uint32_t uncompressed_size(struct file *file)
 {
-	struct rom_inventory *inv = (struct rom_inventory *)(rom->addr + rom->len -
+	uint32_t *data = (uint32_t *)file->addr;
+	if (file->len >= 8 && ntohl(data[0]) == 0x524e4301)
+		return ntohl(data[1]);
+	return file->len;
+}
+
+uint32_t checksum(char *addr, size_t len)
+{
+	uint32_t *data = (uint32_t *)addr, sum = 0;
+	size_t i;
+
+	for (i = 0; i < len / 4; i++)
+		sum += ntohl(data[i]);
+	return sum;
+}
+
+uint32_t rom_get32(struct file *rom, uint32_t end_offset)
+{
+	return ntohl(*(uint32_t *)(rom->addr + rom->len - end_offset));
+}
+
+void rom_put32(struct file *rom, uint32_t end_offset, uint32_t val)
+{
+	*(uint32_t *)(rom->addr + rom->len - end_offset) = htonl(val);
+}
+
+struct rom_inventory *rom_toc(struct file *rom)
+{
+	return (struct rom_inventory *)(rom->addr + rom->len -
 			sizeof(struct rom_inventory));
+}
+
+int has_signature(struct file *rom)
+{
+	struct rom_inventory *inv = rom_toc(rom);
+
+	return ntohl(inv->signature[0]) == ROM_SIGNATURE1 &&
+		ntohl(inv->signature[1]) == ROM_SIGNATURE2;
+}
+
+int directory_entries(struct file *rom)
+{
+	int entries;
+
+	if (rom_get32(rom, ROMDIR_MAGIC_OFS) != ROMDIR_MAGIC)
+		return -1;
+	if ((rom_get32(rom, ROMDIR_COUNT_OFS) >> 16) != ROMDIR_VERSION) {
+		printf("Unknown ROM directory version %d, ignoring it.\n",
+				rom_get32(rom, ROMDIR_COUNT_OFS) >> 16);
+		return -1;
+	}
+	entries = rom_get32(rom, ROMDIR_COUNT_OFS) & 0xffff;
+	if (entries > ROMDIR_MAX_ENTRIES)
+		return -1;
+	return entries;
+}
+
+struct romdir_entry *directory_entry(struct file *rom, int entries, int num)
+{
+	return (struct romdir_entry *)(rom->addr + rom->len -
+			ROMDIR_ENTRIES_OFS(entries) + num * ROMDIR_ENTRY_SIZE);
+}
 
-	if (ntohl(inv->signature[0]) != 0xFFFF5352 ||
-		ntohl(inv->signature[1]) != 0x2F434448) {
+int directory_size(int entries)
+{
+	return ROMDIR_HEADER_SIZE + entries * ROMDIR_ENTRY_SIZE;
+}
+
+int free_space(struct rom_contents *contents, size_t romlen)
+{
+	int i, entries = 0, freebytes;
+
+	freebytes = romlen - sizeof(struct rom_inventory) - contents->header_len;
+	if (contents->device.len) {
+		freebytes -= contents->device.len;
+		entries++;
+	}
+	for (i = 0; i < contents->filesystems; i++) {
+		freebytes -= contents->filesystem[i].len;
+		entries++;
+	}
+	return freebytes - directory_size(entries);
+}
+
+void inventory(char *filename, struct file *rom)
+{
+	struct rom_inventory *inv = rom_toc(rom);
+	int i, entries, freebytes;
+
+	if (!has_signature(rom)) {
 		printf("%s: %dkB A4091 ROM image. Signature: %08x%08x (INVALID)\n\n",
 			filename, (rom->len==32768) ? 32:64,
 			ntohl(inv->signature[0]), ntohl(inv->signature[1]));
@@ -85,34 +178,67 @@ void inventory(char *filename, struct file *rom)
 
 	printf(" ROM header:   offset = 0x000000 length = 0x%06x\n",
 			ntohl(inv->device_offset));
-	printf(" a4091.device: offset = 0x%06x length = 0x%06x ",
-			ntohl(inv->device_offset), ntohl(inv->device_len));
-	is_compressed(rom->addr + ntohl(inv->device_offset));
-
-	if (ntohl(inv->filesystem1_len)) {
-		printf("\n FileSystem 1: offset = 0x%06x length = 0x%06x ",
-				ntohl(inv->filesystem1_offset), ntohl(inv->filesystem1_len));
-		is_compressed(rom->addr + ntohl(inv->filesystem1_offset));
-		printf("\n               DosType = 0x%08x", ntohl(inv->filesystem1_dostype));
-	} else
-		printf("\n FileSystem 1: <empty>");
-
-	if (ntohl(inv->filesystem2_len)) {
-		printf("\n FileSystem 2: offset = 0x%06x length = 0x%06x ",
-			ntohl(inv->filesystem2_offset), ntohl(inv->filesystem2_len));
-		is_compressed(rom->addr + ntohl(inv->filesystem2_offset));
-		printf("\n               DosType = 0x%08x", ntohl(inv->filesystem2_dostype));
-	} else
-		printf("\n FileSystem 2: <empty>");
-	printf("\n\n");
-
-	int freebytes = rom->len - sizeof(struct rom_inventory) - ntohl(inv->device_offset);
-	if (inv->filesystem1_len)
+
+	entries = directory_entries(rom);
+	if (entries < 0) {
+		/* Legacy image without a directory */
+		printf(" a4091.device: offset = 0x%06x length = 0x%06x ",
+				ntohl(inv->device_offset), ntohl(inv->device_len));
+		is_compressed(rom->addr + ntohl(inv->device_offset));
+
+		if (ntohl(inv->filesystem1_len)) {
+			printf("\n FileSystem 1: offset = 0x%06x length = 0x%06x ",
+					ntohl(inv->filesystem1_offset), ntohl(inv->filesystem1_len));
+			is_compressed(rom->addr + ntohl(inv->filesystem1_offset));
+			printf("\n               DosType = 0x%08x", ntohl(inv->filesystem1_dostype));
+		} else
+			printf("\n FileSystem 1: <empty>");
+
+		if (ntohl(inv->filesystem2_len)) {
+			printf("\n FileSystem 2: offset = 0x%06x length = 0x%06x ",
+				ntohl(inv->filesystem2_offset), ntohl(inv->filesystem2_len));
+			is_compressed(rom->addr + ntohl(inv->filesystem2_offset));
+			printf("\n               DosType = 0x%08x", ntohl(inv->filesystem2_dostype));
+		} else
+			printf("\n FileSystem 2: <empty>");
+		printf("\n\n");
+
+		freebytes = rom->len - sizeof(struct rom_inventory) - ntohl(inv->device_offset);
 		freebytes -= ntohl(inv->filesystem1_len);
-	if (inv->filesystem2_len)
 		freebytes -= ntohl(inv->filesystem2_len);
-	if (inv->device_len)
 		freebytes -= ntohl(inv->device_len);
+	} else {
+		uint32_t sum = 0, used = ntohl(inv->device_offset);
+		int fs = 1;
+
+		for (i = 0; i < entries; i++) {
+			struct romdir_entry *e = directory_entry(rom, entries, i);
+			uint32_t offset = ntohl(e->offset), len = ntohl(e->len);
+			int ok = offset + len <= rom->len &&
+				checksum(rom->addr + offset, len) == ntohl(e->checksum);
+
+			if (ntohl(e->type) == ROMDIR_TYPE_DEVICE)
+				printf(" a4091.device: ");
+			else
+				printf(" FileSystem %d: ", fs++);
+			printf("offset = 0x%06x length = 0x%06x ", offset, len);
+			is_compressed(rom->addr + offset);
+			if (ntohl(e->type) == ROMDIR_TYPE_FILESYSTEM)
+				printf("\n               DosType = 0x%08x",
+						ntohl(e->dostype));
+			printf("%s\n", ok ? "" : " (CHECKSUM ERROR)");
+
+			sum += ntohl(e->type) + ntohl(e->dostype) + offset +
+				len + ntohl(e->size) + ntohl(e->checksum);
+			used += len;
+		}
+		printf("\n ROM directory: version %d, %d entries, %d bytes%s\n\n",
+				ROMDIR_VERSION, entries, directory_size(entries),
+				sum == rom_get32(rom, ROMDIR_CHECKSUM_OFS) ?
+				"" : " (CHECKSUM ERROR)");
+		freebytes = rom->len - sizeof(struct rom_inventory) - used -
+			directory_size(entries);
+	}
 
 	printf(" %d bytes free (%2.2f%%)\n\n", freebytes, (float)freebytes/(float)rom->len * 100 );
 }
@@ -131,28 +257,137 @@ char *file_backup(char *addr, size_t len)
 	return backup;
 }
 
-int resize(struct file *rom, int newsize)
+void read_contents(struct file *rom, struct rom_contents *contents)
+{
+	struct rom_inventory *inv = rom_toc(rom);
+	int i, entries = directory_entries(rom);
+
+	memset(contents, 0, sizeof(*contents));
+	contents->header_len = ntohl(inv->device_offset);
+
+	if (entries < 0) {
+		contents->device.addr = file_backup(rom->addr+ntohl(inv->device_offset), ntohl(inv->device_len));
+		contents->device.len = ntohl(inv->device_len);
+		if (ntohl(inv->filesystem1_len)) {
+			contents->filesystem[0].addr = file_backup(rom->addr+ntohl(inv->filesystem1_offset), ntohl(inv->filesystem1_len));
+			contents->filesystem[0].len = ntohl(inv->filesystem1_len);
+			contents->dostype[0] = ntohl(inv->filesystem1_dostype);
+			contents->filesystems = 1;
+		}
+		if (ntohl(inv->filesystem2_len)) {
+			i = contents->filesystems++;
+			contents->filesystem[i].addr = file_backup(rom->addr+ntohl(inv->filesystem2_offset), ntohl(inv->filesystem2_len));
+			contents->filesystem[i].len = ntohl(inv->filesystem2_len);
+			contents->dostype[i] = ntohl(inv->filesystem2_dostype);
+		}
+		return;
+	}
+
+	contents->has_directory = 1;
+	for (i = 0; i < entries; i++) {
+		struct romdir_entry *e = directory_entry(rom, entries, i);
+		struct file *f;
+
+		if (ntohl(e->type) == ROMDIR_TYPE_DEVICE) {
+			f = &contents->device;
+		} else if (contents->filesystems < MAX_FILESYSTEMS) {
+			contents->dostype[contents->filesystems] = ntohl(e->dostype);
+			f = &contents->filesystem[contents->filesystems++];
+		} else {
+			continue;
+		}
+		f->addr = file_backup(rom->addr + ntohl(e->offset), ntohl(e->len));
+		f->len = ntohl(e->len);
+	}
+}
+
+/*
+ * Pack all payloads back to back behind the ROM header, then write the
+ * directory and the legacy TOC in front of the signature.
+ */
+int write_contents(struct file *rom, struct rom_contents *contents)
+{
+	struct rom_inventory *inv = rom_toc(rom);
+	uint32_t offset = contents->header_len, sum = 0;
+	int i, entries = 0, freebytes = free_space(contents, rom->len);
+
+	if (freebytes < 0) {
+		printf("Files can not fit into image (%d bytes too big)\n",
+				-freebytes);
+		return -1;
+	}
+
+	memset(rom->addr + offset, 0xff, rom->len - offset - sizeof(struct rom_inventory));
+
+	inv->device_offset = htonl(offset);
+	inv->device_len = 0;
+	inv->filesystem1_dostype = htonl(0xffffffff);
+	inv->filesystem1_offset = 0;
+	inv->filesystem1_len = 0;
+	inv->filesystem2_dostype = htonl(0xffffffff);
+	inv->filesystem2_offset = 0;
+	inv->filesystem2_len = 0;
+	inv->signature[0] = htonl(ROM_SIGNATURE1);
+	inv->signature[1] = htonl(ROM_SIGNATURE2);
+
+	if (contents->device.len)
+		entries++;
+	entries += contents->filesystems;
+
+	for (i = -1; i < contents->filesystems; i++) {
+		struct file *f = (i < 0) ? &contents->device : &contents->filesystem[i];
+		uint32_t dostype = (i < 0) ? 0 : contents->dostype[i];
+		struct romdir_entry *e;
+		int num = (i < 0) ? 0 : i + !!contents->device.len;
+
+		if (!f->len)
+			continue;
+
+		memcpy(rom->addr + offset, f->addr, f->len);
+
+		e = directory_entry(rom, entries, num);
+		e->type = htonl((i < 0) ? ROMDIR_TYPE_DEVICE : ROMDIR_TYPE_FILESYSTEM);
+		e->dostype = htonl(dostype);
+		e->offset = htonl(offset);
+		e->len = htonl(f->len);
+		e->size = htonl(uncompressed_size(f));
+		e->checksum = htonl(checksum(f->addr, f->len));
+		sum += ntohl(e->type) + dostype + offset + f->len +
+			ntohl(e->size) + ntohl(e->checksum);
+
+		/* Keep the legacy TOC valid for older boot code */
+		if (i < 0) {
+			inv->device_len = htonl(f->len);
+		} else if (i == 0) {
+			inv->filesystem1_dostype = htonl(dostype);
+			inv->filesystem1_offset = htonl(offset);
+			inv->filesystem1_len = htonl(f->len);
+		} else if (i == 1) {
+			inv->filesystem2_dostype = htonl(dostype);
+			inv->filesystem2_offset = htonl(offset);
+			inv->filesystem2_len = htonl(f->len);
+		}
+		offset += f->len;
+	}
+
+	rom_put32(rom, ROMDIR_CHECKSUM_OFS, sum);
+	rom_put32(rom, ROMDIR_COUNT_OFS, (ROMDIR_VERSION << 16) | entries);
+	rom_put32(rom, ROMDIR_MAGIC_OFS, ROMDIR_MAGIC);
+
+	return 0;
+}
+
+int resize(struct file *rom, struct rom_contents *contents, int newsize)
 {
 	if ((newsize * 1024) == rom->len) {
 		printf("Skip resize, ROM is already %dkb\n", newsize);
 		return 0;
 	}
 
-	struct rom_inventory *inv = (struct rom_inventory *)(rom->addr + rom->len -
-			sizeof(struct rom_inventory));
-	struct rom_inventory backup = *inv;
-
-	int freebytes = rom->len - sizeof(struct rom_inventory) - ntohl(inv->device_offset);
-	if (inv->filesystem1_len)
-		freebytes -= ntohl(inv->filesystem1_len);
-	if (inv->filesystem2_len)
-		freebytes -= ntohl(inv->filesystem2_len);
-	if (inv->device_len)
-		freebytes -= ntohl(inv->device_len);
-
-	if (newsize == 32 && freebytes < 32768) {
+	int freebytes = free_space(contents, newsize * 1024);
+	if (freebytes < 0) {
 			printf("Not enough free space to resize. Missing %d bytes.\n",
-					32768 - freebytes);
+					-freebytes);
 			return -1;
 	}
 
@@ -162,18 +397,12 @@ int resize(struct file *rom, int newsize)
 		exit(EXIT_FAILURE);
 	}
 
-	if (newsize == 64)
-		memset(new_addr + 32*1024, 0xff, 32*1024);
-
-	memcpy(new_addr, rom->addr, 32 * 1024);
+	memset(new_addr, 0xff, newsize * 1024);
+	memcpy(new_addr, rom->addr, contents->header_len);
 	free(rom->addr);
 	rom->addr = new_addr;
 	rom->len = newsize * 1024;
 
-	inv = (struct rom_inventory *)(rom->addr + rom->len -
-		sizeof(struct rom_inventory));
-	*inv=backup;
-
 	return 0;
 }
 
@@ -192,7 +421,8 @@ struct file memorize_file(char *filename)
 		exit(EXIT_FAILURE);
 	}
 	int size = buf.st_size;
-	int aligned_size = (size + 15) & 0xfffffff0;
+	/* Payloads are packed longword aligned */
+	int aligned_size = (size + 3) & 0xfffffffc;
 
 	char *image = malloc(aligned_size);
 	if (!image) {
@@ -235,88 +465,11 @@ int write_file(char *filename, struct file rom)
 	return 0;
 }
 
-int replace_file(struct file *rom, int num, struct file *file, int dostype)
+void replace_file(struct file *slot, struct file *file)
 {
-	struct rom_inventory *inv = (struct rom_inventory *)(rom->addr + rom->len -
-			sizeof(struct rom_inventory));
-
-	int new_space = 0;
-	struct file filesystem1 = {NULL,0},
-		    filesystem2 = {NULL,0},
-		    device = {NULL,0};
-
-	switch (num) {
-	case DEVICE:
-		new_space = ntohl(inv->device_offset) + file->len + ntohl(inv->filesystem1_len) + ntohl(inv->filesystem2_len) + sizeof(struct rom_inventory);
-
-		device = *file;
-
-		filesystem1.addr = file_backup(rom->addr+ntohl(inv->filesystem1_offset), ntohl(inv->filesystem1_len));
-		filesystem1.len = ntohl(inv->filesystem1_len);
-
-		filesystem2.addr = file_backup(rom->addr+ntohl(inv->filesystem2_offset), ntohl(inv->filesystem2_len));
-		filesystem2.len = ntohl(inv->filesystem2_len);
-		break;
-	case FILESYSTEM1:
-		new_space = ntohl(inv->device_offset) + ntohl(inv->device_len) + file->len + ntohl(inv->filesystem2_len) + sizeof(struct rom_inventory);
-
-		device.addr = file_backup(rom->addr+ntohl(inv->device_offset), ntohl(inv->device_len));
-		device.len = ntohl(inv->device_len);
-
-		filesystem1 = *file;
-
-		filesystem2.addr = file_backup(rom->addr+ntohl(inv->filesystem2_offset), ntohl(inv->filesystem2_len));
-		filesystem2.len = ntohl(inv->filesystem2_len);
-
-		inv->filesystem1_dostype = htonl(dostype);
-
-		break;
-	case FILESYSTEM2:
-		new_space = ntohl(inv->device_offset) + ntohl(inv->device_len) + ntohl(inv->filesystem1_len) + file->len + sizeof(struct rom_inventory);
-
-		device.addr = file_backup(rom->addr+ntohl(inv->device_offset), ntohl(inv->device_len));
-		device.len = ntohl(inv->device_len);
-
-		filesystem1.addr = file_backup(rom->addr+ntohl(inv->filesystem1_offset), ntohl(inv->filesystem1_len));
-		filesystem1.len = ntohl(inv->filesystem1_len);
-
-		filesystem2 = *file;
-
-		inv->filesystem2_dostype = htonl(dostype);
-
-		break;
-	}
-
-	if (new_space > rom->len) {
-		printf("File can not fit into image (%zd bytes too big)\n",
-				new_space - rom->len);
-		return -1;
-	}
-
-	inv->device_len = 0;
-	inv->filesystem1_offset = 0;
-	inv->filesystem1_len = 0;
-	inv->filesystem2_offset = 0;
-	inv->filesystem2_len = 0;
-
-	/* Write device driver back */
-	memset(rom->addr + ntohl(inv->device_offset), 0xff, rom->len - ntohl(inv->device_offset) - sizeof(struct rom_inventory));
-	memcpy(rom->addr + ntohl(inv->device_offset), device.addr, device.len);
-	inv->device_len = htonl(device.len);
-
-	if (filesystem1.len) {
-		inv->filesystem1_offset = htonl(ntohl(inv->device_offset)+ntohl(inv->device_len));
-		inv->filesystem1_len =htonl(filesystem1.len);
-		memcpy(rom->addr+ntohl(inv->filesystem1_offset), filesystem1.addr, filesystem1.len);
-	}
-
-	if (filesystem2.len) {
-		inv->filesystem2_offset = htonl(ntohl(inv->device_offset)+ntohl(inv->device_len)+ntohl(inv->filesystem1_len));
-		inv->filesystem2_len = htonl(filesystem2.len);
-		memcpy(rom->addr+ntohl(inv->filesystem2_offset), filesystem2.addr, filesystem2.len);
-	}
-
-	return 0;
+	free(slot->addr);
+	*slot = *file;
+	file->addr = NULL;
 }
 
 static void print_version(void)
@@ -331,27 +484,26 @@ static void print_usage(const char *name)
 	printf("\n"
 	       "   -o | --output <filename>              output filename\n"
 	       "   -D | --device <filename>              path to a4091.device\n"
-	       "   -F | --filesystem <filename>          path to CDFileSystem\n"
+	       "   -F | --filesystem <filename>          path to a filesystem (up to %d)\n"
 	       "   -T | --dostype <val>                  DosType (eg. 0x43443031)\n"
-	       "   -s | --skip                           skip first filesystem slot\n"
+	       "   -s | --skip                           skip next filesystem slot\n"
 	       "   -r | --resize [32|64}                 resize rom image to 32kB or 64kB\n"
 	       "   -v | --version:                       print the version\n"
-	       "   -h | --help:                          print this help\n\n");
+	       "   -h | --help:                          print this help\n\n",
+	       MAX_FILESYSTEMS);
 }
 
 int main(int argc, char *argv[])
 {
 	char *output_filename = NULL,
 	     *device_filename = NULL,
-	     *filesystem1_filename = NULL,
-	     *filesystem2_filename = NULL;
+	     *filesystem_filename[MAX_FILESYSTEMS] = { NULL };
 
-	int fs_slot = 0, changed = 0;
-	uint32_t newsize=0, filesystem1_dostype=0, filesystem2_dostype=0;
+	int fs_slot = 0, changed = 0, i;
+	uint32_t newsize=0, filesystem_dostype[MAX_FILESYSTEMS] = { 0 };
 	struct file rom = {NULL,0},
-		    device = {NULL,0},
-		    filesystem1 = {NULL,0},
-		    filesystem2 = {NULL,0};
+		    device = {NULL,0};
+	struct rom_contents contents;
 
 	int opt, option_index = 0;
 	static const struct option long_options[] = {
@@ -376,30 +528,23 @@ int main(int argc, char *argv[])
 			device_filename = strdup(optarg);
 			break;
 		case 'F':
-			if (fs_slot == 0)
-				filesystem1_filename = strdup(optarg);
-			else if (fs_slot ==1)
-				filesystem2_filename = strdup(optarg);
-			else {
-				printf("Only two filesystems supported\n");
+			if (fs_slot >= MAX_FILESYSTEMS) {
+				printf("Only %d filesystems supported\n", MAX_FILESYSTEMS);
 				exit(1);
 			}
-			fs_slot++;
+			filesystem_filename[fs_slot++] = strdup(optarg);
 			break;
 		case 'T':
-			if (fs_slot == 0) {
+			if (fs_slot == 0 || !filesystem_filename[fs_slot - 1]) {
 				printf("Specify filesystem before DosType.\n");
 				exit(1);
-			} else if (fs_slot == 1) {
-				filesystem1_dostype = strtol(optarg, NULL, 16);
-			} else if (fs_slot == 2) {
-				filesystem2_dostype = strtol(optarg, NULL, 16);
 			}
+			filesystem_dostype[fs_slot - 1] = strtoul(optarg, NULL, 16);
 			break;
 		case 's':
 			fs_slot++;
-			if (fs_slot > 1) {
-				printf("Only two filesystems supported\n");
+			if (fs_slot >= MAX_FILESYSTEMS) {
+				printf("Only %d filesystems supported\n", MAX_FILESYSTEMS);
 				exit(1);
 			}
 			break;
@@ -436,18 +581,22 @@ int main(int argc, char *argv[])
 
 	rom = memorize_file(filename);
 
-	//int size = rom.len;
-	//char *image = rom.addr;
-
 	if (rom.len != (32*1024) && rom.len != (64*1024)) {
 		printf("A4091 ROM file needs to be 32k or 64k in size\n");
 		exit(EXIT_FAILURE);
 	}
 
+	if (!has_signature(&rom)) {
+		inventory(filename, &rom);
+		exit(EXIT_FAILURE);
+	}
+
+	read_contents(&rom, &contents);
+
 	if (newsize) {
-		if (resize(&rom, newsize))
+		if (resize(&rom, &contents, newsize))
 			exit(EXIT_FAILURE);
-		if (newsize * 1024 != rom.len)
+		if (newsize * 1024 == rom.len)
 			changed = 1;
 	}
 
@@ -455,35 +604,41 @@ int main(int argc, char *argv[])
 
 	if (device_filename) {
 		device = memorize_file(device_filename);
-		replace_file(&rom, DEVICE, &device, 0L);
+		replace_file(&contents.device, &device);
 		changed = 1;
 	}
 
-	if (filesystem1_filename) {
-		filesystem1 = memorize_file(filesystem1_filename);
-		replace_file(&rom, FILESYSTEM1, &filesystem1,
-				filesystem1_dostype);
+	for (i = 0; i < MAX_FILESYSTEMS; i++) {
+		struct file filesystem;
+		int slot = i;
+
+		if (!filesystem_filename[i])
+			continue;
+		filesystem = memorize_file(filesystem_filename[i]);
+		if (slot >= contents.filesystems) {
+			if (slot > contents.filesystems)
+				printf("Filesystem slot %d is empty, using slot %d.\n",
+						slot + 1, contents.filesystems + 1);
+			slot = contents.filesystems++;
+		}
+		replace_file(&contents.filesystem[slot], &filesystem);
+		if (filesystem_dostype[i] || !contents.dostype[slot])
+			contents.dostype[slot] = filesystem_dostype[i];
 		changed = 1;
 	}
 
-	if (filesystem2_filename) {
-		filesystem2 = memorize_file(filesystem2_filename);
-		replace_file(&rom, FILESYSTEM2, &filesystem2,
-				filesystem2_dostype);
-		changed = 1;
-	}
+	/* Rewritten images always get the directory format */
+	if (changed && write_contents(&rom, &contents))
+		exit(EXIT_FAILURE);
 
 	inventory(output_filename, &rom);
 
 	if (changed)
 		write_file(output_filename, rom);
 
-	if (filesystem1.addr)
-		free(filesystem1.addr);
-	if (filesystem2.addr)
-		free(filesystem2.addr);
-	if (device.addr)
-		free(device.addr);
+	for (i = 0; i < contents.filesystems; i++)
+		free(contents.filesystem[i].addr);
+	free(contents.device.addr);
 	free(rom.addr);
 
 	return 0;
@@ -0,0 +1,73 @@
+/*
+ * SCSI sequential-access (tape) interface description
+ *
+ * Subset of NetBSD sys/dev/scsipi/scsi_tape.h which is used by st.c.
+ * The READ(6) and WRITE(6) opcodes are shared with direct-access devices
+ * (SCSI_READ_6_COMMAND and SCSI_WRITE_6_COMMAND in scsi_disk.h), but the
+ * CDB layout differs.
+ */
+
+#ifndef _DEV_SCSIPI_SCSI_TAPE_H_
+#define _DEV_SCSIPI_SCSI_TAPE_H_
+
+#define	SCSI_REWIND		0x01
+struct scsi_rewind {
+	u_int8_t opcode;
+	u_int8_t byte2;
+#define	SR_IMMED		0x01
+	u_int8_t unused[3];
+	u_int8_t control;
+};
+
+#define	SCSI_READ_BLOCK_LIMITS	0x05
+struct scsi_block_limits {
+	u_int8_t opcode;
+	u_int8_t byte2;
+	u_int8_t unused[3];
+	u_int8_t control;
+};
+
+struct scsi_block_limits_data {
+	u_int8_t reserved;
+	u_int8_t max_length[3];		/* Most significant */
+	u_int8_t min_length[2];		/* Most significant */
+};
+
+struct scsi_rw_tape {
+	u_int8_t opcode;
+	u_int8_t byte2;
+#define	SRW_FIXED		0x01
+	u_int8_t len[3];
+	u_int8_t control;
+};
+
+#define	SCSI_WRITE_FILEMARKS	0x10
+struct scsi_write_filemarks {
+	u_int8_t opcode;
+	u_int8_t byte2;
+	u_int8_t number[3];
+	u_int8_t control;
+};
+
+#define	SCSI_SPACE		0x11
+struct scsi_space {
+	u_int8_t opcode;
+	u_int8_t byte2;
+#define	SS_CODE			0x03
+#define	SP_BLKS			0x00
+#define	SP_FILEMARKS		0x01
+#define	SP_SEQ_FILEMARKS	0x02
+#define	SP_EOM			0x03
+	u_int8_t number[3];
+	u_int8_t control;
+};
+
+/* Mode parameter header dev_spec byte for sequential-access devices */
+#define	SMH_DSP_WRITE_PROT	0x80
+#define	SMH_DSP_BUFF_MODE	0x70
+#define	SMH_DSP_BUFF_MODE_OFF	0x00
+#define	SMH_DSP_BUFF_MODE_ON	0x10
+#define	SMH_DSP_BUFF_MODE_MLTI	0x20
+#define	SMH_DSP_SPEED		0x0f
+
+#endif /* _DEV_SCSIPI_SCSI_TAPE_H_ */
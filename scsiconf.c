@@ -865,7 +865,7 @@ static const struct scsi_quirk_inquiry_pattern scsi_quirk_patterns[] = {
  */
 #ifdef PORT_AMIGA
 int
-scsi_probe_device(struct scsipi_channel *chan, int target, int lun, struct scsipi_periph *periph, int *failed)
+scsi_probe_device(struct scsipi_channel *chan, int target, int lun, struct scsipi_periph *periph, const struct scsipi_inquiry_data *inq, int *failed)
 #else
 static int
 scsi_probe_device(struct scsibus_softc *sc, int target, int lun)
@@ -949,6 +949,12 @@ scsi_probe_device(struct scsibus_softc *sc, int target, int lun)
 			extension[len++] = ' ';
 	}
 
+#ifdef PORT_AMIGA
+	/* The INQUIRY may already have been issued by attach_start() */
+	if (inq != NULL)
+		CopyMem((APTR) inq, &inqbuf, sizeof (inqbuf));
+	else
+#endif
 	if (scsipi_inquire(periph, &inqbuf, XS_CTL_DISCOVERY | XS_CTL_SILENT)) {
 #ifdef PORT_AMIGA
                 *failed = ERROR_INQUIRY_FAILED;
@@ -53,6 +53,7 @@
 #include "scsi_all.h"
 #include "scsi_message.h"
 #include "sd.h"
+#include "mempool.h"
 
 #undef SCSIPI_DEBUG
 #undef QUEUE_DEBUG
@@ -582,7 +583,7 @@ scsipi_get_xs(struct scsipi_periph *periph, int flags)
         chan->chan_xs_free = *(struct scsipi_xfer **) xs;  /* ->next link */
         memset(xs, 0, sizeof (*xs));
     } else {
-        xs = AllocMem(sizeof (*xs), MEMF_CLEAR | MEMF_PUBLIC);
+        xs = mempool_alloc(sizeof (*xs), MEMF_CLEAR | MEMF_PUBLIC);
         if (xs == NULL)
             return (xs);
     }
@@ -806,7 +807,7 @@ scsipi_free_all_xs(struct scsipi_channel *chan)
     while (xs != NULL) {
         struct scsipi_xfer *txs = xs;
         xs = *(struct scsipi_xfer **) xs;  /* ->next link */
-        FreeMem(txs, sizeof (*txs));
+        mempool_free(txs, sizeof (*txs));
     }
     chan->chan_active = 0;
 }
@@ -1635,6 +1636,7 @@ scsipi_mode_sense_big(struct scsipi_periph *periph, int byte2, int page,
 	return scsipi_command(periph, (void *)&cmd, sizeof(cmd),
 	    (void *)data, len, retries, timeout, NULL, flags | XS_CTL_DATA_IN);
 }
+#endif /* !PORT_AMIGA */
 
 int
 scsipi_mode_select(struct scsipi_periph *periph, int byte2,
@@ -1652,6 +1654,7 @@ scsipi_mode_select(struct scsipi_periph *periph, int byte2,
 	    (void *)data, len, retries, timeout, NULL, flags | XS_CTL_DATA_OUT);
 }
 
+#ifndef PORT_AMIGA
 int
 scsipi_mode_select_big(struct scsipi_periph *periph, int byte2,
     struct scsi_mode_parameter_header_10 *data, int len, int flags, int retries,
@@ -1948,11 +1951,16 @@ scsipi_done(struct scsipi_xfer *xs)
 		 * are really only used during crash dumps anyway
 		 * (XXX or during boot-time autoconfiguration of
 		 * ATAPI devices).
+		 *
+		 * On Amiga, polled xfers complete through the interrupt
+		 * like any other, so the queue is restarted as usual.
 		 */
+#ifndef PORT_AMIGA
 		if (xs->xs_control & XS_CTL_POLL) {
 			mutex_exit(chan_mtx(chan));
 			return;
 		}
+#endif
 		cv_broadcast(xs_cv(xs));
 		mutex_exit(chan_mtx(chan));
 		goto out;
@@ -2237,6 +2245,7 @@ scsipi_complete(struct scsipi_xfer *xs)
 	if (error == ERESTART) {
 #ifdef PORT_AMIGA
                 printf("restart %p retries left=%d\n", xs, xs->xs_retries);
+                periph->periph_retries++;
 #endif
 		SDT_PROBE1(scsi, base, xfer, restart,  xs);
 		/*
@@ -2788,14 +2797,17 @@ scsipi_execute_xs(struct scsipi_xfer *xs)
 	 * Not an asynchronous command; wait for it to complete.
 	 */
 	while ((xs->xs_status & XS_STS_DONE) == 0) {
+#ifndef PORT_AMIGA
 		if (poll) {
 			scsipi_printaddr(periph);
-#ifndef PORT_AMIGA
 			printf("polling command not done\n");
 			panic("scsipi_execute_xs");
-#endif
 		}
-#ifdef PORT_AMIGA
+#else
+		/*
+		 * Polled or not, sleep until the siop interrupt or the
+		 * timer tick (which runs the command timeout) arrives.
+		 */
                 irq_and_timer_handler();  // Run timer and interrupts
 #endif
 		cv_wait(xs_cv(xs), chan_mtx(chan));
@@ -3109,6 +3121,9 @@ scsipi_set_xfer_mode(struct scsipi_channel *chan, int target, int immed)
 	xm.xm_mode = 0;
 	xm.xm_period = 0;			/* ignored */
 	xm.xm_offset = 0;			/* ignored */
+#ifdef PORT_AMIGA
+	xm.xm_profile = 0;
+#endif
 
 	/*
 	 * Find the first LUN we know about on this I_T Nexus.
@@ -125,6 +125,11 @@ struct scsipi_xfer_mode {
 	int	xm_mode;		/* PERIPH_CAP* bits */
 	int	xm_period;		/* sync period */
 	int	xm_offset;		/* sync offset */
+#ifdef PORT_AMIGA
+	int	xm_profile;		/* Set by sd_disk_profile(); the fields
+					   below and xm_period apply */
+	int	xm_disc;		/* DP_DISC_* disconnect policy */
+#endif
 };
 
 
@@ -474,6 +479,11 @@ struct scsipi_periph {
 	uint	periph_blkshift;	/* Block size of this LUN in bits */
         uint    periph_changenum;       /* Count of removes/inserts */
         uint    periph_tur_active;      /* Test unit ready already active */
+        uint8_t periph_cache_profile;   /* MODE page 8 profile, sd.h */
+        uint8_t periph_wce;             /* Drive write cache is on */
+        uint8_t periph_sync_period;     /* Sync limit, diskprofile.h */
+        uint8_t periph_disconnect;      /* DP_DISC_*, diskprofile.h */
+        uint    periph_retries;         /* Commands restarted after error */
 #endif
 
 	int	periph_version;		/* ANSI SCSI version */
@@ -586,6 +596,22 @@ typedef enum {
 	XS_REQUEUE		/* 9 requeue this command */
 } scsipi_xfer_result_t;
 
+/*
+ * With XS_CTL_DATA_UIO, data points to a scsipi_uio and datalen is the
+ * sum of its segment lengths. The segments are transferred in order as
+ * if they were one buffer. Also the segment format of CMD_SCATTER_READ
+ * and CMD_SCATTER_WRITE (sd.h).
+ */
+struct scsipi_iovec {
+	void	*iov_base;		/* segment address */
+	u_int32_t iov_len;		/* segment length in bytes */
+};
+
+struct scsipi_uio {
+	struct scsipi_iovec *uio_iov;	/* segments */
+	int	uio_iovcnt;		/* number of segments */
+};
+
 #ifdef _KERNEL
 /*
  * Each scsipi transaction is fully described by one of these structures
@@ -619,6 +645,7 @@ struct scsipi_xfer {
 
         void    *xs_callback_arg;       /* AmigaOS callback data */
         void    *amiga_ior;             /* AmigaOS IO request for transfer */
+        struct scsipi_uio xs_uio;       /* AmigaOS segments, DATA_UIO */
 	int	xs_control;		/* control flags */
 	volatile int xs_status;		/* status flags */
 	struct scsipi_periph *xs_periph;/* peripheral doing the xfer */
@@ -18,9 +18,12 @@
 #include "siopreg.h"
 #include "siopvar.h"
 #include "sd.h"
+#include "diskprofile.h"
 #include "device.h"
 #include "attach.h"
 #include "cmdhandler.h"
+#include "mempool.h"
+#include "bcache.h"
 #include "ndkcompat.h"
 
 #ifndef SDRETRIES
@@ -31,6 +34,12 @@
 #define SD_IO_TIMEOUT   (3 * 1000)  // 5 seconds
 #endif
 
+#ifndef SD_SYNC_TIMEOUT
+#define SD_SYNC_TIMEOUT (30 * 1000) // Write cache flush, 30 seconds
+#endif
+
+#define SD_TUR_POLL_TICKS (4 * TICKS_PER_SECOND)  // Media change polling
+
 typedef struct
 {
     struct scsi_mode_parameter_header_6 hdr;
@@ -40,6 +49,7 @@ typedef struct
 static void sd_complete(struct scsipi_xfer *xs);
 static void sd_startstop_complete(struct scsipi_xfer *xs);
 static void sd_tur_complete(struct scsipi_xfer *xs);
+static void sd_sync_complete(struct scsipi_xfer *xs);
 static void scsidirect_complete(struct scsipi_xfer *xs);
 static void geom_done_inquiry(struct scsipi_xfer *xs);
 
@@ -57,7 +67,7 @@ static const int8_t error_code_mapping[] = {
 };
 
 /* Translate error code to AmigaOS code */
-static int
+int
 translate_xs_error(struct scsipi_xfer *xs)
 {
     scsipi_xfer_result_t res = xs->error;
@@ -153,7 +163,7 @@ sd_read_capacity(struct scsipi_periph *periph, int *blksize, int flags)
      * if it uses a region which is in the same cacheline,
      * cache flush ops against the data buffer won't work properly.
      */
-    datap = AllocMem(sizeof (*datap), MEMF_PUBLIC);
+    datap = mempool_alloc(sizeof (*datap), MEMF_PUBLIC);
     if (datap == NULL)
         return (ERROR_NO_MEMORY);
 
@@ -196,7 +206,7 @@ sd_read_capacity(struct scsipi_periph *periph, int *blksize, int flags)
     capacity = _8btol(datap->data16.addr) + 1;
 
 out:
-    FreeMem(datap, sizeof (*datap));
+    mempool_free(datap, sizeof (*datap));
     return (capacity);
 }
 
@@ -282,6 +292,280 @@ got_blocksize:
     return (blksize);
 }
 
+#define CACHE_PAGE_LEN (sizeof (struct scsi_mode_parameter_header_6) + \
+                        sizeof (((union scsi_disk_pages *) 0)->caching_params))
+
+static int
+sd_get_cache_page(struct scsipi_periph *periph, int pctrl,
+                  scsi_mode_sense_t *modepage)
+{
+    int rc;
+
+    rc = scsipi_mode_sense(periph, SMS_DBD, pctrl | 8, &modepage->hdr,
+                           CACHE_PAGE_LEN, XS_CTL_DATA_IN | XS_CTL_SILENT,
+                           0, 2000);
+    if (rc != 0)
+        return (rc);
+    if ((modepage->pg.caching_params.pg_code & SMS_PAGE_MASK) != 8)
+        return (ERROR_BAD_DRIVE_TYPE);
+    return (0);
+}
+
+/*
+ * sd_cache_probe
+ * --------------
+ * Check at attach time whether the drive has a caching mode page.
+ */
+void
+sd_cache_probe(void *periph_p)
+{
+    struct scsipi_periph *periph = periph_p;
+    scsi_mode_sense_t    *modepage;
+
+    periph->periph_cache_profile = CACHE_PROFILE_NONE;
+    periph->periph_wce = 0;
+    if (periph->periph_type != T_DIRECT)
+        return;
+
+    modepage = mempool_alloc(sizeof (*modepage), MEMF_PUBLIC | MEMF_CLEAR);
+    if (modepage == NULL)
+        return;
+
+    if (sd_get_cache_page(periph, SMS_PCTRL_CURRENT, modepage) == 0) {
+        periph->periph_cache_profile = CACHE_PROFILE_GET;
+        periph->periph_wce = !!(modepage->pg.caching_params.flags &
+                                CACHING_WCE);
+        printf("cache page: flags=%02x flags2=%02x prefetch=%u-%u "
+               "ceiling=%u segments=%u\n",
+               modepage->pg.caching_params.flags,
+               modepage->pg.caching_params.flags2,
+               _2btol(modepage->pg.caching_params.min_prefetch),
+               _2btol(modepage->pg.caching_params.max_prefetch),
+               _2btol(modepage->pg.caching_params.max_prefetch_ceiling),
+               modepage->pg.caching_params.num_cache_segments);
+    }
+    mempool_free(modepage, sizeof (*modepage));
+}
+
+static void
+cache_page_to_profile(struct page_caching *pc, a4091_cache_profile_t *cp)
+{
+    cp->cp_cache_flags          = pc->flags;
+    cp->cp_cache_flags2         = pc->flags2;
+    cp->cp_dis_prefetch_len     = _2btol(pc->dis_prefetch_xfer_len);
+    cp->cp_min_prefetch         = _2btol(pc->min_prefetch);
+    cp->cp_max_prefetch         = _2btol(pc->max_prefetch);
+    cp->cp_max_prefetch_ceiling = _2btol(pc->max_prefetch_ceiling);
+    cp->cp_segments             = pc->num_cache_segments;
+}
+
+/*
+ * sd_cache_profile
+ * ----------------
+ * Report or change the drive's caching mode page (page 8). The requested
+ * settings are masked with the drive's changeable values before they are
+ * applied with MODE SELECT. Runs synchronously in the handler task.
+ */
+int
+sd_cache_profile(void *periph_p, a4091_cache_profile_t *cp)
+{
+    struct scsipi_periph *periph = periph_p;
+    scsi_mode_sense_t    *cur;
+    scsi_mode_sense_t    *chg;
+    scsi_mode_sense_t    *want;
+    struct page_caching  *pc;
+    uint8_t              *pcur;
+    uint8_t              *pchg;
+    uint8_t              *pwant;
+    uint                  len;
+    uint                  i;
+    int                   rc;
+
+    if (periph->periph_cache_profile == CACHE_PROFILE_NONE)
+        return (ERROR_BAD_DRIVE_TYPE);
+    if (cp->cp_profile > CACHE_PROFILE_CUSTOM)
+        return (ERROR_BAD_LENGTH);
+
+    cur = mempool_alloc(sizeof (*cur) * 3, MEMF_PUBLIC | MEMF_CLEAR);
+    if (cur == NULL)
+        return (ERROR_NO_MEMORY);
+    chg  = cur + 1;
+    want = cur + 2;
+
+    rc = sd_get_cache_page(periph, SMS_PCTRL_CURRENT, cur);
+    if ((rc != 0) || (cp->cp_profile == CACHE_PROFILE_GET))
+        goto done;
+
+    rc = sd_get_cache_page(periph, SMS_PCTRL_CHANGEABLE, chg);
+    if (rc != 0)
+        goto done;
+
+    if (cp->cp_profile == CACHE_PROFILE_BALANCED) {
+        rc = sd_get_cache_page(periph, SMS_PCTRL_DEFAULT, want);
+        if (rc != 0)
+            goto done;
+    } else {
+        CopyMem(cur, want, sizeof (*want));
+    }
+
+    pc = &want->pg.caching_params;
+    switch (cp->cp_profile) {
+        case CACHE_PROFILE_SEQUENTIAL:
+            /* Prefetch as much as the drive will, even across seeks */
+            pc->flags  |= CACHING_DISC;
+            pc->flags2 &= ~CACHING2_DRA;
+            _lto2b(0xffff, pc->dis_prefetch_xfer_len);
+            _lto2b(0xffff, pc->max_prefetch);
+            _lto2b(0xffff, pc->max_prefetch_ceiling);
+            break;
+        case CACHE_PROFILE_RANDOM:
+            /* Don't waste drive time on data which won't be read */
+            pc->flags  &= ~CACHING_DISC;
+            pc->flags2 |= CACHING2_DRA;
+            _lto2b(0, pc->dis_prefetch_xfer_len);
+            _lto2b(0, pc->min_prefetch);
+            _lto2b(0, pc->max_prefetch);
+            break;
+        case CACHE_PROFILE_CUSTOM:
+            pc->flags  = cp->cp_cache_flags;
+            pc->flags2 = cp->cp_cache_flags2;
+            _lto2b(cp->cp_dis_prefetch_len, pc->dis_prefetch_xfer_len);
+            _lto2b(cp->cp_min_prefetch, pc->min_prefetch);
+            _lto2b(cp->cp_max_prefetch, pc->max_prefetch);
+            _lto2b(cp->cp_max_prefetch_ceiling, pc->max_prefetch_ceiling);
+            pc->num_cache_segments = cp->cp_segments;
+            break;
+    }
+
+    /* Only change what the drive allows; leave WCE alone unless custom */
+    if (cp->cp_profile != CACHE_PROFILE_CUSTOM) {
+        pc->flags = (pc->flags & ~CACHING_WCE) |
+                    (cur->pg.caching_params.flags & CACHING_WCE);
+    }
+    pcur  = (uint8_t *) &cur->pg.caching_params;
+    pchg  = (uint8_t *) &chg->pg.caching_params;
+    pwant = (uint8_t *) pc;
+    len   = pcur[1] + 2;
+    if (len > sizeof (*pc))
+        len = sizeof (*pc);
+    for (i = 2; i < len; i++)
+        pcur[i] = (pcur[i] & ~pchg[i]) | (pwant[i] & pchg[i]);
+    pcur[0] &= SMS_PAGE_MASK;  // PS bit is reserved for MODE SELECT
+
+    memset(&cur->hdr, 0, sizeof (cur->hdr));
+    rc = scsipi_mode_select(periph, SMS_PF |
+                            ((cp->cp_flags & CPF_SAVE) ? SMS_SP : 0),
+                            &cur->hdr, sizeof (cur->hdr) + len,
+                            XS_CTL_DATA_OUT, 0, 5000);
+    if (rc != 0)
+        goto done;
+
+    periph->periph_cache_profile = cp->cp_profile;
+    rc = sd_get_cache_page(periph, SMS_PCTRL_CURRENT, cur);
+
+done:
+    if (rc == 0) {
+        cache_page_to_profile(&cur->pg.caching_params, cp);
+        periph->periph_wce = !!(cp->cp_cache_flags & CACHING_WCE);
+    }
+    mempool_free(cur, sizeof (*cur) * 3);
+    return (rc);
+}
+
+/*
+ * sd_disk_profile
+ * ---------------
+ * Apply a per-disk performance profile (diskprofile.h). The queue depth is
+ * kept in the periph, though it is 1 unless the periph is running with
+ * tagged queuing: scsipi sends untagged commands to a drive one at a time
+ * whatever its openings. Sync and disconnect limits are passed on to the
+ * host adapter, and the read-ahead and write cache settings go to the
+ * drive's caching mode page. Fields which are 0 are left as they are.
+ * On return, the profile holds the settings now in effect.
+ */
+int
+sd_disk_profile(void *periph_p, void *dp_p)
+{
+    struct scsipi_periph    *periph = periph_p;
+    struct scsipi_channel   *chan = periph->periph_channel;
+    struct scsipi_adapter   *adapt = chan->chan_adapter;
+    a4091_disk_profile_t    *dp = dp_p;
+    a4091_cache_profile_t    cp;
+    struct scsipi_xfer_mode  xm;
+    uint8_t                  preset;
+    int                      rc = 0;
+
+    if ((dp->dp_disconnect > DP_DISC_ALWAYS) ||
+        (dp->dp_write_cache > DP_WCACHE_ON) ||
+        (dp->dp_cache_profile > CACHE_PROFILE_BALANCED))
+        return (ERROR_BAD_LENGTH);
+
+    if (dp->dp_queue_depth != 0) {
+        if (PERIPH_XFER_MODE(periph) & PERIPH_CAP_TQING)
+            periph->periph_openings = MIN(dp->dp_queue_depth,
+                                          adapt->adapt_openings);
+        else
+            periph->periph_openings = 1;
+    }
+
+    if ((dp->dp_sync_period != 0) || (dp->dp_disconnect != 0)) {
+        if (dp->dp_sync_period != 0)
+            periph->periph_sync_period = dp->dp_sync_period;
+        if (dp->dp_disconnect != 0)
+            periph->periph_disconnect = dp->dp_disconnect;
+        xm.xm_target  = periph->periph_target;
+        xm.xm_mode    = (periph->periph_sync_period == DP_SYNC_ASYNC) ?
+                        0 : PERIPH_CAP_SYNC;
+        xm.xm_period  = (periph->periph_sync_period == DP_SYNC_ASYNC) ?
+                        0 : periph->periph_sync_period;
+        xm.xm_offset  = 0;
+        xm.xm_profile = 1;
+        xm.xm_disc    = periph->periph_disconnect;
+        adapt->adapt_request(chan, ADAPTER_REQ_SET_XFER_MODE, &xm);
+    }
+
+    dp->dp_queue_depth = (PERIPH_XFER_MODE(periph) & PERIPH_CAP_TQING) ?
+                         periph->periph_openings : 1;
+    dp->dp_sync_period = periph->periph_sync_period;
+    dp->dp_disconnect  = periph->periph_disconnect;
+
+    if (periph->periph_cache_profile == CACHE_PROFILE_NONE) {
+        /* Drive has no caching page; only fail if settings were asked for */
+        if ((dp->dp_write_cache != 0) || (dp->dp_cache_profile != 0) ||
+            (dp->dp_max_prefetch != 0))
+            return (ERROR_BAD_DRIVE_TYPE);
+        return (0);
+    }
+
+    memset(&cp, 0, sizeof (cp));
+    cp.cp_profile = dp->dp_cache_profile;
+    rc = sd_cache_profile(periph, &cp);
+    preset = periph->periph_cache_profile;
+    if ((rc == 0) &&
+        ((dp->dp_write_cache != 0) || (dp->dp_max_prefetch != 0))) {
+        /* Adjust what the preset left; it is still reported as the preset */
+        cp.cp_profile = CACHE_PROFILE_CUSTOM;
+        if (dp->dp_write_cache == DP_WCACHE_ON)
+            cp.cp_cache_flags |= CACHING_WCE;
+        else if (dp->dp_write_cache == DP_WCACHE_OFF)
+            cp.cp_cache_flags &= ~CACHING_WCE;
+        if (dp->dp_max_prefetch != 0) {
+            cp.cp_max_prefetch = dp->dp_max_prefetch;
+            if (cp.cp_max_prefetch_ceiling < dp->dp_max_prefetch)
+                cp.cp_max_prefetch_ceiling = dp->dp_max_prefetch;
+        }
+        rc = sd_cache_profile(periph, &cp);
+        periph->periph_cache_profile = preset;
+    }
+    if (rc == 0) {
+        dp->dp_cache_profile = preset;
+        dp->dp_write_cache   = (cp.cp_cache_flags & CACHING_WCE) ?
+                               DP_WCACHE_ON : DP_WCACHE_OFF;
+        dp->dp_max_prefetch  = cp.cp_max_prefetch;
+    }
+    return (rc);
+}
+
 int
 sd_testunitready(void *periph_p, void *ior)
 {
@@ -343,59 +627,60 @@ IsMinListEmpty(const struct MinList *list)
  * sd_testunitready_walk
  * ---------------------
  * Walks all peripherals of the channel which have client applications
- * waiting for change interrupts (TD_REMOVE or TD_ADDCHANGEINT).
+ * waiting for change interrupts (TD_REMOVE or TD_ADDCHANGEINT), polling
+ * them every four seconds. The elapsed argument is the number of ticks
+ * since the previous call. Returns the ticks until the next poll is due,
+ * or 0 if no peripheral needs polling.
  */
-void
-sd_testunitready_walk(struct scsipi_channel *chan)
+int
+sd_testunitready_walk(struct scsipi_channel *chan, int elapsed)
 {
     struct scsipi_periph  *periph;
     int                    i;
-    static uint8_t         iter = 0;
+    int                    poll;
+    int                    wanted = 0;
+    static int             due = 0;
 
-    if ((iter++ & 3) != 0)  // Poll every 4 seconds
-        return;
+    due -= elapsed;
+    poll = (due <= 0);
+    if (poll)
+        due = SD_TUR_POLL_TICKS;
 
     for (i = 0; i < SCSIPI_CHAN_PERIPH_BUCKETS; i++) {
         LIST_FOREACH(periph, &chan->chan_periphtab[i], periph_hash) {
-            if ((periph->periph_tur_active == 0) &&
-                ((periph->periph_changeint != NULL) ||
-                 !IsMinListEmpty(&periph->periph_changeintlist))) {
+            if ((periph->periph_changeint != NULL) ||
+                !IsMinListEmpty(&periph->periph_changeintlist)) {
                 /* Need to poll this device to detect load/eject */
-                sd_testunitready(periph, NULL);
+                wanted = 1;
+                if (poll && (periph->periph_tur_active == 0))
+                    sd_testunitready(periph, NULL);
             }
         }
     }
+    return (wanted ? due : 0);
 }
 
 /*
- * sd_readwrite
- * ------------
- * Initiate a read or write operation on the specified SCSI device.
- * b_flags includes B_READ when the operation is a read from the SCSI
- * device to computer RAM.
+ * sd_rw_cdb
+ * ---------
+ * Fill out a read or write command for nblks blocks at blkno, and
+ * return its length.
  */
-int
-sd_readwrite(void *periph_p, uint64_t blkno, uint b_flags, void *buf,
-             uint buflen, void *ior)
+static int
+sd_rw_cdb(struct scsipi_generic *cmdbuf, uint64_t blkno, uint32_t nblks,
+          uint b_flags)
 {
-    struct scsipi_periph *periph = periph_p;
-    struct scsipi_generic cmdbuf;
-    struct scsipi_xfer *xs;
-    uint32_t blkshift = periph->periph_blkshift;
-    uint32_t nblks = buflen >> blkshift;
     int cmdlen;
-    int flags;
 
     /*
-     * Fill out the scsi command.  Use the smallest CDB possible
-     * (6-byte, 10-byte, or 16-byte). If we need FUA or DPO,
-     * need to use 10-byte or bigger, as the 6-byte doesn't support
-     * the flags.
+     * Use the smallest CDB possible (6-byte, 10-byte, or 16-byte).
+     * If we need FUA or DPO, need to use 10-byte or bigger, as the
+     * 6-byte doesn't support the flags.
      */
     if (((blkno & 0x1fffff) == blkno) &&
         ((nblks & 0xff) == nblks)) {
         /* 6-byte CDB */
-        struct scsi_rw_6 *cmd = (struct scsi_rw_6 *) &cmdbuf;
+        struct scsi_rw_6 *cmd = (struct scsi_rw_6 *) cmdbuf;
         cmdlen = sizeof (*cmd);
         memset(cmd, 0, cmdlen);
 
@@ -405,7 +690,7 @@ sd_readwrite(void *periph_p, uint64_t blkno, uint b_flags, void *buf,
         cmd->length = nblks & 0xff;
     } else if ((blkno & 0xffffffff) == blkno) {
         /* 10-byte CDB */
-        struct scsipi_rw_10 *cmd = (struct scsipi_rw_10 *) &cmdbuf;
+        struct scsipi_rw_10 *cmd = (struct scsipi_rw_10 *) cmdbuf;
         cmdlen = sizeof (*cmd);
         memset(cmd, 0, cmdlen);
 
@@ -414,7 +699,7 @@ sd_readwrite(void *periph_p, uint64_t blkno, uint b_flags, void *buf,
         _lto2b(nblks, cmd->length);
     } else {
         /* 16-byte CDB */
-        struct scsipi_rw_16 *cmd = (struct scsipi_rw_16 *) &cmdbuf;
+        struct scsipi_rw_16 *cmd = (struct scsipi_rw_16 *) cmdbuf;
         cmdlen = sizeof (*cmd);
         memset(cmd, 0, cmdlen);
 
@@ -422,7 +707,78 @@ sd_readwrite(void *periph_p, uint64_t blkno, uint b_flags, void *buf,
         _lto8b(blkno, cmd->addr);
         _lto4b(nblks, cmd->length);
     }
-    flags = XS_CTL_ASYNC | XS_CTL_SIMPLE_TAG;
+    return (cmdlen);
+}
+
+/*
+ * sd_barrier
+ * ----------
+ * Prepare for a barrier write (B_ORDERED). With tagged queuing, the
+ * write's ORDERED tag keeps the drive from reordering around it. Without,
+ * scsipi sends the unit's commands one at a time in queue order, so the
+ * write already waits for everything before it to complete. If the
+ * drive's write cache is on, a SYNCHRONIZE CACHE is queued first, so
+ * that the earlier writes are on the medium before the barrier is.
+ */
+static int
+sd_barrier(struct scsipi_periph *periph)
+{
+    struct scsi_synchronize_cache_10 cmd;
+    struct scsipi_xfer *xs;
+
+    if (periph->periph_wce == 0)
+        return (0);
+
+    memset(&cmd, 0, sizeof (cmd));
+    cmd.opcode = SCSI_SYNCHRONIZE_CACHE_10;  // Whole medium
+
+    xs = scsipi_make_xs_locked(periph, (struct scsipi_generic *) &cmd,
+                               sizeof (cmd), NULL, 0, SDRETRIES,
+                               SD_SYNC_TIMEOUT, NULL,
+                               XS_CTL_ASYNC | XS_CTL_ORDERED_TAG);
+    if (__predict_false(xs == NULL))
+        return (TDERR_NoMem);  // out of memory
+    xs->xs_done_callback = sd_sync_complete;
+
+    return (scsipi_execute_xs(xs));
+}
+
+/*
+ * sd_readwrite
+ * ------------
+ * Initiate a read or write operation on the specified SCSI device.
+ * b_flags includes B_READ when the operation is a read from the SCSI
+ * device to computer RAM.
+ */
+int
+sd_readwrite(void *periph_p, uint64_t blkno, uint b_flags, void *buf,
+             uint buflen, void *ior)
+{
+    struct scsipi_periph *periph = periph_p;
+    struct scsipi_generic cmdbuf;
+    struct scsipi_xfer *xs;
+    uint32_t blkshift = periph->periph_blkshift;
+    uint32_t nblks = buflen >> blkshift;
+    void *fill = NULL;
+    int cmdlen;
+    int flags;
+
+    if (b_flags & B_READ) {
+        if (bcache_read(periph, blkno, buf, buflen, &fill)) {
+            cmd_complete(ior, 0);
+            return (0);
+        }
+    } else {
+        bcache_write(periph, blkno, buf, buflen);
+        if ((b_flags & B_ORDERED) && (sd_barrier(periph) != 0)) {
+            bcache_invalidate(periph);  // Cache already has the new data
+            return (TDERR_NoMem);
+        }
+    }
+
+    cmdlen = sd_rw_cdb(&cmdbuf, blkno, nblks, b_flags);
+    flags = XS_CTL_ASYNC;
+    flags |= (b_flags & B_ORDERED) ? XS_CTL_ORDERED_TAG : XS_CTL_SIMPLE_TAG;
     if (b_flags & B_READ)
         flags |= XS_CTL_DATA_IN;
     else
@@ -430,10 +786,16 @@ sd_readwrite(void *periph_p, uint64_t blkno, uint b_flags, void *buf,
 
     xs = scsipi_make_xs_locked(periph, &cmdbuf, cmdlen, buf, buflen,
                                SDRETRIES, SD_IO_TIMEOUT, NULL, flags);
-    if (__predict_false(xs == NULL))
+    if (__predict_false(xs == NULL)) {
+        if (fill != NULL)
+            bcache_fill(fill, NULL, 0);
+        else if ((b_flags & B_READ) == 0)
+            bcache_invalidate(periph);  // Cache already has the new data
         return (TDERR_NoMem);  // out of memory
+    }
 
     xs->amiga_ior = ior;
+    xs->xs_callback_arg = fill;  // Block cache entry to fill, if any
     xs->xs_done_callback = sd_complete;
 
 #if 0
@@ -444,6 +806,81 @@ sd_readwrite(void *periph_p, uint64_t blkno, uint b_flags, void *buf,
     return (scsipi_execute_xs(xs));
 }
 
+/*
+ * sd_scatter
+ * ----------
+ * Read or write consecutive blocks starting at blkno to or from a list
+ * of buffers, with a single SCSI command. Each segment must be a whole
+ * number of blocks and longword aligned, so that it occupies a single
+ * DMA chain entry, and the total may not exceed MAXPHYS. The block cache
+ * is not consulted for reads, but is kept up to date for writes.
+ */
+int
+sd_scatter(void *periph_p, uint64_t blkno, uint b_flags,
+           const a4091_iovec_t *iov, uint iovcnt, void *ior)
+{
+    struct scsipi_periph *periph = periph_p;
+    struct scsipi_generic cmdbuf;
+    struct scsipi_xfer *xs;
+    uint32_t blkshift = periph->periph_blkshift;
+    uint32_t blkmask = (1 << blkshift) - 1;
+    uint32_t total = 0;
+    uint64_t seg_blkno = blkno;
+    int cmdlen;
+    int flags;
+    uint i;
+
+    if ((iovcnt == 0) || (iovcnt > SCATTER_MAX_SEGS))
+        return (IOERR_BADLENGTH);
+    for (i = 0; i < iovcnt; i++) {
+        if ((iov[i].iov_len == 0) || (iov[i].iov_len & blkmask) ||
+            (iov[i].iov_len > AMIGA_MAX_TRANSFER) ||
+            (total + iov[i].iov_len < total))
+            return (IOERR_BADLENGTH);
+        if ((uintptr_t) iov[i].iov_base & 3)
+            return (IOERR_BADADDRESS);
+        total += iov[i].iov_len;
+    }
+    if (total > MAXPHYS)
+        return (IOERR_BADLENGTH);  // One transfer's worth of DMA chain
+
+    if ((b_flags & B_READ) == 0) {
+        for (i = 0; i < iovcnt; i++) {
+            bcache_write(periph, seg_blkno, iov[i].iov_base, iov[i].iov_len);
+            seg_blkno += iov[i].iov_len >> blkshift;
+        }
+        if ((b_flags & B_ORDERED) && (sd_barrier(periph) != 0)) {
+            bcache_invalidate(periph);  // Cache already has the new data
+            return (TDERR_NoMem);
+        }
+    }
+
+    cmdlen = sd_rw_cdb(&cmdbuf, blkno, total >> blkshift, b_flags);
+    flags = XS_CTL_ASYNC | XS_CTL_DATA_UIO;
+    flags |= (b_flags & B_ORDERED) ? XS_CTL_ORDERED_TAG : XS_CTL_SIMPLE_TAG;
+    if (b_flags & B_READ)
+        flags |= XS_CTL_DATA_IN;
+    else
+        flags |= XS_CTL_DATA_OUT;
+
+    xs = scsipi_make_xs_locked(periph, &cmdbuf, cmdlen, NULL, total,
+                               SDRETRIES, SD_IO_TIMEOUT, NULL, flags);
+    if (__predict_false(xs == NULL)) {
+        if ((b_flags & B_READ) == 0)
+            bcache_invalidate(periph);  // Cache already has the new data
+        return (TDERR_NoMem);  // out of memory
+    }
+
+    xs->xs_uio.uio_iov = (struct scsipi_iovec *) iov;
+    xs->xs_uio.uio_iovcnt = iovcnt;
+    xs->data = (u_char *) &xs->xs_uio;
+    xs->amiga_ior = ior;
+    xs->xs_callback_arg = NULL;
+    xs->xs_done_callback = sd_complete;
+
+    return (scsipi_execute_xs(xs));
+}
+
 #ifdef ENABLE_SEEK
 /* Seek is implemented but untested code */
 int
@@ -516,7 +953,7 @@ sd_getgeometry(void *periph_p, void *geom_p, void *ior)
     cmd.unused[0] = 0;  /* Page Code */
     cmd.length = SCSIPI_INQUIRY_LENGTH_SCSI2;
 
-    inq = AllocMem(sizeof (*inq), MEMF_PUBLIC);
+    inq = mempool_alloc(sizeof (*inq), MEMF_PUBLIC);
     if (inq == NULL)
         return (ERROR_NO_MEMORY);
 
@@ -637,7 +1074,7 @@ queue_get_mode_page(struct scsipi_xfer *oxs, uint8_t page, uint8_t dbd,
     int rc;
 
     if (modepage == NULL) {
-        modepage = AllocMem(sizeof (*modepage), MEMF_PUBLIC | MEMF_CLEAR);
+        modepage = mempool_alloc(sizeof (*modepage), MEMF_PUBLIC | MEMF_CLEAR);
         if (__predict_false(modepage == NULL)) {
             cmd_complete(oxs->amiga_ior, ERROR_NO_MEMORY);
             return;
@@ -656,7 +1093,7 @@ queue_get_mode_page(struct scsipi_xfer *oxs, uint8_t page, uint8_t dbd,
                                (uint8_t *)modepage, sizeof (*modepage),
                                1, 1000, NULL, flags);
     if (__predict_false(xs == NULL)) {
-        FreeMem(modepage, sizeof (*modepage));
+        mempool_free(modepage, sizeof (*modepage));
         cmd_complete(oxs->amiga_ior, ERROR_NO_MEMORY);
         return;
     }
@@ -666,7 +1103,7 @@ queue_get_mode_page(struct scsipi_xfer *oxs, uint8_t page, uint8_t dbd,
 
     rc = scsipi_execute_xs(xs);
     if (rc != 0) {
-        FreeMem(modepage, sizeof (*modepage));
+        mempool_free(modepage, sizeof (*modepage));
         cmd_complete(oxs->amiga_ior, rc);
     }
 }
@@ -719,7 +1156,7 @@ geom_done_mode_page_5(struct scsipi_xfer *xs)
         queue_get_mode_page(xs, 5, 0, modepage, geom_done_mode_page_5);
         return;
     }
-    FreeMem(modepage, sizeof (*modepage));
+    mempool_free(modepage, sizeof (*modepage));
     cmd_complete(xs->amiga_ior, rc);
 }
 
@@ -757,7 +1194,7 @@ geom_done_mode_page_4(struct scsipi_xfer *xs)
         return;
     }
 
-    FreeMem(modepage, sizeof (*modepage));
+    mempool_free(modepage, sizeof (*modepage));
     cmd_complete(xs->amiga_ior, rc);
 }
 
@@ -861,7 +1298,7 @@ geom_done_inquiry(struct scsipi_xfer *oxs)
         geom->dg_Flags = (inq->dev_qual2 & SID_REMOVABLE) ? DGF_REMOVABLE : 0;
     }
 
-    FreeMem(inq, sizeof (*inq));
+    mempool_free(inq, sizeof (*inq));
 
     memset(&cmd, 0, sizeof (cmd));
 
@@ -942,6 +1379,11 @@ sd_scsidirect(void *periph_p, void *scmd_p, void *ior)
         flags |= XS_CTL_DATA_IN;
     else
         flags |= XS_CTL_DATA_OUT;
+
+    /* The block cache can't tell what a pass-through write changes */
+    if (((flags & XS_CTL_DATA_OUT) && (buflen != 0)) ||
+        (cmdp->opcode == SCSI_FORMAT_UNIT))
+        bcache_invalidate(periph);
 #if 0
 // xs->xs_control |= XS_CTL_USERCMD;  // to indicate user command (no autosense)
 
@@ -1003,6 +1445,10 @@ sd_complete(struct scsipi_xfer *xs)
 #endif
     }
 #endif
+    if (xs->xs_callback_arg != NULL)
+        bcache_fill(xs->xs_callback_arg, xs->data, rc == 0);
+    else if ((rc != 0) && (xs->xs_control & XS_CTL_DATA_OUT))
+        bcache_invalidate(xs->xs_periph);
     cmd_complete(xs->amiga_ior, rc);
 }
 
@@ -1027,6 +1473,19 @@ sd_startstop_complete(struct scsipi_xfer *xs)
     cmd_complete(xs->amiga_ior, rc);
 }
 
+/*
+ * Called when the write cache flush ahead of a barrier is complete. The
+ * barrier write is already queued behind it, so a failure is only noted.
+ */
+static void
+sd_sync_complete(struct scsipi_xfer *xs)
+{
+    if (xs->error != XS_NOERROR)
+        printf("sd%d.%d cache flush failed xs->error=%d\n",
+               xs->xs_periph->periph_target, xs->xs_periph->periph_lun,
+               xs->error);
+}
+
 /* Called when disk test unit ready is complete */
 static void
 sd_tur_complete(struct scsipi_xfer *xs)
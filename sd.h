@@ -10,9 +10,63 @@ int sd_get_protstatus(void *periph_p, ULONG *status);
 int sd_startstop(void *periph_p, void *ior, int start, int load_eject,
                  int immed);
 int sd_testunitready(void *periph_p, void *ior);
-void sd_testunitready_walk(struct scsipi_channel *chan);
+int sd_testunitready_walk(struct scsipi_channel *chan, int elapsed);
+
+/*
+ * Scatter/gather transfer, used with CMD_SCATTER_READ and
+ * CMD_SCATTER_WRITE.
+ *
+ * io_Offset and io_Actual give the byte offset on disk as with TD_READ64
+ * (io_Actual is the upper 32 bits). io_Data points to an array of
+ * io_Length segments, which are transferred to or from consecutive
+ * blocks with a single SCSI command. Each segment must be longword
+ * aligned and a whole number of blocks, and all segments together may
+ * not exceed MAXPHYS. On completion, io_Actual holds the total number of
+ * bytes transferred.
+ */
+#define SCATTER_MAX_SEGS 8
+
+typedef struct scsipi_iovec a4091_iovec_t;  // iov_base, iov_len
+
+int sd_scatter(void *periph_p, uint64_t blkno, uint b_flags,
+               const a4091_iovec_t *iov, uint iovcnt, void *ior);
 
 uint32_t sd_blocksize(void *periph_p);
+int translate_xs_error(struct scsipi_xfer *xs);
+
+/*
+ * Drive caching profile (MODE page 8), used with CMD_CACHEPROFILE.
+ *
+ * The caller fills in cp_profile (and for CACHE_PROFILE_CUSTOM the page
+ * fields). On return, the page fields hold the drive's current settings.
+ * Only bits and fields which the drive reports as changeable are modified.
+ * The profiles do not touch the write cache (WCE) setting.
+ */
+#define CACHE_PROFILE_GET        0    // Only report current settings
+#define CACHE_PROFILE_SEQUENTIAL 1    // Aggressive read-ahead
+#define CACHE_PROFILE_RANDOM     2    // Read-ahead disabled
+#define CACHE_PROFILE_BALANCED   3    // Drive default settings
+#define CACHE_PROFILE_CUSTOM     4    // Settings from caller
+#define CACHE_PROFILE_NONE       0xff // Drive has no caching page
+
+#define CPF_SAVE                 0x01 // Also store as drive's saved page
+
+typedef struct {
+    uint8_t  cp_profile;              // CACHE_PROFILE_*
+    uint8_t  cp_flags;                // CPF_*
+    uint8_t  cp_cache_flags;          // Page byte 2 (CACHING_* in scsi_disk.h)
+    uint8_t  cp_cache_flags2;         // Page byte 12 (CACHING2_*)
+    uint16_t cp_dis_prefetch_len;     // Disable prefetch transfer length
+    uint16_t cp_min_prefetch;
+    uint16_t cp_max_prefetch;
+    uint16_t cp_max_prefetch_ceiling;
+    uint8_t  cp_segments;             // Number of cache segments
+    uint8_t  cp_pad;
+} a4091_cache_profile_t;
+
+void sd_cache_probe(void *periph_p);
+int sd_cache_profile(void *periph_p, a4091_cache_profile_t *cp);
+int sd_disk_profile(void *periph_p, void *dp_p);
 
 void sd_media_unloaded(struct scsipi_periph *periph);
 void sd_media_loaded(struct scsipi_periph *periph);
@@ -108,6 +108,11 @@ __KERNEL_RCSID(0, "$NetBSD: siop.c,v 1.71 2022/04/07 19:33:37 andvar Exp $");
 #include "sys_queue.h"
 #include "siopreg.h"
 #include "siopvar.h"
+#ifdef PORT_AMIGA
+#include "siop_target.h"
+#include "diskprofile.h"
+#include "stats.h"
+#endif
 #include <stdio.h>
 
 /*
@@ -128,7 +133,9 @@ void siopsetdelay(int);
 void siop_scsidone(struct siop_acb *, int);
 void siop_timeout(void *);
 void siop_sched(struct siop_softc *);
+#ifndef PORT_AMIGA
 void siop_poll(struct siop_softc *, struct siop_acb *);
+#endif
 void siopintr(struct siop_softc *);
 void scsi_period_to_siop(struct siop_softc *, int);
 void siop_start(struct siop_softc *, int, int, u_char *, int, u_char *, int);
@@ -139,6 +146,19 @@ void siop_dump_acb(struct siop_acb *);
 /* 53C710 script */
 #include "siop_script.out"
 
+/*
+ * The script is left waiting in WAIT RESELECT when no command is active
+ * if a disconnected command may reselect, or if another initiator may
+ * select this board (target mode). Otherwise it is halted, and the next
+ * command is started by writing DSP.
+ */
+#ifdef PORT_AMIGA
+#define SIOP_WAIT_IDLE(sc) ((sc)->nexus_list.tqh_first != NULL || \
+    ((sc)->sc_flags & (SIOP_TARGET | SIOP_TARGET_STOP)) == SIOP_TARGET)
+#else
+#define SIOP_WAIT_IDLE(sc) ((sc)->nexus_list.tqh_first != NULL)
+#endif
+
 /* default to not inhibit sync negotiation on any drive */
 u_char siop_inhibit_sync[8] = { 0, 0, 0, 0, 0, 0, 0 }; /* initialize, so patchable */
 #ifndef PORT_AMIGA
@@ -249,6 +269,58 @@ siop_minphys(struct buf *bp)
 }
 #endif
 
+#ifdef PORT_AMIGA
+/*
+ * siop_set_xfer_mode
+ * ------------------
+ * Apply the sync period limit and disconnect policy of a disk profile
+ * (diskprofile.h) to a target. Requests which do not come from a profile
+ * are ignored. Sync transfer is renegotiated with the next command sent
+ * to the target; until then the current agreement remains in use. An
+ * asynchronous limit is negotiated as offset 0, so that a target which is
+ * already synchronous is told to stop.
+ */
+static void
+siop_set_xfer_mode(struct siop_softc *sc, struct scsipi_xfer_mode *xm)
+{
+    int target = xm->xm_target;
+    int s;
+
+    if ((xm->xm_profile == 0) || (target < 0) || (target > 7))
+        return;
+
+    s = bsd_splbio();
+    if ((xm->xm_mode & PERIPH_CAP_SYNC) == 0)
+        sc->sc_sync_limit[target] = DP_SYNC_ASYNC;
+    else
+        sc->sc_sync_limit[target] = xm->xm_period;
+
+    switch (xm->xm_disc) {
+        case DP_DISC_NEVER:
+            siop_allow_disc[target] = 0;
+            break;
+        case DP_DISC_NODATA:
+            siop_allow_disc[target] = 1;
+            break;
+        case DP_DISC_ALWAYS:
+            siop_allow_disc[target] = 3;
+            break;
+        case DP_DISC_DEFAULT:
+            /* As set up by siopinitialize() */
+            if ((sc->sc_nodisconnect != 0) &&
+                ((sc->sc_nodisconnect & (1 << target)) == 0))
+                siop_allow_disc[target] = 3;
+            else
+                siop_allow_disc[target] = 0;
+            break;
+    }
+
+    if (siop_inhibit_sync[target] == 0)
+        sc->sc_sync[target].state = NEG_WIDE;
+    bsd_splx(s);
+}
+#endif
+
 /*
  * used by specific siop controller
  *
@@ -326,18 +398,31 @@ siop_scsipi_request(struct scsipi_channel *chan, scsipi_adapter_req_t req,
 
         bsd_splx(s);
 
+#ifdef PORT_AMIGA
+        /*
+         * Polled commands are not spun on with interrupts disabled.
+         * They complete through the interrupt like any other, while
+         * scsipi_execute_xs() sleeps in the handler task.
+         */
+        (void) flags;
+#else
         if (flags & XS_CTL_POLL || siop_no_dma)
             siop_poll(sc, acb);
+#endif
         return;
 
     case ADAPTER_REQ_GROW_RESOURCES:
         return;
 
     case ADAPTER_REQ_SET_XFER_MODE:
+#ifdef PORT_AMIGA
+        siop_set_xfer_mode(sc, arg);
+#endif
         return;
     }
 }
 
+#ifndef PORT_AMIGA
 void
 siop_poll(struct siop_softc *sc, struct siop_acb *acb)
 {
@@ -412,6 +497,7 @@ siop_poll(struct siop_softc *sc, struct siop_acb *acb)
     }
     bsd_splx(s);
 }
+#endif
 
 /*
  * start next command that's ready
@@ -433,6 +519,10 @@ siop_sched(struct siop_softc *sc)
         return;
     }
 #endif
+#ifdef PORT_AMIGA
+    if (sc->sc_flags & SIOP_TARGET_BUSY)
+        return;     /* connected as a target; siop_target_done() restarts */
+#endif
 
     for (acb = sc->ready_list.tqh_first; acb; acb = acb->chain.tqe_next) {
         periph = acb->xs->xs_periph;
@@ -561,13 +651,26 @@ siop_scsidone(struct siop_acb *acb, int stat)
 #ifdef PORT_AMIGA
     /*
      * Call CachePostDMA here once for the whole buffer, even if it took multiple CachePreDMA calls with DMA_Continue flag
+     * The direction flag must match the one given to CachePreDMA.
      *
      * Source: The MuLib Programmer’s Manual Page 40-41
      * http://aminet.net/package/docs/misc/MuManual
      *
      */
     if (acb->iob_buf != NULL && acb->iob_len != 0) {
-        CachePostDMA(&acb->iob_buf, (LONG *)&acb->iob_len, 0);
+        if (xs->xs_control & XS_CTL_DATA_UIO) {
+            /* Each segment was a separate buffer for CachePreDMA */
+            struct scsipi_uio *uio = acb->iob_buf;
+            int seg;
+            for (seg = 0; seg < uio->uio_iovcnt; seg++) {
+                LONG seglen = uio->uio_iov[seg].iov_len;
+                CachePostDMA(uio->uio_iov[seg].iov_base, &seglen,
+                             acb->iob_dmaflags);
+            }
+        } else {
+            CachePostDMA(acb->iob_buf, (LONG *)&acb->iob_len,
+                         acb->iob_dmaflags);
+        }
     }
 #endif
 
@@ -734,10 +837,58 @@ siopshutdown(struct scsipi_channel *chan)
 {
     struct siop_softc *sc = device_private(chan->chan_adapter->adapt_dev);
 
+    siop_target_shutdown(sc);
     siopreset(sc);
     scsipi_free_all_xs(chan);
     FreeMem(sc->sc_acb, sizeof(struct siop_acb) * SIOP_NACB);
 }
+
+/*
+ * Turn response to selection by other initiators on or off. The 53C710
+ * always responds to selection (SCNTL1 ESR), so this only decides whether
+ * the script keeps waiting for one when idle, and whether a selection
+ * starts the target script. When turned off, the script stops waiting at
+ * the next opportunity.
+ */
+void
+siop_target_mode(struct siop_softc *sc, int enable)
+{
+    siop_regmap_p rp = sc->sc_siopp;
+    int s = bsd_splbio();
+
+    if (enable) {
+        /* Script is halted unless something else keeps it waiting */
+        int halted = (sc->sc_nexus == NULL) &&
+                     (sc->nexus_list.tqh_first == NULL) &&
+                     (sc->sc_flags & SIOP_TARGET) == 0;
+
+        sc->sc_flags |= SIOP_TARGET;
+        sc->sc_flags &= ~SIOP_TARGET_STOP;
+        if (halted)
+            rp->siop_dsp = sc->sc_scriptspa + Ent_wait_reselect;
+    } else if (sc->sc_flags & SIOP_TARGET) {
+        sc->sc_flags |= SIOP_TARGET_STOP;
+        if ((sc->sc_nexus == NULL) && (sc->sc_flags & SIOP_TARGET_BUSY) == 0)
+            rp->siop_istat = SIOP_ISTAT_SIGP;   /* end WAIT RESELECT */
+    }
+    bsd_splx(s);
+}
+
+/*
+ * Called by siop_target.c when the target script has released the bus.
+ * Go back to waiting for (re)selection and start held back commands.
+ */
+void
+siop_target_done(struct siop_softc *sc)
+{
+    sc->sc_flags &= ~SIOP_TARGET_BUSY;
+    if (SIOP_WAIT_IDLE(sc))
+        sc->sc_siopp->siop_dsp = sc->sc_scriptspa + Ent_wait_reselect;
+    else
+        sc->sc_flags &= ~(SIOP_TARGET | SIOP_TARGET_STOP);
+    if (sc->ready_list.tqh_first)
+        siop_sched(sc);
+}
 #endif
 
 void
@@ -778,6 +929,322 @@ siop_timeout(void *arg)
     bsd_splx(s);
 }
 
+#ifdef PORT_AMIGA
+/*
+ * Scatter/gather split calibration
+ * --------------------------------
+ * siop_start() gives an unaligned buffer a short first chain entry, so
+ * that the rest of the transfer is longword aligned, unless the transfer
+ * is too short for the extra entry to pay off. Where that point lies
+ * depends on the CPU, the memory and the Zorro III timing, so it is
+ * measured for each memory region at the first reset, while the SCSI
+ * bus settles.
+ *
+ * A trial is a script of SIOP_TRIAL_MOVES identical memory moves ending
+ * in an interrupt instruction, timed with the E-clock. For each length,
+ * moves which start one byte past a longword boundary are compared with
+ * the same moves split into 3 bytes and an aligned remainder, as
+ * siop_start() would issue them.
+ */
+#define SIOP_TRIAL_MOVES  16    /* Memory moves per timed script */
+#define SIOP_TRIAL_RUNS   2     /* Best of this many runs is used */
+#define SIOP_TRIAL_MAX    512   /* Longest trial length */
+#define SIOP_TRIAL_BUF    (2 * (SIOP_TRIAL_MAX + 8))
+#define SIOP_TRIAL_SCRIPT ((SIOP_TRIAL_MOVES * 6 + 2) * 4)
+#define SIOP_TRIAL_USECS  20000 /* Give up on a script after this long */
+
+static const u_short siop_trial_len[] = {
+    16, 32, 64, 128, 256, SIOP_TRIAL_MAX
+};
+#define SIOP_TRIAL_LENS ARRAY_SIZE(siop_trial_len)
+
+/*
+ * Fast RAM which the A4091 is known to reach by DMA. Accelerator RAM in
+ * the CPU slot is not always visible to Zorro III bus masters, and
+ * Zorro II RAM depends on the Buster revision, so neither is trialled.
+ */
+static const struct {
+    u_long lower;
+    u_long upper;
+} siop_dma_windows[] = {
+    { 0x07000000, 0x08000000 },     /* A3000/A4000 motherboard Fast RAM */
+    { 0x10000000, 0x80000000 },     /* Zorro III expansion space */
+};
+
+/*
+ * siop_trial_script
+ * -----------------
+ * Fill in a trial script of len byte moves from src + 1 to dst + 1,
+ * optionally split for alignment. Returns the script length in bytes.
+ */
+static u_int
+siop_trial_script(uint32_t *script, u_char *src, u_char *dst, u_int len,
+                  int split)
+{
+    uint32_t *p = script;
+    u_int     i;
+
+    for (i = 0; i < SIOP_TRIAL_MOVES; i++) {
+        if (split) {
+            *p++ = 0xc0000000 | 3;          /* Memory Move, 3 bytes */
+            *p++ = (uint32_t) src + 1;
+            *p++ = (uint32_t) dst + 1;
+            *p++ = 0xc0000000 | (len - 3);  /* Aligned remainder */
+            *p++ = (uint32_t) src + 4;
+            *p++ = (uint32_t) dst + 4;
+        } else {
+            *p++ = 0xc0000000 | len;
+            *p++ = (uint32_t) src + 1;
+            *p++ = (uint32_t) dst + 1;
+        }
+    }
+    *p++ = 0x98080000;                      /* Interrupt and stop */
+    *p++ = 0x00000000;
+    return ((p - script) * sizeof (*p));
+}
+
+/*
+ * siop_trial_run
+ * --------------
+ * Run a trial script and return its duration in E-clock ticks, or 0 if
+ * it failed. Completion is seen through the interrupt handler, which
+ * captures ISTAT and DSTAT as for any other script interrupt.
+ */
+static uint32_t
+siop_trial_run(struct siop_softc *sc, uint32_t *script, u_int len)
+{
+    siop_regmap_p    rp = sc->sc_siopp;
+    volatile u_char *istat = &sc->sc_istat;
+    uint64_t         start;
+    uint64_t         now;
+    u_char           dstat;
+
+    CacheClearE(script, len, CACRF_ClearD);
+    sc->sc_istat = 0;
+    sc->sc_dstat = 0;
+    start = eclock_read();
+    rp->siop_dsp = kvtop(script);
+    do {
+        now = eclock_read();
+        if (eclock_usecs(now - start) > SIOP_TRIAL_USECS) {
+            rp->siop_istat |= SIOP_ISTAT_ABRT;
+            delay(1000);
+            rp->siop_istat &= ~SIOP_ISTAT_ABRT;
+            sc->sc_istat = 0;
+            return (0);
+        }
+    } while ((*istat & SIOP_ISTAT_DIP) == 0);
+
+    dstat = sc->sc_dstat;
+    sc->sc_istat = 0;
+    if ((dstat & (SIOP_DSTAT_BF | SIOP_DSTAT_ABRT | SIOP_DSTAT_IID |
+                  SIOP_DSTAT_SIR)) != SIOP_DSTAT_SIR)
+        return (0);
+    return ((uint32_t) (now - start) + 1);
+}
+
+/*
+ * siop_trial_best
+ * ---------------
+ * Time a trial script, returning the best of SIOP_TRIAL_RUNS runs.
+ */
+static uint32_t
+siop_trial_best(struct siop_softc *sc, uint32_t *script, u_char *buf,
+                u_int len, int split)
+{
+    u_int    slen;
+    u_int    run;
+    uint32_t best = 0;
+    uint32_t t;
+
+    slen = siop_trial_script(script, buf, buf + SIOP_TRIAL_BUF / 2,
+                             len, split);
+    for (run = 0; run < SIOP_TRIAL_RUNS; run++) {
+        t = siop_trial_run(sc, script, slen);
+        if (t == 0)
+            return (0);
+        if ((best == 0) || (t < best))
+            best = t;
+    }
+    return (best);
+}
+
+/*
+ * siop_dma_calibrate_region
+ * -------------------------
+ * Find the split threshold for memory like that of buf. Transfers longer
+ * than the threshold are split, so it is the longest trial length from
+ * which on splitting no longer wins. The threshold is never below the
+ * shortest trial length, and if splitting does not win even at the
+ * longest trial length, it is SIOP_DMA_NEVER; neither end is
+ * extrapolated. The gain is the trial time saved over the fixed
+ * SIOP_DMA_SPLIT threshold, in 0.1% units.
+ */
+static int
+siop_dma_calibrate_region(struct siop_softc *sc, uint32_t *script,
+                          u_char *buf, struct siop_dmaregion *dr)
+{
+    uint32_t whole[SIOP_TRIAL_LENS];
+    uint32_t split[SIOP_TRIAL_LENS];
+    uint32_t sum_fixed = 0;
+    uint32_t sum_tuned = 0;
+    u_int    len;
+    u_int    i;
+
+    for (i = 0; i < SIOP_TRIAL_LENS; i++) {
+        len = siop_trial_len[i];
+        whole[i] = siop_trial_best(sc, script, buf, len, 0);
+        split[i] = siop_trial_best(sc, script, buf, len, 1);
+        if ((whole[i] == 0) || (split[i] == 0))
+            return (1);
+    }
+
+    dr->dr_split = SIOP_DMA_NEVER;
+    for (i = SIOP_TRIAL_LENS; i > 0; i--) {
+        if (split[i - 1] >= whole[i - 1])
+            break;
+        dr->dr_split = siop_trial_len[(i > 1) ? i - 2 : 0];
+    }
+
+    for (i = 0; i < SIOP_TRIAL_LENS; i++) {
+        len = siop_trial_len[i];
+        sum_fixed += (len > SIOP_DMA_SPLIT) ? split[i] : whole[i];
+        sum_tuned += (len > dr->dr_split) ? split[i] : whole[i];
+    }
+    dr->dr_gain = (int32_t) (sum_fixed - sum_tuned) * 1000 / (int32_t) sum_fixed;
+    return (0);
+}
+
+/*
+ * siop_dma_reachable
+ * ------------------
+ * Return non-zero if the memory region lies within one of the
+ * siop_dma_windows.
+ */
+static int
+siop_dma_reachable(struct MemHeader *mh)
+{
+    u_long lower = (u_long) mh->mh_Lower;
+    u_long upper = (u_long) mh->mh_Upper;
+    u_int  i;
+
+    for (i = 0; i < ARRAY_SIZE(siop_dma_windows); i++) {
+        if ((lower >= siop_dma_windows[i].lower) &&
+            (upper <= siop_dma_windows[i].upper))
+            return (1);
+    }
+    return (0);
+}
+
+/*
+ * siop_dma_calibrate
+ * ------------------
+ * Calibrate the split threshold of up to SIOP_DMAREGIONS Fast RAM regions,
+ * with a trial buffer taken from each region's free memory. Only regions
+ * which siop_dma_reachable() accepts are trialled. Chip RAM, other Fast
+ * RAM and regions which could not be measured use SIOP_DMA_SPLIT.
+ */
+static void
+siop_dma_calibrate(struct siop_softc *sc)
+{
+    siop_regmap_p          rp = sc->sc_siopp;
+    struct MemHeader      *mh;
+    struct MemHeader      *mhs[SIOP_DMAREGIONS];
+    u_char                *bufs[SIOP_DMAREGIONS];
+    struct siop_dmaregion *dr;
+    uint32_t              *script;
+    u_int                  count = 0;
+    u_int                  gain;
+    u_int                  i;
+
+    sc->sc_ndmaregion = 0;
+    script = AllocMem(SIOP_TRIAL_SCRIPT, MEMF_PUBLIC);
+    if (script == NULL)
+        return;
+
+    Forbid();
+    for (mh = (struct MemHeader *) SysBase->MemList.lh_Head;
+         (mh->mh_Node.ln_Succ != NULL) && (count < SIOP_DMAREGIONS);
+         mh = (struct MemHeader *) mh->mh_Node.ln_Succ) {
+        if (((mh->mh_Attributes & (MEMF_FAST | MEMF_CHIP)) != MEMF_FAST) ||
+            !siop_dma_reachable(mh))
+            continue;
+        bufs[count] = Allocate(mh, SIOP_TRIAL_BUF);
+        if (bufs[count] != NULL)
+            mhs[count++] = mh;
+    }
+    Permit();
+
+    rp->siop_dien = SIOP_DIEN_BF | SIOP_DIEN_ABRT | SIOP_DIEN_SIR |
+                    SIOP_DIEN_IID;
+    for (i = 0; i < count; i++) {
+        dr = &sc->sc_dmaregion[sc->sc_ndmaregion];
+        dr->dr_lower = (u_long) mhs[i]->mh_Lower;
+        dr->dr_upper = (u_long) mhs[i]->mh_Upper;
+        if (siop_dma_calibrate_region(sc, script, bufs[i], dr) != 0) {
+            printf("DMA calibration failed at %p\n", bufs[i]);
+            continue;
+        }
+        gain = (dr->dr_gain < 0) ? -dr->dr_gain : dr->dr_gain;
+        printf("DMA %08lx-%08lx ", dr->dr_lower, dr->dr_upper - 1);
+        if (dr->dr_split == SIOP_DMA_NEVER)
+            printf("never split");
+        else
+            printf("split > %lu", dr->dr_split);
+        printf(" gain %s%u.%u%%\n",
+               (dr->dr_gain < 0) ? "-" : "", gain / 10, gain % 10);
+        sc->sc_ndmaregion++;
+    }
+    rp->siop_dien = 0;
+    sc->sc_istat = 0;
+
+    Forbid();
+    for (i = 0; i < count; i++)
+        Deallocate(mhs[i], bufs[i], SIOP_TRIAL_BUF);
+    Permit();
+    FreeMem(script, SIOP_TRIAL_SCRIPT);
+}
+
+/*
+ * siop_dma_split
+ * --------------
+ * Return the split threshold for a buffer at addr.
+ */
+static u_long
+siop_dma_split(struct siop_softc *sc, u_long addr)
+{
+    struct siop_dmaregion *dr = sc->sc_dmaregion;
+    u_int                  i;
+
+    for (i = 0; i < sc->sc_ndmaregion; i++, dr++)
+        if ((addr >= dr->dr_lower) && (addr < dr->dr_upper))
+            return (dr->dr_split);
+    return (SIOP_DMA_SPLIT);
+}
+
+/*
+ * siop_get_dma_stats
+ * ------------------
+ * Report the calibrated split thresholds for CMD_GETSTATS.
+ */
+void
+siop_get_dma_stats(struct siop_softc *sc, void *ds_p)
+{
+    a4091_dma_stats_t *ds = ds_p;
+    u_int              i;
+
+    ds->ds_regions = sc->sc_ndmaregion;
+    ds->ds_default = SIOP_DMA_SPLIT;
+    ds->ds_maxseg  = AMIGA_MAX_TRANSFER;
+    for (i = 0; i < sc->sc_ndmaregion; i++) {
+        ds->ds_region[i].dr_lower = sc->sc_dmaregion[i].dr_lower;
+        ds->ds_region[i].dr_upper = sc->sc_dmaregion[i].dr_upper;
+        ds->ds_region[i].dr_split = sc->sc_dmaregion[i].dr_split;
+        ds->ds_region[i].dr_gain  = sc->sc_dmaregion[i].dr_gain;
+    }
+}
+#endif /* PORT_AMIGA */
+
 void
 siopreset(struct siop_softc *sc)
 {
@@ -824,6 +1291,12 @@ siopreset(struct siop_softc *sc)
     rp->siop_sien = 0x00;   /* don't enable interrupts yet */
     rp->siop_dien = 0x00;   /* don't enable interrupts yet */
     rp->siop_scid = 1 << sc->sc_channel.chan_id;
+#ifdef PORT_AMIGA
+    /* A reset ends any target connection, but not target mode itself */
+    sc->sc_flags &= ~SIOP_TARGET_BUSY;
+    if (sc->sc_flags & SIOP_TARGET_STOP)
+        sc->sc_flags &= ~(SIOP_TARGET | SIOP_TARGET_STOP);
+#endif
     rp->siop_dwt = 0x00;
     rp->siop_ctest0 |= SIOP_CTEST0_BTD | SIOP_CTEST0_EAN;
     rp->siop_ctest7 |= sc->sc_ctest7;
@@ -856,6 +1329,18 @@ siopreset(struct siop_softc *sc)
     sc->sc_flags &= ~(SIOP_INTDEFER|SIOP_INTSOFF);
     bsd_splx (s);
 
+#ifdef PORT_AMIGA
+    if ((sc->sc_flags & SIOP_ALIVE) == 0) {
+        /* Calibrate DMA while the bus settles */
+        uint64_t start = eclock_read();
+        uint32_t spent;
+
+        siop_dma_calibrate(sc);
+        spent = eclock_usecs(eclock_read() - start);
+        if (spent < siop_reset_delay * 1000)
+            delay(siop_reset_delay * 1000 - spent);
+    } else
+#endif
     delay (siop_reset_delay * 1000);
 #ifdef PORT_AMIGA
     siopintr(sc);
@@ -899,6 +1384,10 @@ siopreset(struct siop_softc *sc)
         /*SIOP_DIEN_WTD |*/ SIOP_DIEN_IID;
     rp->siop_sien = sc->sc_sien;
     rp->siop_dien = sc->sc_dien;
+#ifdef PORT_AMIGA
+    if (sc->sc_flags & SIOP_TARGET)
+        rp->siop_dsp = sc->sc_scriptspa + Ent_wait_reselect;
+#endif
 }
 
 /*
@@ -993,6 +1482,13 @@ siop_start(struct siop_softc *sc, int target, int lun, u_char *cbuf, int clen,
             acb->msgout[4] = sc->sc_minsync;
 #endif
             acb->msgout[5] = SIOP_MAX_OFFSET;
+#ifdef PORT_AMIGA
+            /* Disk profile limit, see siop_set_xfer_mode() */
+            if (sc->sc_sync_limit[target] == DP_SYNC_ASYNC)
+                acb->msgout[5] = 0;
+            else if (sc->sc_sync_limit[target] > acb->msgout[4])
+                acb->msgout[4] = sc->sc_sync_limit[target];
+#endif
             acb->ds.idlen = 6;
             sc->sc_sync[target].state = NEG_WAITS;
 #ifdef DEBUG_SYNC
@@ -1014,28 +1510,57 @@ siop_start(struct siop_softc *sc, int target, int lun, u_char *cbuf, int clen,
     dmaend = NULL;
 #ifdef PORT_AMIGA
     /*
-     * ReadFromRAM should only be set when writing to the device
-     * When this flag is set, CachePreDMA doesn't turn off copyback mode
-     * Maybe there's some way to know here what the direction of the transfer is?
-     * We also need to match this flag at the other side
+     * ReadFromRAM is only set when writing to the device: the data
+     * cache is then pushed, but not invalidated, and CachePreDMA doesn't
+     * turn off copyback mode. For reads, the lines are invalidated;
+     * CachePreDMA pushes lines which only partly belong to the buffer,
+     * so that data next to it is not lost. siop_scsidone() passes the
+     * same flag to CachePostDMA.
      */
-    //ULONG flags = DMA_ReadFromRAM;
-    ULONG flags = 0;
+    ULONG flags = (acb->xs->xs_control & XS_CTL_DATA_OUT) ?
+                  DMA_ReadFromRAM : 0;
+    acb->iob_dmaflags = flags;
+
+    /*
+     * With XS_CTL_DATA_UIO, buf is a segment list which is transferred
+     * as one, each segment starting a new run of chain entries.
+     */
+    struct scsipi_uio *uio = NULL;
+    int seg = 0;
+    if ((acb->xs->xs_control & XS_CTL_DATA_UIO) && len != 0) {
+        uio = (struct scsipi_uio *) buf;
+        addr = uio->uio_iov[0].iov_base;
+        count = uio->uio_iov[0].iov_len;
+    }
 #endif
 
     while (count > 0) {
+#ifdef PORT_AMIGA
+        if (nchain >= DMAMAXIO) {
+            /*
+             * CachePreDMA() may break a segment at every MMU page, so a
+             * transfer can need more chain entries than there are.
+             */
+            printf("siop_start: %d byte transfer needs too many DMA "
+                   "segments\n", len);
+            acb->xs->error = XS_DRIVER_STUFFUP;
+            siop_scsidone(acb, acb->stat[0]);
+            return;
+        }
+#endif
         acb->ds.chain[nchain].databuf = (char *) kvtop (addr);
 #ifdef PORT_AMIGA
         tcount = count;
         if (tcount > AMIGA_MAX_TRANSFER)
             tcount = AMIGA_MAX_TRANSFER;
-        if ((((ULONG) addr) & 3) && (tcount > 30)) {
+        if ((((ULONG) addr) & 3) &&
+            (tcount > siop_dma_split(sc, (u_long) addr))) {
             /*
              * First sg should align transfer, unless it's a small transfer.
              *
-             * XXX: The 30 above is subject to tuning. The tradeoff is that
-             *      one more sg entry takes CPU time and some bus bandwidth
-             *      to process.
+             * The tradeoff is that one more sg entry takes CPU time and
+             * some bus bandwidth to process. The threshold for the memory
+             * holding the buffer is measured by siop_dma_calibrate().
              */
             tcount = 4 - (((ULONG) addr) & 3);
         }
@@ -1069,6 +1594,13 @@ siop_start(struct siop_softc *sc, int target, int lun, u_char *cbuf, int clen,
 #endif
         }
         ++nchain;
+#ifdef PORT_AMIGA
+        if ((count == 0) && (uio != NULL) && (++seg < uio->uio_iovcnt)) {
+            addr = uio->uio_iov[seg].iov_base;
+            count = uio->uio_iov[seg].iov_len;
+            flags &= ~DMA_Continue;
+        }
+#endif
     }
 #ifdef DEBUG
     if (nchain != 1 && len != 0 && siop_debug & 3) {
@@ -1103,7 +1635,8 @@ siop_start(struct siop_softc *sc, int target, int lun, u_char *cbuf, int clen,
     }
 #endif
 #endif
-    if (sc->nexus_list.tqh_first == NULL) {
+    if ((sc->nexus_list.tqh_first == NULL) &&
+        (sc->sc_flags & SIOP_TARGET) == 0) {
 #ifndef PORT_AMIGA
         /* Callout is now configured for every transaction in siop_sched() */
         callout_reset(&acb->xs->xs_callout,
@@ -1272,11 +1805,37 @@ siop_checkintr(struct siop_softc *sc, u_char istat, u_char dstat,
     struct siop_acb *acb = sc->sc_nexus;
     int target = 0;
     int dfifo, dbc, sstat1;
+    u_long dsps;
+#ifdef PORT_AMIGA
+    uint32_t reg;
+    uint32_t dcmd_dbc;
+    uint8_t  ctest8;
 
+    /*
+     * Each register access is a separate Zorro III bus cycle, so registers
+     * needed on every interrupt are fetched as aligned longwords where that
+     * is safe. The SCRIPTS processor is halted here, and none of LCRC,
+     * CTEST8, ISTAT, DFIFO, DCMD or DBC has a read side effect. The longword
+     * holding CTEST0-3 must not be read like this, as reading CTEST3 pops a
+     * byte from the SCSI FIFO.
+     */
+    reg      = *ADDR32((uintptr_t) &rp->siop_lcrc);
+    dfifo    = (uint8_t) reg;
+    ctest8   = reg >> 16;
+    dcmd_dbc = *ADDR32((uintptr_t) &rp->siop_dcmd);
+    dbc      = (uint8_t) dcmd_dbc;
+    sstat1   = rp->siop_sstat1;
+    rp->siop_ctest8 = ctest8 | SIOP_CTEST8_CLF;
+#else
     dfifo = rp->siop_dfifo;
     dbc = rp->siop_dbc0;
     sstat1 = rp->siop_sstat1;
     rp->siop_ctest8 |= SIOP_CTEST8_CLF;
+#endif
+    /* DSPS is compared against many interrupt codes below; read it once */
+    dsps = (dstat & SIOP_DSTAT_SIR) ? rp->siop_dsps : 0;
+    if (dstat & SIOP_DSTAT_SIR)
+        sc->sc_intcode = dsps;
 #ifdef PORT_AMIGA
     if ((rp->siop_ctest1 & SIOP_CTEST1_FMT) != SIOP_CTEST1_FMT) {
         int timeout = 10000;
@@ -1291,7 +1850,11 @@ siop_checkintr(struct siop_softc *sc, u_char istat, u_char dstat,
      * CTEST8 bit 2 (SIOP_CTEST8_CLF) automatically resets after the
      * 53C710 has successfully cleared the FIFO pointers and registers.
      */
-    rp->siop_ctest8 &= ~SIOP_CTEST8_CLF;
+    rp->siop_ctest8 = ctest8 & ~SIOP_CTEST8_CLF;
+
+    if ((sc->sc_flags & SIOP_TARGET_BUSY) &&
+        siop_target_intr(sc, istat, dstat, sstat0))
+        return (0);
 #else
     while ((rp->siop_ctest1 & SIOP_CTEST1_FMT) != SIOP_CTEST1_FMT)
         ;
@@ -1329,7 +1892,7 @@ siop_checkintr(struct siop_softc *sc, u_char istat, u_char dstat,
     }
 #endif
     SIOP_TRACE('i',dstat,istat,(istat&SIOP_ISTAT_DIP)?rp->siop_dsps&0xff:sstat0);
-    if (dstat & SIOP_DSTAT_SIR && rp->siop_dsps == 0xff00) {
+    if (dstat & SIOP_DSTAT_SIR && dsps == 0xff00) {
         /* Normal completion status, or check condition */
 #ifdef DEBUG
         if (acb == NULL) {
@@ -1383,11 +1946,15 @@ siop_checkintr(struct siop_softc *sc, u_char istat, u_char dstat,
             printf("%s: message was not COMMAND COMPLETE: %x\n",
                 device_xname(sc->sc_dev), acb->msg[0]);
 #endif
-        if (sc->nexus_list.tqh_first)
+        if (SIOP_WAIT_IDLE(sc))
             rp->siop_dcntl |= SIOP_DCNTL_STD;
+#ifdef PORT_AMIGA
+        else
+            sc->sc_flags &= ~(SIOP_TARGET | SIOP_TARGET_STOP);
+#endif
         return 1;
     }
-    if (dstat & SIOP_DSTAT_SIR && rp->siop_dsps == 0xff0b) {
+    if (dstat & SIOP_DSTAT_SIR && dsps == 0xff0b) {
 #ifdef DEBUG
         if (acb == NULL) {
             printf("%s: DSTAT_SIR when no active command?\n",
@@ -1468,8 +2035,12 @@ siop_checkintr(struct siop_softc *sc, u_char istat, u_char dstat,
                 ++adjust;
             if (sstat1 & SIOP_SSTAT1_OLF)
                 ++adjust;
+#ifdef PORT_AMIGA
+            acb->iob_curlen = dcmd_dbc & 0xffffff;
+#else
             acb->iob_curlen =
                 *((long *)__UNVOLATILE(&rp->siop_dcmd)) & 0xffffff;
+#endif
             acb->iob_curlen += adjust;
             acb->iob_curbuf =
                 *((long *)__UNVOLATILE(&rp->siop_dnad)) - adjust;
@@ -1577,8 +2148,8 @@ siop_checkintr(struct siop_softc *sc, u_char istat, u_char dstat,
             rp->siop_dsp = sc->sc_scriptspa + Ent_wait_reselect;
         return (acb != NULL);
     }
-    if (dstat & SIOP_DSTAT_SIR && (rp->siop_dsps == 0xff01 ||
-        rp->siop_dsps == 0xff02)) {
+    if (dstat & SIOP_DSTAT_SIR && (dsps == 0xff01 ||
+        dsps == 0xff02)) {
 #ifdef DEBUG
         if (siop_debug & 0x100)
             printf ("%s: TGT %x disconnected TEMP %lx (+%lx) curbuf %lx curlen %lx buf %p len %lx dfifo %x dbc %x sstat1 %x starts %d acb %p\n",
@@ -1639,7 +2210,7 @@ siop_checkintr(struct siop_softc *sc, u_char istat, u_char dstat,
             if (siop_debug & 0x100)
                 printf ("%s: adjusting DMA chain\n",
                     device_xname(sc->sc_dev));
-            if (rp->siop_dsps == 0xff02)
+            if (dsps == 0xff02)
                 printf ("%s: TGT %x disconnected without Save Data Pointers\n",
                     device_xname(sc->sc_dev), target);
 #endif
@@ -1710,7 +2281,7 @@ siop_checkintr(struct siop_softc *sc, u_char istat, u_char dstat,
             siop_sched(sc);
         return (0);
     }
-    if (dstat & SIOP_DSTAT_SIR && rp->siop_dsps == 0xff03) {
+    if (dstat & SIOP_DSTAT_SIR && dsps == 0xff03) {
         int reselid = rp->siop_scratch & 0x7f;
         int reselun = rp->siop_sfbr & 0x07;
 
@@ -1719,7 +2290,7 @@ siop_checkintr(struct siop_softc *sc, u_char istat, u_char dstat,
         if (siop_debug & 0x100)
             printf ("%s: target ID %02x reselected dsps %lx\n",
                  device_xname(sc->sc_dev), reselid,
-                 rp->siop_dsps);
+                 dsps);
         if ((rp->siop_sfbr & 0x80) == 0)
             printf("%s: Reselect message in was not identify: %x\n",
                 device_xname(sc->sc_dev), rp->siop_sfbr);
@@ -1780,7 +2351,7 @@ siop_checkintr(struct siop_softc *sc, u_char istat, u_char dstat,
         rp->siop_dcntl |= SIOP_DCNTL_STD;
         return (0);
     }
-    if (dstat & SIOP_DSTAT_SIR && rp->siop_dsps == 0xff04) {
+    if (dstat & SIOP_DSTAT_SIR && dsps == 0xff04) {
 #ifdef DEBUG
         u_short ctest2 = rp->siop_ctest2;
 
@@ -1803,7 +2374,12 @@ siop_checkintr(struct siop_softc *sc, u_char istat, u_char dstat,
 #endif
 #endif
 #endif
-            rp->siop_dcntl |= SIOP_DCNTL_STD;
+            if (SIOP_WAIT_IDLE(sc))
+                rp->siop_dcntl |= SIOP_DCNTL_STD;
+#ifdef PORT_AMIGA
+            else
+                sc->sc_flags &= ~(SIOP_TARGET | SIOP_TARGET_STOP);
+#endif
             return(0);
         }
         target = sc->sc_nexus->xs->xs_periph->periph_target;
@@ -1814,7 +2390,28 @@ siop_checkintr(struct siop_softc *sc, u_char istat, u_char dstat,
         rp->siop_dsp = sc->sc_scriptspa;
         return (0);
     }
-    if (dstat & SIOP_DSTAT_SIR && rp->siop_dsps == 0xff06) {
+    if (dstat & SIOP_DSTAT_SIR && dsps == 0xff0c) {
+        /* selected by another initiator while waiting for reselect */
+#ifdef PORT_AMIGA
+        if (sc->sc_flags & SIOP_TARGET) {
+            if (sc->sc_nexus) {
+                /* our selection lost arbitration; siop_target_done()
+                 * starts it again */
+                TAILQ_INSERT_HEAD(&sc->ready_list, sc->sc_nexus, chain);
+                sc->sc_tinfo[sc->sc_nexus->xs->xs_periph->periph_target].lubusy
+                    &= ~(1 << sc->sc_nexus->xs->xs_periph->periph_lun);
+                --sc->sc_active;
+                sc->sc_nexus = NULL;
+            }
+            siop_target_select(sc);
+            return (0);
+        }
+#endif
+        (void) rp->siop_ctest2;     /* clear Sig_P */
+        rp->siop_dsp = sc->sc_scriptspa + Ent_wait_reselect;
+        return (0);
+    }
+    if (dstat & SIOP_DSTAT_SIR && dsps == 0xff06) {
         if (acb == NULL) {
             printf("%s: Bad message-in with no active command?\n",
                 device_xname(sc->sc_dev));
@@ -1837,7 +2434,7 @@ siop_checkintr(struct siop_softc *sc, u_char istat, u_char dstat,
         rp->siop_dsp = sc->sc_scriptspa + Ent_clear_ack;
         return (0);
     }
-    if (dstat & SIOP_DSTAT_SIR && rp->siop_dsps == 0xff0a) {
+    if (dstat & SIOP_DSTAT_SIR && dsps == 0xff0a) {
         /* Status phase wasn't followed by message in phase? */
         printf ("%s: Status phase not followed by message in phase? sbcl %x sbdl %x\n",
             device_xname(sc->sc_dev), rp->siop_sbcl, rp->siop_sbdl);
@@ -1861,7 +2458,7 @@ siop_checkintr(struct siop_softc *sc, u_char istat, u_char dstat,
             dma_cachectl (&acb->msg[0], 1);
 #endif
             printf ("SIOP interrupt: %lx sts %x msg %x %x sbcl %x\n",
-                rp->siop_dsps, acb->stat[0], acb->msg[0], acb->msg[1],
+                dsps, acb->stat[0], acb->msg[0], acb->msg[1],
                 rp->siop_sbcl);
         }
         siopreset(sc);
@@ -1935,6 +2532,8 @@ siop_select(struct siop_softc *sc)
 #endif
 
     rp = sc->sc_siopp;
+    /* Amiga: polled commands keep interrupts on, see siop_scsipi_request() */
+#ifndef PORT_AMIGA
     if (acb->xs->xs_control & XS_CTL_POLL || siop_no_dma) {
         sc->sc_flags &= ~SIOP_INTDEFER;
         if ((rp->siop_istat & 0x08) == 0) {
@@ -1951,6 +2550,7 @@ siop_select(struct siop_softc *sc)
         }
 #endif
     }
+#endif
 #ifdef DEBUG
     if (siop_debug & 1)
         printf ("siop_select: target %x cmd %02x ds %p\n",
@@ -1986,8 +2586,6 @@ siopintr(register struct siop_softc *sc)
     rp = sc->sc_siopp;
     dstat = sc->sc_dstat;
     sstat0 = sc->sc_sstat0;
-    if (dstat & SIOP_DSTAT_SIR)
-        sc->sc_intcode = rp->siop_dsps;
     sc->sc_istat = 0;
 #undef EARLY_SPLX
 #ifdef EARLY_SPLX
@@ -0,0 +1,684 @@
+#ifdef DEBUG_TARGET
+#define USE_SERIAL_OUTPUT
+#endif
+
+#include "port.h"
+#include "port_bsd.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/param.h>
+#include <exec/memory.h>
+#include "scsi_all.h"
+#include "scsipiconf.h"
+#include "scsi_disk.h"
+#include "scsipi_disk.h"
+#include "scsipi_all.h"
+#include "sys_queue.h"
+#include "siopreg.h"
+#include "siopvar.h"
+#include "siop_target.h"
+#include "device.h"
+#include "mempool.h"
+
+#ifdef DEBUG_TARGET
+#define PRINTF_TARGET(args...) printf(args)
+#else
+#define PRINTF_TARGET(args...)
+#endif
+
+/*
+ * SCSI target mode
+ *
+ * The initiator script idles in WAIT RESELECT. With SCNTL1 ESR set
+ * (always, see siopreset()), a selection by another initiator also ends
+ * the wait, and the script raises err12. siop_target_select() then starts
+ * the target script (siop_target.ss), which receives the message and
+ * command bytes and interrupts so that the command can be decoded here.
+ * Data moves by DMA directly between the bus and the RAM disk buffer, so
+ * a transfer only costs the host a few interrupts per command.
+ *
+ * While connected as a target, siop_sched() holds back initiator
+ * commands. When the target script has released the bus, siop_target_done()
+ * goes back to waiting and starts them. All of this runs in the command
+ * handler task, as does CMD_TARGET, so no further locking is needed.
+ *
+ * Only a RAM buffer can back the disk. Reading or writing one of the
+ * board's own units would need the chip as an initiator in the middle of
+ * a target connection.
+ */
+
+/* 53C710 target mode script */
+#include "siop_target.out"
+
+#define TGT_MAXXFER      (8 << 20)  // Largest DMA chunk (24-bit count)
+#define TGT_VERIFY_10    0x2f
+
+typedef struct {
+    long  count;
+    char *addr;
+} tgt_table_t;
+
+/* DSA-relative table used by the target script; see siop_target.ss */
+struct siop_target_ds {
+    tgt_table_t ident;          // ts_Ident
+    tgt_table_t msgout;         // ts_MsgOut
+    tgt_table_t extlen;         // ts_ExtLen
+    tgt_table_t extmsg;         // ts_ExtMsg
+    tgt_table_t reject;         // ts_Reject
+    tgt_table_t cmd;            // ts_Cmd
+    tgt_table_t cmd2;           // ts_Cmd2
+    tgt_table_t data;           // ts_Data
+    tgt_table_t status;         // ts_Status
+    tgt_table_t msg;            // ts_Msg
+};
+
+typedef struct {
+    /* Accessed by the 53C710 */
+    struct siop_target_ds ts_ds;
+    uint8_t  ts_msg[2];         // IDENTIFY, last message out
+    uint8_t  ts_extlen;         // Extended message length
+    uint8_t  ts_reject;         // MESSAGE REJECT
+    uint8_t  ts_status;         // Status byte
+    uint8_t  ts_complete;       // COMMAND COMPLETE
+    uint8_t  ts_cdb[16];
+    uint8_t  ts_rsp[256];       // Small data in / data out, extended msgs
+
+    /* Host only */
+    a4091_target_t ts_cfg;      // Disk geometry and statistics
+    uint8_t *ts_buf;            // Disk contents
+    uint32_t ts_bufsize;
+    uint8_t  ts_ownbuf;         // ts_buf was allocated by the driver
+    uint8_t  ts_release;        // Free when the connection ends
+    uint8_t  ts_cmdlen;         // CDB bytes received
+    uint8_t  ts_sense_key;      // Sense for REQUEST SENSE
+    uint8_t  ts_asc;
+    uint8_t  ts_ascq;
+    uint8_t  ts_data_in;        // Transfer direction is to the initiator
+    uint8_t  ts_pad;
+    uint8_t *ts_xfer_addr;      // Next chunk
+    uint32_t ts_xfer_left;
+    uint8_t *ts_dma_addr;       // Chunk in progress
+    uint32_t ts_dma_len;
+} siop_target_t;
+
+#define TS_DMA_LEN offsetof(siop_target_t, ts_cfg)
+
+/* Additional sense codes */
+#define ASC_INVALID_OPCODE    0x20
+#define ASC_LBA_OUT_OF_RANGE  0x21
+#define ASC_INVALID_FIELD     0x24
+#define ASC_LUN_NOT_SUPPORTED 0x25
+#define ASC_WRITE_PROTECTED   0x27
+
+static const uint8_t tgt_inquiry_id[] =
+    "A4091   "           // Vendor (8)
+    "Target RAM disk "   // Product (16)
+    "0001";              // Revision (4)
+
+static u_long
+tgt_scriptspa(void)
+{
+    return (kvtop((void *)__UNCONST(target_scripts)));
+}
+
+static void
+tgt_table(tgt_table_t *tt, void *addr, uint32_t len)
+{
+    tt->count = len;
+    tt->addr = (char *) kvtop(addr);
+}
+
+/*
+ * tgt_continue
+ * ------------
+ * Write back the script's table and bytes and continue the target script
+ * at the specified entry point.
+ */
+static void
+tgt_continue(struct siop_softc *sc, siop_target_t *ts, u_long entry)
+{
+    CacheClearE(ts, TS_DMA_LEN, CACRF_ClearD);
+    sc->sc_siopp->siop_dsp = tgt_scriptspa() + entry;
+}
+
+static void
+tgt_sense(siop_target_t *ts, uint8_t key, uint8_t asc)
+{
+    ts->ts_sense_key = key;
+    ts->ts_asc = asc;
+    ts->ts_ascq = 0;
+    ts->ts_status = SCSI_CHECK;
+    ts->ts_cfg.tg_errors++;
+}
+
+/*
+ * tgt_xfer_next
+ * -------------
+ * Set up the next data chunk, or the status phase if there is no more
+ * data. Only the last chunk continues into the status phase without an
+ * interrupt.
+ */
+static void
+tgt_xfer_next(struct siop_softc *sc, siop_target_t *ts)
+{
+    uint32_t len = ts->ts_xfer_left;
+    u_long   entry;
+
+    if (len == 0) {
+        tgt_continue(sc, ts, Ent_t_status);
+        return;
+    }
+    if (len > TGT_MAXXFER) {
+        len = TGT_MAXXFER;
+        entry = ts->ts_data_in ? Ent_t_datain : Ent_t_dataout;
+    } else {
+        entry = ts->ts_data_in ? Ent_t_datain_last : Ent_t_dataout_last;
+    }
+    CacheClearE(ts->ts_xfer_addr, len, CACRF_ClearD);
+    tgt_table(&ts->ts_ds.data, ts->ts_xfer_addr, len);
+    ts->ts_dma_addr   = ts->ts_xfer_addr;
+    ts->ts_dma_len    = len;
+    ts->ts_xfer_addr += len;
+    ts->ts_xfer_left -= len;
+    if (ts->ts_data_in)
+        ts->ts_cfg.tg_bytes_out += len;
+    else
+        ts->ts_cfg.tg_bytes_in += len;
+    tgt_continue(sc, ts, entry);
+}
+
+/*
+ * tgt_dma_done
+ * ------------
+ * Drop cache lines covering data which the 53C710 wrote to memory.
+ */
+static void
+tgt_dma_done(siop_target_t *ts)
+{
+    if ((ts->ts_dma_len != 0) && !ts->ts_data_in)
+        CacheClearE(ts->ts_dma_addr, ts->ts_dma_len, CACRF_ClearD);
+    ts->ts_dma_len = 0;
+}
+
+static void
+tgt_data(siop_target_t *ts, void *addr, uint32_t len, int data_in)
+{
+    ts->ts_xfer_addr = addr;
+    ts->ts_xfer_left = len;
+    ts->ts_data_in   = data_in;
+}
+
+static int
+tgt_rw_range(siop_target_t *ts, uint32_t lba, uint32_t nblks)
+{
+    if ((lba > ts->ts_cfg.tg_blocks) ||
+        (nblks > ts->ts_cfg.tg_blocks - lba)) {
+        tgt_sense(ts, SKEY_ILLEGAL_REQUEST, ASC_LBA_OUT_OF_RANGE);
+        return (1);
+    }
+    return (0);
+}
+
+static void
+tgt_rw(siop_target_t *ts, uint32_t lba, uint32_t nblks, int data_in)
+{
+    uint bshift = ffs(ts->ts_cfg.tg_blksize) - 1;
+
+    if (tgt_rw_range(ts, lba, nblks))
+        return;
+    if (!data_in && (ts->ts_cfg.tg_flags & TGF_READONLY)) {
+        tgt_sense(ts, SKEY_DATA_PROTECT, ASC_WRITE_PROTECTED);
+        return;
+    }
+    tgt_data(ts, ts->ts_buf + (lba << bshift), nblks << bshift, data_in);
+}
+
+static void
+tgt_inquiry(siop_target_t *ts, uint lun, uint alloc)
+{
+    struct scsipi_inquiry_data *inq = (void *) ts->ts_rsp;
+
+    memset(inq, 0, SCSIPI_INQUIRY_LENGTH_SCSI2);
+    if (ts->ts_cdb[1] & 0x01) {  // EVPD
+        tgt_sense(ts, SKEY_ILLEGAL_REQUEST, ASC_INVALID_FIELD);
+        return;
+    }
+    if (lun != 0)
+        inq->device = SID_QUAL_LU_NOT_SUPP | T_NODEVICE;
+    else
+        inq->device = T_DIRECT;
+    inq->version = 2;
+    inq->response_format = SID_FORMAT_ISO;
+    inq->additional_length = SCSIPI_INQUIRY_LENGTH_SCSI2 - 5;
+    CopyMem((APTR) tgt_inquiry_id, inq->vendor, sizeof (tgt_inquiry_id) - 1);
+    tgt_data(ts, inq, MIN(alloc, SCSIPI_INQUIRY_LENGTH_SCSI2), 1);
+}
+
+static void
+tgt_request_sense(siop_target_t *ts, uint alloc)
+{
+    struct scsi_sense_data *sense = (void *) ts->ts_rsp;
+
+    memset(sense, 0, 18);
+    sense->response_code = SSD_RCODE_CURRENT;
+    sense->flags = ts->ts_sense_key;
+    sense->extra_len = 10;
+    sense->asc = ts->ts_asc;
+    sense->ascq = ts->ts_ascq;
+    ts->ts_sense_key = SKEY_NO_SENSE;
+    ts->ts_asc = 0;
+    ts->ts_ascq = 0;
+    tgt_data(ts, sense, MIN(alloc, 18), 1);
+}
+
+static void
+tgt_mode_sense(siop_target_t *ts, uint alloc)
+{
+    uint8_t *rsp  = ts->ts_rsp;
+    uint     page = ts->ts_cdb[2] & 0x3f;
+    uint     len  = 4;
+
+    if ((page != 0) && (page != 0x3f)) {
+        /* No mode pages are implemented */
+        tgt_sense(ts, SKEY_ILLEGAL_REQUEST, ASC_INVALID_FIELD);
+        return;
+    }
+    memset(rsp, 0, 12);
+    rsp[2] = (ts->ts_cfg.tg_flags & TGF_READONLY) ? 0x80 : 0;
+    if ((ts->ts_cdb[1] & 0x08) == 0) {  // DBD clear: add block descriptor
+        rsp[3] = 8;
+        _lto3b(MIN(ts->ts_cfg.tg_blocks, 0xffffff), &rsp[5]);
+        _lto3b(ts->ts_cfg.tg_blksize, &rsp[9]);
+        len += 8;
+    }
+    rsp[0] = len - 1;
+    tgt_data(ts, rsp, MIN(alloc, len), 1);
+}
+
+/*
+ * tgt_command
+ * -----------
+ * Execute the received command. Sets up the data phase (if any) and the
+ * status byte.
+ */
+static void
+tgt_command(siop_target_t *ts)
+{
+    uint8_t *cdb = ts->ts_cdb;
+    uint     lun = (ts->ts_msg[0] & 0x80) ? (ts->ts_msg[0] & 0x07) : 0;
+
+    ts->ts_cfg.tg_cmds++;
+    ts->ts_status = SCSI_OK;
+    tgt_data(ts, NULL, 0, 1);
+
+    if (cdb[0] != SCSI_REQUEST_SENSE)
+        ts->ts_sense_key = SKEY_NO_SENSE;
+
+    if ((lun != 0) && (cdb[0] != INQUIRY) &&
+        (cdb[0] != SCSI_REQUEST_SENSE)) {
+        tgt_sense(ts, SKEY_ILLEGAL_REQUEST, ASC_LUN_NOT_SUPPORTED);
+        return;
+    }
+
+    switch (cdb[0]) {
+        case SCSI_TEST_UNIT_READY:
+        case START_STOP:
+        case SCSI_PREVENT_ALLOW_MEDIUM_REMOVAL:
+        case SCSI_SYNCHRONIZE_CACHE_10:
+            break;
+
+        case SCSI_REQUEST_SENSE:
+            tgt_request_sense(ts, cdb[4]);
+            break;
+
+        case INQUIRY:
+            tgt_inquiry(ts, lun, cdb[4]);
+            break;
+
+        case SCSI_MODE_SENSE_6:
+            tgt_mode_sense(ts, cdb[4]);
+            break;
+
+        case SCSI_MODE_SELECT_6:
+            /* Accept and ignore the parameters */
+            tgt_data(ts, ts->ts_rsp, cdb[4], 0);
+            break;
+
+        case READ_CAPACITY_10:
+            _lto4b(ts->ts_cfg.tg_blocks - 1, &ts->ts_rsp[0]);
+            _lto4b(ts->ts_cfg.tg_blksize, &ts->ts_rsp[4]);
+            tgt_data(ts, ts->ts_rsp, 8, 1);
+            break;
+
+        case SCSI_READ_6_COMMAND:
+        case SCSI_WRITE_6_COMMAND:
+            tgt_rw(ts, _3btol(&cdb[1]) & 0x1fffff, cdb[4] ? cdb[4] : 256,
+                   cdb[0] == SCSI_READ_6_COMMAND);
+            break;
+
+        case READ_10:
+        case WRITE_10:
+            tgt_rw(ts, _4btol(&cdb[2]), _2btol(&cdb[7]), cdb[0] == READ_10);
+            break;
+
+        case TGT_VERIFY_10:
+            (void) tgt_rw_range(ts, _4btol(&cdb[2]), _2btol(&cdb[7]));
+            break;
+
+        default:
+            tgt_sense(ts, SKEY_ILLEGAL_REQUEST, ASC_INVALID_OPCODE);
+            break;
+    }
+}
+
+/*
+ * tgt_cdb_len
+ * -----------
+ * Return the CDB length implied by the group code of the operation code.
+ */
+static uint
+tgt_cdb_len(uint8_t opcode)
+{
+    switch (opcode >> 5) {
+        case 1:
+        case 2:
+            return (10);
+        case 4:
+            return (16);
+        case 5:
+            return (12);
+        default:
+            return (6);
+    }
+}
+
+/*
+ * tgt_message
+ * -----------
+ * A message other than IDENTIFY, or one received after the command.
+ * ABORT and BUS DEVICE RESET end the connection without status, a NOP
+ * is ignored and everything else is rejected.
+ */
+static void
+tgt_message(struct siop_softc *sc, siop_target_t *ts, u_long dsp)
+{
+    uint8_t msg;
+
+    CacheClearE(ts->ts_msg, sizeof (ts->ts_msg), CACRF_ClearD);
+    if (dsp == Ent_t_msgloop)
+        msg = ts->ts_msg[0];  // First message was not IDENTIFY
+    else
+        msg = ts->ts_msg[1];
+
+    PRINTF_TARGET("target msg %02x\n", msg);
+    switch (msg) {
+        case MSG_ABORT:
+        case MSG_BUS_DEVICE_RESET:
+        case 0x0d:  // ABORT TAG
+        case 0x0e:  // CLEAR QUEUE
+            tgt_continue(sc, ts, Ent_t_disconnect);
+            return;
+    }
+    if (ts->ts_cmdlen != 0) {
+        /* ATN during data phase: give up on the command */
+        tgt_sense(ts, SKEY_ABORTED_COMMAND, 0);
+        tgt_continue(sc, ts, Ent_t_status);
+    } else if (msg == MSG_NOOP) {
+        tgt_continue(sc, ts, Ent_t_msgloop);
+    } else {
+        tgt_continue(sc, ts, Ent_t_reject);
+    }
+}
+
+/*
+ * siop_target_select
+ * ------------------
+ * Called by siop_checkintr() when the initiator script was selected by
+ * another initiator. Start the target script.
+ */
+void
+siop_target_select(struct siop_softc *sc)
+{
+    siop_regmap_p  rp = sc->sc_siopp;
+    siop_target_t *ts = sc->sc_target;
+
+    sc->sc_flags |= SIOP_TARGET_BUSY;
+    rp->siop_sxfer = 0;  // Asynchronous
+
+    if ((ts == NULL) || (sc->sc_flags & SIOP_TARGET_STOP)) {
+        /* Target mode is being turned off; just release the bus */
+        rp->siop_dsp = tgt_scriptspa() + Ent_t_disconnect;
+        return;
+    }
+
+    PRINTF_TARGET("target selected lcrc %02x\n", rp->siop_lcrc);
+    ts->ts_msg[0] = MSG_IDENTIFY;  // LUN 0 unless IDENTIFY says otherwise
+    ts->ts_cmdlen = 0;
+    ts->ts_dma_len = 0;
+    ts->ts_status = SCSI_OK;
+    rp->siop_dsa = kvtop(&ts->ts_ds);
+    tgt_continue(sc, ts, Ent_t_selected);
+}
+
+static void
+tgt_free(struct siop_softc *sc)
+{
+    siop_target_t *ts = sc->sc_target;
+
+    if (ts->ts_ownbuf)
+        FreeMem(ts->ts_buf, ts->ts_bufsize);
+    mempool_free(ts, sizeof (*ts));
+    sc->sc_target = NULL;
+}
+
+/*
+ * siop_target_intr
+ * ----------------
+ * Handle an interrupt while connected as a target. Returns 0 if the
+ * interrupt should be handled by siop_checkintr() instead.
+ */
+int
+siop_target_intr(struct siop_softc *sc, u_char istat, u_char dstat,
+                 u_char sstat0)
+{
+    siop_regmap_p  rp = sc->sc_siopp;
+    siop_target_t *ts = sc->sc_target;
+    u_long         dsp;
+    uint           len;
+
+    if ((dstat & SIOP_DSTAT_SIR) && (rp->siop_dsps == A_tgt_done)) {
+        if (ts != NULL) {
+            tgt_dma_done(ts);
+            if (ts->ts_release)
+                tgt_free(sc);
+        }
+        siop_target_done(sc);
+        return (1);
+    }
+    if (sstat0 & SIOP_SSTAT0_RST) {
+        /* Bus reset; siopreset() will clean up */
+        rp->siop_scntl0 &= ~SIOP_SCNTL0_TRG;
+        sc->sc_flags &= ~SIOP_TARGET_BUSY;
+        return (0);
+    }
+    if (ts == NULL) {
+        printf("target: interrupt with no target state\n");
+        siopreset(sc);
+        return (1);
+    }
+
+    if (dstat & SIOP_DSTAT_SIR) {
+        dsp = rp->siop_dsp - tgt_scriptspa();
+        switch (rp->siop_dsps) {
+            case A_tgt_msg:
+                tgt_message(sc, ts, dsp);
+                return (1);
+
+            case A_tgt_extmsg:
+                CacheClearE(&ts->ts_extlen, 1, CACRF_ClearD);
+                len = ts->ts_extlen ? ts->ts_extlen : 256;
+                tgt_table(&ts->ts_ds.extmsg, ts->ts_rsp, len);
+                tgt_continue(sc, ts, Ent_t_extbody);
+                return (1);
+
+            case A_tgt_cmd:
+                if (ts->ts_cmdlen == 0) {
+                    CacheClearE(ts->ts_cdb, 6, CACRF_ClearD);
+                    ts->ts_cmdlen = tgt_cdb_len(ts->ts_cdb[0]);
+                    if (ts->ts_cmdlen > 6) {
+                        tgt_table(&ts->ts_ds.cmd2, &ts->ts_cdb[6],
+                                  ts->ts_cmdlen - 6);
+                        tgt_continue(sc, ts, Ent_t_command2);
+                        return (1);
+                    }
+                } else {
+                    CacheClearE(&ts->ts_cdb[6], ts->ts_cmdlen - 6,
+                                CACRF_ClearD);
+                }
+                PRINTF_TARGET("target cmd %02x\n", ts->ts_cdb[0]);
+                tgt_command(ts);
+                tgt_xfer_next(sc, ts);
+                return (1);
+
+            case A_tgt_data:
+                tgt_dma_done(ts);
+                tgt_xfer_next(sc, ts);
+                return (1);
+        }
+    }
+    if (sstat0 & SIOP_SSTAT0_M_A) {
+        /* Initiator raised ATN */
+        tgt_continue(sc, ts, Ent_t_atn);
+        return (1);
+    }
+
+    printf("target: istat %x dstat %x sstat0 %x dsps %lx dsp %lx\n",
+           istat, dstat, sstat0, rp->siop_dsps, rp->siop_dsp);
+    ts->ts_cfg.tg_errors++;
+    siopreset(sc);
+    return (1);
+}
+
+/*
+ * tgt_enable
+ * ----------
+ * Set up the target state and disk buffer and start answering selection.
+ */
+static int
+tgt_enable(struct siop_softc *sc, a4091_target_t *tgp)
+{
+    siop_target_t *ts;
+    uint32_t       blksize = tgp->tg_blksize ? tgp->tg_blksize : 512;
+    uint64_t       size = (uint64_t) tgp->tg_blocks * blksize;
+
+    if (sc->sc_target != NULL)
+        return (ERROR_TRY_AGAIN);  // Still enabled, or still disconnecting
+    if ((blksize < 256) || (blksize > 65536) ||
+        (blksize & (blksize - 1)) || (tgp->tg_blocks == 0) ||
+        (size > 0xffffffff))
+        return (ERROR_BAD_LENGTH);
+
+    ts = mempool_alloc(sizeof (*ts), MEMF_PUBLIC | MEMF_CLEAR);
+    if (ts == NULL)
+        return (ERROR_NO_MEMORY);
+
+    ts->ts_bufsize = size;
+    if (tgp->tg_buf != NULL) {
+        ts->ts_buf = tgp->tg_buf;
+    } else {
+        ts->ts_buf = AllocMem(size, MEMF_PUBLIC | MEMF_CLEAR);
+        if (ts->ts_buf == NULL) {
+            mempool_free(ts, sizeof (*ts));
+            return (ERROR_NO_MEMORY);
+        }
+        ts->ts_ownbuf = 1;
+    }
+    ts->ts_cfg.tg_flags   = tgp->tg_flags;
+    ts->ts_cfg.tg_blocks  = tgp->tg_blocks;
+    ts->ts_cfg.tg_blksize = blksize;
+    ts->ts_cfg.tg_buf     = ts->ts_buf;
+
+    tgt_table(&ts->ts_ds.ident,  &ts->ts_msg[0], 1);
+    tgt_table(&ts->ts_ds.msgout, &ts->ts_msg[1], 1);
+    tgt_table(&ts->ts_ds.extlen, &ts->ts_extlen, 1);
+    tgt_table(&ts->ts_ds.reject, &ts->ts_reject, 1);
+    tgt_table(&ts->ts_ds.cmd,    ts->ts_cdb, 6);
+    tgt_table(&ts->ts_ds.status, &ts->ts_status, 1);
+    tgt_table(&ts->ts_ds.msg,    &ts->ts_complete, 1);
+    ts->ts_reject   = MSG_REJECT;
+    ts->ts_complete = MSG_CMD_COMPLETE;
+
+    sc->sc_target = ts;
+    siop_target_mode(sc, 1);
+    printf("target mode on, ID %d, %lu blocks of %lu bytes\n",
+           sc->sc_channel.chan_id, tgp->tg_blocks, blksize);
+    return (0);
+}
+
+/*
+ * siop_target_control
+ * -------------------
+ * Handle CMD_TARGET: enable or disable target mode on this board, and
+ * report its state and statistics.
+ */
+int
+siop_target_control(struct siop_softc *sc, a4091_target_t *tgp)
+{
+    siop_target_t *ts;
+    int            rc = 0;
+
+    /* Finish a disable which was waiting for a connection to end */
+    ts = sc->sc_target;
+    if ((ts != NULL) && ts->ts_release &&
+        !(sc->sc_flags & SIOP_TARGET_BUSY))
+        tgt_free(sc);
+
+    switch (tgp->tg_op) {
+        case TARGET_GET:
+            break;
+        case TARGET_ENABLE:
+            rc = tgt_enable(sc, tgp);
+            break;
+        case TARGET_DISABLE:
+            ts = sc->sc_target;
+            if ((ts == NULL) || ts->ts_release)
+                break;
+            siop_target_mode(sc, 0);
+            *tgp = ts->ts_cfg;  // Final statistics
+            tgp->tg_op = TARGET_DISABLE;
+            if (sc->sc_flags & SIOP_TARGET_BUSY)
+                ts->ts_release = 1;
+            else
+                tgt_free(sc);
+            break;
+        default:
+            return (ERROR_UNKNOWN_COMMAND);
+    }
+
+    ts = sc->sc_target;
+    if ((ts != NULL) && !ts->ts_release) {
+        uint8_t op = tgp->tg_op;
+        *tgp = ts->ts_cfg;
+        tgp->tg_op = op;
+        tgp->tg_enabled = 1;
+    } else {
+        tgp->tg_enabled = 0;
+    }
+    tgp->tg_id = sc->sc_channel.chan_id;
+    return (rc);
+}
+
+/*
+ * siop_target_shutdown
+ * --------------------
+ * Turn off target mode and release its memory before the chip is reset
+ * for the last time.
+ */
+void
+siop_target_shutdown(struct siop_softc *sc)
+{
+    sc->sc_flags &= ~(SIOP_TARGET | SIOP_TARGET_STOP | SIOP_TARGET_BUSY);
+    if (sc->sc_target != NULL)
+        tgt_free(sc);
+}
@@ -0,0 +1,41 @@
+#ifndef _SIOP_TARGET_H
+#define _SIOP_TARGET_H
+
+/*
+ * SCSI target mode, see siop_target.c
+ *
+ * When enabled with CMD_TARGET, the board answers selection by other
+ * initiators on its own SCSI ID (the host adapter ID) and appears to them
+ * as a direct-access disk backed by a RAM buffer. The board keeps working
+ * as an initiator; its own commands wait while another initiator is
+ * connected to it.
+ */
+#define TARGET_GET     0      // Only report state and statistics
+#define TARGET_ENABLE  1      // Start answering selection
+#define TARGET_DISABLE 2      // Stop answering selection
+
+#define TGF_READONLY   0x01   // Reject WRITE commands (DATA PROTECT)
+
+typedef struct {
+    uint8_t  tg_op;           // TARGET_*
+    uint8_t  tg_flags;        // TGF_*
+    uint8_t  tg_id;           // SCSI ID the board answers on (returned)
+    uint8_t  tg_enabled;      // Target mode is enabled (returned)
+    uint32_t tg_blocks;       // Disk size in blocks
+    uint32_t tg_blksize;      // Block size in bytes, 0 = 512
+    void    *tg_buf;          // Disk contents, NULL = allocated by driver
+    uint32_t tg_cmds;         // Commands received (returned)
+    uint32_t tg_errors;       // Commands ended with CHECK CONDITION
+    uint64_t tg_bytes_in;     // Data written by initiators
+    uint64_t tg_bytes_out;    // Data read by initiators
+} a4091_target_t;
+
+struct siop_softc;
+
+int siop_target_control(struct siop_softc *sc, a4091_target_t *tgp);
+void siop_target_select(struct siop_softc *sc);
+int siop_target_intr(struct siop_softc *sc, u_char istat, u_char dstat,
+                     u_char sstat0);
+void siop_target_shutdown(struct siop_softc *sc);
+
+#endif /* _SIOP_TARGET_H */
@@ -95,6 +95,9 @@ struct siop_acb {
 	void	*iob_buf;
 	u_long	iob_curbuf;
 	u_long	iob_len, iob_curlen;
+#ifdef PORT_AMIGA
+	u_long	iob_dmaflags;	/* CachePreDMA() flags, matched on completion */
+#endif
 	u_char	msgout[6];
 	u_char	msg[6];
 	u_char	stat[1];
@@ -121,6 +124,23 @@ struct siop_tinfo {
 	u_char  offset;		/* Offset suggestion */
 };
 
+#ifdef PORT_AMIGA
+/*
+ * Scatter/gather split threshold measured for one memory region: an
+ * unaligned transfer longer than dr_split bytes gets a short first chain
+ * entry to align the rest.
+ */
+struct siop_dmaregion {
+	u_long	dr_lower;	/* First address of the region */
+	u_long	dr_upper;	/* First address past the region */
+	u_long	dr_split;	/* Split unaligned transfers longer than this */
+	short	dr_gain;	/* Trial time saved over SIOP_DMA_SPLIT, 0.1% */
+};
+#define SIOP_DMAREGIONS	4	/* Memory regions calibrated */
+#define SIOP_DMA_SPLIT	30	/* Threshold for other memory */
+#define SIOP_DMA_NEVER	(~0UL)	/* Splitting never paid off */
+#endif
+
 struct	siop_softc {
 	device_t sc_dev;
 #ifndef PORT_AMIGA
@@ -173,6 +193,10 @@ struct	siop_softc {
 #ifdef PORT_AMIGA
 	u_char  sc_nosync;              /* no synchronous SCSI (bit / target) */
 	u_char  sc_nodisconnect;        /* no disconnect SCSI (bit / target) */
+	void   *sc_target;              /* target mode state (siop_target.c) */
+	u_char  sc_sync_limit[8];       /* min sync period, DP_SYNC_ASYNC = none */
+	u_char  sc_ndmaregion;          /* calibrated entries in sc_dmaregion */
+	struct siop_dmaregion sc_dmaregion[SIOP_DMAREGIONS];
 #endif
 	/* one for each target */
 	struct syncpar {
@@ -193,6 +217,9 @@ struct	siop_softc {
 #define	SIOP_ALIVE	0x01	/* controller initialized */
 #define SIOP_SELECTED	0x04	/* bus is in selected state. Needed for
 				   correct abort procedure. */
+#define	SIOP_TARGET	0x08	/* respond to selection, idle in WAIT RESELECT */
+#define	SIOP_TARGET_STOP 0x10	/* target mode being turned off */
+#define	SIOP_TARGET_BUSY 0x02	/* connected as a target */
 
 /* negotiation states */
 #define NEG_WIDE	0	/* Negotiate wide transfers */
@@ -247,6 +274,12 @@ void siop_dump(struct siop_softc *);
 #endif
 #endif
 void siopshutdown(struct scsipi_channel *chan);
+#ifdef PORT_AMIGA
+void siopreset(struct siop_softc *);
+void siop_target_mode(struct siop_softc *, int);
+void siop_target_done(struct siop_softc *);
+void siop_get_dma_stats(struct siop_softc *, void *ds_p);
+#endif
 
 
 #endif /* _SIOPVAR_H */
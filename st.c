@@ -0,0 +1,874 @@
+#ifdef DEBUG_ST
+#define USE_SERIAL_OUTPUT
+#endif
+
+#include "port.h"
+#include "port_bsd.h"
+#include <stdint.h>
+#include <string.h>
+#include <sys/param.h>
+#include <exec/errors.h>
+#include <exec/memory.h>
+#include <exec/lists.h>
+#include <devices/scsidisk.h>
+#include <devices/trackdisk.h>
+#include "scsipiconf.h"
+#include "scsi_disk.h"
+#include "scsi_tape.h"
+#include "scsipi_base.h"
+#include "scsipi_all.h"
+#include "sd.h"
+#include "st.h"
+#include "device.h"
+#include "cmdhandler.h"
+#include "mempool.h"
+#include "ndkcompat.h"
+
+/*
+ * Sequential-access (tape) devices
+ *
+ * A tape drive only streams if the next command arrives before its
+ * buffer runs dry. Otherwise it has to stop, rewind a little and get up
+ * to speed again for every command (shoe-shining). Tools which issue one
+ * synchronous CMD_WRITE at a time can not keep up with that, so writes
+ * are copied into a ring of staging buffers and replied immediately.
+ * While a WRITE is in progress, further data is collected in the next
+ * buffer and sent as soon as the drive finishes, so small writes are
+ * combined into large transfers. In fixed block mode, reads are served
+ * from the same ring, which is filled ahead of the reader.
+ *
+ * Only one read-ahead READ is outstanding at a time, so that a filemark
+ * stops read-ahead before it runs into the next file. Before any other
+ * command is sent, read-ahead data which has not been consumed is given
+ * back by spacing the tape backwards, so the position seen by the
+ * application does not change.
+ *
+ * Requests are processed strictly in arrival order. The drive executes
+ * commands in the order they are sent, so a command may be sent while
+ * earlier buffered writes are still in progress.
+ */
+
+#define ST_NBUF          4          // Staging buffers per unit
+#define ST_MIN_NBUF      2          // With fewer buffers, do unbuffered I/O
+#define ST_BUFSIZE       (64 << 10) // Size of each staging buffer
+
+#define ST_IO_TIMEOUT    (3 * 60 * 1000)       // READ, WRITE, WRITE FILEMARKS
+#define ST_SPACE_TIMEOUT (4 * 60 * 60 * 1000)  // SPACE, REWIND
+#define ST_CTL_TIMEOUT   (10 * 1000)           // MODE SENSE, MODE SELECT, ...
+
+/* st_buf_t.sb_state */
+#define SB_FREE          0          // Not in use
+#define SB_FILL          1          // Collecting write data
+#define SB_BUSY          2          // READ or WRITE in progress
+#define SB_FULL          3          // Read data not yet consumed
+
+/* Return values of request handlers */
+#define ST_DONE          0          // Request was replied or sent to drive
+#define ST_WAIT          1          // Wait for a transfer to complete
+
+typedef struct {
+    uint8_t  *sb_data;
+    uint32_t  sb_len;      // Valid bytes in buffer
+    uint32_t  sb_off;      // Read data already consumed
+    uint8_t   sb_state;    // SB_*
+    int8_t    sb_error;    // Read condition which follows the data
+} st_buf_t;
+
+typedef struct {
+    struct scsipi_periph *st_periph;
+    struct MinList        st_waitq;    // Requests not yet started
+    st_buf_t              st_buf[ST_NBUF];
+    uint32_t              st_blksize;  // Fixed block size, 0 = variable
+    uint32_t              st_bufsize;  // Usable bytes per buffer, 0 = none
+    uint32_t              st_min_blk;  // READ BLOCK LIMITS
+    uint32_t              st_max_blk;
+    uint8_t               st_nbuf;     // Staging buffers allocated
+    uint8_t               st_head;     // Oldest buffer in use
+    uint8_t               st_used;     // Buffers in use from st_head
+    uint8_t               st_busy;     // Buffers with a transfer in progress
+    uint8_t               st_reading;  // Ring holds read-ahead data
+    uint8_t               st_ra_stop;  // Read-ahead hit filemark or error
+    uint8_t               st_running;  // st_run() is active
+    uint8_t               st_rerun;    // st_run() called while active
+    int8_t                st_error;    // Deferred buffered write error
+} st_softc_t;
+
+typedef struct {
+    struct scsi_mode_parameter_header_6  hdr;
+    struct scsi_general_block_descriptor blk;
+} st_mode_t;
+
+#undef NewMinList
+void NewMinList(struct MinList *list);
+
+static void st_run(st_softc_t *st);
+
+/*
+ * st_xs_error
+ * -----------
+ * Translate the result of a tape command to an AmigaOS error code, and
+ * set xs->resid to the number of bytes which were not transferred. The
+ * adapter does not report a residual, but the drive provides one in the
+ * sense information field (in blocks for fixed block mode).
+ */
+static int
+st_xs_error(struct scsipi_xfer *xs, uint32_t unit)
+{
+    struct scsi_sense_data *sense = &xs->sense.scsi_sense;
+    int32_t                 info  = 0;
+    uint8_t                 key;
+
+    if (xs->error == XS_NOERROR) {
+        xs->resid = 0;
+        return (0);
+    }
+    xs->resid = xs->datalen;
+    if (xs->error != XS_SENSE)
+        return (translate_xs_error(xs));
+
+    key = SSD_SENSE_KEY(sense->flags);
+    if (sense->response_code & SSD_RCODE_VALID) {
+        info = (int32_t) _4btol(sense->info);
+        if (info < 0)
+            xs->resid = 0;  // Record was longer than the request
+        else if ((uint32_t) info * unit <= (uint32_t) xs->datalen)
+            xs->resid = info * unit;
+    } else if ((key == SKEY_NO_SENSE) || (key == SKEY_RECOVERED_ERROR)) {
+        xs->resid = 0;
+    }
+
+    if (sense->flags & SSD_FILEMARK)
+        return (ERROR_FILEMARK);
+    if (key == SKEY_BLANK_CHECK)
+        return (ERROR_END_OF_DATA);
+    if ((sense->flags & SSD_EOM) || (key == SKEY_VOLUME_OVERFLOW))
+        return (ERROR_END_OF_MEDIA);
+    if (sense->flags & SSD_ILI)
+        return ((info < 0) ? ERROR_BAD_LENGTH : 0);
+    if ((key == SKEY_NO_SENSE) || (key == SKEY_RECOVERED_ERROR))
+        return (0);
+    return (translate_xs_error(xs));
+}
+
+static int
+st_command(st_softc_t *st, void *cmd, int cmdlen, void *buf, uint32_t len,
+           int flags, int timeout, void (*done)(struct scsipi_xfer *),
+           void *arg, struct IOStdReq *ior)
+{
+    struct scsipi_xfer *xs;
+
+    /*
+     * No retries: a repeated READ or WRITE would transfer a different
+     * block than the one which failed.
+     */
+    flags |= XS_CTL_ASYNC | XS_CTL_SIMPLE_TAG;
+    xs = scsipi_make_xs_locked(st->st_periph, cmd, cmdlen, buf, len,
+                               0, timeout, NULL, flags);
+    if (__predict_false(xs == NULL))
+        return (ERROR_NO_MEMORY);
+
+    xs->amiga_ior        = ior;
+    xs->xs_done_callback = done;
+    xs->xs_callback_arg  = arg;
+    return (scsipi_execute_xs(xs));
+}
+
+/*
+ * st_direct_done
+ * --------------
+ * Completion of a command which was issued on behalf of a request
+ * (unbuffered READ / WRITE, WRITE FILEMARKS, SPACE, REWIND), or
+ * internally to restore the tape position (no request).
+ */
+static void
+st_direct_done(struct scsipi_xfer *xs)
+{
+    struct IOStdReq *ior  = xs->amiga_ior;
+    st_softc_t      *st   = xs->xs_periph->drv_state;
+    uint32_t         unit = (st->st_blksize != 0) ? st->st_blksize : 1;
+    int              rc   = st_xs_error(xs, unit);
+
+#ifdef DEBUG_ST
+    printf("st%d.%d direct %02x done rc=%d resid=%d\n",
+           xs->xs_periph->periph_target, xs->xs_periph->periph_lun,
+           xs->cmd->opcode, rc, xs->resid);
+#endif
+    if (ior == NULL) {
+        if ((rc != 0) && (st->st_error == 0))
+            st->st_error = rc;
+        return;
+    }
+    if ((ior->io_Command == CMD_READ) || (ior->io_Command == CMD_WRITE))
+        ior->io_Actual = xs->datalen - xs->resid;
+    cmd_complete(ior, rc);
+}
+
+static int
+st_rw(st_softc_t *st, uint b_flags, void *buf, uint32_t len,
+      void (*done)(struct scsipi_xfer *), void *arg, struct IOStdReq *ior)
+{
+    struct scsi_rw_tape cmd;
+    uint32_t            count = len;
+
+    memset(&cmd, 0, sizeof (cmd));
+    cmd.opcode = (b_flags & B_READ) ? SCSI_READ_6_COMMAND :
+                                      SCSI_WRITE_6_COMMAND;
+    if (st->st_blksize != 0) {
+        cmd.byte2 = SRW_FIXED;
+        count /= st->st_blksize;
+    }
+    _lto3b(count, cmd.len);
+
+    return (st_command(st, &cmd, sizeof (cmd), buf, len,
+                       (b_flags & B_READ) ? XS_CTL_DATA_IN : XS_CTL_DATA_OUT,
+                       ST_IO_TIMEOUT, done, arg, ior));
+}
+
+static int
+st_space(st_softc_t *st, uint code, int32_t count, struct IOStdReq *ior)
+{
+    struct scsi_space cmd;
+
+    memset(&cmd, 0, sizeof (cmd));
+    cmd.opcode = SCSI_SPACE;
+    cmd.byte2  = code & SS_CODE;
+    _lto3b((uint32_t) count, cmd.number);
+
+    return (st_command(st, &cmd, sizeof (cmd), NULL, 0, 0, ST_SPACE_TIMEOUT,
+                       st_direct_done, NULL, ior));
+}
+
+/*
+ * st_buf_get
+ * ----------
+ * Take the next buffer of the ring, if one is available.
+ */
+static st_buf_t *
+st_buf_get(st_softc_t *st, uint8_t state)
+{
+    st_buf_t *sb;
+
+    if (st->st_used >= st->st_nbuf)
+        return (NULL);
+    sb = &st->st_buf[(st->st_head + st->st_used) % st->st_nbuf];
+    st->st_used++;
+    sb->sb_len   = 0;
+    sb->sb_off   = 0;
+    sb->sb_error = 0;
+    sb->sb_state = state;
+    return (sb);
+}
+
+/*
+ * st_buf_retire
+ * -------------
+ * Return buffers at the head of the ring which are no longer in use.
+ */
+static void
+st_buf_retire(st_softc_t *st)
+{
+    while ((st->st_used != 0) &&
+           (st->st_buf[st->st_head].sb_state == SB_FREE)) {
+        st->st_head = (st->st_head + 1) % st->st_nbuf;
+        st->st_used--;
+    }
+}
+
+static st_buf_t *
+st_buf_fill(st_softc_t *st)
+{
+    st_buf_t *sb;
+
+    if (st->st_used != 0) {
+        sb = &st->st_buf[(st->st_head + st->st_used - 1) % st->st_nbuf];
+        if ((sb->sb_state == SB_FILL) && (sb->sb_len < st->st_bufsize))
+            return (sb);
+    }
+    return (st_buf_get(st, SB_FILL));
+}
+
+static void
+st_write_done(struct scsipi_xfer *xs)
+{
+    st_softc_t *st = xs->xs_periph->drv_state;
+    st_buf_t   *sb = xs->xs_callback_arg;
+    int         rc = st_xs_error(xs, (st->st_blksize != 0) ?
+                                     st->st_blksize : 1);
+
+#ifdef DEBUG_ST
+    printf("st write %p len=%"PRIu32" rc=%d\n", sb, sb->sb_len, rc);
+#endif
+    if ((rc != 0) && (st->st_error == 0))
+        st->st_error = rc;
+
+    sb->sb_state = SB_FREE;
+    st->st_busy--;
+    st_buf_retire(st);
+    st_run(st);
+}
+
+static void
+st_write_start(st_softc_t *st, st_buf_t *sb)
+{
+    int rc;
+
+    sb->sb_state = SB_BUSY;
+    st->st_busy++;
+    rc = st_rw(st, B_WRITE, sb->sb_data, sb->sb_len, st_write_done, sb, NULL);
+    if (rc != 0) {
+        if (st->st_error == 0)
+            st->st_error = rc;
+        sb->sb_state = SB_FREE;
+        st->st_busy--;
+        st_buf_retire(st);
+    }
+}
+
+/*
+ * st_flush
+ * --------
+ * Send the buffer which is collecting write data, if there is one.
+ */
+static void
+st_flush(st_softc_t *st)
+{
+    st_buf_t *sb;
+
+    if (st->st_used == 0)
+        return;
+    sb = &st->st_buf[(st->st_head + st->st_used - 1) % st->st_nbuf];
+    if ((sb->sb_state == SB_FILL) && (sb->sb_len != 0))
+        st_write_start(st, sb);
+}
+
+static void
+st_read_done(struct scsipi_xfer *xs)
+{
+    st_softc_t *st = xs->xs_periph->drv_state;
+    st_buf_t   *sb = xs->xs_callback_arg;
+    int         rc = st_xs_error(xs, st->st_blksize);
+
+    sb->sb_len = xs->datalen - xs->resid;
+    if (rc != 0) {
+        sb->sb_error   = rc;
+        st->st_ra_stop = 1;
+    }
+#ifdef DEBUG_ST
+    printf("st read %p len=%"PRIu32" rc=%d\n", sb, sb->sb_len, rc);
+#endif
+    sb->sb_state = SB_FULL;
+    st->st_busy--;
+    st_run(st);
+}
+
+/*
+ * st_read_ahead
+ * -------------
+ * Start the next read-ahead READ if there is a free buffer.
+ */
+static void
+st_read_ahead(st_softc_t *st)
+{
+    st_buf_t *sb;
+    int       rc;
+
+    if (!st->st_reading || st->st_ra_stop || (st->st_busy != 0))
+        return;
+
+    sb = st_buf_get(st, SB_BUSY);
+    if (sb == NULL)
+        return;
+
+    st->st_busy++;
+    rc = st_rw(st, B_READ, sb->sb_data, st->st_bufsize, st_read_done, sb,
+               NULL);
+    if (rc != 0) {
+        st->st_busy--;
+        sb->sb_state   = SB_FULL;
+        sb->sb_error   = rc;
+        st->st_ra_stop = 1;
+    }
+}
+
+/*
+ * st_read_discard
+ * ---------------
+ * Drop read-ahead data which the application has not consumed. If
+ * requested, space the tape back to the position of the application.
+ * Must only be called when no READ is in progress.
+ */
+static void
+st_read_discard(st_softc_t *st, int reposition)
+{
+    st_buf_t *sb;
+    uint32_t  blocks   = 0;
+    int       filemark = 0;
+
+    while (st->st_used != 0) {
+        sb = &st->st_buf[st->st_head];
+        if (sb->sb_state == SB_FULL) {
+            blocks += (sb->sb_len - sb->sb_off) / st->st_blksize;
+            if (sb->sb_error == ERROR_FILEMARK)
+                filemark = 1;
+        }
+        sb->sb_state = SB_FREE;
+        st->st_head = (st->st_head + 1) % st->st_nbuf;
+        st->st_used--;
+    }
+    st->st_head    = 0;
+    st->st_reading = 0;
+    st->st_ra_stop = 0;
+
+    if (!reposition)
+        return;
+
+#ifdef DEBUG_ST
+    printf("st give back %"PRIu32" blocks%s\n", blocks,
+           filemark ? " and filemark" : "");
+#endif
+    /* The drive executes these before the command which follows */
+    if (filemark)
+        (void) st_space(st, SP_FILEMARKS, -1, NULL);
+    if (blocks != 0)
+        (void) st_space(st, SP_BLKS, -(int32_t) blocks, NULL);
+}
+
+/*
+ * st_settle
+ * ---------
+ * Prepare for a command which is not a buffered transfer. Buffered write
+ * data is sent, and read-ahead is dropped once it has stopped.
+ */
+static int
+st_settle(st_softc_t *st, int reposition)
+{
+    st_flush(st);
+    if (st->st_busy != 0)
+        return (ST_WAIT);
+    if (st->st_reading)
+        st_read_discard(st, reposition);
+    return (ST_DONE);
+}
+
+static int
+st_deferred_error(st_softc_t *st, struct IOStdReq *ior)
+{
+    int rc = st->st_error;
+
+    if (rc == 0)
+        return (0);
+    st->st_error = 0;
+    cmd_complete(ior, rc);
+    return (1);
+}
+
+static int
+st_write(st_softc_t *st, struct IOStdReq *ior)
+{
+    uint32_t  len = ior->io_Length;
+    uint8_t  *data = ior->io_Data;
+    st_buf_t *sb;
+    uint32_t  count;
+    int       rc;
+
+    if (st->st_reading && st_settle(st, 1))
+        return (ST_WAIT);
+    if ((ior->io_Actual == 0) && st_deferred_error(st, ior))
+        return (ST_DONE);
+
+    if ((len == 0) || ((st->st_blksize != 0) && (len % st->st_blksize))) {
+        cmd_complete(ior, (len == 0) ? 0 : ERROR_BAD_LENGTH);
+        return (ST_DONE);
+    }
+
+    if ((st->st_bufsize == 0) ||
+        ((st->st_blksize == 0) && (len > st->st_bufsize))) {
+        /* Unbuffered */
+        st_flush(st);
+        rc = st_rw(st, B_WRITE, data, len, st_direct_done, NULL, ior);
+        if (rc != 0)
+            cmd_complete(ior, rc);
+        return (ST_DONE);
+    }
+
+    while (ior->io_Actual < len) {
+        if (st->st_blksize != 0)
+            sb = st_buf_fill(st);
+        else
+            sb = st_buf_get(st, SB_FILL);  // One record per buffer
+        if (sb == NULL)
+            return (ST_WAIT);
+
+        count = MIN(st->st_bufsize - sb->sb_len, len - ior->io_Actual);
+        CopyMem(data + ior->io_Actual, sb->sb_data + sb->sb_len, count);
+        sb->sb_len     += count;
+        ior->io_Actual += count;
+
+        if ((st->st_blksize == 0) || (sb->sb_len == st->st_bufsize))
+            st_write_start(st, sb);
+    }
+    cmd_complete(ior, 0);
+    return (ST_DONE);
+}
+
+static int
+st_read(st_softc_t *st, struct IOStdReq *ior)
+{
+    uint32_t  len = ior->io_Length;
+    uint8_t  *data = ior->io_Data;
+    st_buf_t *sb;
+    uint32_t  count;
+    int       rc;
+
+    if (!st->st_reading && st_settle(st, 0))
+        return (ST_WAIT);
+    if ((ior->io_Actual == 0) && st_deferred_error(st, ior))
+        return (ST_DONE);
+
+    if ((len == 0) || ((st->st_blksize != 0) && (len % st->st_blksize))) {
+        cmd_complete(ior, (len == 0) ? 0 : ERROR_BAD_LENGTH);
+        return (ST_DONE);
+    }
+
+    if ((st->st_blksize == 0) || (st->st_bufsize == 0)) {
+        /* Variable block mode reads one record per request */
+        rc = st_rw(st, B_READ, data, len, st_direct_done, NULL, ior);
+        if (rc != 0)
+            cmd_complete(ior, rc);
+        return (ST_DONE);
+    }
+
+    st->st_reading = 1;
+    while (ior->io_Actual < len) {
+        sb = &st->st_buf[st->st_head];
+        if ((st->st_used == 0) || (sb->sb_state != SB_FULL)) {
+            st_read_ahead(st);
+            return (ST_WAIT);
+        }
+
+        if (sb->sb_off == sb->sb_len) {
+            rc = sb->sb_error;
+            if ((rc != 0) && (ior->io_Actual != 0))
+                break;  // Report the condition with the next read
+            sb->sb_state = SB_FREE;
+            st_buf_retire(st);
+            if (rc != 0) {
+                st->st_ra_stop = 0;
+                cmd_complete(ior, rc);
+                return (ST_DONE);
+            }
+            continue;
+        }
+
+        count = MIN(sb->sb_len - sb->sb_off, len - ior->io_Actual);
+        CopyMem(sb->sb_data + sb->sb_off, data + ior->io_Actual, count);
+        sb->sb_off     += count;
+        ior->io_Actual += count;
+        if ((sb->sb_off == sb->sb_len) && (sb->sb_error == 0)) {
+            sb->sb_state = SB_FREE;
+            st_buf_retire(st);
+        }
+    }
+    cmd_complete(ior, 0);
+    return (ST_DONE);
+}
+
+static int
+st_mode_sense(st_softc_t *st, st_mode_t *mode)
+{
+    memset(mode, 0, sizeof (*mode));
+    return (scsipi_mode_sense(st->st_periph, 0, 0, &mode->hdr,
+                              sizeof (*mode), XS_CTL_DATA_IN, 0,
+                              ST_CTL_TIMEOUT));
+}
+
+static void
+st_set_bufsize(st_softc_t *st)
+{
+    if (st->st_nbuf == 0)
+        st->st_bufsize = 0;
+    else if (st->st_blksize == 0)
+        st->st_bufsize = ST_BUFSIZE;
+    else
+        st->st_bufsize = ST_BUFSIZE - (ST_BUFSIZE % st->st_blksize);
+}
+
+/*
+ * st_set_mode
+ * -----------
+ * Select the block size (0 = variable) and enable buffered mode, which
+ * lets the drive report GOOD status as soon as the data is in its buffer.
+ * Without buffered mode, a drive can not stream.
+ */
+static int
+st_set_mode(st_softc_t *st, uint32_t blksize)
+{
+    st_mode_t *mode;
+    int        rc;
+
+    if ((blksize != 0) && (st->st_max_blk != 0) &&
+        ((blksize < st->st_min_blk) || (blksize > st->st_max_blk)))
+        return (ERROR_BAD_LENGTH);
+    if (blksize > 0xffffff)
+        return (ERROR_BAD_LENGTH);
+
+    mode = mempool_alloc(sizeof (*mode), MEMF_PUBLIC);
+    if (mode == NULL)
+        return (ERROR_NO_MEMORY);
+
+    rc = st_mode_sense(st, mode);
+    if (rc == 0) {
+        mode->hdr.data_length  = 0;
+        mode->hdr.medium_type  = 0;
+        mode->hdr.dev_spec     = SMH_DSP_BUFF_MODE_ON;
+        mode->hdr.blk_desc_len = sizeof (mode->blk);
+        _lto3b(0, mode->blk.nblocks);
+        _lto3b(blksize, mode->blk.blklen);
+        rc = scsipi_mode_select(st->st_periph, 0, &mode->hdr,
+                                sizeof (*mode), XS_CTL_DATA_OUT, 0,
+                                ST_CTL_TIMEOUT);
+    }
+    if (rc == 0) {
+        st->st_blksize = blksize;
+        st_set_bufsize(st);
+    } else {
+        printf("st mode select %"PRIu32" failed: %d\n", blksize, rc);
+        rc = ERROR_SENSE_CODE;
+    }
+    mempool_free(mode, sizeof (*mode));
+    return (rc);
+}
+
+static int
+st_control(st_softc_t *st, struct IOStdReq *ior)
+{
+    struct scsi_write_filemarks wfm;
+    struct scsi_rewind          rew;
+    int                         rc;
+
+    if (ior->io_Command == CMD_UPDATE) {
+        /* Nothing to flush while reading; keep the read-ahead data */
+        if (st->st_reading) {
+            cmd_complete(ior, 0);
+            return (ST_DONE);
+        }
+        if (st_settle(st, 1))
+            return (ST_WAIT);
+    } else if (st_settle(st, ior->io_Command != CMD_TAPE_REWIND)) {
+        return (ST_WAIT);
+    }
+    if (st_deferred_error(st, ior))
+        return (ST_DONE);
+
+    switch (ior->io_Command) {
+        case CMD_UPDATE:
+        case CMD_TAPE_WRITEFM:
+            /* Writing zero filemarks makes the drive flush its buffer */
+            memset(&wfm, 0, sizeof (wfm));
+            wfm.opcode = SCSI_WRITE_FILEMARKS;
+            _lto3b((ior->io_Command == CMD_UPDATE) ? 0 : ior->io_Length,
+                   wfm.number);
+            rc = st_command(st, &wfm, sizeof (wfm), NULL, 0, 0,
+                            ST_IO_TIMEOUT, st_direct_done, NULL, ior);
+            break;
+
+        case CMD_TAPE_REWIND:
+            memset(&rew, 0, sizeof (rew));
+            rew.opcode = SCSI_REWIND;
+            rc = st_command(st, &rew, sizeof (rew), NULL, 0, 0,
+                            ST_SPACE_TIMEOUT, st_direct_done, NULL, ior);
+            break;
+
+        case CMD_TAPE_SPACE: {
+            int32_t count = (int32_t) ior->io_Length;
+            if (((ior->io_Offset != ST_SPACE_BLOCKS) &&
+                 (ior->io_Offset != ST_SPACE_FILEMARKS) &&
+                 (ior->io_Offset != ST_SPACE_EOD)) ||
+                (count < -0x800000) || (count > 0x7fffff)) {
+                rc = ERROR_BAD_LENGTH;
+                break;
+            }
+            rc = st_space(st, ior->io_Offset, count, ior);
+            break;
+        }
+
+        case CMD_TAPE_BLKSIZE:
+            rc = st_set_mode(st, ior->io_Length);
+            ior->io_Actual = st->st_blksize;
+            if (rc == 0)
+                cmd_complete(ior, 0);
+            break;
+
+        case HD_SCSICMD:
+            rc = sd_scsidirect(st->st_periph, ior->io_Data, ior);
+            break;
+
+        default:
+            rc = ERROR_UNKNOWN_COMMAND;
+            break;
+    }
+    if (rc != 0)
+        cmd_complete(ior, rc);
+    return (ST_DONE);
+}
+
+/*
+ * st_run
+ * ------
+ * Process waiting requests in order until one has to wait for a transfer
+ * to complete. Called for each new request and each completed buffered
+ * transfer.
+ */
+static void
+st_run(st_softc_t *st)
+{
+    struct IOStdReq *ior;
+    int              rc;
+
+    if (st->st_running) {
+        st->st_rerun = 1;
+        return;
+    }
+    st->st_running = 1;
+    do {
+        st->st_rerun = 0;
+        while ((ior = (struct IOStdReq *)
+                      RemHead((struct List *) &st->st_waitq)) != NULL) {
+            switch (ior->io_Command) {
+                case CMD_WRITE:
+                    rc = st_write(st, ior);
+                    break;
+                case CMD_READ:
+                    rc = st_read(st, ior);
+                    break;
+                default:
+                    rc = st_control(st, ior);
+                    break;
+            }
+            if (rc == ST_WAIT) {
+                AddHead((struct List *) &st->st_waitq,
+                        &ior->io_Message.mn_Node);
+                break;
+            }
+        }
+
+        /* Keep the drive busy */
+        ior = (struct IOStdReq *) st->st_waitq.mlh_Head;
+        if (st->st_busy == 0)
+            st_flush(st);
+        if ((ior->io_Message.mn_Node.ln_Succ == NULL) ||
+            (ior->io_Command == CMD_READ))
+            st_read_ahead(st);
+    } while (st->st_rerun);
+    st->st_running = 0;
+}
+
+/*
+ * st_iorequest
+ * ------------
+ * Queue a request for a sequential-access unit.
+ */
+void
+st_iorequest(struct IORequest *ior)
+{
+    struct scsipi_periph *periph = (struct scsipi_periph *) ior->io_Unit;
+    st_softc_t           *st     = periph->drv_state;
+
+    ((struct IOStdReq *) ior)->io_Actual = 0;
+    AddTail((struct List *) &st->st_waitq, &ior->io_Message.mn_Node);
+    st_run(st);
+}
+
+/*
+ * st_attach
+ * ---------
+ * Set up a sequential-access unit after it has been attached: query the
+ * block limits and current block size, enable buffered mode and allocate
+ * staging buffers.
+ */
+int
+st_attach(struct scsipi_periph *periph)
+{
+    st_softc_t                   *st;
+    struct scsi_block_limits      cmd;
+    struct scsi_block_limits_data *limits;
+    st_mode_t                    *mode;
+    uint32_t                      blksize = 0;
+    uint                          i;
+
+    st = mempool_alloc(sizeof (*st), MEMF_PUBLIC | MEMF_CLEAR);
+    if (st == NULL)
+        return (ERROR_NO_MEMORY);
+    st->st_periph = periph;
+    NewMinList(&st->st_waitq);
+
+    mode = mempool_alloc(sizeof (*mode) + sizeof (*limits), MEMF_PUBLIC);
+    if (mode != NULL) {
+        limits = (struct scsi_block_limits_data *) (mode + 1);
+        memset(&cmd, 0, sizeof (cmd));
+        cmd.opcode = SCSI_READ_BLOCK_LIMITS;
+        if (scsipi_command(periph, (void *) &cmd, sizeof (cmd),
+                           (void *) limits, sizeof (*limits), 0,
+                           ST_CTL_TIMEOUT, NULL,
+                           XS_CTL_DATA_IN | XS_CTL_SILENT) == 0) {
+            st->st_max_blk = _3btol(limits->max_length);
+            st->st_min_blk = _2btol(limits->min_length);
+        }
+        if (st_mode_sense(st, mode) == 0)
+            blksize = _3btol(mode->blk.blklen);
+        mempool_free(mode, sizeof (*mode) + sizeof (*limits));
+    }
+    if ((st->st_min_blk != 0) && (st->st_min_blk == st->st_max_blk))
+        blksize = st->st_min_blk;  // Drive only supports fixed blocks
+
+    for (i = 0; i < ST_NBUF; i++) {
+        st->st_buf[i].sb_data = mempool_alloc(ST_BUFSIZE, MEMF_PUBLIC);
+        if (st->st_buf[i].sb_data == NULL)
+            break;
+    }
+    if (i < ST_MIN_NBUF) {
+        while (i-- > 0)
+            mempool_free(st->st_buf[i].sb_data, ST_BUFSIZE);
+        i = 0;
+    }
+    st->st_nbuf    = i;
+    st->st_blksize = blksize;
+    st_set_bufsize(st);
+    periph->drv_state = st;
+
+    if (st_set_mode(st, blksize) != 0)
+        printf("st: buffered mode not enabled\n");
+
+    printf("st%d.%d block limits %"PRIu32"-%"PRIu32" blksize %"PRIu32
+           " %u buffers\n", periph->periph_target, periph->periph_lun,
+           st->st_min_blk, st->st_max_blk, st->st_blksize, st->st_nbuf);
+    return (0);
+}
+
+/*
+ * st_detach
+ * ---------
+ * Release tape state. The caller has already waited for all commands to
+ * the unit to complete. A write error which has not yet been reported is
+ * lost.
+ */
+void
+st_detach(struct scsipi_periph *periph)
+{
+    st_softc_t       *st = periph->drv_state;
+    struct IORequest *ior;
+    uint              i;
+
+    if (st == NULL)
+        return;
+
+    while ((ior = (struct IORequest *)
+                  RemHead((struct List *) &st->st_waitq)) != NULL) {
+        cmd_complete(ior, IOERR_ABORTED);
+    }
+    for (i = 0; i < st->st_nbuf; i++)
+        mempool_free(st->st_buf[i].sb_data, ST_BUFSIZE);
+
+    periph->drv_state = NULL;
+    mempool_free(st, sizeof (*st));
+}
@@ -0,0 +1,35 @@
+#ifndef _ST_H
+#define _ST_H
+
+/*
+ * Sequential-access (tape) device support, see st.c
+ *
+ * CMD_READ and CMD_WRITE transfer data at the current tape position;
+ * io_Offset is ignored. In fixed block mode, io_Length must be a multiple
+ * of the block size. In variable block mode, each CMD_WRITE writes one
+ * record and each CMD_READ reads one record of up to io_Length bytes.
+ *
+ * Writes are buffered by the driver and replied as soon as the data has
+ * been copied. A write error is therefore reported by the next command
+ * sent to the unit. CMD_UPDATE waits until all buffered data is on tape
+ * and reports any pending error.
+ *
+ * A read which reaches a filemark, end of data or end of medium returns
+ * the data up to that point. The next read then fails with ERROR_FILEMARK,
+ * ERROR_END_OF_DATA or ERROR_END_OF_MEDIA (device.h), and the read after
+ * that continues past the filemark.
+ */
+
+/* CMD_TAPE_SPACE io_Offset values */
+#define ST_SPACE_BLOCKS    0  // Space over io_Length blocks
+#define ST_SPACE_FILEMARKS 1  // Space over io_Length filemarks
+#define ST_SPACE_EOD       3  // Space to end of recorded data
+
+struct scsipi_periph;
+struct IORequest;
+
+int st_attach(struct scsipi_periph *periph);
+void st_detach(struct scsipi_periph *periph);
+void st_iorequest(struct IORequest *ior);
+
+#endif /* _ST_H */
@@ -0,0 +1,74 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+/*
+ * Driver statistics, returned by the CMD_GETSTATS device command.
+ *
+ * The caller points io_Data at an a4091_stats_t and sets io_Length to
+ * its size. The driver fills in as much as fits and returns the number
+ * of bytes written in io_Actual. New sections are only ever appended,
+ * and st_version is bumped when that happens.
+ */
+#define A4091_STATS_VERSION 5
+
+/* Driver memory pool, see mempool.c */
+typedef struct {
+    uint32_t ms_allocs;      // Allocations served
+    uint32_t ms_frees;       // Allocations returned
+    uint32_t ms_failed;      // Allocations which could not be served
+    uint32_t ms_large;       // Allocations passed through to AllocMem()
+    uint32_t ms_inuse;       // Bytes currently allocated
+    uint32_t ms_peak;        // Highest value of ms_inuse seen
+    uint32_t ms_puddles;     // Puddles taken from Exec
+    uint32_t ms_reserved;    // Bytes held in puddles
+} a4091_mem_stats_t;
+
+/* Metadata block cache, see bcache.c (version 2) */
+typedef struct {
+    uint32_t bs_blocks;      // Cache size in blocks, 0 = disabled
+    uint32_t bs_used;        // Blocks currently holding data
+    uint32_t bs_lookups;     // Cacheable reads seen
+    uint32_t bs_hits;        // Reads served without a SCSI command
+    uint32_t bs_fills;       // Blocks added after a read
+    uint32_t bs_updates;     // Cached blocks updated by a write
+    uint32_t bs_evictions;   // Blocks replaced to make room
+    uint32_t bs_invalidates; // Blocks dropped (media change, detach, error)
+} a4091_bcache_stats_t;
+
+/* Boot timing, measured from the start of the handler task (version 3) */
+typedef struct {
+    uint32_t bt_ready_usecs; // Channel ready for I/O
+    uint32_t bt_open_usecs;  // First unit opened, 0 = not yet
+    uint32_t bt_cdrom_usecs; // CD-ROM boot scan done, 0 = none (version 4)
+} a4091_boot_stats_t;
+
+/* Scatter/gather split calibration, see siop_dma_calibrate() (version 5) */
+#define A4091_DMA_REGIONS 4
+
+#define A4091_DMA_NEVER   0xffffffff  // dr_split: splitting never paid off
+
+typedef struct {
+    uint32_t dr_lower;       // First address of the memory region
+    uint32_t dr_upper;       // First address past the region
+    uint32_t dr_split;       // Unaligned transfers longer than this are split
+    int16_t  dr_gain;        // Trial time saved over ds_default, 0.1% units
+    uint16_t dr_pad;
+} a4091_dma_region_t;
+
+typedef struct {
+    uint16_t           ds_regions;  // Calibrated entries in ds_region
+    uint16_t           ds_default;  // Threshold used for other memory
+    uint32_t           ds_maxseg;   // Longest scatter/gather segment
+    a4091_dma_region_t ds_region[A4091_DMA_REGIONS];
+} a4091_dma_stats_t;
+
+typedef struct {
+    uint16_t             st_version;  // A4091_STATS_VERSION
+    uint16_t             st_size;     // sizeof (a4091_stats_t) of the driver
+    a4091_mem_stats_t    st_mem;
+    a4091_bcache_stats_t st_bcache;
+    a4091_boot_stats_t   st_boot;
+    a4091_dma_stats_t    st_dma;      // (version 5)
+} a4091_stats_t;
+
+#endif /* _STATS_H */
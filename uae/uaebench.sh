@@ -0,0 +1,164 @@
+#!/bin/sh
+#
+# uaebench.sh
+# -----------
+# Boots an A4091 ROM headless under FS-UAE's A4091 emulation with scratch
+# SCSI disk images attached, runs a4091bench against them and collects
+# its JSON results on the host.
+#
+# The emulated Amiga boots AROS (FS-UAE's built-in replacement Kickstart
+# unless -k is given) from a host directory holding a Startup-Sequence
+# and a4091bench. A second host directory is mounted as RESULTS:, where
+# a4091bench writes its results. The emulator is stopped as soon as the
+# results appear, or after the timeout.
+#
+# Requires fs-uae and rdbtool (amitools). Without a display, the
+# emulator is run under xvfb-run when that is available.
+#
+# The figures come from an emulated 53C710 and disks, so they are only
+# comparable between builds run on the same host and emulator version.
+
+ROM=a4091.rom
+BENCH=a4091bench
+KICK=
+OUT=
+DISKS=2
+SIZE=256Mi
+SECS=2
+TIMEOUT=300
+KEEP=0
+
+usage()
+{
+    cat <<EOF
+Usage: $0 [options]
+   -r <rom>     A4091 ROM image to test ($ROM)
+   -b <file>    a4091bench executable ($BENCH)
+   -k <file>    Kickstart or AROS ROM (FS-UAE's built-in AROS)
+   -n <disks>   number of SCSI disks, targets 0 to n-1 ($DISKS)
+   -S <size>    size of each disk image ($SIZE)
+   -s <secs>    duration of each test ($SECS)
+   -t <secs>    give up after this long ($TIMEOUT)
+   -o <file>    write the JSON results to file (stdout)
+   -K           keep the work directory
+Extra FS-UAE options may be given one per line in \$UAEBENCH_OPTIONS.
+EOF
+    exit 1
+}
+
+while getopts "r:b:k:n:S:s:t:o:Kh" opt; do
+    case $opt in
+        r) ROM=$OPTARG ;;
+        b) BENCH=$OPTARG ;;
+        k) KICK=$OPTARG ;;
+        n) DISKS=$OPTARG ;;
+        S) SIZE=$OPTARG ;;
+        s) SECS=$OPTARG ;;
+        t) TIMEOUT=$OPTARG ;;
+        o) OUT=$OPTARG ;;
+        K) KEEP=1 ;;
+        *) usage ;;
+    esac
+done
+
+for tool in fs-uae rdbtool; do
+    if ! command -v $tool >/dev/null; then
+        echo "$tool not found" >&2
+        exit 1
+    fi
+done
+for file in "$ROM" "$BENCH" $KICK; do
+    if [ ! -f "$file" ]; then
+        echo "$file not found" >&2
+        exit 1
+    fi
+done
+
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/uaebench.XXXXXX") || exit 1
+if [ $KEEP -eq 0 ]; then
+    trap 'rm -rf "$WORK"' EXIT
+else
+    echo "Work directory $WORK" >&2
+fi
+mkdir -p "$WORK/boot/C" "$WORK/boot/S" "$WORK/results"
+cp "$BENCH" "$WORK/boot/C/a4091bench"
+
+# Each disk gets an empty RDB: the mounter scans it at boot, but there is
+# no partition which could be booted instead of the boot directory.
+UNITS=
+unit=0
+while [ $unit -lt $DISKS ]; do
+    rdbtool "$WORK/disk$unit.hdf" create size=$SIZE + init >/dev/null || exit 1
+    UNITS="$UNITS $unit"
+    unit=$((unit + 1))
+done
+
+cat >"$WORK/boot/S/Startup-Sequence" <<EOF
+C:a4091bench -s $SECS -w -o RESULTS:a4091bench.json$UNITS
+EOF
+
+CONFIG="$WORK/uaebench.fs-uae"
+cat >"$CONFIG" <<EOF
+[fs-uae]
+amiga_model = A4000/040
+${KICK:+kickstart_file = $(realpath "$KICK")}
+uae_a4091 = true
+uae_a4091_rom_file = $(realpath "$ROM")
+hard_drive_0 = $WORK/boot
+hard_drive_0_label = Boot
+hard_drive_1 = $WORK/results
+hard_drive_1_label = RESULTS
+hard_drive_1_priority = -128
+fullscreen = 0
+automatic_input_grab = 0
+sound_card = none
+floppy_drive_volume = 0
+EOF
+unit=0
+while [ $unit -lt $DISKS ]; do
+    drive=$((unit + 2))
+    cat >>"$CONFIG" <<EOF
+hard_drive_$drive = $WORK/disk$unit.hdf
+hard_drive_${drive}_type = rdb
+hard_drive_${drive}_controller = scsi${unit}_a4091
+EOF
+    unit=$((unit + 1))
+done
+[ -n "$UAEBENCH_OPTIONS" ] && echo "$UAEBENCH_OPTIONS" >>"$CONFIG"
+
+RUN=
+if [ -z "$DISPLAY" ] && command -v xvfb-run >/dev/null; then
+    RUN="xvfb-run -a"
+fi
+START=$(date +%s)
+$RUN fs-uae "$CONFIG" >"$WORK/fs-uae.log" 2>&1 &
+PID=$!
+
+RESULT="$WORK/results/a4091bench.json"
+while [ ! -f "$RESULT" ]; do
+    if ! kill -0 $PID 2>/dev/null; then
+        echo "fs-uae exited without results, see $WORK/fs-uae.log" >&2
+        trap - EXIT
+        exit 1
+    fi
+    if [ $(($(date +%s) - START)) -ge $TIMEOUT ]; then
+        echo "No results after $TIMEOUT seconds, see $WORK/fs-uae.log" >&2
+        kill $PID
+        trap - EXIT
+        exit 1
+    fi
+    sleep 1
+done
+ELAPSED=$(($(date +%s) - START))
+kill $PID 2>/dev/null
+wait $PID 2>/dev/null
+
+# Wrap the Amiga side results with what is known on the host
+{
+    printf '{\n"rom": "%s",\n' "$(basename "$ROM")"
+    printf '"git": "%s",\n' "$(git describe --always --dirty 2>/dev/null)"
+    printf '"host_seconds": %d,\n' "$ELAPSED"
+    printf '"amiga": '
+    cat "$RESULT"
+    printf '}\n'
+} >"${OUT:-/dev/stdout}"